@@ -48,7 +48,8 @@ int main(int argc, char *argv[]) {
          << endl;
     cout << "max # of classes of service (COS) = " << CATController::getNumCos()
          << endl;
-    string cdp_status = CATController::getCdpStatus() ? "ENABLED" : "DISABLED";
+    string cdp_status =
+        CATController::getCdpStatus() ? "SUPPORTED" : "NOT SUPPORTED";
     cout << "CDP Status: " << cdp_status << endl;
   }
   cout << "=========================================" << endl;
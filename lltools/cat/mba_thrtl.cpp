@@ -0,0 +1,100 @@
+/** $lic$
+* MIT License
+* 
+* Copyright (c) 2017-2018 by Massachusetts Institute of Technology
+* Copyright (c) 2017-2018 by Qatar Computing Research Institute, HBKU
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+* 
+* If you use this software in your research, we request that you reference
+* the KPart paper ("KPart: A Hybrid Cache Partitioning-Sharing Technique for
+* Commodity Multicores", El-Sayed, Mukkara, Tsai, Kasture, Ma, and Sanchez,
+* HPCA-24, February 2018) as the source in any publications that use this
+* software, and that you send us a citation of your work.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+**/
+#include <unistd.h>
+
+#include <iostream>
+#include <limits>
+#include <string>
+
+#include "mba.h"
+
+using namespace std;
+
+void usage(char *argv[]) {
+  cout << "USAGE:" << endl;
+  cout << argv[0] << " [-g] [-p percent] [-c cos] [-h]" << endl;
+  cout << "\t-c cos: Perform action for the specified class of "
+       << "service (COS)" << endl;
+  cout << "\t-g: Get the memory bandwidth throttling delay for specified COS"
+       << endl;
+  cout << "\t-p percent: Throttle the specified COS to the given percentage "
+       << "of peak memory bandwidth" << endl;
+  cout << "\t-h: Print this help" << endl;
+  cout << "NOTE: Needs sudo to run" << endl;
+}
+
+int main(int argc, char *argv[]) {
+  int c;
+  const uint32_t invalid_cos = numeric_limits<uint32_t>::max();
+  uint32_t cos = invalid_cos;
+  bool set = false;
+  int percent = 100;
+
+  while ((c = getopt(argc, argv, "gc:p:h")) != -1) {
+    switch (c) {
+    case 'g':
+      set = false;
+      break;
+    case 'c':
+      cos = atoi(optarg);
+      break;
+    case 'p':
+      set = true;
+      percent = atoi(optarg);
+      break;
+    case 'h':
+      usage(argv);
+      return 0;
+    case '?':
+      usage(argv);
+      return -1;
+    }
+  }
+
+  if (cos == invalid_cos) {
+    usage(argv);
+    return -1;
+  }
+
+  MBAController ctrl(set);
+
+  if (set) {
+    ctrl.setThrottle(cos, ctrl.percentToDelay(percent));
+  } else {
+    uint32_t delay = ctrl.getThrottle(cos);
+    cout << "Throttling delay for COS " << cos << ": " << delay;
+    if (MBAController::isLinear())
+      cout << " (~" << 100 - delay << "% of peak bandwidth)";
+    cout << endl;
+  }
+
+  return 0;
+}
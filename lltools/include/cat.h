@@ -33,9 +33,12 @@
 #include <exception>
 #include <sstream>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "cpuid.h"
 #include "msr.h"
+#include "msr_batch.h"
 #include "msr_haswell.h"
 #include "sysconfig.h"
 
@@ -55,15 +58,61 @@ public:
 };
 
 class CATController {
+public:
+  // With Code and Data Prioritization (CDP) enabled, every COS has a data
+  // mask (IA32_L3_MASK_2n) and a code mask (IA32_L3_MASK_2n+1), and only
+  // half as many COS are available. MASK_UNIFIED sets both.
+  enum MaskType { MASK_UNIFIED, MASK_DATA, MASK_CODE };
+
 private:
   MSR msr;
   int numCores;
   int cbmLen;
-  int numCos;
+  int numCos; // usable COS, i.e., halved when CDP is enabled
   bool cdpEnabled;
 
+  // One core per package; L3 mask MSRs are per package, so each mask must be
+  // written through a core of every package
+  std::vector<int> domainCores;
+
+  void checkCos(uint32_t cos) const {
+    if (cos >= (uint32_t) numCos) {
+      std::stringstream ss;
+      ss << "cos (" << cos << ") exceeds max supported cos (" << numCos - 1
+         << ")";
+      throw CATException(ss.str());
+    }
+  }
+
+  // Mask MSRs that hold the given mask(s) of cos
+  std::vector<uint32_t> maskMsrs(uint32_t cos, MaskType type) const {
+    checkCos(cos);
+    std::vector<uint32_t> msrs;
+    if (!cdpEnabled) {
+      if (type == MASK_CODE)
+        throw CATException("CDP is not enabled; there are no code masks");
+      msrs.push_back(MSR_IA32_L3_MASK_0 + cos);
+    } else {
+      if (type != MASK_CODE)
+        msrs.push_back(MSR_IA32_L3_MASK_0 + 2 * cos);
+      if (type != MASK_DATA)
+        msrs.push_back(MSR_IA32_L3_MASK_0 + 2 * cos + 1);
+    }
+    return msrs;
+  }
+
+  void checkCbm(uint32_t cbm) const {
+    if (cbm >> cbmLen != 0) {
+      std::stringstream ss;
+      ss << "Length of capacity bit mask exceeds max value (" << cbmLen << ")";
+      throw CATException(ss.str());
+    }
+  }
+
 public:
-  CATController(bool write = true) : msr(write) {
+  // devDir is where the MSR files are (see MSR), e.g. a fake tree in tests
+  CATController(bool write = true, const std::string &devDir = "/dev/cpu")
+      : msr(write, devDir) {
     numCores = getNumCores();
     assert(numCores > 0);
 
@@ -78,9 +127,26 @@ public:
 
     cbmLen = getCbmLen();
     numCos = getNumCos();
-    cdpEnabled = getCdpStatus();
+
+    std::vector<std::vector<int> > domains = getCacheDomains();
+    for (const std::vector<int> &d : domains)
+      domainCores.push_back(d.front());
+
+    // CDP is switched on through IA32_L3_QOS_CFG (e.g., by mounting resctrl
+    // with -o cdp); assume all packages agree
+    cdpEnabled = getCdpStatus() &&
+                 (msr.read(domainCores[0], MSR_IA32_L3_QOS_CFG) & 0x1);
+    if (cdpEnabled)
+      numCos /= 2;
   }
 
+  int getNumDomains() const { return domainCores.size(); }
+
+  bool isCdpEnabled() const { return cdpEnabled; }
+
+  // Number of COS that can be used, which is getNumCos() / 2 under CDP
+  int getNumActiveCos() const { return numCos; }
+
   static bool catSupported() {
     CPUID catCpuId(0x7, 0x0);
     const uint32_t CAT_BIT = 12; //bit 12 instead of bit 15
@@ -116,8 +182,9 @@ public:
                                               //return 20;
   }
 
+  // Whether CDP is supported: CPUID.(EAX=10H, ECX=1):ECX[bit 2]
   static bool getCdpStatus() {
-    const uint32_t cdpMask = 0x2;
+    const uint32_t cdpMask = 0x4;
     CPUID resCpuId(0x10, 0x1);
     return ((resCpuId.ECX() & cdpMask) > 0);
   }
@@ -129,14 +196,14 @@ public:
   }
 
   void setCos(int core, uint32_t cos) {
-    if (cos >= numCos) {
+    if (cos >= (uint32_t) numCos) {
       std::stringstream ss;
       ss << "cos (" << cos << ") exceeds max supported cos (" << numCos - 1
          << ")";
       throw CATException(ss.str());
     }
 
-    assert(cos < numCos);
+    assert(cos < (uint32_t) numCos);
     uint64_t pqrAssoc = msr.read(core, MSR_IA32_PQR_ASSOC);
     pqrAssoc &= 0xFFFFFFFF; // clear away cos
     uint64_t cosBits = cos;
@@ -145,39 +212,75 @@ public:
     msr.write(core, MSR_IA32_PQR_ASSOC, pqrAssoc);
   }
 
+  // Assigns many cores at once: all PQR_ASSOC reads go out as one batch, then
+  // all writes as another
+  void setCoses(const std::vector<std::pair<int, uint32_t> > &coreCos) {
+    MSRBatch reads(msr);
+    std::vector<size_t> handles;
+    for (const std::pair<int, uint32_t> &cc : coreCos) {
+      checkCos(cc.second);
+      handles.push_back(reads.read(cc.first, MSR_IA32_PQR_ASSOC));
+    }
+    reads.run();
+
+    MSRBatch writes(msr);
+    for (size_t i = 0; i < coreCos.size(); i++) {
+      uint64_t pqrAssoc = reads.value(handles[i]);
+      pqrAssoc &= 0xFFFFFFFF; // keep the RMID
+      pqrAssoc |= static_cast<uint64_t>(coreCos[i].second) << 32;
+      writes.write(coreCos[i].first, MSR_IA32_PQR_ASSOC, pqrAssoc);
+    }
+    writes.run();
+    writes.check();
+  }
+
   void setGlobalCos(int cos) {
     for (int i = 0; i < numCores; i++)
       setCos(i, cos);
   }
 
-  uint32_t getCbm(int cos) {
-    if (cos >= numCos) {
-      std::stringstream ss;
-      ss << "cos (" << cos << ") exceeds max supported cos (" << numCos - 1
-         << ")";
-      throw CATException(ss.str());
-    }
-    uint64_t l3Mask = msr.read(0, MSR_IA32_L3_MASK_0 + cos);
+  // Under CDP, MASK_UNIFIED returns the data mask
+  uint32_t getCbm(int cos, int domain = 0, MaskType type = MASK_UNIFIED) {
+    uint32_t msrAddr = maskMsrs(cos, type).front();
+    uint64_t l3Mask = msr.read(domainCores[domain], msrAddr);
     l3Mask &= 0xFFFFFFFF; // bits 31:0
     return static_cast<uint32_t>(l3Mask);
   }
 
-  void setCbm(int cos, uint32_t cbm) {
-    if (cos >= numCos) {
-      std::stringstream ss;
-      ss << "cos (" << cos << ") exceeds max supported cos (" << numCos - 1
-         << ")";
-      throw CATException(ss.str());
-    } else if (cbm >> cbmLen != 0) {
-      std::stringstream ss;
-      ss << "Length of capacity bit mask exceeds max value (" << cbmLen << ")";
-      throw CATException(ss.str());
+  // Sets the mask(s) of cos on one package
+  void setCbm(int cos, uint32_t cbm, int domain,
+              MaskType type = MASK_UNIFIED) {
+    checkCbm(cbm);
+    int core = domainCores[domain];
+    for (uint32_t msrAddr : maskMsrs(cos, type)) {
+      uint64_t l3Mask = msr.read(core, msrAddr);
+      l3Mask &= 0xFFFFFFFF00000000; // clear away bit mask
+      uint64_t cbmBits = cbm;
+      l3Mask |= cbmBits;
+      msr.write(core, msrAddr, l3Mask);
     }
+  }
 
-    uint64_t l3Mask = msr.read(0, MSR_IA32_L3_MASK_0 + cos);
-    l3Mask &= 0xFFFFFFFF00000000; // clear away bit mask
-    uint64_t cbmBits = cbm;
-    l3Mask |= cbmBits;
-    msr.write(0, MSR_IA32_L3_MASK_0 + cos, l3Mask);
+  // Sets the mask of cos on every package
+  void setCbm(int cos, uint32_t cbm) {
+    for (int d = 0; d < getNumDomains(); d++)
+      setCbm(cos, cbm, d);
+  }
+
+  // Sets many masks on every package in a single batch. Bits 63:32 of
+  // IA32_L3_MASK_n are reserved, so the masks are written without reading
+  // the old values first.
+  void setCbms(const std::vector<std::pair<int, uint32_t> > &cosCbm,
+               MaskType type = MASK_UNIFIED) {
+    MSRBatch batch(msr);
+    for (const std::pair<int, uint32_t> &cc : cosCbm) {
+      checkCbm(cc.second);
+      for (uint32_t msrAddr : maskMsrs(cc.first, type)) {
+        for (int core : domainCores)
+          batch.write(core, msrAddr, cc.second);
+      }
+    }
+    batch.run();
+    batch.check();
   }
 };
@@ -34,8 +34,10 @@
 #include <sstream>
 #include <string>
 #include <iostream>
+#include <vector>
 #include "cpuid.h"
 #include "msr.h"
+#include "msr_batch.h"
 #include "msr_haswell.h"
 #include "sysconfig.h"
 
@@ -64,69 +66,50 @@ private:
   // CMT event multiplier to convert IA32_QM_CTR counts into bytes
   int64_t cmt_multiplier;
 
-  // Always read QoS Monitoring events for core 0. This works fine on
-  // blb3 which only has a single physical package. On multi-socket
-  // systems, one needs to figure out which package to read data for.
-  const int CORE = 0;
+  // QoS Monitoring counters are per package: an RMID's occupancy and
+  // traffic on a package can only be read through a core of that package.
+  // domainCores holds one such core per package.
+  std::vector<int> domainCores;
 
-  void setEvtselRmid(uint64_t rmid) {
-    const uint64_t mask = 0x3ff; // 10 bits
-    const uint32_t shift = 32;
-
-    rmid &= mask;
-    rmid <<= shift;
-
-    uint64_t evtsel = msr.read(CORE, MSR_IA32_QM_EVTSEL);
-    evtsel &= ~(mask << shift);
-    evtsel |= rmid;
-
-    msr.write(CORE, MSR_IA32_QM_EVTSEL, evtsel);
-  }
-
-  void setEvtselEvt(uint64_t evt) {
-    const uint64_t mask = 0xff; // 8 bits
-
-    evt &= mask;
-
-    uint64_t evtsel = msr.read(CORE, MSR_IA32_QM_EVTSEL);
-    evtsel &= ~mask;
-    evtsel |= evt;
-
-    msr.write(CORE, MSR_IA32_QM_EVTSEL, evtsel);
+  // IA32_QM_EVTSEL only holds the RMID (bits 41:32) and the event ID (bits
+  // 7:0); everything else is reserved, so it is written directly rather than
+  // read-modified-written
+  static uint64_t evtsel(uint64_t rmid, uint64_t evt) {
+    return ((rmid & 0x3ff) << 32) | (evt & 0xff);
   }
 
-  int64_t readQmCtr(uint64_t rmid, uint64_t evt) {
-    //rmid = 0;  //TEST
-    setEvtselRmid(rmid);
-    setEvtselEvt(evt);
-
-    int64_t ctr = msr.read(CORE, MSR_IA32_QM_CTR);
-
-    //std::cout << "rmid = " <<  rmid << std::endl;
-    //std::cout << "evt = " <<  evt << std::endl;
-    //std::cout << "ctr = " <<  ctr << std::endl;
-
+  int64_t decodeQmCtr(uint64_t ctr) const {
     if (ctr & (0x1ULL << 63)) { // bad rmid or evt
       throw CMTException("Baaaaaad RMID or Event Type");
-      return -1;
     }
 
     if (ctr & (0x1ULL << 62)) { // ctr unavailable
       throw CMTException("Counter unavailable");
-      return -1;
     }
 
-    ctr *= cmt_multiplier;
+    return static_cast<int64_t>(ctr) * cmt_multiplier;
+  }
 
-    return ctr;
+  int64_t readQmCtr(uint64_t rmid, uint64_t evt, int domain) {
+    int core = domainCores[domain];
+    msr.write(core, MSR_IA32_QM_EVTSEL, evtsel(rmid, evt));
+    return decodeQmCtr(msr.read(core, MSR_IA32_QM_CTR));
   }
 
 public:
-  CMTController(bool write = true) : msr(write) {
+  // devDir is where the MSR files are (see MSR)
+  CMTController(bool write = true, const std::string &devDir = "/dev/cpu")
+      : msr(write, devDir) {
     CPUID cmtMulCpuId(0xf, 0x1);
     cmt_multiplier = cmtMulCpuId.EBX();
+
+    std::vector<std::vector<int> > domains = getCacheDomains();
+    for (const std::vector<int> &d : domains)
+      domainCores.push_back(d.front());
   }
 
+  int getNumDomains() const { return domainCores.size(); }
+
   ~CMTController() {}
 
   void setRmid(int core, uint64_t rmid) {
@@ -149,11 +132,11 @@ public:
   uint64_t getRmid(int core) {
     uint64_t mask = 0x3ff; // 10 bits
     uint64_t pqr_assoc = msr.read(core, MSR_IA32_PQR_ASSOC);
-    return (pqr_assoc & 0x3ff);
+    return (pqr_assoc & mask);
   }
 
   uint64_t getGlobalRmid() {
-    uint64_t rmid = getRmid(CORE);
+    uint64_t rmid = getRmid(0);
     for (int c = 0; c < getNumCores(); ++c) {
       if (getRmid(c) != rmid) {
         throw CMTException("No global RMID");
@@ -163,16 +146,68 @@ public:
     return rmid;
   }
 
+  int64_t getLlcOccupancy(uint64_t rmid, int domain) {
+    return readQmCtr(rmid, LLC_OCCUPANCY, domain);
+  }
+
+  // Occupancy summed over all packages
   int64_t getLlcOccupancy(uint64_t rmid) {
-    return readQmCtr(rmid, LLC_OCCUPANCY);
+    int64_t occupancy = 0;
+    for (int d = 0; d < getNumDomains(); d++)
+      occupancy += getLlcOccupancy(rmid, d);
+    return occupancy;
   }
 
-  int64_t getTotalMemTraffic(uint64_t rmid) {
-    return readQmCtr(rmid, TOTAL_MEM_BW);
+  // Memory traffic counters wrap around independently on each package (see
+  // getMemTrafficMax()), so they are only exposed per package
+  int64_t getTotalMemTraffic(uint64_t rmid, int domain) {
+    return readQmCtr(rmid, TOTAL_MEM_BW, domain);
   }
 
-  int64_t getLocalMemTraffic(uint64_t rmid) {
-    return readQmCtr(rmid, LOCAL_MEM_BW);
+  int64_t getLocalMemTraffic(uint64_t rmid, int domain) {
+    return readQmCtr(rmid, LOCAL_MEM_BW, domain);
+  }
+
+  // One RMID's counters on one package, as returned by sampleAll()
+  struct Sample {
+    uint64_t rmid;
+    int domain;
+    int64_t llcOccupancy;
+    int64_t localMemTraffic;
+    int64_t totalMemTraffic;
+  };
+
+  // Reads occupancy and local/total traffic of every RMID on every package
+  // in one MSR batch; within a package, the EVTSEL/CTR pairs are issued in
+  // order. Results are ordered by RMID, then package.
+  std::vector<Sample> sampleAll(const std::vector<uint64_t> &rmids) {
+    const uint64_t evts[3] = { LLC_OCCUPANCY, LOCAL_MEM_BW, TOTAL_MEM_BW };
+    MSRBatch batch(msr);
+    std::vector<size_t> handles;
+    for (uint64_t rmid : rmids) {
+      for (int core : domainCores) {
+        for (uint64_t evt : evts) {
+          batch.write(core, MSR_IA32_QM_EVTSEL, evtsel(rmid, evt));
+          handles.push_back(batch.read(core, MSR_IA32_QM_CTR));
+        }
+      }
+    }
+    batch.run();
+
+    std::vector<Sample> samples;
+    size_t h = 0;
+    for (uint64_t rmid : rmids) {
+      for (int d = 0; d < getNumDomains(); d++) {
+        Sample s;
+        s.rmid = rmid;
+        s.domain = d;
+        s.llcOccupancy = decodeQmCtr(batch.value(handles[h++]));
+        s.localMemTraffic = decodeQmCtr(batch.value(handles[h++]));
+        s.totalMemTraffic = decodeQmCtr(batch.value(handles[h++]));
+        samples.push_back(s);
+      }
+    }
+    return samples;
   }
 
   // This method returns the upper limit of DRAM traffic, measured in bytes,
@@ -31,17 +31,44 @@
 #pragma once
 
 #include <stdint.h>
+#include <map>
+#include <utility>
 
 class CPUID {
   uint32_t regs[4];
 
+  struct Leaf {
+    uint32_t regs[4];
+  };
+
+  // Leaves reported instead of the hardware's, keyed by (eax, ecx)
+  static std::map<std::pair<uint32_t, uint32_t>, Leaf> &overrides() {
+    static std::map<std::pair<uint32_t, uint32_t>, Leaf> leaves;
+    return leaves;
+  }
+
 public:
   explicit CPUID(uint32_t eax, uint32_t ecx) {
+    auto it = overrides().find(std::make_pair(eax, ecx));
+    if (it != overrides().end()) {
+      for (int i = 0; i < 4; i++)
+        regs[i] = it->second.regs[i];
+      return;
+    }
     asm volatile("cpuid"
                  : "=a"(regs[0]), "=b"(regs[1]), "=c"(regs[2]), "=d"(regs[3])
                  : "a"(eax), "c"(ecx));
   }
 
+  // Fakes a leaf, e.g. to simulate RDT features the CPU does not have
+  static void setOverride(uint32_t eax, uint32_t ecx, uint32_t a, uint32_t b,
+                          uint32_t c, uint32_t d) {
+    Leaf leaf = { { a, b, c, d } };
+    overrides()[std::make_pair(eax, ecx)] = leaf;
+  }
+
+  static void clearOverrides() { overrides().clear(); }
+
   const uint32_t &EAX() const { return regs[0]; }
   const uint32_t &EBX() const { return regs[1]; }
   const uint32_t &ECX() const { return regs[2]; }
@@ -0,0 +1,171 @@
+/** $lic$
+* MIT License
+* 
+* Copyright (c) 2017-2018 by Massachusetts Institute of Technology
+* Copyright (c) 2017-2018 by Qatar Computing Research Institute, HBKU
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+* 
+* If you use this software in your research, we request that you reference
+* the KPart paper ("KPart: A Hybrid Cache Partitioning-Sharing Technique for
+* Commodity Multicores", El-Sayed, Mukkara, Tsai, Kasture, Ma, and Sanchez,
+* HPCA-24, February 2018) as the source in any publications that use this
+* software, and that you send us a citation of your work.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+**/
+#pragma once
+
+#include <algorithm>
+#include <exception>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "cpuid.h"
+#include "msr.h"
+#include "msr_batch.h"
+#include "msr_haswell.h"
+#include "sysconfig.h"
+
+/*******************************************************************************
+ * Memory Bandwidth Allocation (MBA). Each COS has a throttling delay in
+ * IA32_L2_QoS_Ext_BW_Thrtl_n; with a linear delay scale, a delay of d limits
+ * the cores in that COS to roughly (100 - d)% of their peak memory bandwidth.
+ * CPUID specs obtained from Intel SDM Vol 3 (Sys. Prog. Guide) Chapter 17
+ *******************************************************************************/
+
+class MBAException : public std::exception {
+private:
+  std::string error;
+
+public:
+  MBAException(std::string error) : error(error) {}
+  ;
+
+  const char *what() const throw() { return error.c_str(); }
+};
+
+class MBAController {
+private:
+  MSR msr;
+  int numCos;
+  int maxDelay;
+
+  // One core per package; throttling MSRs are per package, like L3 masks
+  std::vector<int> domainCores;
+
+  void checkCos(uint32_t cos) const {
+    if (cos >= (uint32_t) numCos) {
+      std::stringstream ss;
+      ss << "cos (" << cos << ") exceeds max supported MBA cos ("
+         << numCos - 1 << ")";
+      throw MBAException(ss.str());
+    }
+  }
+
+  void checkDelay(uint32_t delay) const {
+    if (delay > (uint32_t) maxDelay) {
+      std::stringstream ss;
+      ss << "throttling delay (" << delay << ") exceeds max value ("
+         << maxDelay << ")";
+      throw MBAException(ss.str());
+    }
+  }
+
+public:
+  // devDir is where the MSR files are (see MSR)
+  MBAController(bool write = true, const std::string &devDir = "/dev/cpu")
+      : msr(write, devDir) {
+    if (!mbaSupported())
+      throw MBAException("MBA not present");
+
+    numCos = getNumCos();
+    maxDelay = getMaxDelay();
+
+    std::vector<std::vector<int> > domains = getCacheDomains();
+    for (const std::vector<int> &d : domains)
+      domainCores.push_back(d.front());
+  }
+
+  int getNumDomains() const { return domainCores.size(); }
+
+  // CPUID.(EAX=10H, ECX=0):EBX[bit 3]
+  static bool mbaSupported() {
+    const uint32_t MBA_BIT = 3;
+    CPUID rdtCpuId(0x10, 0x0);
+    return ((rdtCpuId.EBX() & (1 << MBA_BIT)) >> MBA_BIT) != 0;
+  }
+
+  static int getNumCos() {
+    const uint32_t numCosMask = 0xFFFF;
+    CPUID mbaCpuId(0x10, 0x3);
+    return (mbaCpuId.EDX() & numCosMask) + 1;
+  }
+
+  static int getMaxDelay() {
+    const uint32_t maxDelayMask = 0xFFF;
+    CPUID mbaCpuId(0x10, 0x3);
+    return (mbaCpuId.EAX() & maxDelayMask) + 1;
+  }
+
+  // Whether delays map linearly to bandwidth: CPUID.(EAX=10H, ECX=3):ECX[2]
+  static bool isLinear() {
+    CPUID mbaCpuId(0x10, 0x3);
+    return (mbaCpuId.ECX() & 0x4) != 0;
+  }
+
+  // Smallest bandwidth step, in percent, on a linear delay scale (as in
+  // Linux's resctrl, it is also the smallest bandwidth that can be set)
+  int getBandwidthGranularity() const { return 100 - maxDelay; }
+
+  // Delay that throttles to at most the given bandwidth percentage, rounded
+  // down to a multiple of the granularity
+  uint32_t percentToDelay(int percent) const {
+    int gran = getBandwidthGranularity();
+    percent = std::max(gran, std::min(percent, 100));
+    return 100 - (percent / gran) * gran;
+  }
+
+  uint32_t getThrottle(int cos, int domain = 0) {
+    checkCos(cos);
+    uint64_t thrtl = msr.read(domainCores[domain],
+                              MSR_IA32_L2_QOS_EXT_BW_THRTL_0 + cos);
+    return static_cast<uint32_t>(thrtl & 0xFFFF);
+  }
+
+  // Sets the delay of cos on every package
+  void setThrottle(int cos, uint32_t delay) {
+    setThrottles({ std::make_pair(cos, delay) });
+  }
+
+  // Sets many delays on every package in a single batch. Only bits 15:0 are
+  // defined, so the old values are not read first.
+  void setThrottles(const std::vector<std::pair<int, uint32_t> > &cosDelay) {
+    MSRBatch batch(msr);
+    for (const std::pair<int, uint32_t> &cd : cosDelay) {
+      checkCos(cd.first);
+      checkDelay(cd.second);
+      for (int core : domainCores)
+        batch.write(core, MSR_IA32_L2_QOS_EXT_BW_THRTL_0 + cd.first,
+                    cd.second);
+    }
+    batch.run();
+    batch.check();
+  }
+};
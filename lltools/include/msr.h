@@ -32,6 +32,7 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <stdint.h>
 #include <exception>
 #include <sstream>
 #include <string>
@@ -42,25 +43,55 @@
 #include <fcntl.h>
 #include <vector>
 
+// Stand-in for the /dev/cpu/N/msr files, e.g. a simulated platform. Must be
+// safe to call from several threads at once (e.g., a CmtSampler's and the
+// planner's).
+class MSRDevice {
+public:
+  virtual ~MSRDevice() {}
+  virtual int getNumCores() const = 0;
+  // Return -1 and set errno on failure
+  virtual int read(int core, uint32_t msr, uint64_t &val) = 0;
+  virtual int write(int core, uint32_t msr, uint64_t val) = 0;
+};
+
 class MSR {
 private:
   std::vector<int> fds;
+  MSRDevice *device;
+  // Byte offset of MSR m is m * stride: 1 on the msr driver's devices, 8 in
+  // regular files, so that neighbouring MSRs do not overlap there
+  off_t stride;
+
+  static MSRDevice *&installedDevice() {
+    static MSRDevice *dev = nullptr;
+    return dev;
+  }
 
 public:
-  MSR(bool write = true) {
-    int numCores = getNumCores();
+  // devDir is normally /dev/cpu; tests can point it at a directory of
+  // regular files laid out as <devDir>/N/msr, with numCores of them. If an
+  // MSRDevice is installed, it replaces the files altogether.
+  MSR(bool write = true, const std::string &devDir = "/dev/cpu",
+      int numCores = ::getNumCores())
+      : device(installedDevice()), stride(1) {
+    if (device)
+      return;
     assert(numCores > 0);
 
     fds.clear();
     for (int i = 0; i < numCores; i++) {
       std::stringstream ss;
-      ss << "/dev/cpu/" << i << "/msr";
+      ss << devDir << "/" << i << "/msr";
       int flags = write ? O_RDWR : O_RDONLY;
       int fd = open(ss.str().c_str(), flags);
       if (fd == -1)
         throw FileIOException("Error opening " + ss.str());
       fds.push_back(fd);
     }
+    struct stat st;
+    if (fstat(fds[0], &st) == 0 && S_ISREG(st.st_mode))
+      stride = sizeof(uint64_t);
   }
 
   ~MSR() {
@@ -69,49 +100,65 @@ public:
     fds.clear();
   }
 
+  // Every MSR created afterwards goes to dev (nullptr restores the files)
+  static void setDevice(MSRDevice *dev) { installedDevice() = dev; }
+  static MSRDevice *getDevice() { return installedDevice(); }
+
+  int getNumCores() const {
+    return device ? device->getNumCores() : fds.size();
+  }
+
+  // Raw accessors; return -1 and set errno on failure, like pread/pwrite
+  int tryRead(int core, ssize_t msr, uint64_t &val) const {
+    if (device)
+      return device->read(core, msr, val);
+    ssize_t nbytes = pread(fds[core], &val, sizeof(val), msr * stride);
+    return (nbytes == sizeof(val)) ? 0 : -1;
+  }
+
+  int tryWrite(int core, ssize_t msr, uint64_t val) const {
+    if (device)
+      return device->write(core, msr, val);
+    ssize_t nbytes = pwrite(fds[core], &val, sizeof(val), msr * stride);
+    return (nbytes == sizeof(val)) ? 0 : -1;
+  }
+
   uint64_t read(int core, ssize_t msr) const {
-    int fd = fds[core];
     uint64_t val;
-    ssize_t nbytes = pread(fd, &val, sizeof(val), msr);
-    if (nbytes == -1) {
-      std::stringstream msg;
-      msg << "Error reading from msr 0x" << std::hex << msr;
-      msg << " | core " << core << std::endl;
-      msg << "errno : " << strerror(errno);
-      throw FileIOException(msg.str());
-    }
+    if (tryRead(core, msr, val) == -1)
+      throw FileIOException(errorMsg("reading from", core, msr, errno));
     return val;
   }
 
+  // No read-back of the old value: every MSR access is an IPI to the core
   void write(int core, ssize_t msr, uint64_t val) const {
-    int fd = fds[core];
-    uint64_t prevVal = read(core, msr);
-    ssize_t nbytes = pwrite(fd, &val, sizeof(val), msr);
-    if (nbytes == -1) {
+    if (tryWrite(core, msr, val) == -1) {
       std::stringstream msg;
-      msg << "Error writing to msr 0x" << std::hex << msr;
-      msg << " | Core " << core;
-      msg << " | original = 0x" << std::hex << prevVal;
-      msg << " | new = 0x" << std::hex << val << std::endl;
-      msg << "errno : " << strerror(errno);
+      msg << errorMsg("writing to", core, msr, errno);
+      msg << " | new = 0x" << std::hex << val;
       throw FileIOException(msg.str());
     }
   }
 
+  static std::string errorMsg(const char *op, int core, ssize_t msr,
+                              int err) {
+    std::stringstream msg;
+    msg << "Error " << op << " msr 0x" << std::hex << msr << std::dec;
+    msg << " | core " << core << " | errno : " << strerror(err);
+    return msg.str();
+  }
+
   class FileIOException : public std::exception {
   private:
     std::string msg;
 
   public:
-    FileIOException(std::string msg) : msg(msg) {}
+    FileIOException(std::string msg) : msg("msr file io error\n" + msg) {}
     ;
 
     ~FileIOException() throw() {}
     ;
 
-    virtual const char *what() const throw() {
-      std::string err = "msr file io error\n" + msg;
-      return err.c_str();
-    }
+    virtual const char *what() const throw() { return msg.c_str(); }
   };
 };
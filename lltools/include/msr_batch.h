@@ -0,0 +1,147 @@
+/** $lic$
+* MIT License
+* 
+* Copyright (c) 2017-2018 by Massachusetts Institute of Technology
+* Copyright (c) 2017-2018 by Qatar Computing Research Institute, HBKU
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+* 
+* If you use this software in your research, we request that you reference
+* the KPart paper ("KPart: A Hybrid Cache Partitioning-Sharing Technique for
+* Commodity Multicores", El-Sayed, Mukkara, Tsai, Kasture, Ma, and Sanchez,
+* HPCA-24, February 2018) as the source in any publications that use this
+* software, and that you send us a citation of your work.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+**/
+#pragma once
+
+#include <errno.h>
+#include <stdint.h>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "msr.h"
+
+/*******************************************************************************
+ * A batch of MSR reads and writes. Operations are queued, then run() executes
+ * them grouped by core, in the order they were queued on each core. The
+ * batch runs on the calling thread: each access to /dev/cpu/N/msr already
+ * runs on core N, and a thread per core would cost more to start than the
+ * accesses take. Errors do not abort the batch; they are recorded per
+ * operation and surfaced when the results are consumed (value(), check()).
+ *******************************************************************************/
+
+class MSRBatch {
+private:
+  struct Op {
+    int core;
+    uint32_t msr;
+    bool isWrite;
+    uint64_t val;
+    int err; // errno, or 0 on success
+  };
+
+  const MSR &msr;
+  std::vector<Op> ops;
+  bool done;
+
+  void runCore(const std::vector<size_t> &idxs) {
+    for (size_t i : idxs) {
+      Op &op = ops[i];
+      int ret = op.isWrite ? msr.tryWrite(op.core, op.msr, op.val)
+                           : msr.tryRead(op.core, op.msr, op.val);
+      op.err = (ret == -1) ? (errno ? errno : EIO) : 0;
+    }
+  }
+
+  std::string errorMsg(const Op &op) const {
+    return MSR::errorMsg(op.isWrite ? "writing to" : "reading from", op.core,
+                         op.msr, op.err);
+  }
+
+public:
+  explicit MSRBatch(const MSR &msr) : msr(msr), done(false) {}
+
+  // Queue a read; the returned handle is passed to value() after run()
+  size_t read(int core, uint32_t msrAddr) {
+    Op op = { core, msrAddr, false, 0, 0 };
+    ops.push_back(op);
+    done = false;
+    return ops.size() - 1;
+  }
+
+  void write(int core, uint32_t msrAddr, uint64_t val) {
+    Op op = { core, msrAddr, true, val, 0 };
+    ops.push_back(op);
+    done = false;
+  }
+
+  size_t size() const { return ops.size(); }
+
+  void run() {
+    std::map<int, std::vector<size_t> > perCore;
+    for (size_t i = 0; i < ops.size(); i++) {
+      if (ops[i].core < 0 || ops[i].core >= msr.getNumCores()) {
+        ops[i].err = ENODEV;
+        continue;
+      }
+      perCore[ops[i].core].push_back(i);
+    }
+
+    for (auto &it : perCore)
+      runCore(it.second);
+    done = true;
+  }
+
+  bool ok(size_t handle) const { return done && ops[handle].err == 0; }
+
+  uint64_t value(size_t handle) const {
+    const Op &op = ops[handle];
+    if (!done)
+      throw MSR::FileIOException("MSR batch has not been run");
+    if (op.err)
+      throw MSR::FileIOException(errorMsg(op));
+    return op.val;
+  }
+
+  size_t numErrors() const {
+    size_t n = 0;
+    for (const Op &op : ops)
+      n += (op.err != 0);
+    return n;
+  }
+
+  // Throws describing the first failed operation, if any
+  void check() const {
+    for (const Op &op : ops) {
+      if (op.err) {
+        std::stringstream ss;
+        ss << errorMsg(op) << " (" << numErrors() << " of " << ops.size()
+           << " operations failed)";
+        throw MSR::FileIOException(ss.str());
+      }
+    }
+  }
+
+  void clear() {
+    ops.clear();
+    done = false;
+  }
+};
@@ -47,6 +47,8 @@
 
 #define MSR_IA32_PQR_ASSOC (0xc8f)
 #define MSR_IA32_L3_MASK_0 (0xc90)
+#define MSR_IA32_L3_QOS_CFG (0xc81)
+#define MSR_IA32_L2_QOS_EXT_BW_THRTL_0 (0xd50)
 
 // Platform QoS MSRs (CMT)
 #define MSR_IA32_QM_EVTSEL (0xc8d)
@@ -0,0 +1,250 @@
+/** $lic$
+* MIT License
+*
+* Copyright (c) 2017-2018 by Massachusetts Institute of Technology
+* Copyright (c) 2017-2018 by Qatar Computing Research Institute, HBKU
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* If you use this software in your research, we request that you reference
+* the KPart paper ("KPart: A Hybrid Cache Partitioning-Sharing Technique for
+* Commodity Multicores", El-Sayed, Mukkara, Tsai, Kasture, Ma, and Sanchez,
+* HPCA-24, February 2018) as the source in any publications that use this
+* software, and that you send us a citation of your work.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+**/
+#pragma once
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <exception>
+#include <string>
+#include <vector>
+
+/*******************************************************************************
+ * Binary per-phase counter logs. A log is a header followed by fixed-size,
+ * append-only records, one per phase:
+ *
+ *   header:  char magic[8]          "KPLOG\0\0\0"
+ *            uint32_t version       PHASE_LOG_VERSION
+ *            uint32_t numColumns
+ *            int32_t  pidx          process the log belongs to
+ *            then numColumns names, each a uint32_t length and its chars
+ *   record:  uint64_t phase, then numColumns uint64_t values
+ *
+ * Integers are in host byte order; logs are meant to be read on the machine
+ * (or at least the architecture) that wrote them.
+ *******************************************************************************/
+
+#define PHASE_LOG_MAGIC "KPLOG\0\0\0"
+#define PHASE_LOG_VERSION 1
+
+class PhaseLogException : public std::exception {
+private:
+  std::string msg;
+
+public:
+  PhaseLogException(std::string msg) : msg("phase log error\n" + msg) {}
+  ~PhaseLogException() throw() {}
+  virtual const char *what() const throw() { return msg.c_str(); }
+};
+
+// Appends records to a log through a buffer allocated up front, so that
+// logging a phase is a copy into the buffer and only every bufRecords-th
+// phase costs a write()
+class PhaseLogWriter {
+private:
+  int fd;
+  std::string path;
+  uint32_t numColumns;
+  std::vector<uint64_t> buf;
+  size_t used; // words of buf holding records not yet written
+
+  void writeAll(const void *data, size_t len) {
+    const char *p = (const char *)data;
+    while (len) {
+      ssize_t ret = ::write(fd, p, len);
+      if (ret == -1 && errno == EINTR)
+        continue;
+      if (ret == -1)
+        throw PhaseLogException("Error writing " + path + ": " +
+                                strerror(errno));
+      p += ret;
+      len -= ret;
+    }
+  }
+
+public:
+  PhaseLogWriter(const std::string &path,
+                 const std::vector<std::string> &columns, int pidx,
+                 size_t bufRecords = 4096)
+      : path(path), numColumns(columns.size()), used(0) {
+    fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1)
+      throw PhaseLogException("Error opening " + path + ": " +
+                              strerror(errno));
+    buf.resize((bufRecords ? bufRecords : 1) * (numColumns + 1));
+
+    std::string hdr(PHASE_LOG_MAGIC, 8);
+    uint32_t version = PHASE_LOG_VERSION;
+    int32_t id = pidx;
+    hdr.append((const char *)&version, sizeof(version));
+    hdr.append((const char *)&numColumns, sizeof(numColumns));
+    hdr.append((const char *)&id, sizeof(id));
+    for (const std::string &col : columns) {
+      uint32_t len = col.size();
+      hdr.append((const char *)&len, sizeof(len));
+      hdr.append(col);
+    }
+    writeAll(hdr.data(), hdr.size());
+  }
+
+  // Owns fd
+  PhaseLogWriter(const PhaseLogWriter &) = delete;
+  PhaseLogWriter &operator=(const PhaseLogWriter &) = delete;
+
+  ~PhaseLogWriter() {
+    try {
+      flush();
+    } catch (PhaseLogException &) {
+    }
+    close(fd);
+  }
+
+  uint32_t getNumColumns() const { return numColumns; }
+
+  // Starts a record in the buffer and returns where its getNumColumns()
+  // values go; they must be filled in before the next flush()
+  uint64_t *appendRecord(uint64_t phase) {
+    if (used == buf.size())
+      flush();
+    uint64_t *record = &buf[used];
+    used += numColumns + 1;
+    record[0] = phase;
+    return record + 1;
+  }
+
+  // values holds getNumColumns() values
+  void append(uint64_t phase, const uint64_t *values) {
+    memcpy(appendRecord(phase), values, numColumns * sizeof(uint64_t));
+  }
+
+  void flush() {
+    if (!used)
+      return;
+    size_t len = used * sizeof(uint64_t);
+    used = 0;
+    writeAll(buf.data(), len);
+  }
+};
+
+// Reads a log back, record by record. A truncated last record (e.g., from a
+// killed writer) reads as the end of the log.
+class PhaseLogReader {
+private:
+  int fd;
+  std::string path;
+  std::vector<std::string> columns;
+  int pidx;
+
+  // Reads exactly len bytes; returns false at the end of the log
+  bool readAll(void *data, size_t len) {
+    char *p = (char *)data;
+    while (len) {
+      ssize_t ret = ::read(fd, p, len);
+      if (ret == -1 && errno == EINTR)
+        continue;
+      if (ret == -1)
+        throw PhaseLogException("Error reading " + path + ": " +
+                                strerror(errno));
+      if (ret == 0)
+        return false;
+      p += ret;
+      len -= ret;
+    }
+    return true;
+  }
+
+  void readHeader() {
+    char magic[8];
+    uint32_t version, numColumns;
+    int32_t id;
+    if (!readAll(magic, sizeof(magic)) ||
+        memcmp(magic, PHASE_LOG_MAGIC, sizeof(magic)))
+      throw PhaseLogException(path + " is not a phase log");
+    if (!readAll(&version, sizeof(version)) || version != PHASE_LOG_VERSION)
+      throw PhaseLogException(path + " has an unsupported version");
+    if (!readAll(&numColumns, sizeof(numColumns)) ||
+        !readAll(&id, sizeof(id)))
+      throw PhaseLogException(path + " has a truncated header");
+    pidx = id;
+    for (uint32_t c = 0; c < numColumns; c++) {
+      uint32_t len;
+      std::string name;
+      if (readAll(&len, sizeof(len))) {
+        name.resize(len);
+        if (len == 0 || readAll(&name[0], len)) {
+          columns.push_back(name);
+          continue;
+        }
+      }
+      throw PhaseLogException(path + " has a truncated header");
+    }
+  }
+
+public:
+  explicit PhaseLogReader(const std::string &path) : path(path) {
+    fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+      throw PhaseLogException("Error opening " + path + ": " +
+                              strerror(errno));
+    try {
+      readHeader();
+    } catch (PhaseLogException &) {
+      close(fd);
+      throw;
+    }
+  }
+
+  PhaseLogReader(const PhaseLogReader &) = delete;
+  PhaseLogReader &operator=(const PhaseLogReader &) = delete;
+
+  ~PhaseLogReader() { close(fd); }
+
+  const std::vector<std::string> &getColumns() const { return columns; }
+  int getPidx() const { return pidx; }
+
+  // Index of the named column, or -1
+  int findColumn(const std::string &name) const {
+    for (size_t c = 0; c < columns.size(); c++)
+      if (columns[c] == name)
+        return c;
+    return -1;
+  }
+
+  // Reads the next record; returns false at the end of the log
+  bool next(uint64_t &phase, std::vector<uint64_t> &values) {
+    values.resize(columns.size());
+    return readAll(&phase, sizeof(phase)) &&
+           (values.empty() ||
+            readAll(values.data(), values.size() * sizeof(uint64_t)));
+  }
+};
@@ -32,13 +32,69 @@
 
 #include <algorithm>
 #include <fstream>
+#include <sstream>
 #include <stdlib.h>
 #include <unistd.h>
 #include <vector>
 
+// Number of cores of a simulated single-package machine; 0 when running on
+// the real topology
+inline int &simulatedNumCores() {
+  static int numCores = 0;
+  return numCores;
+}
+
 inline int getNumCores() {
+  if (simulatedNumCores() > 0)
+    return simulatedNumCores();
   // Unimplemented for gcc versions < 4.8
   // int numCores = std::thread::hardware_concurrency();
   int numCores = sysconf(_SC_NPROCESSORS_ONLN);
   return (numCores > 0) ? numCores : -1;
 }
+
+// Physical package (socket) of a core, from sysfs topology. Each package has
+// its own LLC and its own copy of the CAT/CMT MSRs. Falls back to package 0
+// if topology information is unavailable.
+inline int getPackageId(int core) {
+  if (simulatedNumCores() > 0)
+    return 0;
+  std::stringstream ss;
+  ss << "/sys/devices/system/cpu/cpu" << core << "/topology/physical_package_id";
+  std::ifstream in(ss.str().c_str());
+  int id = 0;
+  if (!(in >> id))
+    return 0;
+  return id;
+}
+
+// Cores grouped by cache domain (i.e., package), in increasing package id
+// order. Domain indices are dense even if package ids are not.
+inline std::vector<std::vector<int> > getCacheDomains() {
+  std::vector<int> pkgIds;
+  std::vector<int> corePkg;
+  for (int c = 0; c < getNumCores(); c++) {
+    corePkg.push_back(getPackageId(c));
+    if (std::find(pkgIds.begin(), pkgIds.end(), corePkg.back()) == pkgIds.end())
+      pkgIds.push_back(corePkg.back());
+  }
+  std::sort(pkgIds.begin(), pkgIds.end());
+
+  std::vector<std::vector<int> > domains(pkgIds.size());
+  for (int c = 0; c < (int) corePkg.size(); c++) {
+    int d = std::find(pkgIds.begin(), pkgIds.end(), corePkg[c]) - pkgIds.begin();
+    domains[d].push_back(c);
+  }
+  return domains;
+}
+
+// Index (into getCacheDomains()) of the cache domain a core belongs to
+inline int getCacheDomain(int core) {
+  std::vector<std::vector<int> > domains = getCacheDomains();
+  for (int d = 0; d < (int) domains.size(); d++) {
+    if (std::find(domains[d].begin(), domains[d].end(), core) !=
+        domains[d].end())
+      return d;
+  }
+  return 0;
+}
@@ -0,0 +1,79 @@
+/** $lic$
+* MIT License
+*
+* Copyright (c) 2017-2018 by Massachusetts Institute of Technology
+* Copyright (c) 2017-2018 by Qatar Computing Research Institute, HBKU
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* If you use this software in your research, we request that you reference
+* the KPart paper ("KPart: A Hybrid Cache Partitioning-Sharing Technique for
+* Commodity Multicores", El-Sayed, Mukkara, Tsai, Kasture, Ma, and Sanchez,
+* HPCA-24, February 2018) as the source in any publications that use this
+* software, and that you send us a citation of your work.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+**/
+#include <stdio.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "phase_log.h"
+
+using namespace std;
+
+void usage(char *argv[]) {
+  cout << "USAGE:" << endl;
+  cout << argv[0] << " <phase_log> [-h]" << endl;
+  cout << "\tConverts a binary per-phase counter log written by KPart "
+       << "(KPART_LOG_FORMAT=binary) to CSV on stdout" << endl;
+  cout << "\t-h: Print this help" << endl;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 2 || string(argv[1]) == "-h") {
+    usage(argv);
+    return argc == 2 ? 0 : -1;
+  }
+
+  try {
+    PhaseLogReader log(argv[1]);
+    const vector<string> &columns = log.getColumns();
+
+    printf("# pidx %d\n", log.getPidx());
+    printf("PHASE");
+    for (const string &col : columns)
+      printf(",%s", col.c_str());
+    printf("\n");
+
+    uint64_t phase;
+    vector<uint64_t> values;
+    while (log.next(phase, values)) {
+      printf("%lu", phase);
+      for (uint64_t v : values)
+        printf(",%lu", v);
+      printf("\n");
+    }
+  } catch (PhaseLogException &e) {
+    cerr << e.what() << endl;
+    return -1;
+  }
+
+  return 0;
+}
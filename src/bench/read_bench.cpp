@@ -0,0 +1,144 @@
+/** $lic$
+* MIT License
+*
+* Copyright (c) 2017-2018 by Massachusetts Institute of Technology
+* Copyright (c) 2017-2018 by Qatar Computing Research Institute, HBKU
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* If you use this software in your research, we request that you reference
+* the KPart paper ("KPart: A Hybrid Cache Partitioning-Sharing Technique for
+* Commodity Multicores", El-Sayed, Mukkara, Tsai, Kasture, Ma, and Sanchez,
+* HPCA-24, February 2018) as the source in any publications that use this
+* software, and that you send us a citation of your work.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+**/
+
+// Micro-benchmark of the ways KPart can read a process's counters at a phase
+// boundary: one read() per event (the original path), one read() of the
+// whole group, and rdpmc through the mmapped event pages. The events count
+// this process, since rdpmc only works on self-monitored events.
+//
+// Usage: read_bench [iterations] [events (1-6)]
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <vector>
+#include "pmu/group_reader.h"
+
+static const uint64_t EVENT_CONFIGS[] = {
+    PERF_COUNT_HW_INSTRUCTIONS,        PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_CACHE_REFERENCES,    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_MISSES};
+static const int MAX_EVENTS = sizeof(EVENT_CONFIGS) / sizeof(uint64_t);
+
+static std::vector<int> open_group(int numEvents, uint64_t readFormat) {
+  std::vector<int> fds;
+  for (int i = 0; i < numEvents; i++) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = EVENT_CONFIGS[i];
+    attr.read_format = readFormat;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    int groupFd = fds.empty() ? -1 : fds[0];
+    int fd = syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0);
+    if (fd == -1)
+      err(1, "cannot open event %d (check perf_event_paranoid)", i);
+    fds.push_back(fd);
+  }
+  return fds;
+}
+
+static double now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Times iters reads with readFn, and returns ns per read. The instruction
+// count of the last read is kept in last, so the reads cannot be elided.
+template <typename F> double time_reads(long iters, F readFn, uint64_t &last) {
+  for (long i = 0; i < iters / 100; i++) // warm up
+    last = readFn();
+  double start = now_ns();
+  for (long i = 0; i < iters; i++)
+    last = readFn();
+  return (now_ns() - start) / iters;
+}
+
+int main(int argc, char **argv) {
+  long iters = (argc > 1) ? atol(argv[1]) : 1000000;
+  int numEvents = (argc > 2) ? atoi(argv[2]) : 3;
+  if (iters <= 0 || numEvents < 1 || numEvents > MAX_EVENTS)
+    errx(1, "usage: %s [iterations] [events (1-%d)]", argv[0], MAX_EVENTS);
+
+  uint64_t groupFormat = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                         PERF_FORMAT_TOTAL_TIME_RUNNING;
+  std::vector<int> singleFds = open_group(numEvents, 0);
+  std::vector<int> groupFds = open_group(numEvents, groupFormat);
+  pmu::GroupReader groupReader(groupFds, std::vector<void *>(), true, false);
+  pmu::GroupReader rdpmcReader(groupFds, std::vector<void *>(), true, true);
+
+  printf("[BENCH] %d events, %ld reads per mode\n", numEvents, iters);
+  uint64_t last;
+
+  std::vector<uint64_t> values(numEvents);
+  double ns = time_reads(iters, [&]() {
+    for (int i = 0; i < numEvents; i++) {
+      if (read(singleFds[i], &values[i], sizeof(uint64_t)) != sizeof(uint64_t))
+        err(1, "cannot read event %d", i);
+    }
+    return values[0];
+  }, last);
+  printf("[BENCH] %-24s %10.1f ns/phase\n", "read() per event", ns);
+
+  uint64_t enabled, running;
+  ns = time_reads(iters, [&]() {
+    if (!groupReader.read(values, enabled, running))
+      errx(1, "cannot read event group");
+    return values[0];
+  }, last);
+  printf("[BENCH] %-24s %10.1f ns/phase\n", "group read()", ns);
+
+  if (rdpmcReader.getMode() != pmu::GroupReader::RDPMC) {
+    printf("[BENCH] %-24s unavailable (rdpmc disabled, see "
+           "/sys/bus/event_source/devices/cpu/rdpmc)\n", "rdpmc");
+  } else {
+    ns = time_reads(iters, [&]() {
+      if (!rdpmcReader.read(values, enabled, running))
+        errx(1, "cannot read event group");
+      return values[0];
+    }, last);
+    printf("[BENCH] %-24s %10.1f ns/phase (%lu fell back to read())\n",
+           "rdpmc", ns, rdpmcReader.getNumFallbacks());
+  }
+  printf("[BENCH] Phase ends read from ring-buffer samples take no extra "
+         "syscall or counter read\n");
+
+  printf("[BENCH] (%lu instructions counted)\n", last);
+  return 0;
+}
@@ -31,48 +31,121 @@
 * SOFTWARE.
 **/
 
+#include <algorithm>
+#include <assert.h>
+#include <err.h>
 #include <sstream>
 #include <string>
 #include <string.h>
 #include <iostream>
+#include <limits>
 #include "cache_utils.h"
+#include "pipeline/async_log.h"
+#include "rdt/id_pools.h"
+#include "rdt/quirks.h"
+#include "rdt/resctrl_backend.h"
+#include "sysconfig.h"
 #ifdef USE_CMT
 #include "cmt.h"
 #endif
 
+int numCores = 0;
+int cacheWays = 0;
+
 namespace cache_utils {
 
-int share_all_cache_ways() { // Share all ways!
-  if (enableLogging) {
-    printf("[INFO]  Inside resetCacheWaysAllCores()\n");
+using pipeline::log_printf;
+
+rdt::RdtBackend *rdtBackend = nullptr;
+
+// COS IDs for clusters; COS 0 stays the default class of unmanaged cores,
+// and the COSes after it are reserved for profiling
+static rdt::CosPool *cosPool = nullptr;
+static int numProfilingCos = 0;
+
+// Cores each app runs on, indexed by app
+static std::vector<std::vector<int> > appCores;
+
+// Cores the last partitioning plan mapped to a COS of the pool
+static std::vector<bool> poolCores;
+
+// cutAllowed[w]: whether a partition may end right before way w, i.e., way w
+// is not coupled to way w-1 by a platform quirk (see rdt/quirks.h)
+static std::vector<bool> cutAllowed;
+
+uint32_t full_cbm() {
+  // In 64 bits, as masks may be 32 ways long
+  return (uint32_t) ((1ULL << cacheWays) - 1);
+}
+
+void init_rdt_backend() {
+  try {
+    if (rdtBackend == nullptr)
+      rdtBackend = rdt::create_rdt_backend();
+  } catch (std::exception &e) {
+    errx(1, "Cannot initialize cache allocation backend: %s", e.what());
   }
-  int sts;
 
-  for (int cosID = 0; cosID < NUM_CORES; cosID++) {
-    int limit = CACHE_WAYS - 1;
-    std::string waysString = "";
-    for (int i = 0; i < limit; i++) {
-      waysString = waysString + std::to_string(i);
-      waysString += ",";
+  numCores = getNumCores();
+  cacheWays = rdtBackend->getCbmLen();
+  if (numCores < 1 || cacheWays < 3)
+    errx(1, "Unsupported platform: %d cores, %d LLC ways", numCores,
+         cacheWays);
+
+  reserve_profiling_cos(PROFILING_COS_DEFAULT);
+
+  cutAllowed.assign(cacheWays + 1, true);
+  rdt::CpuSignature cpu = rdt::get_cpu_signature();
+  for (const rdt::PlatformQuirk *q : rdt::find_quirks(cpu, cacheWays)) {
+    log_printf("[INFO] Applying %s allocation quirks (family 0x%x, model 0x%x, "
+               "stepping %d)\n",
+               q->part, cpu.family, cpu.model, cpu.stepping);
+    for (const std::vector<int> &group : q->coupledWays) {
+      int lo = *std::min_element(group.begin(), group.end());
+      int hi = *std::max_element(group.begin(), group.end());
+      for (int w = lo + 1; w <= hi && w < cacheWays; w++)
+        cutAllowed[w] = false;
     }
+  }
+  if (enableLogging) {
+    log_printf("[INFO] Using %s allocation backend (%d COS, %d-bit CBM), %d "
+               "cores\n",
+               rdtBackend->name(), rdtBackend->getNumCos(),
+               rdtBackend->getCbmLen(), numCores);
+  }
+}
+
+rdt::RdtBackend *get_rdt_backend() {
+  assert(rdtBackend != nullptr);
+  return rdtBackend;
+}
 
-    waysString = waysString + std::to_string(CACHE_WAYS - 1);
-    waysString = " " + waysString;
+void print_apply_latency(const char *name) {
+  const rdt::ApplyStats &stats = rdtBackend->getApplyStats();
+  log_printf("[TIMECALC] %s = %.3f ms (avg %.3f ms, max %.3f ms over %lu "
+             "applies; %lu writes issued, %lu skipped)\n",
+             name, stats.lastApplyMs, stats.avgApplyMs(), stats.maxApplyMs,
+             stats.numApplies, stats.writesIssued, stats.writesSkipped);
+}
 
-    std::string rs =
-        CAT_CBM_TOOL_DIR + std::to_string(cosID) + " -m" + waysString;
-    sts = system(rs.c_str());
-    if (enableLogging) {
-      printf("[INFO] Changing COS %d to %d ways. Status= %d \n", cosID,
-             CACHE_WAYS, sts);
-    }
-    rs = CAT_COS_TOOL_DIR + std::to_string(cosID) + " -s " +
-         std::to_string(cosID);
-    sts = system(rs.c_str());
-    if (enableLogging) {
-      printf("[INFO] Changing CORE %d map to COS %d. Status= %d \n", cosID,
-             cosID, sts);
-    }
+int share_all_cache_ways() { // Share all ways!
+  if (enableLogging) {
+    log_printf("[INFO]  Inside resetCacheWaysAllCores()\n");
+  }
+
+  rdt::PartitionPlan plan;
+  uint32_t fullCbm = full_cbm();
+  int numCos = get_rdt_backend()->getNumCos();
+  plan.cbms.assign(numCos, fullCbm);
+  plan.coreCos.assign(numCores, 0);
+  poolCores.clear();
+
+  int sts = get_rdt_backend()->applyPlan(plan);
+  if (enableLogging) {
+    log_printf("[INFO] Changing COS 0-%d to %d ways, all cores map to COS 0. "
+               "Status= %d \n",
+               numCos - 1, cacheWays, sts);
+    print_apply_latency("share_all_cache_ways");
   }
   return sts;
 }
@@ -96,7 +169,7 @@ void get_maxmarginalutil_mrcs(arma::vec curve, int cur, int parts,
 
 void smoothenMRCs(arma::mat &mpkiVsWays) {
   if (enableLogging)
-    printf("[INFO]  Inside smoothenMRCs()\n");
+    log_printf("[INFO]  Inside smoothenMRCs()\n");
   double prevValue = 0.0;
   for (int j = 0; j < mpkiVsWays.n_cols; j++) {
     for (int i = 1; i < mpkiVsWays.n_rows; i++) {
@@ -105,7 +178,7 @@ void smoothenMRCs(arma::mat &mpkiVsWays) {
     }
   }
   if (enableLogging)
-    mpkiVsWays.print();
+    pipeline::log_print(mpkiVsWays);
 }
 
 void get_maxmarginalutil_ipcs(arma::vec curve, int cur, int parts,
@@ -130,7 +203,7 @@ void get_maxmarginalutil_ipcs(arma::vec curve, int cur, int parts,
 
 void smoothenIPCs(arma::mat &ipcVsWays) {
   if (enableLogging)
-    printf("[INFO] Inside smoothenIPCs()\n");
+    log_printf("[INFO] Inside smoothenIPCs()\n");
   double prevValue = 0.0;
   for (int j = 0; j < ipcVsWays.n_cols; j++) {
     for (int i = 1; i < ipcVsWays.n_rows; i++) {
@@ -139,22 +212,24 @@ void smoothenIPCs(arma::mat &ipcVsWays) {
     }
   }
   if (enableLogging)
-    ipcVsWays.print();
+    pipeline::log_print(ipcVsWays);
 }
 
+// Weighted speedups are relative to each app's IPC with this many ways - 1
+static const int APP_RELATIVE_IPC_BUCK = 2;
+
 std::vector<std::vector<double> > get_wscurves_for_combinedmrcs(
     std::vector<std::vector<std::vector<std::pair<uint32_t, uint32_t> > > >
         cluster_bucks,
     arma::mat ipcVsWays) {
-  int APP_RELATIVE_IPC_BUCK = 2;
 
   if (enableLogging) {
-    printf("[INFO]  Inside get_wscurves_for_combinedmrcs():\n");
+    log_printf("[INFO]  Inside get_wscurves_for_combinedmrcs():\n");
   }
 
   std::vector<std::vector<double> > wsCurveVecDbl;
   arma::vec ipcApp;
-  std::vector<double> wsCurve(CACHE_WAYS);
+  std::vector<double> wsCurve(cacheWays);
 
   for (uint32_t cid = 0; cid < cluster_bucks.size(); cid++) {
     for (uint32_t p = 0; p < cluster_bucks[cid].size(); p++) {
@@ -176,66 +251,498 @@ std::vector<std::vector<double> > get_wscurves_for_combinedmrcs(
   return wsCurveVecDbl;
 }
 
-void apply_partition_plan(std::stack<int> partitions[]) {
-  std::string waysString;
-  int cosID, status;
-  std::stack<int> appPartitions;
+static double memBwBytesPerCycle = DEFAULT_MEM_BW_BYTES_PER_CYCLE;
+static double memMissPenaltyCycles = DEFAULT_MEM_MISS_PENALTY_CYCLES;
 
-  for (int a = 0; a < NUM_CORES; ++a) {
-    appPartitions = partitions[a];
-    cosID = a;
-    waysString = "";
-    while (!appPartitions.empty()) {
-      waysString = waysString + std::to_string(appPartitions.top());
-      waysString += ",";
-      appPartitions.pop();
+void set_memory_model(double bwBytesPerCycle, double missPenaltyCycles) {
+  memBwBytesPerCycle = bwBytesPerCycle;
+  memMissPenaltyCycles = missPenaltyCycles;
+}
+
+// Weighted speedup of K clusters with the given ways and bandwidth caps.
+// Each app's profiled IPC splits into a base CPI and miss stalls; the
+// bandwidth all apps demand (capped by MBA) stretches the stalls once memory
+// saturates, and an app never gets more bandwidth than its cap.
+static double predict_ws_with_bandwidth(
+    const std::vector<
+        std::vector<std::vector<std::pair<uint32_t, uint32_t> > > > &
+        cluster_bucks,
+    const arma::mat &ipcVsWays, const arma::mat &mpkiVsWays,
+    const uint32_t *allocs, const int *bwPercents, uint32_t K) {
+  struct AppPoint {
+    int app;
+    double cpiBase, stallPi, bytesPi, capBpc;
+  };
+  std::vector<AppPoint> points;
+  double demand = 0.0;
+  for (uint32_t c = 0; c < K; c++) {
+    for (const std::pair<uint32_t, uint32_t> &ab :
+         cluster_bucks[c][allocs[c] - 1]) {
+      double ipc = ipcVsWays(ab.second, ab.first);
+      double mpki = mpkiVsWays(ab.second, ab.first);
+      if (ipc <= 0)
+        continue;
+      AppPoint p;
+      p.app = ab.first;
+      p.stallPi = mpki * memMissPenaltyCycles / 1000;
+      p.cpiBase = std::max(1.0 / ipc - p.stallPi, 0.1 / ipc);
+      p.bytesPi = mpki * CACHE_LINE_SIZE / 1000;
+      p.capBpc = memBwBytesPerCycle * bwPercents[c] / 100;
+      demand += std::min(p.bytesPi / (p.cpiBase + p.stallPi), p.capBpc);
+      points.push_back(p);
     }
+  }
 
-    waysString.erase(waysString.end() - 1);
-    waysString = " " + waysString;
+  double stretch = std::max(1.0, demand / memBwBytesPerCycle);
+  double ws = 0.0;
+  for (const AppPoint &p : points) {
+    double ipc = 1.0 / (p.cpiBase + p.stallPi * stretch);
+    if (ipc * p.bytesPi > p.capBpc)
+      ipc = p.capBpc / p.bytesPi;
+    ws += ipc / ipcVsWays(APP_RELATIVE_IPC_BUCK, p.app);
+  }
+  return ws;
+}
 
-    std::string rs = CAT_CBM_TOOL_DIR + std::to_string(cosID);
-    rs += " -m" + waysString;
+double allocate_ways_and_bandwidth(
+    std::vector<std::vector<std::vector<std::pair<uint32_t, uint32_t> > > >
+        cluster_bucks,
+    arma::mat ipcVsWays, arma::mat mpkiVsWays, uint32_t *allocs,
+    int *bwPercents, uint32_t K, int bwGran, bool moveWays) {
+  for (uint32_t c = 0; c < K; c++)
+    bwPercents[c] = 100;
+  // Search on a copy, so that the given ways stay unless moving some wins
+  std::vector<uint32_t> ways(allocs, allocs + K);
+  double bestWs = predict_ws_with_bandwidth(
+      cluster_bucks, ipcVsWays, mpkiVsWays, &ways[0], bwPercents, K);
+  double startWs = bestWs;
+
+  // Steepest ascent over single steps: one bandwidth level up or down, or
+  // one way from a cluster to another
+  while (true) {
+    int bestBwCluster = -1, bestBwDelta = 0;
+    int bestFrom = -1, bestTo = -1;
+    double moveWs = bestWs;
+
+    for (uint32_t c = 0; c < K; c++) {
+      for (int delta = -bwGran; delta <= bwGran; delta += 2 * bwGran) {
+        int old = bwPercents[c];
+        if (old + delta < bwGran || old + delta > 100)
+          continue;
+        bwPercents[c] = old + delta;
+        double ws = predict_ws_with_bandwidth(
+            cluster_bucks, ipcVsWays, mpkiVsWays, &ways[0], bwPercents, K);
+        bwPercents[c] = old;
+        if (ws > moveWs + 1e-9) {
+          moveWs = ws;
+          bestBwCluster = c;
+          bestBwDelta = delta;
+          bestFrom = -1;
+        }
+      }
+    }
 
-    status = system(rs.c_str());
-    if (enableLogging) {
-      printf("[INFO] Changing cache alloc for cos %d to %s ways. Status= %d \n",
-             cosID, waysString.c_str(), status);
+    for (uint32_t from = 0; moveWays && from < K; from++) {
+      if (ways[from] <= 1)
+        continue;
+      for (uint32_t to = 0; to < K; to++) {
+        if (to == from)
+          continue;
+        ways[from]--;
+        ways[to]++;
+        double ws = predict_ws_with_bandwidth(
+            cluster_bucks, ipcVsWays, mpkiVsWays, &ways[0], bwPercents, K);
+        ways[from]++;
+        ways[to]--;
+        if (ws > moveWs + 1e-9) {
+          moveWs = ws;
+          bestFrom = from;
+          bestTo = to;
+          bestBwCluster = -1;
+        }
+      }
     }
 
-    if (status != 0)
+    if (bestFrom >= 0) {
+      ways[bestFrom]--;
+      ways[bestTo]++;
+    } else if (bestBwCluster >= 0) {
+      bwPercents[bestBwCluster] += bestBwDelta;
+    } else {
       break;
+    }
+    bestWs = moveWs;
+  }
+
+  // The caps were chosen along with the moved ways; the moves only stand if
+  // they beat the hill climber's ways under the same caps
+  double keptWs = predict_ws_with_bandwidth(cluster_bucks, ipcVsWays,
+                                            mpkiVsWays, allocs, bwPercents, K);
+  if (bestWs > keptWs + 1e-9)
+    std::copy(ways.begin(), ways.end(), allocs);
+  else
+    bestWs = keptWs;
+
+  if (enableLogging) {
+    log_printf("[INFO] Joint ways/bandwidth allocation (predicted WS %.2f -> "
+               "%.2f): ",
+               startWs, bestWs);
+    for (uint32_t c = 0; c < K; c++)
+      log_printf("%u ways @ %d%%, ", allocs[c], bwPercents[c]);
+    log_printf("\n");
   }
+  return bestWs;
+}
+
+static uint32_t partition_cbm(std::stack<int> appPartitions) {
+  std::vector<int> ways;
+  while (!appPartitions.empty()) {
+    ways.push_back(appPartitions.top());
+    appPartitions.pop();
+  }
+  return rdt::ways_to_cbm(ways);
+}
+
+void set_app_cores(const std::vector<std::vector<int> > &cores) {
+  appCores = cores;
+}
 
-  //Now map each core to its COS
-  for (int cosID = 0; cosID < NUM_CORES; cosID++) {
-    std::string rs = CAT_COS_TOOL_DIR + std::to_string(cosID) + " -s " +
-                     std::to_string(cosID);
-    status = system(rs.c_str());
-    if (enableLogging) {
-      printf("[INFO] Changing CORE %d map to COS %d. Status= %d \n", cosID,
-             cosID, status);
+std::vector<int> app_cores(int app) {
+  if (app < (int) appCores.size())
+    return appCores[app];
+  return std::vector<int>(1, app);
+}
+
+int get_num_partition_cos() { return cosPool->getNumCos(); }
+
+void reserve_profiling_cos(int num) {
+  // COS 0 and at least one cluster COS besides the profiling ones
+  int numCos = get_rdt_backend()->getNumCos();
+  if (num + 2 > numCos)
+    errx(1, "Cannot reserve %d COSes for profiling: the platform has %d", num,
+         numCos);
+  delete cosPool;
+  cosPool = new rdt::CosPool(numCos, profiling_cos(num));
+  numProfilingCos = num;
+}
+
+int get_num_profiling_cos() { return numProfilingCos; }
+
+// Masks of the last partitioning plan applied to each app, i.e., the ways it
+// has warmed up. Apps start out sharing the whole cache.
+static std::vector<uint32_t> lastAppCbms;
+static std::vector<uint32_t> lastAppCodeCbms;
+
+uint32_t last_partition_cbm(int app, bool code) {
+  const std::vector<uint32_t> &cbms = code ? lastAppCodeCbms : lastAppCbms;
+  if (app < (int) cbms.size())
+    return cbms[app];
+  return full_cbm();
+}
+
+static int popcount(uint32_t cbm) { return __builtin_popcount(cbm); }
+
+int apply_partition_plan(std::stack<int> partitions[], int numApps,
+                         std::stack<int> codePartitions[],
+                         const int *bwPercents) {
+  // Apps with the same allocation (i.e., in the same cluster) share a COS.
+  // Apps without ways are not managed: no COS, and their cores stay as is.
+  std::vector<rdt::CosAlloc> appAllocs(numApps), managedAllocs;
+  std::vector<uint32_t> appCbms, appCodeCbms;
+  for (int a = 0; a < numApps; ++a) {
+    rdt::CosAlloc &alloc = appAllocs[a];
+    alloc.cbm = partition_cbm(partitions[a]);
+    alloc.codeCbm =
+        codePartitions ? partition_cbm(codePartitions[a]) : alloc.cbm;
+    alloc.mbaPercent = bwPercents ? bwPercents[a] : 100;
+    if (!partitions[a].empty())
+      managedAllocs.push_back(alloc);
+    appCbms.push_back(alloc.cbm);
+    appCodeCbms.push_back(alloc.codeCbm);
+  }
+  if (managedAllocs.empty())
+    return 0;
+  std::vector<int> appCos(numApps, -1), managedCos;
+  try {
+    managedCos = cosPool->assign(managedAllocs);
+  } catch (rdt::RdtException &e) {
+    log_printf("[ERROR] Cannot apply partitioning plan: %s\n", e.what());
+    return 0;
+  }
+  for (int a = 0, m = 0; a < numApps; ++a) {
+    if (!partitions[a].empty())
+      appCos[a] = managedCos[m++];
+  }
+
+  // COSes no cluster uses (including the default COS 0, and the profiling
+  // COSes the cores of apps without ways may still be in) get the whole cache
+  rdt::PartitionPlan plan;
+  int numCos = *std::max_element(appCos.begin(), appCos.end()) + 1;
+  uint32_t fullCbm = full_cbm();
+  plan.cbms.assign(numCos, fullCbm);
+  if (codePartitions)
+    plan.codeCbms.assign(numCos, fullCbm);
+  if (bwPercents)
+    plan.mbaPercents.assign(numCos, 100);
+  plan.coreCos.assign(numCores, -1);
+  for (int a = 0; a < numApps; ++a) {
+    int cos = appCos[a];
+    if (cos < 0)
+      continue;
+    plan.cbms[cos] = appAllocs[a].cbm;
+    if (codePartitions)
+      plan.codeCbms[cos] = appAllocs[a].codeCbm;
+    if (bwPercents)
+      plan.mbaPercents[cos] = appAllocs[a].mbaPercent;
+    for (int core : app_cores(a)) {
+      if (core >= numCores)
+        continue;
+      if (plan.coreCos[core] >= 0 && plan.coreCos[core] != cos)
+        log_printf("[ERROR] Core %d runs apps in different clusters; app %d's "
+                   "COS %d wins\n",
+                   core, a, cos);
+      plan.coreCos[core] = cos;
+    }
+  }
+  // Cores of apps that left the plan (e.g., gone, or not profiled yet) must
+  // not stay in a COS the pool may have given to another cluster
+  poolCores.resize(numCores, false);
+  for (int core = 0; core < numCores; core++) {
+    if (poolCores[core] && plan.coreCos[core] < 0)
+      plan.coreCos[core] = 0;
+    poolCores[core] = (plan.coreCos[core] > 0);
+  }
+
+  int status = get_rdt_backend()->applyPlan(plan);
+  if (enableLogging) {
+    for (int a = 0; a < numApps; ++a) {
+      int cos = appCos[a];
+      if (cos < 0)
+        continue;
+      log_printf("[INFO] App %d (cores %s) -> COS %d: %s ways. Status= %d \n",
+                 a, rdt::format_cpu_list(app_cores(a)).c_str(), cos,
+                 rdt::cbm_to_string(plan.cbms[cos]).c_str(), status);
+      if (codePartitions)
+        log_printf("[INFO]   cos %d code ways: %s\n", cos,
+                   rdt::cbm_to_string(plan.codeCbms[cos]).c_str());
+      if (bwPercents)
+        log_printf("[INFO]   cos %d memory bandwidth: %d%%\n", cos,
+                   plan.mbaPercents[cos]);
     }
   }
+  print_apply_latency("apply_partition_plan");
+
+  // Ways an app gains start out cold; the ways it loses cost nothing
+  int waysMoved = 0;
+  for (int a = 0; a < numApps; ++a) {
+    waysMoved += popcount(appCbms[a] & ~last_partition_cbm(a, false));
+    if (codePartitions)
+      waysMoved += popcount(appCodeCbms[a] & ~last_partition_cbm(a, true));
+  }
+  lastAppCbms = appCbms;
+  lastAppCodeCbms = appCodeCbms;
+  if (enableLogging)
+    log_printf("[INFO] Ways moved by this plan: %d\n", waysMoved);
+  return waysMoved;
+}
+
+void release_cores(const std::vector<int> &cores) {
+  rdt::PartitionPlan plan;
+  plan.coreCos.assign(numCores, -1);
+  for (int core : cores) {
+    if (core < numCores)
+      plan.coreCos[core] = 0;
+    if (core < (int) poolCores.size())
+      poolCores[core] = false;
+  }
+  int status = get_rdt_backend()->applyPlan(plan);
+  if (enableLogging)
+    log_printf("[INFO] Cores %s back to COS 0. Status= %d \n",
+               rdt::format_cpu_list(cores).c_str(), status);
 }
 
-void print_allocations(uint32_t *allocs) {
-  for (int i = 0; i < NUM_CORES; i++) {
-    std::cout << allocs[i] << ", ";
+// keep[a][w] for layout_partitions(): whether app a held way w in the last
+// plan
+static std::vector<std::vector<int> > last_plan_keep_ways(int numApps) {
+  std::vector<std::vector<int> > keep(numApps, std::vector<int>(cacheWays, 0));
+  for (int a = 0; a < numApps; ++a) {
+    for (int w : rdt::cbm_to_ways(last_partition_cbm(a, false)))
+      keep[a][w] = 1;
   }
-  std::cout << std::endl;
+  return keep;
+}
+
+bool way_cut_allowed(int way) {
+  return way <= 0 || way >= cacheWays || cutAllowed[way];
+}
+
+// Finds the order to lay out partitions in (packed from way 0) that keeps
+// the most ways, never cutting between coupled ways. keepPrefix[p][w] is how
+// much partition p keeps if it gets ways 0..w-1. Returns false if every order
+// cuts through coupled ways.
+static bool find_layout(const uint32_t *allocs, int numParts,
+                        const std::vector<std::vector<int> > &keepPrefix,
+                        std::vector<int> &order) {
+  order.clear();
+  if (numParts > MAX_LAYOUT_SEARCH_PARTS) {
+    int way = 0;
+    bool ok = true;
+    for (int p = 0; p < numParts; p++) {
+      order.push_back(p);
+      way += allocs[p];
+      ok = ok && way_cut_allowed(way);
+    }
+    return ok;
+  }
+
+  // Partitions are packed from way 0, so a set of partitions laid out first
+  // always spans the same ways, whatever their order. best[set] is the most
+  // ways kept by any valid order of set; last[set] its last partition.
+  uint32_t numSets = 1U << numParts;
+  std::vector<int> first(numSets, 0);
+  std::vector<int> best(numSets, -1);
+  std::vector<int> last(numSets, -1);
+  best[0] = 0;
+  for (uint32_t set = 0; set < numSets; set++) {
+    if (best[set] < 0)
+      continue;
+    for (int p = 0; p < numParts; p++) {
+      if (set & (1U << p))
+        continue;
+      uint32_t next = set | (1U << p);
+      int end = std::min(first[set] + (int) allocs[p], cacheWays);
+      if (!way_cut_allowed(end))
+        continue;
+      int kept = best[set] + keepPrefix[p][end] - keepPrefix[p][first[set]];
+      first[next] = end;
+      if (kept > best[next]) {
+        best[next] = kept;
+        last[next] = p;
+      }
+    }
+  }
+  if (best[numSets - 1] < 0)
+    return false;
+  for (uint32_t set = numSets - 1; set != 0; set &= ~(1U << last[set]))
+    order.push_back(last[set]);
+  std::reverse(order.begin(), order.end());
+  return true;
+}
+
+bool layout_partitions(const uint32_t *allocs, int numParts,
+                       const std::vector<std::vector<int> > &keep,
+                       std::stack<int> partitions[]) {
+  std::vector<std::vector<int> > keepPrefix(numParts);
+  for (int p = 0; p < numParts; p++) {
+    keepPrefix[p].assign(cacheWays + 1, 0);
+    for (int w = 0; w < cacheWays; w++) {
+      int k = (p < (int) keep.size()) ? keep[p][w] : 0;
+      keepPrefix[p][w + 1] = keepPrefix[p][w] + k;
+    }
+  }
+
+  std::vector<int> order;
+  bool ok = find_layout(allocs, numParts, keepPrefix, order);
+  if (!ok) {
+    log_printf("[ERROR] No layout of the allocations keeps the coupled ways "
+               "together: ");
+    print_allocations(const_cast<uint32_t *>(allocs), numParts);
+    order.clear();
+    for (int p = 0; p < numParts; p++)
+      order.push_back(p);
+  }
+
+  int way = 0;
+  for (int p : order) {
+    for (uint32_t i = 0; i < allocs[p] && way < cacheWays; i++)
+      partitions[p].push(way++);
+  }
+  return ok;
+}
+
+bool constrain_allocations(uint32_t *allocs, int numParts,
+                           const std::vector<std::vector<double> > &utility) {
+  std::vector<std::vector<int> > noKeep(numParts,
+                                        std::vector<int>(cacheWays + 1, 0));
+  std::vector<int> order;
+  if (find_layout(allocs, numParts, noKeep, order))
+    return true;
+  if (numParts > MAX_CONSTRAINED_SEARCH_PARTS)
+    return false;
+
+  // Exact search over sizes and order: best[set][w] is the highest utility
+  // of laying out the partitions in set over ways 0..w-1, every partition
+  // getting at least one way and no cut between coupled ways
+  int totalWays = 0;
+  for (int p = 0; p < numParts; p++)
+    totalWays += allocs[p];
+  totalWays = std::min(totalWays, cacheWays);
+  const double NONE = -std::numeric_limits<double>::infinity();
+  uint32_t numSets = 1U << numParts;
+  std::vector<std::vector<double> > best(
+      numSets, std::vector<double>(totalWays + 1, NONE));
+  std::vector<std::vector<std::pair<int, int> > > choice(
+      numSets, std::vector<std::pair<int, int> >(totalWays + 1));
+  best[0][0] = 0.0;
+  for (uint32_t set = 0; set < numSets; set++) {
+    int left = numParts - __builtin_popcount(set);
+    for (int w = 0; w < totalWays; w++) {
+      if (best[set][w] == NONE)
+        continue;
+      for (int p = 0; p < numParts; p++) {
+        if (set & (1U << p))
+          continue;
+        uint32_t next = set | (1U << p);
+        // Leave at least one way for each partition after p
+        for (int size = 1; w + size <= totalWays - (left - 1); size++) {
+          int end = w + size;
+          if (!way_cut_allowed(end))
+            continue;
+          double u = best[set][w] + utility[p][size - 1];
+          if (u > best[next][end]) {
+            best[next][end] = u;
+            choice[next][end] = std::make_pair(p, size);
+          }
+        }
+      }
+    }
+  }
+  if (best[numSets - 1][totalWays] == NONE)
+    return false;
+
+  for (uint32_t set = numSets - 1, w = totalWays; set != 0;) {
+    std::pair<int, int> c = choice[set][w];
+    allocs[c.first] = c.second;
+    set &= ~(1U << c.first);
+    w -= c.second;
+  }
+  if (enableLogging) {
+    log_printf(
+        "[INFO] Allocations changed to keep the coupled ways together: ");
+    print_allocations(allocs, numParts);
+  }
+  return true;
+}
+
+void print_allocations(uint32_t *allocs, int numParts) {
+  std::ostringstream ss;
+  for (int i = 0; i < numParts; i++) {
+    ss << allocs[i] << ", ";
+  }
+  ss << std::endl;
+  pipeline::log_write(ss.str());
 }
 
 void do_ucp_mrcs(arma::mat mpkiVsWays) {
   if (enableLogging)
-    printf("[INFO]  Inside do_ucp_mrcs()\n");
+    log_printf("[INFO]  Inside do_ucp_mrcs()\n");
   smoothenMRCs(mpkiVsWays);
 
   int numApps = mpkiVsWays.n_cols;
   std::stack<int> buckets;
-  for (int i = (CACHE_WAYS - 1); i >= 0; --i)
+  for (int i = (cacheWays - 1); i >= 0; --i)
     buckets.push(i);
-  std::stack<int> partitions[NUM_CORES];
+  std::stack<int> partitions[numApps];
   for (int a = 0; a < numApps; ++a) {
     partitions[a].push(buckets.top());
     buckets.pop();
@@ -269,153 +776,55 @@ void do_ucp_mrcs(arma::mat mpkiVsWays) {
       partitions[maxMuAppIdx].push(buckets.top());
       buckets.pop();
     }
-    std::cout << '\n';
+    log_printf("\n");
   }
 
-  // --- Workaround bug with COS 10,11 in Intel's CAT --- //
-  std::stack<int> appParts;
-  int victimId_b10, victimId_b11 = -1;
-  int victimPartSize_b10, victimPartSize_b11 = -1;
-  int buckID = -1;
-
+  // Only the way counts matter: lay them out as contiguous masks, keeping
+  // the platform's coupled ways together
+  uint32_t allocs[numApps];
+  std::vector<std::vector<double> > utility(numApps);
   for (int a = 0; a < numApps; ++a) {
-    appParts = partitions[a];
-    while (!appParts.empty()) {
-      buckID = appParts.top();
-      if (buckID == 10) {
-        victimId_b10 = a;
-        victimPartSize_b10 = partitions[a].size();
-      }
-      if (buckID == 11) {
-        victimId_b11 = a;
-        victimPartSize_b11 = partitions[a].size();
-      }
-      appParts.pop();
-    }
+    allocs[a] = partitions[a].size();
+    partitions[a] = std::stack<int>();
+    for (int w = 0; w < cacheWays; w++)
+      utility[a].push_back(-mpkiVsWays(w, a));
   }
-  if (victimId_b10 != victimId_b11) {
-    // We got a problem, workaround CAT bug
-    int swapMe = -1;
-    bool notFound = true;
-
-    // Swap with the other victim partition
-    if (victimPartSize_b10 > 1) {
-      appParts = partitions[victimId_b10]; //3,8,9,10
-      while (!partitions[victimId_b10].empty())
-        partitions[victimId_b10].pop();
-
-      while (!appParts.empty()) {
-        buckID = appParts.top();
-        if (buckID != 10 && notFound) {
-          swapMe = buckID;
-          notFound = false;
-          appParts.pop();
-        } else {
-          partitions[victimId_b10].push(buckID);
-          appParts.pop();
-        }
-      }
-      partitions[victimId_b10].push(11);
-      appParts = partitions[victimId_b11];
-      while (!partitions[victimId_b11].empty())
-        partitions[victimId_b11].pop();
-
-      while (!appParts.empty()) {
-        buckID = appParts.top();
-        if (buckID != 11) {
-          partitions[victimId_b11].push(buckID);
-        }
-        appParts.pop();
-      }
-      partitions[victimId_b11].push(swapMe);
-    } else if (victimPartSize_b11 > 1) {
-      // Safe to assume here that partition with 10 is single
-      appParts = partitions[victimId_b11]; //3,8,9,10
-      while (!partitions[victimId_b11].empty())
-        partitions[victimId_b11].pop();
-
-      while (!appParts.empty()) {
-        buckID = appParts.top();
-        if (buckID != 11 && notFound) {
-          swapMe = buckID;
-          notFound = false;
-          appParts.pop();
-        } else {
-          partitions[victimId_b11].push(buckID);
-          appParts.pop();
-        }
-      }
-      partitions[victimId_b11].push(10);
-      appParts = partitions[victimId_b10];
-      while (!partitions[victimId_b10].empty())
-        partitions[victimId_b10].pop();
-
-      while (!appParts.empty()) {
-        buckID = appParts.top();
-        if (buckID != 10) {
-          partitions[victimId_b10].push(buckID);
-        }
-        appParts.pop();
-      }
-      partitions[victimId_b10].push(swapMe);
-    } else { //10 in a single-buck partition, 11 in another single-buck
-             //partition ...
-
-      // Pick another victim partition with size > 2:
-      int swap1, swap2 = -1;
-      bool done = false;
-      for (int a = 0; a < numApps; ++a) {
-        if (a != victimId_b10 && a != victimId_b11 &&
-            partitions[a].size() >= 2) {
-          swap1 = partitions[a].top(); //get element1
-          partitions[a].pop();
-          swap2 = partitions[a].top(); //get element2
-          partitions[a].pop();
-
-          partitions[a].push(10);
-          partitions[a].push(11);
-
-          partitions[victimId_b10].pop();
-          partitions[victimId_b10].push(swap1);
-
-          partitions[victimId_b11].pop();
-          partitions[victimId_b11].push(swap2);
-          done = true;
-        }
-
-        if (done)
-          break;
-      }
-    }
+  if (!constrain_allocations(allocs, numApps, utility) ||
+      !layout_partitions(allocs, numApps, last_plan_keep_ways(numApps),
+                         partitions)) {
+    log_printf("[ERROR] No layout keeps the coupled ways together, keeping "
+               "the previous partitions\n");
+    return;
   }
 
-  apply_partition_plan(partitions);
+  apply_partition_plan(partitions, numApps);
 
   if (enableLogging)
-    printf("\n ------------- Cache assignments --------------  \n");
+    log_printf("\n ------------- Cache assignments --------------  \n");
 
+  std::ostringstream ss;
   for (int a = 0; a < numApps; ++a) {
     std::stack<int> appPartitions = partitions[a];
     while (!appPartitions.empty()) {
-      std::cout << ' ' << appPartitions.top();
+      ss << ' ' << appPartitions.top();
       appPartitions.pop();
     }
-    std::cout << '\n';
+    ss << '\n';
   }
+  pipeline::log_write(ss.str());
 }
 
 void do_ucp_ipcs(arma::mat ipcVsWays) {
   if (enableLogging)
-    printf("[INFO]  Inside do_ucp_ipcs()\n");
+    log_printf("[INFO]  Inside do_ucp_ipcs()\n");
 
   smoothenIPCs(ipcVsWays);
   int numApps = ipcVsWays.n_cols;
   std::stack<int> buckets;
-  for (int i = (CACHE_WAYS - 1); i >= 0; --i)
+  for (int i = (cacheWays - 1); i >= 0; --i)
     buckets.push(i);
 
-  std::stack<int> partitions[NUM_CORES];
-  std::stack<int> partitionsFixed[NUM_CORES];
+  std::stack<int> partitions[numApps];
 
   for (int a = 0; a < numApps; ++a) {
     partitions[a].push(buckets.top());
@@ -449,275 +858,53 @@ void do_ucp_ipcs(arma::mat ipcVsWays) {
       partitions[maxMuAppIdx].push(buckets.top());
       buckets.pop();
     }
-    std::cout << '\n';
+    log_printf("\n");
   }
 
-  // --- Workaround bug with COS 10,11 in Intel's CAT --- //
-  std::stack<int> appParts;
-  int victimId_b10, victimId_b11 = -1;
-  int victimPartSize_b10, victimPartSize_b11 = -1;
-  int buckID = -1;
-
+  // Only the way counts matter: lay them out as contiguous masks, keeping
+  // the platform's coupled ways together
+  uint32_t allocs[numApps];
+  std::vector<std::vector<double> > utility(numApps);
   for (int a = 0; a < numApps; ++a) {
-    appParts = partitions[a];
-    while (!appParts.empty()) {
-      buckID = appParts.top();
-      if (buckID == 10) {
-        victimId_b10 = a;
-        victimPartSize_b10 = partitions[a].size();
-      }
-      if (buckID == 11) {
-        victimId_b11 = a;
-        victimPartSize_b11 = partitions[a].size();
-      }
-      appParts.pop();
-    }
+    allocs[a] = partitions[a].size();
+    partitions[a] = std::stack<int>();
+    for (int w = 0; w < cacheWays; w++)
+      utility[a].push_back(ipcVsWays(w, a));
   }
-
-  if (victimId_b10 != victimId_b11) {
-    // We got a problem, workaround CAT bug
-    int swapMe = -1;
-    bool notFound = true;
-
-    // Swap with the other victim partition
-    if (victimPartSize_b10 > 1) {
-      appParts = partitions[victimId_b10]; //3,8,9,10
-      while (!partitions[victimId_b10].empty())
-        partitions[victimId_b10].pop();
-
-      while (!appParts.empty()) {
-        buckID = appParts.top();
-        if (buckID != 10 && notFound) {
-          swapMe = buckID;
-          notFound = false;
-          appParts.pop();
-        } else {
-          partitions[victimId_b10].push(buckID);
-          appParts.pop();
-        }
-      }
-      partitions[victimId_b10].push(11);
-      appParts = partitions[victimId_b11];
-      while (!partitions[victimId_b11].empty())
-        partitions[victimId_b11].pop();
-
-      while (!appParts.empty()) {
-        buckID = appParts.top();
-        if (buckID != 11) {
-          partitions[victimId_b11].push(buckID);
-        }
-        appParts.pop();
-      }
-      partitions[victimId_b11].push(swapMe);
-    } else if (victimPartSize_b11 > 1) {
-      // Safe to assume here that partition with 10 is single
-      appParts = partitions[victimId_b11]; //3,8,9,10
-      while (!partitions[victimId_b11].empty())
-        partitions[victimId_b11].pop();
-
-      while (!appParts.empty()) {
-        buckID = appParts.top();
-        if (buckID != 11 && notFound) {
-          swapMe = buckID;
-          notFound = false;
-          appParts.pop();
-        } else {
-          partitions[victimId_b11].push(buckID);
-          appParts.pop();
-        }
-      }
-      partitions[victimId_b11].push(10);
-      appParts = partitions[victimId_b10];
-      while (!partitions[victimId_b10].empty())
-        partitions[victimId_b10].pop();
-
-      while (!appParts.empty()) {
-        buckID = appParts.top();
-        if (buckID != 10) {
-          partitions[victimId_b10].push(buckID);
-        }
-        appParts.pop();
-      }
-      partitions[victimId_b10].push(swapMe);
-    } else { //10 in a single-buck partition, 11 in another single-buck
-             //partition ...
-
-      // Pick another victim partition with size > 2:
-      int swap1, swap2 = -1;
-      bool done = false;
-      for (int a = 0; a < numApps; ++a) {
-        if (a != victimId_b10 && a != victimId_b11 &&
-            partitions[a].size() >= 2) {
-          swap1 = partitions[a].top(); //get element1
-          partitions[a].pop();
-          swap2 = partitions[a].top(); //get element2
-          partitions[a].pop();
-
-          partitions[a].push(10);
-          partitions[a].push(11);
-
-          partitions[victimId_b10].pop();
-          partitions[victimId_b10].push(swap1);
-
-          partitions[victimId_b11].pop();
-          partitions[victimId_b11].push(swap2);
-          done = true;
-        }
-
-        if (done)
-          break;
-      }
-    }
+  if (!constrain_allocations(allocs, numApps, utility) ||
+      !layout_partitions(allocs, numApps, last_plan_keep_ways(numApps),
+                         partitions)) {
+    log_printf("[ERROR] No layout keeps the coupled ways together, keeping "
+               "the previous partitions\n");
+    return;
   }
 
-  apply_partition_plan(partitions);
+  apply_partition_plan(partitions, numApps);
 
-  printf("\n [INFO] ------------- Cache assignments --------------  \n");
+  log_printf("\n [INFO] ------------- Cache assignments --------------  \n");
+  std::ostringstream ss;
   for (int a = 0; a < numApps; ++a) {
     std::stack<int> appPartitions = partitions[a];
     while (!appPartitions.empty()) {
-      std::cout << ' ' << appPartitions.top();
+      ss << ' ' << appPartitions.top();
       appPartitions.pop();
     }
-    std::cout << '\n';
+    ss << '\n';
   }
+  pipeline::log_write(ss.str());
 
 }
 
 std::string get_cacheways_for_core(int coreIdx) {
-  std::string getCOSstring =
-      "../lltools/build/cat_cbm -g -c " +
-      std::to_string(coreIdx); //Assumption: coreIdx = COS idx
-  int sts = system(getCOSstring.c_str());
+  //Assumption: coreIdx = COS idx
+  std::string waysString =
+      rdt::cbm_to_string(get_rdt_backend()->getCbm(coreIdx));
   if (enableLogging) {
-    printf("[INFO] Inside getCacheWays(). Get ways, status= %d \n", sts);
+    log_printf("[INFO] Inside getCacheWays(). COS %d ways = %s \n", coreIdx,
+               waysString.c_str());
   }
 
-  return getCOSstring;
-}
-
-// --- Workaround bug with COS 10,11 in Intel's CAT --- //
-//void verify_intel_cos_issue(std::stack<int> [] & cluster_partitions, uint32_t
-//K){
-void verify_intel_cos_issue(std::stack<int> *cluster_partitions, uint32_t K) {
-  std::stack<int> clustParts;
-  int victimId_b10 = -1;
-  int victimId_b11 = -1;
-  int victimPartSize_b10 = -1;
-  int victimPartSize_b11 = -1;
-  int buckID = -1;
-  int myK = (int) K;
-  for (int a = 0; a < myK; ++a) {
-    clustParts = cluster_partitions[a];
-    while (!clustParts.empty()) {
-      buckID = clustParts.top();
-      if (buckID == 10) {
-        victimId_b10 = a;
-        victimPartSize_b10 = cluster_partitions[a].size();
-      }
-      if (buckID == 11) {
-        victimId_b11 = a;
-        victimPartSize_b11 = cluster_partitions[a].size();
-      }
-      clustParts.pop();
-    }
-  }
-
-  if (victimId_b10 != victimId_b11) {
-    // We got a problem, workaround CAT bug
-    int swapMe = -1;
-    bool notFound = true;
-
-    // Swap with the other victim partition
-    if (victimPartSize_b10 > 1) {
-      clustParts = cluster_partitions[victimId_b10]; //3,8,9,10
-      while (!cluster_partitions[victimId_b10].empty())
-        cluster_partitions[victimId_b10].pop();
-
-      while (!clustParts.empty()) {
-        buckID = clustParts.top();
-        if (buckID != 10 && notFound) {
-          swapMe = buckID;
-          notFound = false;
-          clustParts.pop();
-        } else {
-          cluster_partitions[victimId_b10].push(buckID);
-          clustParts.pop();
-        }
-      }
-      cluster_partitions[victimId_b10].push(11);
-      clustParts = cluster_partitions[victimId_b11];
-      while (!cluster_partitions[victimId_b11].empty())
-        cluster_partitions[victimId_b11].pop();
-
-      while (!clustParts.empty()) {
-        buckID = clustParts.top();
-        if (buckID != 11) {
-          cluster_partitions[victimId_b11].push(buckID);
-        }
-        clustParts.pop();
-      }
-      cluster_partitions[victimId_b11].push(swapMe);
-    } else if (victimPartSize_b11 > 1) {
-      // Safe to assume here that partition with 10 is single
-      clustParts = cluster_partitions[victimId_b11]; //3,8,9,10
-      while (!cluster_partitions[victimId_b11].empty())
-        cluster_partitions[victimId_b11].pop();
-
-      while (!clustParts.empty()) {
-        buckID = clustParts.top();
-        if (buckID != 11 && notFound) {
-          swapMe = buckID;
-          notFound = false;
-          clustParts.pop();
-        } else {
-          cluster_partitions[victimId_b11].push(buckID);
-          clustParts.pop();
-        }
-      }
-      cluster_partitions[victimId_b11].push(10);
-      clustParts = cluster_partitions[victimId_b10];
-      while (!cluster_partitions[victimId_b10].empty())
-        cluster_partitions[victimId_b10].pop();
-
-      while (!clustParts.empty()) {
-        buckID = clustParts.top();
-        if (buckID != 10) {
-          cluster_partitions[victimId_b10].push(buckID);
-        }
-        clustParts.pop();
-      }
-      cluster_partitions[victimId_b10].push(swapMe);
-    } else { //10 in a single-buck partition, 11 in another single-buck
-             //partition ...
-             // Pick another victim partition with size > 2:
-      int swap1, swap2 = -1;
-      bool done = false;
-      for (int a = 0; a < myK; ++a) {
-        if (a != victimId_b10 && a != victimId_b11 &&
-            cluster_partitions[a].size() >= 2) {
-          swap1 = cluster_partitions[a].top(); //get element1
-          cluster_partitions[a].pop();
-          swap2 = cluster_partitions[a].top(); //get element2
-          cluster_partitions[a].pop();
-
-          cluster_partitions[a].push(10);
-          cluster_partitions[a].push(11);
-
-          cluster_partitions[victimId_b10].pop();
-          cluster_partitions[victimId_b10].push(swap1);
-
-          cluster_partitions[victimId_b11].pop();
-          cluster_partitions[victimId_b11].push(swap2);
-          done = true;
-        }
-
-        if (done)
-          break;
-      }
-    }
-  }
-  //return cluster_partitions;
+  return waysString;
 }
 
 } // namespace cache_utils
@@ -34,6 +34,7 @@
 #include <sstream>
 #include <stack>
 #include "kpart.h"
+#include "rdt/rdt_backend.h"
 #include <armadillo>
 using namespace arma;
 #ifdef USE_CMT
@@ -42,14 +43,92 @@ using namespace arma;
 
 namespace cache_utils {
 
+// Allocation backend that programs every partitioning plan below. Must be
+// initialized once, before any of the functions that change cache ways.
+void init_rdt_backend();
+
+rdt::RdtBackend *get_rdt_backend();
+
+// Mask of every way of the cache, the one COS 0 always keeps
+uint32_t full_cbm();
+
+void print_apply_latency(const char *name);
+
 // Cache sharing-partitioning utility functions, used heavily by KPart
 int share_all_cache_ways();
 
 std::string get_cacheways_for_core(int coreIdx);
 
-void print_allocations(uint32_t *allocs);
+void print_allocations(uint32_t *allocs, int numParts);
+
+// Cores each app runs on; app a runs on core a unless told otherwise. An app
+// given no cores (e.g., a daemon-mode slot without a workload) runs on none.
+void set_app_cores(const std::vector<std::vector<int> > &cores);
+std::vector<int> app_cores(int app);
+
+// COSes available to partitions, i.e., the most clusters a plan can have
+int get_num_partition_cos();
+
+// COS 1..num are set aside for profiling slices, out of the pool's reach, so
+// that profiling never changes COS 0 (the default class of every core KPart
+// does not manage) nor a cluster's COS. init_rdt_backend() reserves
+// PROFILING_COS_DEFAULT of them; reserve more before the first partitioning
+// plan.
+void reserve_profiling_cos(int num);
+int get_num_profiling_cos();
+// i-th COS reserved for profiling
+inline int profiling_cos(int i) { return 1 + i; }
+
+// Programs the ways of apps 0..numApps-1. Apps with the same allocation share
+// a COS (see rdt::CosPool), and every app's cores are mapped to its COS. Apps
+// with no ways in partitions are left alone, save for cores the last plan
+// mapped to a COS of the pool, which go back to COS 0 before the pool hands
+// that COS to another cluster.
+// codePartitions, if given, holds each app's code ways (CDP only); otherwise
+// the code masks follow the data masks. bwPercents, if given, holds each
+// app's memory bandwidth cap (MBA only). Returns the number of ways the apps
+// gained over the last partitioning plan, i.e., the ways whose lines they
+// must warm up again.
+int apply_partition_plan(std::stack<int> partitions[], int numApps,
+                         std::stack<int> codePartitions[] = nullptr,
+                         const int *bwPercents = nullptr);
+
+// Maps cores back to COS 0, which shares the whole cache, e.g. once the app
+// that ran on them is gone
+void release_cores(const std::vector<int> &cores);
 
-void apply_partition_plan(std::stack<int> partitions[]);
+// Data (or code) mask of app's last partitioning plan; all ways before the
+// first one.
+uint32_t last_partition_cbm(int app, bool code);
+
+// Exhaustive layout search covers up to this many partitions; beyond it,
+// partitions are laid out in index order
+const int MAX_LAYOUT_SEARCH_PARTS = 16;
+// Largest number of partitions constrain_allocations() resizes
+const int MAX_CONSTRAINED_SEARCH_PARTS = 12;
+
+// Whether a partition may end right before way `way`: false if a platform
+// quirk couples it to the way below (see rdt/quirks.h)
+bool way_cut_allowed(int way);
+
+// Makes allocs (ways per partition) admit a contiguous layout that keeps
+// every group of coupled ways in one partition. If they do not already, the
+// sizes are chosen anew to maximize the total utility under that constraint,
+// where utility[p][w-1] is partition p's utility with w ways. Returns false
+// if that is impossible.
+bool constrain_allocations(uint32_t *allocs, int numParts,
+                           const std::vector<std::vector<double> > &utility);
+
+// Lays out numParts partitions of allocs[p] ways each as contiguous masks,
+// packed from way 0, in the order that keeps the most of the ways they held
+// before, so that repartitioning throws away as few warm lines as possible.
+// No partition boundary falls between coupled ways. keep[p][w] weighs
+// partition p keeping way w (e.g., how many of its apps held it); empty if
+// there is no history. Fills partitions[p] with its ways; returns false if
+// coupled ways had to be split (run constrain_allocations() first).
+bool layout_partitions(const uint32_t *allocs, int numParts,
+                       const std::vector<std::vector<int> > &keep,
+                       std::stack<int> partitions[]);
 
 void do_ucp_mrcs(arma::mat mpkiVsWays);
 
@@ -64,12 +143,24 @@ std::vector<std::vector<double> > get_wscurves_for_combinedmrcs(
         cluster_bucks,
     arma::mat ipcVsWays);
 
+// Peak memory bandwidth (bytes per core cycle) and unloaded miss penalty
+// (cycles) that allocate_ways_and_bandwidth() predicts with
+void set_memory_model(double bwBytesPerCycle, double missPenaltyCycles);
+
+// Chooses a memory bandwidth cap (in percent of peak, a multiple of bwGran)
+// for each of the K clusters and, if moveWays, rebalances the ways in allocs
+// too, by local search on the weighted speedup predicted from every app's
+// IPC and MPKI curves (i.e., its measured memory bandwidth at each
+// allocation). allocs only changes if the moved ways predict better than
+// allocs does under the chosen caps. Returns the predicted weighted speedup.
+double allocate_ways_and_bandwidth(
+    std::vector<std::vector<std::vector<std::pair<uint32_t, uint32_t> > > >
+        cluster_bucks,
+    arma::mat ipcVsWays, arma::mat mpkiVsWays, uint32_t *allocs,
+    int *bwPercents, uint32_t K, int bwGran, bool moveWays);
+
 void smoothenIPCs(arma::mat &ipcVsWays);
 
 void smoothenMRCs(arma::mat &mpkiVsWays);
 
-//void verify_intel_cos_issue(std::stack<int> [] & cluster_partitions, uint32_t
-//K);
-void verify_intel_cos_issue(std::stack<int> *cluster_partitions, uint32_t K);
-
 } // namespace cache_utils
@@ -334,9 +334,7 @@ HCluster::cluster(std::vector<std::vector<RawMissCurve> > curves, uint32_t K) {
     delete node;
   }
 
-  for (uint32_t i = 0; i < numCurves; i++) {
-    results.item_to_clusts[i] = itemClusters[i];
-  }
+  results.item_to_clusts.assign(&itemClusters[0], &itemClusters[numCurves]);
 
   results.cluster_curves = clusterCurves;
   results.cluster_buckets = clustersBucksAll;
@@ -540,11 +538,8 @@ HCluster::clusterAuto(std::vector<std::vector<RawMissCurve> > curves) {
     // Info available here:
     // itemClusters[appIdx] => which cluster is this app member of?
     // clusterCurves[cid] => combined curve of this cluster ID
-    for (uint32_t i = 0; i < numCurves; i++) {
-      results.item_to_clusts[i] = itemClusters[i];
-    }
-
-    //results.item_to_clusts = itemClusters; //error
+    results.item_to_clusts.assign(&itemClusters[0],
+                                  &itemClusters[numCurves]);
     results.cluster_curves = clusterCurves;
     results.cluster_buckets = clustersBucksAll;
 
@@ -87,7 +87,7 @@ public:
         numChildren; // number of original observations in the newly formed node
   };
   struct results_pack {
-    int item_to_clusts[8]; //map item to cluster ID
+    std::vector<int> item_to_clusts; //map item to cluster ID
     std::vector<std::vector<RawMissCurve> > cluster_curves;
     std::vector<std::vector<std::vector<std::pair<uint32_t, uint32_t> > > >
         cluster_buckets;
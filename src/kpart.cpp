@@ -35,6 +35,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <strings.h>
 #include <stdarg.h>
 #include <signal.h>
 #include <sys/wait.h>
@@ -45,7 +46,10 @@
 #include <sys/prctl.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
-#include <sys/ptrace.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/syscall.h>
 #include <sched.h>
 #include <limits>
 #include <string>
@@ -55,42 +59,86 @@
 #include <fstream>
 #include <sstream>
 #include <stack>
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <mutex>
+#include <thread>
 #include "cache_utils.h"
 using namespace cache_utils;
+#include "sysconfig.h"
+#include "phase_log.h"
+#include "rdt/cmt_sampler.h"
+#include "rdt/id_pools.h"
+#include "rdt/resctrl_backend.h"
+#include "pipeline/async_log.h"
+#include "pipeline/signal_pump.h"
+#include "pipeline/work_queue.h"
+#include "pmu/group_reader.h"
+#include "pmu/miss_source.h"
+#include "profiling/plan_generator.h"
+#include "profiling/sweep_scheduler.h"
+#include "sim/sim_platform.h"
 #include "cluster/hill_climb.h"
 #include "cluster/whirlpool.h"
 #include "cluster/hcluster.h"
 #include "cluster/armadillo.h"
 using namespace arma;
+using pipeline::log_printf;
 
 extern "C" {
 #include "perf_util.h"
 }
 
-#ifdef USE_CMT
-#include "cmt.h"
-#endif
-
 //Monitoring and profiling variables
 bool monitorStartFlag(false);
 bool doMorePartitioning(true);
 int monitorLen = 1; //estimate MRC IPC point every monitorLen phases
 int sampleSlicesIdx = -1;
+struct timeval sliceStart; // when the current profiling slice was applied
 uint32_t K =
     2; // Default number of clusters is 2, but changes in Kauto calculations
 int numSamplesBeforePartitioning = 1;
 bool firstInvokation = true;
 int numSamples = 0;
 int numProcesses = 0; //updated dynamically when processes are launched
+// Set by --daemon: KPart attaches to running workloads instead of launching
+// processes (see run_daemon())
+bool daemonMode = false;
+std::string controlFifo;
+std::vector<std::string> daemonSpecs; // initial workloads
+
+// What ends a phase, set by KPART_PHASE_DRIVER: every phaseLen instructions
+// (the default) or cycles, through the overflow of that event, or every
+// phaseLen ns of wall-clock time, when a timer samples all processes at once.
+// Instructions and cycles are events 0 and 2 (see read_counters()).
+enum PhaseDriver { PHASE_INSTRUCTIONS, PHASE_CYCLES, PHASE_TIME };
+PhaseDriver phaseDriver = PHASE_INSTRUCTIONS;
+int phaseEvent = 0; // the event whose overflow ends a phase
 int procIdxProfiled_global =
     0;                //starts with process 0, up to (computed) numProcesses
 
+// Sized by generate_profiling_plan(), once the platform is known
 int numWaysToSample = 7;
-arma::cube allAppsCacheAssignments(2, CACHE_WAYS, numWaysToSample, fill::zeros);
-arma::mat currentlySampling = zeros<arma::mat>(NUM_CORES, 2);
-arma::mat sampledMRCs = zeros<arma::mat>(CACHE_WAYS, NUM_CORES);
-arma::mat sampledIPCs = zeros<arma::mat>(CACHE_WAYS, NUM_CORES);
-arma::vec loggingMRCFlags = zeros<arma::vec>(NUM_CORES);
+arma::cube allAppsCacheAssignments;
+arma::mat currentlySampling;
+arma::mat sampledMRCs;
+arma::mat sampledIPCs;
+arma::vec loggingMRCFlags;
+
+// Set by KPART_PROFILE_GROUPS: how many processes a profiling episode may
+// profile at once, each in a COS of its own (see start_sweep()). With 1, the
+// default, they are profiled one at a time, through allAppsCacheAssignments.
+int profileGroups = 1;
+std::vector<int> sampleSizes; // way counts each process is sampled at
+std::vector<profiling::SweepScheduler::Slice> sweepSlices;
+std::vector<int> sweepApps;        // pidx of each app of sweepSlices
+std::vector<int> sweepSamplesLeft; // per app of sweepSlices
+
+// With CDP on, every process is profiled twice: first its data ways vary while
+// code may use the whole cache, then (profilingCode) the other way around.
+bool profilingCode(false);
+arma::mat sampledCodeIPCs;
 
 // Will be set according to user input:
 int invokeMonitorLen = -1; //Skip this much instructions before invoking DynaWay
@@ -105,60 +153,134 @@ int profileInterval = -1;
 
 const int SIGSAGE = SIGRTMIN + 1;
 
+// pidfd_open(2), which glibc only wraps in recent versions; fails with ENOSYS
+// if the kernel headers predate it
+static int open_pidfd(pid_t pid) {
+#ifdef SYS_pidfd_open
+  return syscall(SYS_pidfd_open, pid, 0);
+#else
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
 struct ProcessInfo {
   int pid;
   int pidx; // Process indices in order specified on cmd line
   std::string input;
   std::vector<int> cores;
   perf_event_desc_t *fds;
+  // Counter groups, with a reader for each (see read_counters()). Processes
+  // have one group; cgroups one per CPU of their cpuset, as cgroup events
+  // count on a single CPU. fds is groups[0].
+  std::vector<perf_event_desc_t *> groups;
+  std::vector<std::shared_ptr<pmu::GroupReader> > readers;
   int numPhases;
   int maxPhases;
   std::vector<char *> args;
+  // Counts so far, with every phase's share scaled up for the time the group
+  // was multiplexed out during it (see set_counters())
   std::vector<uint64_t> values;
+  std::vector<uint64_t> rawValues; // as read, cumulative
+  // Time the event group was enabled and actually counting, in ns, as of the
+  // last read of values
+  uint64_t timeEnabled;
+  uint64_t timeRunning;
+  double runningRatio; // of the last phase: 1 unless multiplexed, 0 if the
+                       // counters did not run at all
+  int muxRetries; // profiling samples retried in a row (MUX_MAX_RETRIES)
+  int numLowConfidence; // profiling samples retried in total
   FILE *logFd;
+  // With KPART_LOG_FORMAT=binary, phases are logged to phaseLog instead of
+  // logFd; shared by copies of the ProcessInfo, and flushed when the last one
+  // goes away
+  std::shared_ptr<PhaseLogWriter> phaseLog;
+
+  // Daemon mode (see attach_workload()): spec is "pid:<pid>" or
+  // "cgroup:<dir>", and cgroup the directory of a cgroup workload. Slots
+  // whose workload is gone are inactive until the next workload takes them
+  // over, with a new generation.
+  bool launched; // forked by profile(), and killed along with KPart
+  bool active;
+  uint64_t generation;
+  std::string spec;
+  std::string cgroup;
+  int pidFd; // tells when the process exits; -1 if none
+  bool profiled; // has curves in sampledMRCs/sampledIPCs
 
   FILE *mrcfd;
   FILE *ipcfd;
 
   uint64_t lastInstrCtr;
   uint64_t lastCyclesCtr;
-  uint64_t lastMemTrafficCtr;
+  double lastMissCtr; // see missSource
+  uint64_t lastTimeEnabled;
+  uint64_t lastTimeRunning;
 
   arma::vec xPoints = arma::linspace<arma::vec>(0, 0, numWaysToSample);
   arma::vec yPoints_ipc = arma::linspace<arma::vec>(0, 0, numWaysToSample);
   arma::vec yPoints_mpki = arma::linspace<arma::vec>(0, 0, numWaysToSample);
+  // Confidence of each point: the share of its sample the counters ran
+  arma::vec yPoints_conf = arma::linspace<arma::vec>(0, 0, numWaysToSample);
+
+  arma::vec mrcEstAvg = zeros<arma::vec>(cacheWays);
+  arma::mat mrcEstimates = zeros<arma::mat>(cacheWays, EST_HISTORY_LENGTH);
 
-  arma::vec mrcEstAvg = zeros<arma::vec>(CACHE_WAYS);
-  arma::mat mrcEstimates = zeros<arma::mat>(CACHE_WAYS, 1000);
+  arma::vec ipcCurveAvg = zeros<arma::vec>(cacheWays);
+  arma::mat ipcCurveEstimates = zeros<arma::mat>(cacheWays, EST_HISTORY_LENGTH);
 
-  arma::vec ipcCurveAvg = zeros<arma::vec>(CACHE_WAYS);
-  arma::mat ipcCurveEstimates = zeros<arma::mat>(CACHE_WAYS, 1000);
+  // IPC vs. code ways (CDP only)
+  arma::vec codeIpcCurveAvg = zeros<arma::vec>(cacheWays);
+  arma::mat codeIpcCurveEstimates =
+      zeros<arma::mat>(cacheWays, EST_HISTORY_LENGTH);
 
+  // Episodes estimated so far; episode n is in column est_col(n)
   int mrcEstIndex;
+  int codeEstIndex;
   int pSampleSlicesIdx;
 
 #ifdef USE_CMT
-  int rmid;
+  int rmid; // -1 while the process waits for an RMID (see rmidPool)
+  uint64_t rmidFirstSweep; // first CMT sweep that counts for rmid
 
-  int64_t memTrafficLast;
+  // Traffic counted under earlier RMIDs; memTrafficTotal keeps growing
+  // across RMID changes and stands still while the process is unmonitored
+  int64_t memTrafficBase;
   int64_t memTrafficTotal;
+  // Same for total (local and remote) traffic
+  int64_t totalTrafficBase;
+  int64_t totalTraffic;
 
   int64_t avgCacheOccupancy;
 #endif
 
   ProcessInfo()
       : pid(-1), pidx(-1), fds(nullptr), numPhases(0), maxPhases(-1),
-        logFd(nullptr), mrcfd(nullptr), ipcfd(nullptr), lastInstrCtr(0),
-        lastCyclesCtr(0), lastMemTrafficCtr(0), mrcEstIndex(0),
+        timeEnabled(0), timeRunning(0), runningRatio(1.0), muxRetries(0),
+        numLowConfidence(0), logFd(nullptr), launched(false),
+        active(true), generation(0), pidFd(-1), profiled(false),
+        mrcfd(nullptr),
+        ipcfd(nullptr), lastInstrCtr(0), lastCyclesCtr(0),
+        lastMissCtr(0), lastTimeEnabled(0), lastTimeRunning(0),
+        mrcEstIndex(0), codeEstIndex(0),
         pSampleSlicesIdx(0)
 #ifdef USE_CMT
         ,
-        rmid(-1), memTrafficLast(0), memTrafficTotal(0), avgCacheOccupancy(0)
+        rmid(-1), rmidFirstSweep(0), memTrafficBase(0), memTrafficTotal(0),
+        totalTrafficBase(0), totalTraffic(0),
+        avgCacheOccupancy(0)
 #endif
         {
   }
 
   void flush() {
+    if (phaseLog) {
+      try {
+        phaseLog->flush();
+      } catch (PhaseLogException &e) {
+        warnx("%s", e.what());
+      }
+    }
     fflush(logFd);
     fflush(mrcfd);
     fflush(ipcfd);
@@ -168,48 +290,106 @@ struct ProcessInfo {
 
 };
 
+std::vector<ProcessInfo> processInfo;
+
 #ifdef USE_CMT
 
-CMTController cmtCtrl;
 std::string lmbName = "LOCAL_MEM_TRAFFIC";
 std::string l3OccupName = "L3_OCCUPANCY";
 
-void updateMemTraffic(ProcessInfo &pinfo) {
-  int64_t memTraffic = cmtCtrl.getLocalMemTraffic(pinfo.rmid);
+// Sweeps the RMIDs of all processes in the background, so that reading
+// counters at phase boundaries never touches an MSR or resctrl file
+rdt::CmtSampler *cmtSampler = nullptr;
+
+// Processes get RMIDs from a pool, indexed by pidx. With more processes than
+// RMIDs they take turns being monitored, every RMID_ROTATION_MS; the processes
+// being profiled always are, as their MPKI comes from their memory traffic.
+rdt::RmidPool *rmidPool = nullptr;
+struct timeval lastRmidRotation;
+std::vector<int> rmidPinnedProcs;
+
+void updateCmtCounters(ProcessInfo &pinfo) {
+  rdt::CmtSampler::Snapshot snap;
+  if (pinfo.rmid < 0 || !cmtSampler->getSnapshot(pinfo.rmid, snap) ||
+      snap.sweep < pinfo.rmidFirstSweep)
+    return; // not sampled yet; keep the previous values
+
+  // Already 64-bit and wrap-corrected, counted from when rmid was bound
+  pinfo.memTrafficTotal = pinfo.memTrafficBase + snap.localMemTraffic;
+  pinfo.totalTraffic = pinfo.totalTrafficBase + snap.totalMemTraffic;
+  pinfo.avgCacheOccupancy = snap.llcOccupancy;
+}
 
-  if (memTraffic < pinfo.memTrafficLast) {
-    pinfo.memTrafficTotal += (cmtCtrl.getMemTrafficMax() - pinfo.memTrafficLast);
-    pinfo.memTrafficTotal += memTraffic;
-  } else {
-    pinfo.memTrafficTotal += (memTraffic - pinfo.memTrafficLast);
+// Applies the pool's RMID changes to the processes, the backend and the
+// sampler. preempt lets waiting processes take their turn (see
+// rdt::RmidPool::rotate).
+void rotate_rmids(bool preempt) {
+  // Released RMIDs stay in the sampler, which tracks how they cool down
+  auto occupancy = [](uint32_t rmid) -> int64_t {
+    rdt::CmtSampler::Snapshot snap;
+    return cmtSampler->getSnapshot(rmid, snap) ? snap.llcOccupancy : 0;
+  };
+  gettimeofday(&lastRmidRotation, 0);
+
+  for (const rdt::RmidPool::Change &c : rmidPool->rotate(occupancy, preempt)) {
+    ProcessInfo &pinfo = processInfo[c.workload];
+    if (c.oldRmid >= 0) {
+      get_rdt_backend()->unbindRmid(c.oldRmid);
+      pinfo.memTrafficBase = pinfo.memTrafficTotal;
+      pinfo.totalTrafficBase = pinfo.totalTraffic;
+    }
+    if (c.newRmid >= 0) {
+      get_rdt_backend()->bindRmid(c.newRmid, pinfo.pid, pinfo.cores,
+                                  pinfo.cgroup);
+      // Re-adding restarts the RMID's counts from its next sweep
+      cmtSampler->removeRmid(c.newRmid);
+      cmtSampler->addRmid(c.newRmid);
+      pinfo.rmidFirstSweep = cmtSampler->getNumSweeps() + 2;
+    }
+    pinfo.rmid = c.newRmid;
+    if (enableLogging)
+      log_printf("[INFO] PROC %d: RMID %d -> %d\n", pinfo.pidx, c.oldRmid,
+                 c.newRmid);
   }
-
-  pinfo.memTrafficLast = memTraffic;
 }
 
-void updateCacheOccupancy(ProcessInfo &pinfo) {
-  pinfo.avgCacheOccupancy = cmtCtrl.getLlcOccupancy(pinfo.rmid);
+// Makes sure the processes being profiled are monitored
+void monitor_profiled_processes(const std::vector<int> &pidxs) {
+  if (pidxs == rmidPinnedProcs)
+    return;
+  for (int pidx : rmidPinnedProcs)
+    rmidPool->setPinned(pidx, false);
+  bool unmonitored = false;
+  for (int pidx : pidxs) {
+    rmidPool->setPinned(pidx, true);
+    unmonitored = unmonitored || rmidPool->getRmid(pidx) < 0;
+  }
+  rmidPinnedProcs = pidxs;
+  if (unmonitored)
+    rotate_rmids(true);
 }
 
 void initCmt(ProcessInfo &pinfo) {
-  for (int c : pinfo.cores) {
-    cmtCtrl.setRmid(c, pinfo.rmid);
-  }
-
-  pinfo.memTrafficLast = cmtCtrl.getLocalMemTraffic(pinfo.rmid);
+  pinfo.memTrafficBase = 0;
   pinfo.memTrafficTotal = 0;
+  pinfo.totalTrafficBase = 0;
+  pinfo.totalTraffic = 0;
   pinfo.avgCacheOccupancy = 0;
+
+  rmidPool->addWorkload(pinfo.pidx);
+  rotate_rmids(false);
+  if (pinfo.rmid < 0)
+    log_printf("[INFO] PROC %d waits for an RMID (%d processes waiting)\n",
+               pinfo.pidx, rmidPool->getNumWaiting());
 }
 
 #endif
 
-std::vector<ProcessInfo> processInfo;
-
-int activeProcs = 0;
+std::atomic<int> activeProcs(0);
 int numEvents = 0;
 char *events = nullptr;
 int64_t phaseLen = -1;
-bool inRoi = false;
+std::atomic<bool> inRoi(false);
 
 perf_event_desc_t *globFds;
 
@@ -217,61 +397,332 @@ bool pinProcesses = true;
 
 std::string logFile;
 bool prettyPrint;
+bool binaryLog; // KPART_LOG_FORMAT=binary (see parse_log_format())
 
+// Group leader (and member) fds to their process. Guarded by pidMapMutex,
+// which also keeps the process's groups open while the phase pipeline reads
+// them (see on_phase_signal() and detach_workload()).
 std::unordered_map<int, ProcessInfo *> pidMap;
+std::mutex pidMapMutex;
+
+// Set when running on a simulated platform (KPART_SIM); processes are then
+// synthetic apps instead of children, and no perf events are opened
+sim::SimPlatform *simPlatform = nullptr;
 
 void global_setup_counters(const char *events);
 void setup_counters(ProcessInfo &pinfo); //see below
+bool setup_cgroup_counters(ProcessInfo &pinfo);
 void read_counters(ProcessInfo &pinfo);
 
+// Counter values of a process at one of its phase boundaries
+struct PhaseSample {
+  int pidx;
+  uint64_t generation; // of the workload in slot pidx
+  std::vector<uint64_t> values;
+  uint64_t timeEnabled;
+  uint64_t timeRunning;
+};
+
+// Events are opened with PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+// PERF_FORMAT_TOTAL_TIME_RUNNING, so a read() of the group leader, and every
+// PERF_SAMPLE_READ record it writes, is
+//   { nr, time_enabled, time_running, value[nr] }
+// with the values in the order the events were given.
+const int GROUP_READ_HEADER_WORDS = 3;
+
+void decode_group_read(const ProcessInfo &pinfo, const uint64_t *buf,
+                       size_t words, PhaseSample &sample) {
+  if (words < GROUP_READ_HEADER_WORDS || buf[0] != (uint64_t) numEvents ||
+      words < GROUP_READ_HEADER_WORDS + numEvents)
+    errx(1, "incorrect read of event group %s, %lu words",
+         pinfo.fds[0].name, words);
+
+  sample.pidx = pinfo.pidx;
+  sample.generation = pinfo.generation;
+  sample.timeEnabled = buf[1];
+  sample.timeRunning = buf[2];
+  sample.values.assign(&buf[GROUP_READ_HEADER_WORDS],
+                       &buf[GROUP_READ_HEADER_WORDS + numEvents]);
+}
+
+// Reads (and sums) all of the process's counter groups into sample
+void read_groups(const ProcessInfo &pinfo, PhaseSample &sample) {
+  sample.pidx = pinfo.pidx;
+  sample.generation = pinfo.generation;
+  sample.values.assign(numEvents, 0);
+  sample.timeEnabled = sample.timeRunning = 0;
+  std::vector<uint64_t> values;
+  uint64_t enabled, running;
+  for (const std::shared_ptr<pmu::GroupReader> &reader : pinfo.readers) {
+    if (!reader->read(values, enabled, running))
+      errx(1, "cannot read values of event group %s", pinfo.fds[0].name);
+    for (uint32_t i = 0; i < numEvents; i++)
+      sample.values[i] += values[i];
+    sample.timeEnabled += enabled;
+    sample.timeRunning += running;
+  }
+}
+
+// Fraction of the time the group was enabled that it was counting, between
+// two reads; 1 if it was not enabled at all
+double running_ratio(uint64_t enabled, uint64_t running, uint64_t lastEnabled,
+                     uint64_t lastRunning) {
+  if (enabled <= lastEnabled)
+    return 1.0;
+  return (double)(running - lastRunning) / (double)(enabled - lastEnabled);
+}
+
+// Makes sample the process's current counter values. A group that shares the
+// PMU with more events than it has counters (or other perf users) counts only
+// part of the time, so what it counted since the last read is scaled up by
+// how long it was enabled over how long it ran then, as perf stat does for
+// whole runs. Scaling each delta rather than the cumulative counts keeps the
+// estimates from going down when the running ratio changes. If the group did
+// not run at all, nothing is added and runningRatio is 0.
+void set_counters(ProcessInfo &pinfo, const PhaseSample &sample) {
+  pinfo.runningRatio =
+      running_ratio(sample.timeEnabled, sample.timeRunning, pinfo.timeEnabled,
+                    pinfo.timeRunning);
+  if (pinfo.rawValues.size() != sample.values.size()) {
+    pinfo.rawValues.assign(sample.values.size(), 0);
+    pinfo.values.assign(sample.values.size(), 0);
+  }
+  uint64_t enabled = (sample.timeEnabled > pinfo.timeEnabled)
+                         ? sample.timeEnabled - pinfo.timeEnabled
+                         : 0;
+  uint64_t running = (sample.timeRunning > pinfo.timeRunning)
+                         ? sample.timeRunning - pinfo.timeRunning
+                         : 0;
+  double scale = (running && running < enabled)
+                     ? (double) enabled / running
+                     : 1.0;
+  for (size_t i = 0; i < sample.values.size(); i++) {
+    if (sample.values[i] > pinfo.rawValues[i])
+      pinfo.values[i] += (sample.values[i] - pinfo.rawValues[i]) * scale;
+  }
+  pinfo.rawValues = sample.values;
+  pinfo.timeEnabled = sample.timeEnabled;
+  pinfo.timeRunning = sample.timeRunning;
+#ifdef USE_CMT
+  updateCmtCounters(pinfo);
+#endif
+}
+
 void read_counters(ProcessInfo &pinfo) {
   if (pinfo.values.size() < numEvents)
     pinfo.values.resize(numEvents);
 
-  for (uint32_t i = 0; i < numEvents; i++) {
-    int ret = read(pinfo.fds[i].fd, &pinfo.values[i], sizeof(pinfo.values[i]));
-    if (ret != sizeof(pinfo.values[i])) {
-      if (ret == -1)
-        errx(1, "cannot read values event %s", pinfo.fds[i].name);
-      errx(1, "incorrect read of values event %s, %d", pinfo.fds[i].name, ret);
-    }
-  }
-
+  if (simPlatform) {
+    // Events are taken to be instructions, LLC references and cycles, in
+    // that order (see tests/example.sh)
+    sim::SimPlatform::CoreCounters ctrs =
+        simPlatform->getCounters(pinfo.cores[0]);
+    pinfo.values[0] = ctrs.instructions;
+    pinfo.values[1] = ctrs.llcRefs;
+    pinfo.values[2] = ctrs.cycles;
 #ifdef USE_CMT
-  updateMemTraffic(pinfo);
-  updateCacheOccupancy(pinfo);
+    updateCmtCounters(pinfo);
 #endif
+    return;
+  }
+
+  PhaseSample sample;
+  read_groups(pinfo, sample);
+  set_counters(pinfo, sample);
 }
 
-void dump_counters(ProcessInfo &pinfo) {
+// Last column of the log: the running ratio of the phase (see set_counters())
+std::string runningRatioName = "RUNNING_RATIO";
+
+// Takes log output off the control path (see log_counters()); set up first
+// thing in main()
+pipeline::AsyncLog *asyncLog = nullptr;
+
+// One phase of a process's counter log, as queued for the log thread
+struct CounterRecord {
+  int pid;
+  uint64_t phase;
+  double runningRatio;
+  uint64_t timeEnabled;
+  uint64_t timeRunning;
+  int64_t memTrafficTotal;
+  int64_t avgCacheOccupancy;
+  uint64_t values[MAX_LOGGED_EVENTS];
+};
+static_assert(sizeof(CounterRecord) <= pipeline::AsyncLog::PAYLOAD_BYTES,
+              "counter records must fit a log record");
+
+// Log thread: writes a counter record to a text log
+void write_counters_text(void *dst, const char *payload, size_t len) {
+  FILE *logFd = static_cast<FILE *>(dst);
+  const CounterRecord &rec = *reinterpret_cast<const CounterRecord *>(payload);
   int i;
-  read_counters(pinfo);
 
   if (prettyPrint) {
     for (i = 0; i < numEvents; i++) {
-      fprintf(pinfo.logFd, "%40s  %3d:%ld\n", pinfo.fds[i].name, pinfo.pid,
-              pinfo.values[i]);
+      fprintf(logFd, "%40s  %3d:%ld\n", globFds[i].name, rec.pid,
+              rec.values[i]);
     }
 #ifdef USE_CMT
-    fprintf(pinfo.logFd, "%40s %3d:%ld\n", lmbName.c_str(), pinfo.pid,
-            pinfo.memTrafficTotal);
-    fprintf(pinfo.logFd, "%40s %d:%ld\n", l3OccupName.c_str(), pinfo.pid,
-            pinfo.avgCacheOccupancy);
+    fprintf(logFd, "%40s %3d:%ld\n", lmbName.c_str(), rec.pid,
+            rec.memTrafficTotal);
+    fprintf(logFd, "%40s %d:%ld\n", l3OccupName.c_str(), rec.pid,
+            rec.avgCacheOccupancy);
 #endif
+    fprintf(logFd, "%40s %3d:%.3f\n", runningRatioName.c_str(), rec.pid,
+            rec.runningRatio);
   } else {
-    for (i = 0; i < numEvents - 1; i++)
-      fprintf(pinfo.logFd, "%ld ", pinfo.values[i]);
+    for (i = 0; i < numEvents; i++)
+      fprintf(logFd, "%ld ", rec.values[i]);
+
+#ifdef USE_CMT
+    fprintf(logFd, "%ld ", rec.memTrafficTotal);
+    fprintf(logFd, "%ld ", rec.avgCacheOccupancy);
+#endif
+    fprintf(logFd, "%.3f\n", rec.runningRatio);
+  }
+}
+
+// Log thread: writes a counter record to a binary log, in the columns named
+// by print_log_header()
+void write_counters_binary(void *dst, const char *payload, size_t len) {
+  PhaseLogWriter *phaseLog = static_cast<PhaseLogWriter *>(dst);
+  const CounterRecord &rec = *reinterpret_cast<const CounterRecord *>(payload);
+  uint64_t *record;
+  int i;
+
+  try {
+    record = phaseLog->appendRecord(rec.phase);
+  } catch (PhaseLogException &e) {
+    errx(-1, "%s", e.what());
+  }
+  for (i = 0; i < numEvents; i++)
+    record[i] = rec.values[i];
+#ifdef USE_CMT
+  record[i++] = rec.memTrafficTotal;
+  record[i++] = rec.avgCacheOccupancy;
+#endif
+  record[i++] = rec.timeEnabled;
+  record[i++] = rec.timeRunning;
+}
+
+// Queues the last values read for the process's log
+void log_counters(ProcessInfo &pinfo) {
+  CounterRecord rec;
+  rec.pid = pinfo.pid;
+  rec.phase = pinfo.numPhases;
+  rec.runningRatio = pinfo.runningRatio;
+  rec.timeEnabled = pinfo.timeEnabled;
+  rec.timeRunning = pinfo.timeRunning;
+#ifdef USE_CMT
+  rec.memTrafficTotal = pinfo.memTrafficTotal;
+  rec.avgCacheOccupancy = pinfo.avgCacheOccupancy;
+#endif
+  std::copy(pinfo.values.begin(), pinfo.values.begin() + numEvents,
+            rec.values);
+
+  if (pinfo.phaseLog)
+    asyncLog->push(write_counters_binary, pinfo.phaseLog.get(), &rec,
+                   sizeof(rec));
+  else
+    asyncLog->push(write_counters_text, pinfo.logFd, &rec, sizeof(rec));
+}
+
+// LLC misses behind the MPKI samples; set up by setup_miss_source()
+pmu::MissSource *missSource = nullptr;
+
+// Misses of the process so far, as of the last values read
+double count_misses(const ProcessInfo &pinfo) {
+  pmu::MissSource::Counts counts;
+  counts.values = &pinfo.values;
+  counts.mbmLocalBytes = counts.mbmTotalBytes = 0;
+#ifdef USE_CMT
+  counts.mbmLocalBytes = pinfo.memTrafficTotal;
+  counts.mbmTotalBytes = pinfo.totalTraffic;
+#endif
+  return missSource->getMisses(counts);
+}
 
+// KPART_MISS_SOURCE picks the source (see pmu::MissSource); by default, a
+// miss event if one was given, or else MBM local traffic
+void setup_miss_source() {
+  std::vector<std::string> names;
+  for (uint32_t i = 0; i < numEvents; i++)
+    names.push_back(globFds[i].name);
 #ifdef USE_CMT
-    fprintf(pinfo.logFd, "%ld ", pinfo.values[numEvents - 1]);
-    fprintf(pinfo.logFd, "%ld ", pinfo.memTrafficTotal);
-    fprintf(pinfo.logFd, "%ld\n", pinfo.avgCacheOccupancy);
+  bool haveMbm = true;
 #else
-    fprintf(pinfo.logFd, "%ld\n", pinfo.values[numEvents - 1]);
+  bool haveMbm = false;
 #endif
+  const char *spec = getenv("KPART_MISS_SOURCE");
+  std::string missSpec =
+      spec ? spec : pmu::MissSource::defaultSpec(names, haveMbm);
+  try {
+    missSource = new pmu::MissSource(missSpec, names, haveMbm,
+                                     CACHE_LINE_SIZE);
+  } catch (std::invalid_argument &e) {
+    errx(1, "[KPART] Bad KPART_MISS_SOURCE: %s", e.what());
+  }
+  log_printf("[KPART] LLC misses from %s\n",
+             missSource->getDescription().c_str());
+}
+
+// Whether plans cap memory bandwidth too; set up by setup_memory_model()
+bool allocateBandwidth = false;
+
+static double parse_env_double(const char *name, double dflt) {
+  const char *str = getenv(name);
+  if (!str)
+    return dflt;
+  char *end;
+  double val = strtod(str, &end);
+  if (*str == '\0' || *end != '\0' || !(val > 0))
+    errx(1, "[KPART] Bad %s: %s", name, str);
+  return val;
+}
+
+// With MBA, plans throttle memory bandwidth by a model of each app's
+// bandwidth, which comes from its miss curve. KPART_MEM_BW (peak bytes per
+// core cycle) and KPART_MEM_PENALTY (cycles per miss with unloaded memory)
+// describe the platform; the simulated one knows its own peak bandwidth.
+void setup_memory_model() {
+  if (!get_rdt_backend()->isMbaSupported())
+    return;
+  if (missSource->getKind() == pmu::MissSource::NONE) {
+    log_printf("[KPART] No LLC miss source, so no bandwidth model: memory "
+               "bandwidth stays unthrottled\n");
+    return;
+  }
+  double bw = DEFAULT_MEM_BW_BYTES_PER_CYCLE;
+  if (simPlatform)
+    bw = simPlatform->getConfig().memGBs / simPlatform->getConfig().freqGhz;
+  bw = parse_env_double("KPART_MEM_BW", bw);
+  double penalty =
+      parse_env_double("KPART_MEM_PENALTY", DEFAULT_MEM_MISS_PENALTY_CYCLES);
+  cache_utils::set_memory_model(bw, penalty);
+  allocateBandwidth = true;
+  log_printf("[KPART] Bandwidth model: %.1f bytes/cycle peak, %.0f cycles "
+             "per miss\n",
+             bw, penalty);
+}
+
+// Share of the time each process's counters actually ran, over the whole run
+void print_multiplexing_stats() {
+  for (ProcessInfo &pinfo : processInfo) {
+    if (!pinfo.timeEnabled)
+      continue;
+    log_printf("[INFO] PROC %d: counters ran %.1f%% of the time, %d profiling "
+               "samples retried for multiplexing\n",
+               pinfo.pidx, 100.0 * pinfo.timeRunning / pinfo.timeEnabled,
+               pinfo.numLowConfidence);
   }
 }
 
+void dump_counters(ProcessInfo &pinfo) {
+  read_counters(pinfo);
+  log_counters(pinfo);
+}
+
 // ----------- Helper Functions --------------------//
 struct timeval startAll, endAll;
 struct timeval startT, endT;
@@ -282,213 +733,240 @@ void stopTime(const char *name) {
   gettimeofday(&endT, 0);
   double time = (endT.tv_sec - startT.tv_sec) * 1e3 +
                 (endT.tv_usec - startT.tv_usec) * 1e-3;
-  printf("[TIMECALC] %s = %.3f ms\n", name, time);
+  log_printf("[TIMECALC] %s = %.3f ms\n", name, time);
 }
 
+// KPART_PROFILE_PLAN picks how each app's sweep samples the cache (see
+// profiling::PlanGenerator); uniform, 6 samples by default
 void generate_profiling_plan(int cacheCapacity) {
   if (enableLogging) {
-    printf("[INFO]  Inside generateProfilingPlan(%d) \n", cacheCapacity);
-  }
-
-  arma::vec plan;
-  switch (cacheCapacity) {
-  // Modify "plan" if you want DynaWay to sample cache sizes differently
-  // Add cases if more/different cache capacities are passible
-  case 12:
-    plan = { 11, 11, 8, 6, 4, 2, 1 };
-    break;
-  case 11:
-    plan = { 10, 10, 8, 6, 4, 2, 1 };
-    break;
-  case 10:
-    plan = { 9, 9, 8, 6, 4, 2, 1 };
-    break;
-  case 9:
-    plan = { 8, 8, 6, 4, 3, 2, 1 };
-    break;
-  case 8:
-    plan = { 7, 7, 6, 4, 3, 2, 1 };
-    break;
-  case 7:
-    plan = { 6, 6, 5, 4, 3, 2, 1 };
-    break;
-  case 6:
-    plan = { 5, 5, 4, 3, 2, 1 };
-    break;
-  case 5:
-    plan = { 4, 4, 3, 2, 1 };
-    break;
-  case 4:
-    plan = { 3, 3, 2, 1 };
-    break;
-  case 3:
-    plan = { 2, 2, 1 };
-    break;
-  default:
-    errx(1, "Invalid cache capacity passed to generate_profiling_plan().");
+    log_printf("[INFO]  Inside generateProfilingPlan(%d) \n", cacheCapacity);
+  }
+
+  const char *spec = getenv("KPART_PROFILE_PLAN");
+  std::vector<profiling::PlanGenerator::Slice> slices;
+  try {
+    profiling::PlanGenerator generator(spec ? spec : "uniform");
+    slices = generator.generate(cacheCapacity, cache_utils::way_cut_allowed);
+    sampleSizes =
+        generator.getSampleSizes(cacheCapacity, cache_utils::way_cut_allowed);
+    log_printf("[KPART] Profiling plan: %s\n",
+               generator.getDescription().c_str());
+  } catch (std::invalid_argument &e) {
+    errx(1, "[KPART] Bad KPART_PROFILE_PLAN: %s", e.what());
   }
 
+  arma::vec plan(slices.size());
+  for (size_t s = 0; s < slices.size(); s++)
+    plan[s] = slices[s].profiledWays;
   numWaysToSample = plan.size();
 
   if (enableLogging) {
-    plan.print();
-    printf("[INFO] Num curve points to sample = %d\n", numWaysToSample);
+    pipeline::log_print(plan);
+    log_printf("[INFO] Num curve points to sample = %d\n", numWaysToSample);
   }
 
   // Resize data structures based on the new cache capacity available to batch
-  // apps
+  // apps, and to every workload that may join in daemon mode
+  int numSlots = daemonMode ? MAX_DAEMON_WORKLOADS : numProcesses;
   allAppsCacheAssignments.set_size(2, cacheCapacity, numWaysToSample);
-  sampledMRCs.set_size(cacheCapacity, NUM_CORES);
-  sampledIPCs.set_size(cacheCapacity, NUM_CORES);
+  currentlySampling = zeros<arma::mat>(numSlots, 2);
+  loggingMRCFlags = zeros<arma::vec>(numSlots);
+  sampledMRCs = zeros<arma::mat>(cacheCapacity, numSlots);
+  sampledIPCs = zeros<arma::mat>(cacheCapacity, numSlots);
+  sampledCodeIPCs = zeros<arma::mat>(cacheCapacity, numSlots);
 
   for (ProcessInfo &pinfoIter : processInfo) {
     // Resizing relevant data structures
     pinfoIter.mrcEstAvg.set_size(cacheCapacity);
-    pinfoIter.mrcEstimates.set_size(cacheCapacity, 1000);
+    pinfoIter.mrcEstimates.set_size(cacheCapacity, EST_HISTORY_LENGTH);
     pinfoIter.ipcCurveAvg.set_size(cacheCapacity);
-    pinfoIter.ipcCurveEstimates.set_size(cacheCapacity, 1000);
+    pinfoIter.ipcCurveEstimates.set_size(cacheCapacity, EST_HISTORY_LENGTH);
+    pinfoIter.codeIpcCurveAvg.set_size(cacheCapacity);
+    pinfoIter.codeIpcCurveEstimates.set_size(cacheCapacity, EST_HISTORY_LENGTH);
     pinfoIter.mrcEstIndex = 0;
+    pinfoIter.codeEstIndex = 0;
     pinfoIter.xPoints.set_size(numWaysToSample);
     pinfoIter.yPoints_ipc.set_size(numWaysToSample);
     pinfoIter.yPoints_mpki.set_size(numWaysToSample);
+    pinfoIter.yPoints_conf.set_size(numWaysToSample);
   }
 
-  int row = -1;
-  int idx = -1;
-  arma::mat A(2, cacheCapacity);
-  int sliceIdx = 0;
-
+  // Row 0: ways of the profiled app, row 1: ways the others share; e.g.,
+  // with 6 ways, "1, 1, 1, 1, 1, 0" and "0, 0, 0, 0, 0, 1"
   for (int s = 0; s < numWaysToSample; s++) {
-    // E.g.: if cache capacity = 6, plan = {5, 5, 4, 3, 2, 1};
-    int p = plan[s];           // e.g. 5 (ways being profiled for target app)
-    int r = cacheCapacity - p; // e.g. 1 (remaining ways for rest of apps)
-
-    row = 0;
-    idx = 0;
-    for (int i = 0; i < p; i++) {
-      A(row, idx) = 1;
-      idx++;
+    arma::mat A(2, cacheCapacity);
+    for (int i = 0; i < cacheCapacity; i++) {
+      A(0, i) = (slices[s].profiledMask >> i) & 1;
+      A(1, i) = (slices[s].sharedMask >> i) & 1;
     }
-    for (int i = 0; i < r; i++) {
-      A(row, idx) = 0;
-      idx++;
-    }
-    //e.g. init: "1, 1, 1, 1, 1, 0"
-
-    row = 1;
-    idx = 0;
-    for (int i = 0; i < p; i++) {
-      A(row, idx) = 0;
-      idx++;
-    }
-    for (int i = 0; i < r; i++) {
-      A(row, idx) = 1;
-      idx++;
-    }
-    //e.g. init: "1, 0, 0, 0, 0, 0"
-
-    allAppsCacheAssignments.slice(sliceIdx) = A;
-    sliceIdx++;
+    allAppsCacheAssignments.slice(s) = A;
   }
-
-  // workaround CAT bug with buckets 10,11
-  A = { { 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1 },
-        { 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 } }; // 0:11, 1:1
-  allAppsCacheAssignments.slice(0) = A;
-  allAppsCacheAssignments.slice(1) = A;
-
 }
 
 // ---------------------------------------------------------- //
 int set_cacheways_to_cores(arma::mat C, int procIdxProfiled) {
   // E.g.  A = {  {1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
   //           {0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1} }; // 0:1, 1:11
-  std::string waysString;
   int cosID, numWaysBeingSampled, status;
   arma::mat cosMap = zeros<arma::mat>(C.n_rows, 2);
-
-  // cosID = 0 has the sampled way string,
-  // cosID = 1 should have the other way string with all remaining processes
+  rdt::PartitionPlan plan;
+
+  // Under CDP, the rows of C only split the kind of ways being profiled; the
+  // other kind gets the whole cache
+  bool cdp = get_rdt_backend()->isCdpEnabled();
+  std::vector<uint32_t> rowCbms;
+  std::vector<int> allWays;
+  for (int j = 0; j < C.n_cols; j++)
+    allWays.push_back(j);
+
+  // Row 0 has the sampled way string,
+  // row 1 should have the other way string with all remaining processes
   // sharing these ways ..
   for (cosID = 0; cosID < C.n_rows; cosID++) {
-    waysString = "";
+    std::vector<int> ways;
     numWaysBeingSampled = 0;
     for (int j = 0; j < C.n_cols; j++) {
       if (C(cosID, j) > 0) {
         numWaysBeingSampled++;
-        waysString = waysString + std::to_string(j);
-        waysString += ",";
+        ways.push_back(j);
       }
     }
-    waysString.erase(waysString.end() - 1);
-    waysString = " " + waysString;
-
-    std::string rs = CAT_CBM_TOOL_DIR + std::to_string(cosID);
-    rs += " -m" + waysString;
-
-    status = system(rs.c_str());
-    //if(enableLogging){ printf("[INFO] Changing cache alloc for cos %d to %s
-    //ways. Status= %d \n", cosID, waysString.c_str(), status); }
-
-    if (status != 0)
-      break;
+    rowCbms.push_back(rdt::ways_to_cbm(ways));
 
     //Indicate that this process is now sampling "x" number of cache ways
     //currentlySampling[cosID] = numWaysBeingSampled;
     cosMap(cosID, 0) = numWaysBeingSampled;
     cosMap(cosID, 1) = 1;
-    //if(enableLogging){ printf("[INFO] Indicating that COS %d is now mapped to
-    //%d ways.\n", cosID, numWaysBeingSampled); }
   }
 
-  //Now map: (1) the profiled process (id: procIdxProfiled) to COS0,
-  cosID = 0; //Assumption: profiled process will be mapped to COS0
-  std::string rs = CAT_COS_TOOL_DIR + std::to_string(procIdxProfiled) + " -s " +
-                   std::to_string(cosID);
-
-  status = system(rs.c_str());
-  if (enableLogging) {
-    printf("[INFO] Changing CORE %d map to COS %d. Status= %d \n",
-           procIdxProfiled, cosID, status);
+  // Row r of C goes to the r-th profiling COS; COS 0 keeps the whole cache
+  int profiledCos = cache_utils::profiling_cos(0);
+  int othersCos = cache_utils::profiling_cos(1);
+  uint32_t fullCbm = rdt::ways_to_cbm(allWays);
+  std::vector<uint32_t> fullCbms(profiledCos + rowCbms.size(), fullCbm);
+  std::vector<uint32_t> profCbms = fullCbms;
+  std::copy(rowCbms.begin(), rowCbms.end(), profCbms.begin() + profiledCos);
+  plan.cbms = (cdp && profilingCode) ? fullCbms : profCbms;
+  if (cdp)
+    plan.codeCbms = profilingCode ? profCbms : fullCbms;
+  // Profile at full memory bandwidth, whatever the last partitioning chose
+  if (get_rdt_backend()->isMbaSupported())
+    plan.mbaPercents.assign(fullCbms.size(), 100);
+
+  //Now map: (1) the cores of the profiled process (id: procIdxProfiled) to
+  // its COS, (2) every other core to the others' COS to share the remaining
+  // ways. In daemon mode only the cores of the workloads KPart manages are
+  // ours to move.
+  if (daemonMode) {
+    plan.coreCos.assign(numCores, -1);
+    for (int procID = 0; procID < numProcesses; procID++) {
+      for (int core : cache_utils::app_cores(procID)) {
+        if (core < numCores)
+          plan.coreCos[core] = othersCos;
+      }
+    }
+  } else {
+    plan.coreCos.assign(numCores, othersCos);
   }
-
-  currentlySampling(procIdxProfiled, 0) =
-      cosMap(cosID, 0); //numWaysBeingSampled;
-  currentlySampling(procIdxProfiled, 1) = 1;
-
-  // (2) everyone else to COS1 to share the remaining ways
-  cosID = 1; //Assumption: rest of processes will be sharing cache ways in COS 1
-
-  for (int procID = 0; procID < NUM_CORES; procID++) {
-    if (procID == procIdxProfiled)
-      continue;
-
-    rs = CAT_COS_TOOL_DIR + std::to_string(procID) + " -s " +
-         std::to_string(cosID);
-    status = system(rs.c_str());
-    //if(enableLogging){ printf("[INFO] Changing CORE %d map to COS %d. Status=
-    //%d \n", procID, cosID, status); }
+  for (int core : cache_utils::app_cores(procIdxProfiled)) {
+    if (core < numCores)
+      plan.coreCos[core] = profiledCos;
+  }
+  for (int procID = 0; procID < numProcesses; procID++) {
+    cosID = (procID == procIdxProfiled) ? 0 : 1;
 
     //Indicate that this process is now sampling "x" number of cache ways
     currentlySampling(procID, 0) = cosMap(cosID, 0); //numWaysBeingSampled;
     currentlySampling(procID, 1) = 1;
-    //if(enableLogging){ printf("[INFO] Indicating that pid %d is now sampling
-    //%d ways.\n", procID, numWaysBeingSampled); }
+  }
+#ifdef USE_CMT
+  monitor_profiled_processes(std::vector<int>(1, procIdxProfiled));
+#endif
+
+  status = get_rdt_backend()->applyPlan(plan);
+  gettimeofday(&sliceStart, 0);
+  if (enableLogging) {
+    log_printf("[INFO] Changing CORE %d map to COS %d (%s %sways), others to "
+               "COS %d (%s ways). Status= %d \n",
+               procIdxProfiled, profiledCos,
+               rdt::cbm_to_string(rowCbms[0]).c_str(),
+               !cdp ? "" : (profilingCode ? "code " : "data "), othersCos,
+               rdt::cbm_to_string(rowCbms[1]).c_str(), status);
+    print_apply_latency("set_cacheways_to_cores");
   }
 
   if (status != 0) {
-    printf("[ERROR] Failed to change cache allocation for COS ID %d \n", cosID);
+    log_printf("[ERROR] Failed to change cache allocation for PROC %d \n",
+               procIdxProfiled);
   }
   return status;
 }
 
 // ---------------------------------------------------------- //
-void dump_mrc_estimates(ProcessInfo &pinfo) {
-  rewind(pinfo.mrcfd);
+// Part of a row of an estimates log, as queued for the log thread
+struct EstimateRecord {
+  uint32_t numValues;
+  uint16_t rewind; // first record of the log: start over
+  uint16_t endOfRow;
+  double values[(pipeline::AsyncLog::PAYLOAD_BYTES - 8) / sizeof(double)];
+};
+
+// Log thread: writes an estimates record
+void write_estimates(void *dst, const char *payload, size_t len) {
+  FILE *fd = static_cast<FILE *>(dst);
+  const EstimateRecord &rec =
+      *reinterpret_cast<const EstimateRecord *>(payload);
+  if (rec.rewind)
+    rewind(fd);
+  for (uint32_t v = 0; v < rec.numValues; v++)
+    fprintf(fd, "%f ", rec.values[v]);
+  if (rec.endOfRow)
+    fprintf(fd, "\n");
+}
 
+// Column of a process's estimates that holds episode n
+int est_col(int n) { return n % EST_HISTORY_LENGTH; }
+
+// Oldest episode still held once episode n is estimated
+int first_held_est(int n) { return std::max(0, n - EST_HISTORY_LENGTH + 1); }
+
+// Episodes first..last of estimates, oldest first
+arma::mat est_window(const arma::mat &estimates, int first, int last) {
+  arma::mat window(estimates.n_rows, last - first + 1);
+  for (int n = first; n <= last; n++)
+    window.col(n - first) = estimates.col(est_col(n));
+  return window;
+}
+
+// Queues episodes first..end-1 of estimates to rewrite fd with, one row per
+// line
+void log_estimates(FILE *fd, const arma::mat &estimates, int first,
+                   int end) {
+  const uint32_t maxValues = sizeof(EstimateRecord::values) / sizeof(double);
+  int numCols = end - first;
+  EstimateRecord rec;
+  rec.rewind = 1;
+  for (int i = 0; i < estimates.n_rows; i++) {
+    int j = 0;
+    do {
+      rec.numValues = std::min<uint32_t>(numCols - j, maxValues);
+      for (uint32_t v = 0; v < rec.numValues; v++)
+        rec.values[v] = estimates(i, est_col(first + j++));
+      rec.endOfRow = (j == numCols);
+      asyncLog->push(write_estimates, fd, &rec, sizeof(rec));
+      rec.rewind = 0;
+    } while (j < numCols);
+  }
+}
+
+// Both dump the episodes held before the current one
+void dump_mrc_estimates(ProcessInfo &pinfo) {
+  int first = first_held_est(pinfo.mrcEstIndex);
   // Smoothen before dumping:
   double prevValue = 0.0;
-  for (int j = 0; j < pinfo.mrcEstIndex; j++) {
+  for (int n = first; n < pinfo.mrcEstIndex; n++) {
+    int j = est_col(n);
     for (int i = 1; i < pinfo.mrcEstimates.n_rows; i++) {
       prevValue = pinfo.mrcEstimates(i - 1, j);
       pinfo.mrcEstimates(i, j) = std::min(prevValue, pinfo.mrcEstimates(i, j));
@@ -496,20 +974,15 @@ void dump_mrc_estimates(ProcessInfo &pinfo) {
   }
 
   // dump to log file of online samples for this process
-  for (int i = 0; i < pinfo.mrcEstimates.n_rows; i++) {
-    for (int j = 0; j < pinfo.mrcEstIndex; j++) {
-      fprintf(pinfo.mrcfd, "%f ", pinfo.mrcEstimates(i, j));
-    }
-    fprintf(pinfo.mrcfd, "\n");
-  }
+  log_estimates(pinfo.mrcfd, pinfo.mrcEstimates, first, pinfo.mrcEstIndex);
 }
 
 void dump_ipc_estimates(ProcessInfo &pinfo) {
-  rewind(pinfo.ipcfd);
-
+  int first = first_held_est(pinfo.mrcEstIndex);
   // Smoothen before dumping:
   double prevValue = 0.0;
-  for (int j = 0; j < pinfo.mrcEstIndex; j++) {
+  for (int n = first; n < pinfo.mrcEstIndex; n++) {
+    int j = est_col(n);
     for (int i = 1; i < pinfo.ipcCurveEstimates.n_rows; i++) {
       prevValue = pinfo.ipcCurveEstimates(i - 1, j);
       pinfo.ipcCurveEstimates(i, j) =
@@ -518,29 +991,52 @@ void dump_ipc_estimates(ProcessInfo &pinfo) {
   }
 
   // dump to log file of online samples for this process
-  for (int i = 0; i < pinfo.ipcCurveEstimates.n_rows; i++) {
-    for (int j = 0; j < pinfo.mrcEstIndex; j++) {
-      fprintf(pinfo.ipcfd, "%f ", pinfo.ipcCurveEstimates(i, j));
-    }
-    fprintf(pinfo.ipcfd, "\n");
-  }
+  log_estimates(pinfo.ipcfd, pinfo.ipcCurveEstimates, first,
+                pinfo.mrcEstIndex);
 }
 // ---------------------------------------------------------- //
 
-void cluster_mrcs(arma::mat mpkiVsWays, arma::mat ipcVsWays) {
-  if (enableLogging)
-    printf("\n [INFO]  Inside cluster_mrcs()\n");
-  cache_utils::smoothenMRCs(mpkiVsWays);
-  cache_utils::smoothenIPCs(ipcVsWays);
+// Clusters the apps sharing one LLC (columns of mpkiVsWays/ipcVsWays, which
+// are apps[0..n-1]) and partitions that LLC's ways among the clusters.
+// Each app's ways are returned in app_partitions[apps[i]]. Returns the
+// number of clusters chosen, or 0 if the platform quirks leave no valid
+// layout of their ways (see rdt/quirks.h).
+//
+// With CDP, codeIpcVsWays holds the IPC vs. code ways curves, and once K is
+// chosen, the hill climber splits the ways among 2K parts (the data and code
+// partitions of every cluster), returned in app_code_partitions.
+//
+// With MBA, every cluster also gets a memory bandwidth cap, returned in
+// app_bw_percents (or nullptr without MBA), chosen jointly with its ways.
+//
+// Every cluster takes a COS, so K is at most maxClusters (save the smallest K
+// clusterAuto() returns, in case none fits).
+uint32_t cluster_domain_mrcs(arma::mat mpkiVsWays, arma::mat ipcVsWays,
+                             const arma::mat *codeIpcVsWays,
+                             const std::vector<int> &apps, int maxClusters,
+                             std::stack<int> app_partitions[],
+                             std::stack<int> app_code_partitions[],
+                             int app_bw_percents[]) {
   int numApps = mpkiVsWays.n_cols;
 
+  // A lone app gets the whole LLC, and all of the memory bandwidth
+  if (numApps == 1) {
+    for (int i = (cacheWays - 1); i >= 0; --i)
+      app_partitions[apps[0]].push(i);
+    if (codeIpcVsWays)
+      app_code_partitions[apps[0]] = app_partitions[apps[0]];
+    if (app_bw_percents)
+      app_bw_percents[apps[0]] = 100;
+    return 1;
+  }
+
   // Convert sampled MRCs to format compatible with hclustering library:
   uint32_t numTimeIntervals = 1;
   std::vector<std::vector<RawMissCurve> > timeCurves;
 
   for (uint32_t i = 0; i < numApps; i++) {
-    std::vector<uint32_t> data(CACHE_WAYS);
-    std::copy(&mpkiVsWays.col(i)[0], &mpkiVsWays.col(i)[CACHE_WAYS],
+    std::vector<uint32_t> data(cacheWays);
+    std::copy(&mpkiVsWays.col(i)[0], &mpkiVsWays.col(i)[cacheWays],
               data.begin());
     std::vector<RawMissCurve> appCurves;
     for (uint32_t j = 0; j < numTimeIntervals; j++) {
@@ -550,20 +1046,22 @@ void cluster_mrcs(arma::mat mpkiVsWays, arma::mat ipcVsWays) {
   }
 
   if (enableLogging) {
-    printf("[INFO]  printing appCurves:\n");
+    log_printf("[INFO]  printing appCurves:\n");
+    std::ostringstream ss;
     for (uint32_t i = 0; i < timeCurves.size(); i++) {
-      std::cout << "App " << i << " ";
+      ss << "App " << apps[i] << " ";
       for (uint32_t j = 0; j < timeCurves[i].size(); j++) {
-        std::cout << timeCurves[i][j];
+        ss << timeCurves[i][j];
       }
-      std::cout << std::endl;
+      ss << std::endl;
     }
-    std::cout << std::endl;
+    ss << std::endl;
+    pipeline::log_write(ss.str());
   }
 
   // ************* AUTO-K CALC ************* //
   if (enableLogging)
-    printf("\n[INFO] Auto-K Clustering ... \n");
+    log_printf("\n[INFO] Auto-K Clustering ... \n");
   hcluster::HCluster clustauto;
   std::vector<hcluster::HCluster::results_pack> rpauto =
       clustauto.clusterAuto(timeCurves);
@@ -575,13 +1073,17 @@ void cluster_mrcs(arma::mat mpkiVsWays, arma::mat ipcVsWays) {
   uint32_t bestK = 0;
   int bestKidx = -1.0;
 
-  for (uint32_t k = 0; k < (NUM_CORES - 2); k++) {
-    int num_clusters = NUM_CORES - (k + 1);
+  // rpauto[k] has numApps - (k + 1) clusters
+  int numK = std::max(1, numApps - 2);
+  for (uint32_t k = 0; k < numK; k++) {
+    int num_clusters = numApps - (k + 1);
+    if (num_clusters > maxClusters && k + 1 < numK)
+      continue;
 
     if (enableLogging)
-      printf("\n \t[========================  K = %d   "
-             "========================]\n",
-             num_clusters);
+      log_printf("\n \t[========================  K = %d   "
+                 "========================]\n",
+                 num_clusters);
 
     hcluster::HCluster::results_pack rp = rpauto[k];
     auto item_to_clusts = rp.item_to_clusts;
@@ -592,7 +1094,7 @@ void cluster_mrcs(arma::mat mpkiVsWays, arma::mat ipcVsWays) {
     std::vector<const MissCurve *> curveVec;
     for (uint32_t c = 0; c < num_clusters; c++) {
       //std::cout << "cluster ID = "<< c << " temp: "; //std::endl;
-      std::vector<uint32_t> data(CACHE_WAYS);
+      std::vector<uint32_t> data(cacheWays);
       data = cluster_curves[c][0].yvals;
       curveVec.push_back(new RawMissCurve(std::move(data), nullptr));
     }
@@ -604,13 +1106,13 @@ void cluster_mrcs(arma::mat mpkiVsWays, arma::mat ipcVsWays) {
         cache_utils::get_wscurves_for_combinedmrcs(cluster_bucks, ipcVsWays);
     std::vector<const MissCurve *> wsCurveVec;
     for (uint32_t i = 0; i < wsCurveVecDbl.size(); i++) {
-      std::vector<uint32_t> data(CACHE_WAYS);
-      std::copy(&wsCurveVecDbl[i][0], &wsCurveVecDbl[i][CACHE_WAYS],
+      std::vector<uint32_t> data(cacheWays);
+      std::copy(&wsCurveVecDbl[i][0], &wsCurveVecDbl[i][cacheWays],
                 data.begin());
       wsCurveVec.push_back(new RawMissCurve(std::move(data), nullptr));
     }
 
-    hillClimbingPartitionWsCurves(CACHE_WAYS, minAllocs, &allocations[0],
+    hillClimbingPartitionWsCurves(cacheWays, minAllocs, &allocations[0],
                                   wsCurveVec, wsCurveVecDbl);
 
     //Given this partitioning plan, what's the corresponding total WS?
@@ -626,17 +1128,18 @@ void cluster_mrcs(arma::mat mpkiVsWays, arma::mat ipcVsWays) {
       bestKidx = k;
     }
     if (enableLogging)
-      printf("\t\t=> For num_clusters = %d, predicted WS = %.2f\n",
-             num_clusters, wsK);
+      log_printf("\t\t=> For num_clusters = %d, predicted WS = %.2f\n",
+                 num_clusters, wsK);
 
   } //end of processing all K results returned by clusterAuto()
     // ************* End of AUTO-K calculations ************* //
 
   // Select this predicted K
-  K = bestK;
+  uint32_t K = bestK;
 
   if (enableLogging)
-    printf("\n[INFO] Cluster applications into K-Auto = %d groups ... \n", K);
+    log_printf("\n[INFO] Cluster applications into K-Auto = %d groups ... \n",
+               K);
 
   hcluster::HCluster::results_pack rp = rpauto[bestKidx];
 
@@ -645,7 +1148,7 @@ void cluster_mrcs(arma::mat mpkiVsWays, arma::mat ipcVsWays) {
   auto cluster_bucks = rp.cluster_buckets;
 
   if (enableLogging)
-    printf("[INFO] Get partitions for per-cluster curves.. \n");
+    log_printf("[INFO] Get partitions for per-cluster curves.. \n");
 
   std::vector<uint32_t> minAllocs;
   minAllocs.push_back(1);
@@ -656,290 +1159,771 @@ void cluster_mrcs(arma::mat mpkiVsWays, arma::mat ipcVsWays) {
       cache_utils::get_wscurves_for_combinedmrcs(cluster_bucks, ipcVsWays);
   std::vector<const MissCurve *> wsCurveVec;
   for (uint32_t i = 0; i < wsCurveVecDbl.size(); i++) {
-    std::vector<uint32_t> data(CACHE_WAYS);
-    std::copy(&wsCurveVecDbl[i][0], &wsCurveVecDbl[i][CACHE_WAYS],
+    std::vector<uint32_t> data(cacheWays);
+    std::copy(&wsCurveVecDbl[i][0], &wsCurveVecDbl[i][cacheWays],
               data.begin());
     wsCurveVec.push_back(new RawMissCurve(std::move(data), nullptr));
   }
-  hillClimbingPartitionWsCurves(CACHE_WAYS, minAllocs, &allocations[0],
+  hillClimbingPartitionWsCurves(cacheWays, minAllocs, &allocations[0],
                                 wsCurveVec, wsCurveVecDbl);
   if (enableLogging) {
-    printf("[INFO] Hill climbing on WS curves: ");
-    cache_utils::print_allocations(allocations);
+    log_printf("[INFO] Hill climbing on WS curves: ");
+    cache_utils::print_allocations(allocations, K);
   }
 
-  // Apply per-cluster partitioning; e.g.: for K=3: 9, 2, 1
-  if (enableLogging)
-    printf("[INFO] Apply per-cluster partitioning ... \n");
-
-  std::stack<int> buckets;
-  for (int i = (CACHE_WAYS - 1); i >= 0; --i)
-    buckets.push(i);
-  std::stack<int> cluster_partitions[K];
-  for (uint32_t c = 0; c < K; c++) {
-    for (uint32_t p = 0; p < allocations[c]; p++) {
-      cluster_partitions[c].push(buckets.top());
-      buckets.pop();
+  // With CDP, data and code ways of each cluster become separate parts of
+  // the same hill climbing problem. Data and code sensitivity were profiled
+  // with the other kind of ways unconstrained, so this assumes they add up.
+  uint32_t numParts = K;
+  if (codeIpcVsWays && cacheWays >= 2 * K) {
+    numParts = 2 * K;
+    std::vector<std::vector<double> > codeWsCurveVecDbl =
+        cache_utils::get_wscurves_for_combinedmrcs(cluster_bucks,
+                                                   *codeIpcVsWays);
+    for (uint32_t i = 0; i < codeWsCurveVecDbl.size(); i++) {
+      std::vector<uint32_t> data(cacheWays);
+      std::copy(&codeWsCurveVecDbl[i][0], &codeWsCurveVecDbl[i][cacheWays],
+                data.begin());
+      wsCurveVec.push_back(new RawMissCurve(std::move(data), nullptr));
+      wsCurveVecDbl.push_back(codeWsCurveVecDbl[i]);
     }
+  } else if (codeIpcVsWays && enableLogging) {
+    log_printf("[INFO] Too few ways to split code and data of %d clusters\n",
+               K);
+  }
+  uint32_t partAllocations[numParts];
+  if (numParts != K) {
+    hillClimbingPartitionWsCurves(cacheWays, minAllocs, &partAllocations[0],
+                                  wsCurveVec, wsCurveVecDbl);
+    if (enableLogging) {
+      log_printf("[INFO] Hill climbing on data+code WS curves: ");
+      for (uint32_t p = 0; p < numParts; p++)
+        log_printf("%u, ", partAllocations[p]);
+      log_printf("\n");
+    }
+  } else {
+    std::copy(&allocations[0], &allocations[K], &partAllocations[0]);
   }
 
-  // Workaround bug with COS 10,11 in Intel's CAT
-  cache_utils::verify_intel_cos_issue(cluster_partitions, K);
+  // Throttle clusters whose traffic hurts the others more than the
+  // bandwidth helps them. Ways only move along when data and code are not
+  // split, as the model only knows about data ways.
+  int clusterBw[K];
+  if (app_bw_percents) {
+    cache_utils::allocate_ways_and_bandwidth(
+        cluster_bucks, ipcVsWays, mpkiVsWays, partAllocations, clusterBw, K,
+        get_rdt_backend()->getMbaGranularity(), numParts == K);
+  }
 
-  std::stack<int> app_partitions[numApps];
+  // Apply per-cluster partitioning; e.g.: for K=3: 9, 2, 1
+  if (enableLogging)
+    log_printf("[INFO] Apply per-cluster partitioning ... \n");
+
+  // Platform quirks (rdt/quirks.h) may require some ways to go together; the
+  // sizes are chosen under that constraint, not patched up afterwards
+  if (!cache_utils::constrain_allocations(partAllocations, numParts,
+                                          wsCurveVecDbl)) {
+    log_printf("[ERROR] No allocation keeps the coupled ways together\n");
+    return 0;
+  }
 
-  printf("\n ------------- KPart+DynaWay Cache assignments to apps "
-         "--------------  "
-         "\n");
+  // Place each cluster's ways where its apps' lines already are: weigh every
+  // way by how many of the cluster's apps held it in the last plan (code
+  // parts by their code ways)
+  std::vector<std::vector<int> > keepWays(numParts,
+                                          std::vector<int>(cacheWays, 0));
   for (int a = 0; a < numApps; ++a) {
     int cid = item_to_clusts[a];
-    app_partitions[a] = cluster_partitions[cid];
-    std::cout << "App: " << a << " Clust: " << cid << " Parts: ";
-    std::string waysString = "";
-    while (!app_partitions[a].empty()) {
-      std::cout << ' ' << app_partitions[a].top();
-      waysString = waysString + std::to_string(app_partitions[a].top());
-      waysString += ",";
-      app_partitions[a].pop();
+    for (uint32_t p = cid; p < numParts; p += K) {
+      uint32_t lastCbm = cache_utils::last_partition_cbm(apps[a], p >= K);
+      for (int w : rdt::cbm_to_ways(lastCbm))
+        keepWays[p][w]++;
     }
-    std::cout << std::endl;
   }
-
+  std::stack<int> cluster_partitions[numParts];
+  if (!cache_utils::layout_partitions(partAllocations, numParts, keepWays,
+                                      cluster_partitions))
+    return 0;
+
+  log_printf("\n ------------- KPart+DynaWay Cache assignments to apps "
+             "--------------  "
+             "\n");
+  std::ostringstream ss;
   for (int a = 0; a < numApps; ++a) {
     int cid = item_to_clusts[a];
-    app_partitions[a] = cluster_partitions[cid];
+    std::stack<int> appParts = cluster_partitions[cid];
+    ss << "App: " << apps[a] << " Clust: " << cid << " Parts: ";
+    while (!appParts.empty()) {
+      ss << ' ' << appParts.top();
+      appParts.pop();
+    }
+    ss << std::endl;
   }
+  pipeline::log_write(ss.str());
 
-  // Now apply this partitioning plan:
-  cache_utils::apply_partition_plan(app_partitions);
+  for (int a = 0; a < numApps; ++a) {
+    int cid = item_to_clusts[a];
+    app_partitions[apps[a]] = cluster_partitions[cid];
+    // Without a split, code shares the cluster's ways with data
+    if (codeIpcVsWays)
+      app_code_partitions[apps[a]] = cluster_partitions[cid + numParts - K];
+    if (app_bw_percents)
+      app_bw_percents[apps[a]] = clusterBw[cid];
+  }
 
+  return K;
 }
 
-// ---------------------------------------------------------- //
-void sigsage_handler(int n, siginfo_t *info, void *vsc) {
-  struct sigcontext *sc = reinterpret_cast<struct sigcontext *>(vsc);
-  struct perf_event_mmap_page *hdr;
-  struct perf_event_header ehdr;
-  int id, ret;
+// Cache domain (socket) whose LLC app appIdx runs on. Apps without a process
+// are indexed by core.
+int app_cache_domain(int appIdx) {
+  int core = appIdx;
+  if (appIdx < (int) processInfo.size() && !processInfo[appIdx].cores.empty())
+    core = processInfo[appIdx].cores[0];
+  return getCacheDomain(core);
+}
 
-  int pid = info->si_uid;
-  int fd = info->si_fd;
-  ProcessInfo &pinfo = *pidMap[fd];
+// Each socket has its own LLC and its own CAT masks, so KPart runs one
+// clustering and partitioning problem per socket, then applies the combined
+// plan.
+//
+// codeIpcVsWays is the IPC vs. code ways matrix under CDP, or nullptr.
+void cluster_mrcs(arma::mat mpkiVsWays, arma::mat ipcVsWays,
+                  const arma::mat *codeIpcVsWays = nullptr) {
+  if (enableLogging)
+    log_printf("\n [INFO]  Inside cluster_mrcs()\n");
+  cache_utils::smoothenMRCs(mpkiVsWays);
+  cache_utils::smoothenIPCs(ipcVsWays);
+  arma::mat codeIpc;
+  if (codeIpcVsWays) {
+    codeIpc = *codeIpcVsWays;
+    cache_utils::smoothenIPCs(codeIpc);
+  }
+  int numApps = mpkiVsWays.n_cols;
 
-  ++pinfo.numPhases;
-  //printf("[TEST] PROC %d, PHASE %d", pinfo.pidx, pinfo.numPhases);
-  //assert(pinfo.numPhases <= pinfo.maxPhases);
+  // Processes that are gone, or have not been profiled yet (daemon mode), are
+  // left out of the plan
+  std::vector<std::vector<int> > domainApps;
+  for (int a = 0; a < numApps; a++) {
+    if (a < (int) processInfo.size() &&
+        (!processInfo[a].active || !processInfo[a].profiled))
+      continue;
+    int d = app_cache_domain(a);
+    if (d >= (int) domainApps.size())
+      domainApps.resize(d + 1);
+    domainApps[d].push_back(a);
+  }
 
-  // --------------------------------------------------- //
-  if (!monitorStartFlag && pinfo.numPhases > 1) {
-    pinfo.lastInstrCtr = pinfo.values[0];
-    pinfo.lastCyclesCtr = pinfo.values[2];
-#ifdef USE_CMT
-    pinfo.lastMemTrafficCtr = pinfo.memTrafficTotal;
-#endif
+  std::stack<int> app_partitions[numApps];
+  std::stack<int> app_code_partitions[numApps];
+  bool mba = allocateBandwidth;
+  int app_bw_percents[numApps];
+  std::fill(&app_bw_percents[0], &app_bw_percents[numApps], 100);
+
+  // Split the COSes left for partitions evenly among the cache domains
+  int numDomains = 0;
+  for (const std::vector<int> &apps : domainApps)
+    numDomains += apps.empty() ? 0 : 1;
+  if (numDomains == 0)
+    return;
+  int maxClusters =
+      std::max(1, cache_utils::get_num_partition_cos() / numDomains);
+  uint32_t totalK = 0;
+  for (uint32_t d = 0; d < domainApps.size(); d++) {
+    const std::vector<int> &apps = domainApps[d];
+    if (apps.empty())
+      continue;
+    if (enableLogging)
+      log_printf("\n[INFO] Partitioning cache domain %d (%lu apps)\n", d,
+                 apps.size());
+
+    arma::mat domainMpki(mpkiVsWays.n_rows, apps.size());
+    arma::mat domainIpc(ipcVsWays.n_rows, apps.size());
+    arma::mat domainCodeIpc(ipcVsWays.n_rows, apps.size());
+    for (uint32_t i = 0; i < apps.size(); i++) {
+      domainMpki.col(i) = mpkiVsWays.col(apps[i]);
+      domainIpc.col(i) = ipcVsWays.col(apps[i]);
+      if (codeIpcVsWays)
+        domainCodeIpc.col(i) = codeIpc.col(apps[i]);
+    }
+    uint32_t domainK = cluster_domain_mrcs(
+        domainMpki, domainIpc, codeIpcVsWays ? &domainCodeIpc : nullptr, apps,
+        maxClusters, app_partitions, app_code_partitions,
+        mba ? app_bw_percents : nullptr);
+    if (domainK == 0) {
+      log_printf("[ERROR] Keeping the previous partitions\n");
+      return;
+    }
+    totalK += domainK;
   }
+  K = totalK;
 
-  if (pinfo.numPhases % invokeMonitorLen == 0 && estimateMRCenabled) {
-    pinfo.lastInstrCtr = pinfo.values[0];
-    pinfo.lastCyclesCtr = pinfo.values[2];
-#ifdef USE_CMT
-    pinfo.lastMemTrafficCtr = pinfo.memTrafficTotal;
-#endif
+  // Now apply this partitioning plan:
+  cache_utils::apply_partition_plan(
+      app_partitions, numApps, codeIpcVsWays ? app_code_partitions : nullptr,
+      mba ? app_bw_percents : nullptr);
+}
 
-    if (pinfo.pidx == 0 && (pinfo.numPhases < pinfo.maxPhases)) { //Master
-      if (enableLogging) {
-        printf("\n[INFO] Master process invokes beginning of profiling for "
-               "PROC %d, PHASE %d\n",
-               procIdxProfiled_global, pinfo.numPhases);
-      }
+// ---------------------------------------------------------- //
+// Points of pinfo's sweep the curves are fitted to, i.e., its way counts and
+// their IPCs and MPKIs: low-confidence points, whose counters ran less than
+// MIN_RUNNING_RATIO of their sample, are left out and interpolated from their
+// neighbours instead, unless they bound the sampled range
+void confident_points(const ProcessInfo &pinfo, arma::vec &x, arma::vec &ipc,
+                      arma::vec &mpki) {
+  double lo = pinfo.xPoints.min(), hi = pinfo.xPoints.max();
+  std::vector<uint32_t> keep;
+  for (uint32_t i = 0; i < pinfo.xPoints.n_elem; i++) {
+    if (pinfo.yPoints_conf[i] >= MIN_RUNNING_RATIO ||
+        pinfo.xPoints[i] == lo || pinfo.xPoints[i] == hi)
+      keep.push_back(i);
+  }
+  if (keep.size() < pinfo.xPoints.n_elem && enableLogging)
+    log_printf("[INFO] PROC %d: %lu low-confidence points interpolated\n",
+               pinfo.pidx, pinfo.xPoints.n_elem - keep.size());
+  x.set_size(keep.size());
+  ipc.set_size(keep.size());
+  mpki.set_size(keep.size());
+  for (uint32_t k = 0; k < keep.size(); k++) {
+    x[k] = pinfo.xPoints[keep[k]];
+    ipc[k] = pinfo.yPoints_ipc[keep[k]];
+    mpki[k] = pinfo.yPoints_mpki[keep[k]];
+  }
+}
 
-      if (firstInvokation) {
-        invokeMonitorLen = profileInterval;
-        firstInvokation = false;
-      }
+// Turns the points sampled in a code pass into pinfo's IPC vs. code ways
+// curve, averaged over the last HIST_WINDOW_LENGTH episodes like the data
+// curves.
+void estimate_code_curve(ProcessInfo &pinfo) {
+  arma::vec xx = arma::linspace<vec>(1, cacheWays, cacheWays);
+  int col = est_col(pinfo.codeEstIndex);
+  arma::vec yyIpc = pinfo.codeIpcCurveEstimates.col(col);
+
+  // As with data, the first reading is only a warmup period
+  pinfo.xPoints.at(0) = pinfo.xPoints.at(1);
+  pinfo.yPoints_ipc.at(0) = pinfo.yPoints_ipc.at(1);
+  pinfo.yPoints_conf.at(0) = pinfo.yPoints_conf.at(1);
+  arma::vec x, ipc, mpki;
+  confident_points(pinfo, x, ipc, mpki);
+  interp1(x, ipc, xx, yyIpc, "linear");
+  yyIpc[cacheWays - 1] = yyIpc[cacheWays - 2];
+  pinfo.codeIpcCurveEstimates.col(col) = yyIpc;
+
+  int startCol = std::max(0, (pinfo.codeEstIndex - HIST_WINDOW_LENGTH));
+  int endCol = pinfo.codeEstIndex;
+  for (int w = 0; w < cacheWays; w++) {
+    double sum = 0.0;
+    for (int j = startCol; j <= endCol; j++)
+      sum += pinfo.codeIpcCurveEstimates(w, est_col(j));
+    pinfo.codeIpcCurveAvg[w] = sum / (endCol - startCol + 1);
+  }
+  pinfo.codeEstIndex++;
 
-      startTime(); //calculate elapsed time for profiling episode
+  sampledCodeIPCs.col(pinfo.pidx) = pinfo.codeIpcCurveAvg;
+  if (enableLogging) {
+    log_printf("\n -- sampledCodeIPCs -- \n");
+    pipeline::log_print(sampledCodeIPCs);
+  }
+}
 
-      monitorStartFlag = true;
-      sampleSlicesIdx = 0;
-      arma::mat C = allAppsCacheAssignments.slice(sampleSlicesIdx);
-      //Slice has all cache assignments in a form of a matrix
-      //Each row in the matrix corresponds to a given COS assignment
+// Profiles the same process again, now varying its code ways
+void start_code_profiling(ProcessInfo &pinfo) {
+  if (enableLogging)
+    log_printf("[INFO] Profiling code ways for PROC %d\n", pinfo.pidx);
+  profilingCode = true;
+  sampleSlicesIdx = 0;
+  arma::mat C = allAppsCacheAssignments.slice(sampleSlicesIdx);
+  set_cacheways_to_cores(C, procIdxProfiled_global);
+  sampleSlicesIdx++;
+}
 
-      set_cacheways_to_cores(C, procIdxProfiled_global);
-      sampleSlicesIdx++;
-    }
-  } else if (monitorStartFlag && (pinfo.numPhases % monitorLen == 0)) {
-    pinfo.xPoints[(sampleSlicesIdx - 1)] = currentlySampling(pinfo.pidx, 0);
+// Profiling episodes start on the phases of the first active process (the
+// master), and go through the active processes in order. Inactive slots
+// (daemon mode) are skipped.
+int first_active_proc() {
+  for (int p = 0; p < numProcesses; p++) {
+    if (processInfo[p].active)
+      return p;
+  }
+  return -1;
+}
 
-    //BUG: APM8 w/onlineProf: sometimes counters don't get updated even though
-    //process moved to next phase!
-    //Workaround: Enable hyperthreading and pin KPart to a thread not being used
-    //by a process being profiled
-    if ((double)(pinfo.values[0] - pinfo.lastInstrCtr) == 0) {
-      printf(" ### BUG ALERT WITH H/W COUNTERS ### pinfo.pidx = %d, "
-             "pinfo.pnumPhases = %d, pinfo.values[0] (instr)=%f, "
-             "pinfo.values[2] (cycles)=%f \n",
-             pinfo.pidx, pinfo.numPhases, (double) pinfo.values[0],
-             (double) pinfo.values[2]);
-      currentlySampling(pinfo.pidx, 1) = 5; //Mark as incomplete with error ..
-    } else { //Collect counters and mark as collected
-      pinfo.yPoints_ipc[(sampleSlicesIdx - 1)] =
-          (double)(pinfo.values[0] - pinfo.lastInstrCtr) /
-          (double)(pinfo.values[2] - pinfo.lastCyclesCtr);
-#ifdef USE_CMT
-      double misses = (double)(pinfo.memTrafficTotal -
-                               pinfo.lastMemTrafficCtr) / CACHE_LINE_SIZE;
-      ;
-      pinfo.yPoints_mpki[(sampleSlicesIdx - 1)] =
-          misses * 1000 / (pinfo.values[0] - pinfo.lastInstrCtr);
-#endif
-      currentlySampling(pinfo.pidx, 1) = 0; //Collected, mark as completed!
-    }
+int next_active_proc(int pidx) {
+  for (int p = pidx + 1; p < numProcesses; p++) {
+    if (processInfo[p].active)
+      return p;
+  }
+  return -1;
+}
 
-    pinfo.lastInstrCtr = pinfo.values[0];
-    pinfo.lastCyclesCtr = pinfo.values[2];
-#ifdef USE_CMT
-    pinfo.lastMemTrafficCtr = pinfo.memTrafficTotal;
-#endif
+// Called once the last process has been profiled
+void repartition(int phase) {
+  //Done sampling, apply partitioning
+  if (enableLogging)
+    log_printf("[Done sampling MRCs, now reapply partitioning; PHASE %d] \n",
+               phase);
+  stopTime("END OF PROFILING.");
 
-    if (enableLogging) {
-      printf("[INFO] pinfo.pidx = %d, pinfo.pnumPhases = %d, "
-             "sampledWays=%f,sampledIPC=%f, sampledMPKI=%f \n",
-             pinfo.pidx, pinfo.numPhases, pinfo.xPoints[(sampleSlicesIdx - 1)],
-             pinfo.yPoints_ipc[(sampleSlicesIdx - 1)],
-             pinfo.yPoints_mpki[(sampleSlicesIdx - 1)]);
-    }
+  // Do cache partitioning only
+  numSamples++;
+  if (numSamples == numSamplesBeforePartitioning && doMorePartitioning) {
+    if (enableLogging)
+      log_printf("[INFO] Clustering ... ");
+
+    startTime();
+    // Only the first numProcesses columns hold profiled apps
+    bool cdp = get_rdt_backend()->isCdpEnabled();
+    arma::mat codeIPCs;
+    if (cdp)
+      codeIPCs = sampledCodeIPCs.cols(0, numProcesses - 1);
+    cluster_mrcs(sampledMRCs.cols(0, numProcesses - 1),
+                 sampledIPCs.cols(0, numProcesses - 1),
+                 cdp ? &codeIPCs : nullptr);
+    stopTime("END OF CLUSTERING.");
+
+    // Old, per-app UCP partitioning:
+    //doUcpForIPCs(sampledIPCs);
+    //doUcpForMRCs(sampledMRCs);
+
+    numSamples = 0;
+  }
+  //[INFO]  Disable further monitoring and repartitioning
+  //doMorePartitioning = false;
+  //estimateMRCenabled = false;
+}
 
-    if (sampleSlicesIdx == numWaysToSample &&
-        currentlySampling(pinfo.pidx, 1) != 5) {
+// ---------------------------------------------------------- //
+// Counter values the next sample of pinfo starts from
+void save_counters(ProcessInfo &pinfo) {
+  pinfo.lastInstrCtr = pinfo.values[0];
+  pinfo.lastCyclesCtr = pinfo.values[2];
+  pinfo.lastTimeEnabled = pinfo.timeEnabled;
+  pinfo.lastTimeRunning = pinfo.timeRunning;
+  pinfo.lastMissCtr = count_misses(pinfo);
+}
 
-      // Use collected MRC samples to estimate MRC only for one profiled process
-      if (pinfo.pidx == procIdxProfiled_global) {
-        if (loggingMRCFlags(pinfo.pidx, 0) <
-            1) { //If this proc hasn't logged yet, log MRC
-          if (enableLogging)
-            printf("[In P%d - DONE SAMPLING]\n", pinfo.pidx);
+// Stores the IPC and MPKI of pinfo's last phase as its curve point at index
+// point. Returns the sampling status: 0 if collected, 5 if the phase has to
+// be sampled again (see currentlySampling).
+int collect_sample(ProcessInfo &pinfo, int point) {
+  //BUG: APM8 w/onlineProf: sometimes counters don't get updated even though
+  //process moved to next phase!
+  //Workaround: Enable hyperthreading and pin KPart to a thread not being used
+  //by a process being profiled
+  double ratio = running_ratio(pinfo.timeEnabled, pinfo.timeRunning,
+                               pinfo.lastTimeEnabled, pinfo.lastTimeRunning);
+  if (ratio <= 0) {
+    // Multiplexed out for the whole phase: there is nothing to scale up
+    log_printf("[INFO] PROC %d: counters did not run in phase %d, sampling "
+               "again\n",
+               pinfo.pidx, pinfo.numPhases);
+    pinfo.numLowConfidence++;
+    return 5; //Mark as incomplete with error ..
+  } else if ((double)(pinfo.values[0] - pinfo.lastInstrCtr) == 0) {
+    log_printf(" ### BUG ALERT WITH H/W COUNTERS ### pinfo.pidx = %d, "
+               "pinfo.pnumPhases = %d, pinfo.values[0] (instr)=%f, "
+               "pinfo.values[2] (cycles)=%f \n",
+               pinfo.pidx, pinfo.numPhases, (double) pinfo.values[0],
+               (double) pinfo.values[2]);
+    return 5; //Mark as incomplete with error ..
+  } else if (ratio < MIN_RUNNING_RATIO &&
+             pinfo.muxRetries < MUX_MAX_RETRIES) {
+    // Scaled counts of a mostly multiplexed-out group are too noisy for
+    // the curves; sample this allocation again
+    log_printf("[INFO] PROC %d: counters ran %.0f%% of phase %d "
+               "(multiplexed), sampling again\n",
+               pinfo.pidx, 100 * ratio, pinfo.numPhases);
+    pinfo.muxRetries++;
+    pinfo.numLowConfidence++;
+    return 5; //Mark as incomplete with error ..
+  } else { //Collect counters and mark as collected
+    if (ratio < MIN_RUNNING_RATIO)
+      log_printf("[INFO] PROC %d: keeping a low-confidence sample (counters "
+                 "ran %.0f%% of phase %d)\n",
+                 pinfo.pidx, 100 * ratio, pinfo.numPhases);
+    pinfo.muxRetries = 0;
+    pinfo.yPoints_conf[point] = std::min(ratio, 1.0);
+    pinfo.yPoints_ipc[point] =
+        (double)(pinfo.values[0] - pinfo.lastInstrCtr) /
+        (double)(pinfo.values[2] - pinfo.lastCyclesCtr);
+    double misses = count_misses(pinfo) - pinfo.lastMissCtr;
+    pinfo.yPoints_mpki[point] =
+        misses * 1000 / (pinfo.values[0] - pinfo.lastInstrCtr);
+    return 0; //Collected, mark as completed!
+  }
+}
 
-          //Print xpoints and ypoints then interpolate to derive linear function
-          arma::vec xx = arma::linspace<vec>(1, CACHE_WAYS, CACHE_WAYS);
-          arma::vec yyMrc = pinfo.mrcEstimates.col(pinfo.mrcEstIndex);
-          arma::vec yyIpc = pinfo.ipcCurveEstimates.col(pinfo.mrcEstIndex);
+// Turns the points sampled in pinfo's sweep into its miss and IPC curves,
+// averaged over the last HIST_WINDOW_LENGTH episodes
+void estimate_data_curves(ProcessInfo &pinfo) {
+  //Print xpoints and ypoints then interpolate to derive linear function
+  arma::vec xx = arma::linspace<vec>(1, cacheWays, cacheWays);
+  int col = est_col(pinfo.mrcEstIndex);
+  arma::vec yyMrc = pinfo.mrcEstimates.col(col);
+  arma::vec yyIpc = pinfo.ipcCurveEstimates.col(col);
+
+  // Need to ignore the first reading because it's only warmup period
+  // Consider the second reading only
+  pinfo.xPoints.at(0) = pinfo.xPoints.at(1);
+  pinfo.yPoints_mpki.at(0) = pinfo.yPoints_mpki.at(1);
+  pinfo.yPoints_ipc.at(0) = pinfo.yPoints_ipc.at(1);
+  pinfo.yPoints_conf.at(0) = pinfo.yPoints_conf.at(1);
+
+  // Interpolate to estimate the remaining points on the curves
+  arma::vec x, ipc, mpki;
+  confident_points(pinfo, x, ipc, mpki);
+  interp1(x, mpki, xx, yyMrc, "linear");
+  interp1(x, ipc, xx, yyIpc, "linear");
+
+  pinfo.mrcEstimates.col(col) = yyMrc;
+  pinfo.mrcEstimates.col(col)[(cacheWays - 1)] =
+      pinfo.mrcEstimates.col(col)[(cacheWays - 2)];
+
+  pinfo.ipcCurveEstimates.col(col) = yyIpc;
+  pinfo.ipcCurveEstimates.col(col)[(cacheWays - 1)] =
+      pinfo.ipcCurveEstimates.col(col)[(cacheWays - 2)];
+
+  //Dump estimates to file to analyze later
+  dump_mrc_estimates(pinfo);
+  dump_ipc_estimates(pinfo);
+
+  int startCol = std::max(0, (pinfo.mrcEstIndex - HIST_WINDOW_LENGTH));
+  int endCol = pinfo.mrcEstIndex;
+  double sum, count, avg;
+
+  //calc avg MRC curves
+  for (int w = 0; w < cacheWays; w++) {
+    sum = 0.0;
+    count = 0.0;
+    avg = 0.0;
+    for (int j = startCol; j <= endCol; j++) {
+      sum += pinfo.mrcEstimates(w, est_col(j));
+      count++;
+    }
+    avg = sum / count;
+    pinfo.mrcEstAvg[w] = avg;
+  }
 
-          // Need to ignore the first reading because it's only warmup period
-          // Consider the second reading only
-          pinfo.xPoints.at(0) = pinfo.xPoints.at(1);
-          pinfo.yPoints_mpki.at(0) = pinfo.yPoints_mpki.at(1);
-          pinfo.yPoints_ipc.at(0) = pinfo.yPoints_ipc.at(1);
+  //calc avg IPC curves
+  for (int w = 0; w < cacheWays; w++) {
+    sum = 0.0;
+    count = 0.0;
+    avg = 0.0;
+    for (int j = startCol; j <= endCol; j++) {
+      sum += pinfo.ipcCurveEstimates(w, est_col(j));
+      count++;
+    }
+    avg = sum / count;
+    pinfo.ipcCurveAvg[w] = avg;
+  }
 
-          // Interpolate to estimate the remaining points on the curves
-          interp1(pinfo.xPoints, pinfo.yPoints_mpki, xx, yyMrc, "linear");
-          interp1(pinfo.xPoints, pinfo.yPoints_ipc, xx, yyIpc, "linear");
+  if (enableLogging) {
+    log_printf(" ---- pinfo.mrcEstimates() ---- \n");
+    pipeline::log_print(est_window(pinfo.mrcEstimates, startCol, endCol));
+    log_printf(" ---- pinfo.ipcCurveEstimates() ---- \n");
+    pipeline::log_print(
+        est_window(pinfo.ipcCurveEstimates, startCol, endCol));
+  }
 
-          pinfo.mrcEstimates.col(pinfo.mrcEstIndex) = yyMrc;
-          pinfo.mrcEstimates.col(pinfo.mrcEstIndex)[(CACHE_WAYS - 1)] =
-              pinfo.mrcEstimates.col(pinfo.mrcEstIndex)[(CACHE_WAYS - 2)];
+  pinfo.mrcEstIndex++;
 
-          pinfo.ipcCurveEstimates.col(pinfo.mrcEstIndex) = yyIpc;
-          pinfo.ipcCurveEstimates.col(pinfo.mrcEstIndex)[(CACHE_WAYS - 1)] =
-              pinfo.ipcCurveEstimates.col(pinfo.mrcEstIndex)[(CACHE_WAYS - 2)];
+  //Store globally
+  sampledMRCs.col(pinfo.pidx) = pinfo.mrcEstAvg;
+  sampledIPCs.col(pinfo.pidx) = pinfo.ipcCurveAvg;
+  pinfo.profiled = true;
 
-          //Dump estimates to file to analyze later
-          dump_mrc_estimates(pinfo);
-          dump_ipc_estimates(pinfo);
+  if (enableLogging) {
+    log_printf("\n -- sampledMRCs -- \n");
+    pipeline::log_print(sampledMRCs);
 
-          loggingMRCFlags(pinfo.pidx, 0) = 1;
+    log_printf("\n -- sampledIPCs -- \n");
+    pipeline::log_print(sampledIPCs);
+  }
+}
 
-          int startCol = std::max(0, (pinfo.mrcEstIndex - HIST_WINDOW_LENGTH));
-          int endCol = pinfo.mrcEstIndex;
-          double sum, count, avg;
-
-          //calc avg MRC curves
-          for (int w = 0; w < CACHE_WAYS; w++) {
-            sum = 0.0;
-            count = 0.0;
-            avg = 0.0;
-            for (int j = startCol; j <= endCol; j++) {
-              sum += pinfo.mrcEstimates(w, j);
-              count++;
-            }
-            avg = sum / count;
-            pinfo.mrcEstAvg[w] = avg;
-          }
+// ---------------------------------------------------------- //
+// With KPART_PROFILE_GROUPS above 1, an episode profiles the active processes
+// together instead, following the slices of a profiling::SweepScheduler.
+// Groups run in the COSes reserved for profiling (see parse_profile_groups()):
+// group 0 in the first and the ways the other processes share in the second,
+// as in a serial sweep, then group g in the (g + 1)-th. COS 0 keeps the whole
+// cache. sampleSlicesIdx is then the number of sweep slices applied so far.
+int sweep_group_cos(int g) {
+  return cache_utils::profiling_cos((g == 0) ? 0 : g + 1);
+}
 
-          //calc avg IPC curves
-          for (int w = 0; w < CACHE_WAYS; w++) {
-            sum = 0.0;
-            count = 0.0;
-            avg = 0.0;
-            for (int j = startCol; j <= endCol; j++) {
-              sum += pinfo.ipcCurveEstimates(w, j);
-              count++;
-            }
-            avg = sum / count;
-            pinfo.ipcCurveAvg[w] = avg;
-          }
+int sweep_shared_cos() { return cache_utils::profiling_cos(1); }
 
-          if (enableLogging) {
-            printf(" ---- pinfo.mrcEstimates() ---- \n");
-            pinfo.mrcEstimates
-                .cols(std::max(0, (pinfo.mrcEstIndex - HIST_WINDOW_LENGTH)),
-                      pinfo.mrcEstIndex).print();
-            printf(" ---- pinfo.ipcCurveEstimates() ---- \n");
-            pinfo.ipcCurveEstimates
-                .cols(std::max(0, (pinfo.mrcEstIndex - HIST_WINDOW_LENGTH)),
-                      pinfo.mrcEstIndex).print();
-          } else {
-            pinfo.mrcEstimates
-                .cols(std::max(0, (pinfo.mrcEstIndex - HIST_WINDOW_LENGTH)),
-                      pinfo.mrcEstIndex);
-            pinfo.ipcCurveEstimates
-                .cols(std::max(0, (pinfo.mrcEstIndex - HIST_WINDOW_LENGTH)),
-                      pinfo.mrcEstIndex);
-          }
+// Whether slice s still has a process to profile, i.e., one that is active
+bool sweep_slice_active(int s) {
+  for (const profiling::SweepScheduler::Group &g : sweepSlices[s].groups) {
+    if (processInfo[sweepApps[g.app]].active)
+      return true;
+  }
+  return false;
+}
 
-          pinfo.mrcEstIndex++;
+// Gives each group of slice s its ways and moves the cores of its process
+// there; every other managed core goes to the shared COS
+int set_sweep_slice(int s) {
+  const profiling::SweepScheduler::Slice &slice = sweepSlices[s];
+  int sharedCos = sweep_shared_cos();
+  int numCos = sweep_group_cos(profileGroups - 1) + 1;
+  rdt::PartitionPlan plan;
+  plan.cbms.assign(numCos, (uint32_t) slice.sharedMask);
+  plan.cbms[0] = cache_utils::full_cbm(); // COS 0 keeps the whole cache
+  if (get_rdt_backend()->isMbaSupported())
+    plan.mbaPercents.assign(numCos, 100);
+
+  if (daemonMode) {
+    plan.coreCos.assign(numCores, -1);
+    for (int procID = 0; procID < numProcesses; procID++) {
+      for (int core : cache_utils::app_cores(procID)) {
+        if (core < numCores)
+          plan.coreCos[core] = sharedCos;
+      }
+    }
+  } else {
+    plan.coreCos.assign(numCores, sharedCos);
+  }
+  for (int procID = 0; procID < numProcesses; procID++) {
+    currentlySampling(procID, 0) = 0;
+    currentlySampling(procID, 1) = 0;
+  }
 
-          //Store globally
-          sampledMRCs.col(pinfo.pidx) = pinfo.mrcEstAvg;
-          sampledIPCs.col(pinfo.pidx) = pinfo.ipcCurveAvg;
+  std::vector<int> profiled;
+  std::stringstream groups;
+  for (size_t g = 0; g < slice.groups.size(); g++) {
+    const profiling::SweepScheduler::Group &group = slice.groups[g];
+    int pidx = sweepApps[group.app];
+    int cosID = sweep_group_cos(g);
+    plan.cbms[cosID] = (uint32_t) group.mask;
+    if (!processInfo[pidx].active)
+      continue; // its ways go unused for this slice
+    for (int core : cache_utils::app_cores(pidx)) {
+      if (core < numCores)
+        plan.coreCos[core] = cosID;
+    }
+    currentlySampling(pidx, 0) = group.ways;
+    currentlySampling(pidx, 1) = 1;
+    profiled.push_back(pidx);
+    groups << "PROC " << pidx << " to COS " << cosID << " ("
+           << rdt::cbm_to_string((uint32_t) group.mask)
+           << (group.warmup ? " warmup" : "") << "), ";
+  }
+#ifdef USE_CMT
+  monitor_profiled_processes(profiled);
+#endif
 
-          if (enableLogging) {
-            printf("\n -- sampledMRCs -- \n");
-            sampledMRCs.print();
+  int status = get_rdt_backend()->applyPlan(plan);
+  gettimeofday(&sliceStart, 0);
+  if (enableLogging) {
+    log_printf("[INFO] Profiling slice %d of %zu: %sothers to COS %d (%s "
+               "ways). Status= %d \n",
+               s + 1, sweepSlices.size(), groups.str().c_str(), sharedCos,
+               rdt::cbm_to_string((uint32_t) slice.sharedMask).c_str(),
+               status);
+    print_apply_latency("set_sweep_slice");
+  }
+  if (status != 0)
+    log_printf("[ERROR] Failed to change cache allocation for profiling "
+               "slice %d\n",
+               s + 1);
+  return status;
+}
 
-            printf("\n -- sampledIPCs -- \n");
-            sampledIPCs.print();
-          }
+// Schedules the sweep of the active processes and applies its first slice
+void start_sweep() {
+  sweepApps.clear();
+  for (int p = 0; p < numProcesses; p++) {
+    if (processInfo[p].active)
+      sweepApps.push_back(p);
+  }
+  std::vector<std::vector<int> > sizes(sweepApps.size(), sampleSizes);
+  profiling::SweepScheduler scheduler(cacheWays, profileGroups,
+                                      cache_utils::way_cut_allowed);
+  sweepSlices = scheduler.schedule(sizes);
+  sweepSamplesLeft.assign(sweepApps.size(), sampleSizes.size());
+  if (enableLogging)
+    log_printf("[INFO] Profiling %zu processes in %zu slices\n",
+               sweepApps.size(), sweepSlices.size());
+
+  sampleSlicesIdx = 0;
+  set_sweep_slice(sampleSlicesIdx++);
+}
+
+// Moves on to the next slice once every process of this one has its sample
+// (or left), and repartitions after the last one
+void next_sweep_slice(int phase) {
+  for (const profiling::SweepScheduler::Group &g :
+       sweepSlices[sampleSlicesIdx - 1].groups) {
+    int pidx = sweepApps[g.app];
+    if (processInfo[pidx].active && currentlySampling(pidx, 1) != 0)
+      return;
+  }
+  while (sampleSlicesIdx < (int) sweepSlices.size()) {
+    if (sweep_slice_active(sampleSlicesIdx)) {
+      set_sweep_slice(sampleSlicesIdx++);
+      return;
+    }
+    sampleSlicesIdx++;
+  }
+
+  struct timeval now;
+  gettimeofday(&now, 0);
+  double time = (now.tv_sec - startT.tv_sec) * 1e3 +
+                (now.tv_usec - startT.tv_usec) * 1e-3;
+  std::vector<std::vector<int> > sizes(sweepApps.size(), sampleSizes);
+  log_printf("[TIMECALC] Profiling sweep = %.3f ms, %zu slices for %zu "
+             "processes (%d one at a time)\n",
+             time, sweepSlices.size(), sweepApps.size(),
+             profiling::SweepScheduler::serialSlices(sizes));
+  monitorStartFlag = false;
+  repartition(phase);
+}
+
+// A phase of pinfo during a sweep: a sample, if pinfo is being profiled
+void on_sweep_phase(ProcessInfo &pinfo) {
+  const profiling::SweepScheduler::Group *group = nullptr;
+  for (const profiling::SweepScheduler::Group &g :
+       sweepSlices[sampleSlicesIdx - 1].groups) {
+    if (sweepApps[g.app] == pinfo.pidx)
+      group = &g;
+  }
+  if (!group || currentlySampling(pinfo.pidx, 1) == 0) {
+    save_counters(pinfo);
+    return;
+  }
+
+  // Samples go in the order of sampleSizes, after point 0, which warmups
+  // overwrite (see estimate_data_curves())
+  int point = 0;
+  if (!group->warmup)
+    point = 1 + (std::find(sampleSizes.begin(), sampleSizes.end(),
+                           group->ways) - sampleSizes.begin());
+  pinfo.xPoints[point] = group->ways;
+  currentlySampling(pinfo.pidx, 1) = collect_sample(pinfo, point);
+  save_counters(pinfo);
+
+  if (enableLogging) {
+    log_printf("[INFO] pinfo.pidx = %d, pinfo.pnumPhases = %d, "
+               "sampledWays=%f,sampledIPC=%f, sampledMPKI=%f%s \n",
+               pinfo.pidx, pinfo.numPhases, pinfo.xPoints[point],
+               pinfo.yPoints_ipc[point], pinfo.yPoints_mpki[point],
+               group->warmup ? " (warmup)" : "");
+  }
+
+  if (currentlySampling(pinfo.pidx, 1) == 0 && !group->warmup &&
+      --sweepSamplesLeft[group->app] == 0) {
+    if (enableLogging)
+      log_printf("[In P%d - DONE SAMPLING]\n", pinfo.pidx);
+    estimate_data_curves(pinfo);
+  }
+  next_sweep_slice(pinfo.numPhases);
+}
+
+// ---------------------------------------------------------- //
+// Per-phase profiling and partitioning logic. Called when pinfo crosses a
+// phase boundary, before its counters are read for the new phase.
+void on_phase(ProcessInfo &pinfo) {
+  ++pinfo.numPhases;
+#ifdef USE_CMT
+  // Give the processes waiting for an RMID their turn
+  if (pinfo.pidx == first_active_proc() && rmidPool->getNumWaiting() > 0) {
+    struct timeval now;
+    gettimeofday(&now, 0);
+    double sinceRotation = (now.tv_sec - lastRmidRotation.tv_sec) * 1e3 +
+                           (now.tv_usec - lastRmidRotation.tv_usec) / 1e3;
+    if (sinceRotation >= RMID_ROTATION_MS)
+      rotate_rmids(true);
+  }
+#endif
+  //log_printf("[TEST] PROC %d, PHASE %d", pinfo.pidx, pinfo.numPhases);
+  //assert(pinfo.numPhases <= pinfo.maxPhases);
+
+  // --------------------------------------------------- //
+  if (!monitorStartFlag && pinfo.numPhases > 1) {
+    save_counters(pinfo);
+  }
+
+  if (pinfo.numPhases % invokeMonitorLen == 0 && estimateMRCenabled) {
+    save_counters(pinfo);
+
+    if (pinfo.pidx == first_active_proc() &&
+        (pinfo.numPhases < pinfo.maxPhases)) { //Master
+      if (!processInfo[procIdxProfiled_global].active)
+        procIdxProfiled_global = pinfo.pidx;
+      if (enableLogging) {
+        log_printf("\n[INFO] Master process invokes beginning of profiling for "
+                   "PROC %d, PHASE %d\n",
+                   procIdxProfiled_global, pinfo.numPhases);
+      }
+
+      if (firstInvokation) {
+        invokeMonitorLen = profileInterval;
+        firstInvokation = false;
+      }
+
+      startTime(); //calculate elapsed time for profiling episode
+
+      monitorStartFlag = true;
+      profilingCode = false;
+      if (profileGroups > 1) {
+        start_sweep();
+      } else {
+        sampleSlicesIdx = 0;
+        arma::mat C = allAppsCacheAssignments.slice(sampleSlicesIdx);
+        //Slice has all cache assignments in a form of a matrix
+        //Each row in the matrix corresponds to a given COS assignment
+
+        set_cacheways_to_cores(C, procIdxProfiled_global);
+        sampleSlicesIdx++;
+      }
+    }
+  } else if (monitorStartFlag && profileGroups > 1 &&
+             (pinfo.numPhases % monitorLen == 0)) {
+    on_sweep_phase(pinfo);
+  } else if (monitorStartFlag && (pinfo.numPhases % monitorLen == 0)) {
+    pinfo.xPoints[(sampleSlicesIdx - 1)] = currentlySampling(pinfo.pidx, 0);
+    currentlySampling(pinfo.pidx, 1) =
+        collect_sample(pinfo, sampleSlicesIdx - 1);
+    save_counters(pinfo);
+
+    if (enableLogging) {
+      log_printf("[INFO] pinfo.pidx = %d, pinfo.pnumPhases = %d, "
+                 "sampledWays=%f,sampledIPC=%f, sampledMPKI=%f \n",
+                 pinfo.pidx, pinfo.numPhases,
+                 pinfo.xPoints[(sampleSlicesIdx - 1)],
+                 pinfo.yPoints_ipc[(sampleSlicesIdx - 1)],
+                 pinfo.yPoints_mpki[(sampleSlicesIdx - 1)]);
+    }
+
+    if (sampleSlicesIdx == numWaysToSample &&
+        currentlySampling(pinfo.pidx, 1) != 5) {
 
-          if (procIdxProfiled_global == (NUM_CORES - 1)) {
-            //Done sampling, apply partitioning
-            if (enableLogging)
-              printf(
-                  "[Done sampling MRCs, now reapply partitioning; PHASE %d] \n",
-                  pinfo.numPhases);
-            stopTime("END OF PROFILING.");
-
-            // Do cache partitioning only
-            numSamples++;
-            if (numSamples == numSamplesBeforePartitioning &&
-                doMorePartitioning) {
-              if (enableLogging)
-                printf("[INFO] Clustering ... ");
-
-              startTime();
-              cluster_mrcs(sampledMRCs, sampledIPCs);
-              stopTime("END OF CLUSTERING.");
-
-              // Old, per-app UCP partitioning:
-              //doUcpForIPCs(sampledIPCs);
-              //doUcpForMRCs(sampledMRCs);
-
-              numSamples = 0;
-            }
-            //[INFO]  Disable further monitoring and repartitioning
-            //doMorePartitioning = false;
-            //estimateMRCenabled = false;
+      // Use collected MRC samples to estimate MRC only for one profiled process
+      if (pinfo.pidx == procIdxProfiled_global) {
+        if (profilingCode) {
+          if (enableLogging)
+            log_printf("[In P%d - DONE SAMPLING CODE]\n", pinfo.pidx);
+          estimate_code_curve(pinfo);
+          profilingCode = false;
+          loggingMRCFlags(pinfo.pidx, 0) = 1;
+          if (next_active_proc(procIdxProfiled_global) < 0)
+            repartition(pinfo.numPhases);
+        } else if (loggingMRCFlags(pinfo.pidx, 0) <
+                   1) { //If this proc hasn't logged yet, log MRC
+          if (enableLogging)
+            log_printf("[In P%d - DONE SAMPLING]\n", pinfo.pidx);
+
+          estimate_data_curves(pinfo);
+
+          if (get_rdt_backend()->isCdpEnabled()) {
+            start_code_profiling(pinfo);
+          } else {
+            loggingMRCFlags(pinfo.pidx, 0) = 1;
+            if (next_active_proc(procIdxProfiled_global) < 0)
+              repartition(pinfo.numPhases);
           }
 
         } //end if(loggingMRCFlags(pinfo.pidx,0) < 1){  //If this proc hasn't
@@ -949,15 +1933,15 @@ void sigsage_handler(int n, siginfo_t *info, void *vsc) {
 
       if (loggingMRCFlags(procIdxProfiled_global, 0) == 1) {
         if (enableLogging)
-          printf("[INFO] Profiling done for PROC %d (activeProcs = %d)\n",
-                 procIdxProfiled_global, activeProcs);
+          log_printf("[INFO] Profiling done for PROC %d (activeProcs = %d)\n",
+                     procIdxProfiled_global, activeProcs.load());
 
-        loggingMRCFlags.zeros(); //= zeros<arma::vec>(NUM_CORES);
+        loggingMRCFlags.zeros(); //= zeros<arma::vec>(numCores);
         sampleSlicesIdx = 0;     //Start over
-        procIdxProfiled_global++;
+        procIdxProfiled_global = next_active_proc(procIdxProfiled_global);
 
-        if (procIdxProfiled_global >= numProcesses) {
-          procIdxProfiled_global = 0;
+        if (procIdxProfiled_global < 0) {
+          procIdxProfiled_global = std::max(0, first_active_proc());
           monitorStartFlag = false;
         }
 
@@ -966,49 +1950,157 @@ void sigsage_handler(int n, siginfo_t *info, void *vsc) {
         else { //get new allocated cache ways to sample
       if (pinfo.pidx == procIdxProfiled_global) {
         if (enableLogging) {
-          currentlySampling.print();
+          pipeline::log_print(currentlySampling);
         }
         if (currentlySampling(procIdxProfiled_global, 1) ==
             0) { //profiled process done?
           if (enableLogging) {
-            printf("[INFO] Master process invokes NEXT profiling plan .. \n");
+            log_printf(
+                "[INFO] Master process invokes NEXT profiling plan .. \n");
           }
           arma::mat C = allAppsCacheAssignments.slice(sampleSlicesIdx);
           set_cacheways_to_cores(C, procIdxProfiled_global);
           sampleSlicesIdx++;
         } else {
           //Still some processes didn't collect IPC...
-          printf("[INFO] Wait... \n");
+          log_printf("[INFO] Wait... \n");
         }
       }
     }
 
   }
   // --------------------------------------------------- //
+}
 
-  id = perf_fd2event(pinfo.fds, numEvents, info->si_fd);
-  if (id == -1)
-    errx(1, "cannot find event for descriptor %d", info->si_fd);
-  if (id != 0)
-    errx(1, "only first event is supposed to fire");
+// ---------------------------------------------------------- //
+// Phase boundaries of launched processes are handled off the signal path.
+// The pump thread receives SIGSAGE through a signalfd and only moves the
+// sample record from the group leader's ring buffer into plannerQueue; the
+// planner thread runs the phase logic (profiling, MRC estimation,
+// clustering and CAT programming) on the samples, in order. A clustering
+// pass thus delays when later phases are processed, but not their counter
+// values, which the kernel captures when each phase ends.
+//
+// In daemon mode, workloads added and removed at runtime go through the same
+// queue, so that only the planner ever changes processInfo.
+//
+// The pump also runs the phase timer (see PhaseDriver). With time phases it
+// reads every process's counters on each tick, so all processes are sampled
+// on the same grid; otherwise each tick is a TICK event, on which the
+// planner ends profiling slices that ran past PROFILE_SLICE_MAX_MS.
+struct PlannerEvent {
+  enum Kind { PHASE, ADD, REMOVE, TICK } kind;
+  PhaseSample sample; // PHASE
+  std::string spec;   // ADD, REMOVE: see attach_workload()
+};
 
-  hdr = reinterpret_cast<struct perf_event_mmap_page *>(pinfo.fds[id].buf);
+pipeline::SignalPump *phasePump = nullptr;
+pipeline::WorkQueue<PlannerEvent> plannerQueue;
+std::thread planner;
+int phaseTimerFd = -1;
+std::atomic<uint64_t> phaseTicks(0), missedPhaseTicks(0);
 
-  ret = perf_read_buffer(&pinfo.fds[id], &ehdr, sizeof(ehdr));
-  if (ret)
+void attach_workload(const std::string &spec);
+void detach_workload(const std::string &spec);
+
+// Runs on the pump thread; touches nothing but the ring buffer
+void on_phase_signal(const struct signalfd_siginfo &info) {
+  struct perf_event_header ehdr;
+  int id, ret;
+
+  std::lock_guard<std::mutex> lock(pidMapMutex);
+  auto it = pidMap.find(info.ssi_fd);
+  if (it == pidMap.end()) {
+    if (daemonMode)
+      return; // queued before its workload was detached
+    errx(1, "cannot find process for descriptor %d", info.ssi_fd);
+  }
+  ProcessInfo &pinfo = *it->second;
+
+  perf_event_desc_t *group = nullptr;
+  for (perf_event_desc_t *g : pinfo.groups) {
+    if (perf_fd2event(g, numEvents, info.ssi_fd) != -1)
+      group = g;
+  }
+  id = group ? perf_fd2event(group, numEvents, info.ssi_fd) : -1;
+  if (id == -1)
+    errx(1, "cannot find event for descriptor %d", info.ssi_fd);
+  if (id != phaseEvent)
+    errx(1, "only the phase event is supposed to fire");
+
+  ret = perf_read_buffer(&group[id], &ehdr, sizeof(ehdr));
+  if (ret) {
+    if (daemonMode)
+      return; // the descriptor was reused by a newly attached workload
     errx(1, "cannot read event header");
+  }
   if (ehdr.type != PERF_RECORD_SAMPLE) {
     errx(1, "unknown event type %d, skipping", ehdr.type);
   }
 
-  //First val is a special case, need to read it regardless
-  uint64_t dummy;
-  ret = perf_read_buffer(&pinfo.fds[id], &dummy, sizeof(uint64_t));
+  // The sample holds the group's values at the overflow, so they are taken
+  // from the ring buffer instead of read() again
+  size_t sampleWords = (ehdr.size - sizeof(ehdr)) / sizeof(uint64_t);
+  uint64_t buf[sampleWords];
+  ret = perf_read_buffer(&group[id], buf, sizeof(buf));
   if (ret)
-    errx(1, "cannot read first value");
+    errx(1, "cannot read sample values");
+
+  PlannerEvent ev;
+  ev.kind = PlannerEvent::PHASE;
+  if (pinfo.groups.size() == 1)
+    decode_group_read(pinfo, buf, sampleWords, ev.sample);
+  else
+    read_groups(pinfo, ev.sample); // a cgroup: sum all of its CPUs
+  plannerQueue.push(std::move(ev));
+}
 
-  // dump_counters reads and updates values
-  dump_counters(pinfo);
+// Runs on the pump thread, on every expiration of the phase timer
+void on_phase_timer() {
+  uint64_t expirations;
+  if (read(phaseTimerFd, &expirations, sizeof(expirations)) !=
+      sizeof(expirations))
+    return;
+  phaseTicks += expirations;
+  missedPhaseTicks += expirations - 1;
+
+  if (phaseDriver != PHASE_TIME) {
+    PlannerEvent ev;
+    ev.kind = PlannerEvent::TICK;
+    plannerQueue.push(std::move(ev));
+    return;
+  }
+
+  // One phase for every process with counters, read back to back
+  std::lock_guard<std::mutex> lock(pidMapMutex);
+  for (ProcessInfo &pinfo : processInfo) {
+    if (pinfo.readers.empty())
+      continue;
+    PlannerEvent ev;
+    ev.kind = PlannerEvent::PHASE;
+    read_groups(pinfo, ev.sample);
+    plannerQueue.push(std::move(ev));
+  }
+}
+
+// Starts the phase timer, once the processes run
+void arm_phase_timer() {
+  double periodMs =
+      (phaseDriver == PHASE_TIME) ? phaseLen / 1e6 : PROFILE_SLICE_MAX_MS / 4;
+  int64_t periodNs = std::max<int64_t>(1, periodMs * 1e6);
+  struct itimerspec spec;
+  spec.it_interval.tv_sec = periodNs / 1000000000;
+  spec.it_interval.tv_nsec = periodNs % 1000000000;
+  spec.it_value = spec.it_interval;
+  if (timerfd_settime(phaseTimerFd, 0, &spec, nullptr) == -1)
+    err(1, "cannot arm phase timer");
+}
+
+// Runs on the planner thread
+void end_phase(ProcessInfo &pinfo, const PhaseSample &sample) {
+  on_phase(pinfo);
+  set_counters(pinfo, sample);
+  log_counters(pinfo);
 
   if (pinfo.numPhases == pinfo.maxPhases) {
 #ifdef MASTER_PROC
@@ -1018,28 +2110,180 @@ void sigsage_handler(int n, siginfo_t *info, void *vsc) {
     assert(pinfo.pidx == 0);
 #endif
     if (--activeProcs == 0) {
-      printf("[KPART] Stats collection done; killing process tree\n");
+      log_printf("[KPART] Stats collection done; killing process tree\n");
       fflush(stdout);
       inRoi = false;
-      for (auto &pinfo : processInfo) {
-        do {
-          kill(pinfo.pid, SIGKILL);
-          // ptrace(PTRACE_KILL, pinfo.pid, NULL, NULL);
-        } while (waitpid(pinfo.pid, NULL, 0) != -1);
-      }
+      // profile() reaps them
+      for (auto &pinfo : processInfo)
+        kill(pinfo.pid, SIGKILL);
+    }
+  }
+}
+
+// Ends the current profiling slice with a direct read of the profiled
+// process's counters if it reached no phase boundary in PROFILE_SLICE_MAX_MS
+void end_slow_slice() {
+  if (!monitorStartFlag)
+    return;
+  // The processes the slice waits for
+  std::vector<int> profiled(1, procIdxProfiled_global);
+  if (profileGroups > 1) {
+    profiled.clear();
+    for (const profiling::SweepScheduler::Group &g :
+         sweepSlices[sampleSlicesIdx - 1].groups) {
+      if (currentlySampling(sweepApps[g.app], 1) != 0)
+        profiled.push_back(sweepApps[g.app]);
+    }
+  }
+
+  for (int pidx : profiled) {
+    // Ending a phase may end the slice, or the episode
+    ProcessInfo &pinfo = processInfo[pidx];
+    struct timeval now;
+    gettimeofday(&now, 0);
+    double sliceMs = (now.tv_sec - sliceStart.tv_sec) * 1e3 +
+                     (now.tv_usec - sliceStart.tv_usec) / 1e3;
+    if (!monitorStartFlag || sliceMs < PROFILE_SLICE_MAX_MS)
+      return;
+    if (!pinfo.active)
+      continue;
+
+    PhaseSample sample;
+    {
+      std::lock_guard<std::mutex> lock(pidMapMutex);
+      if (pinfo.readers.empty())
+        continue;
+      read_groups(pinfo, sample);
     }
+    if (enableLogging)
+      log_printf("[INFO] PROC %d: no phase in %.1f ms, ending slice %d\n",
+                 pinfo.pidx, sliceMs, sampleSlicesIdx);
+    end_phase(pinfo, sample);
   }
 }
 
+void plan_phases() {
+  // Workloads join between profiling episodes, so that every episode
+  // profiles a fixed set
+  std::vector<std::string> pendingAdds;
+  PlannerEvent ev;
+  while (plannerQueue.pop(ev)) {
+    if (ev.kind == PlannerEvent::ADD) {
+      pendingAdds.push_back(ev.spec);
+    } else if (ev.kind == PlannerEvent::REMOVE) {
+      detach_workload(ev.spec);
+    } else if (!daemonMode && activeProcs == 0) {
+      continue; // stats collection is over
+    } else if (ev.kind == PlannerEvent::TICK) {
+      end_slow_slice();
+    } else {
+      ProcessInfo &pinfo = processInfo[ev.sample.pidx];
+      // Samples taken before a slice was ended by hand are stale
+      if (pinfo.active && pinfo.generation == ev.sample.generation &&
+          ev.sample.timeEnabled >= pinfo.timeEnabled)
+        end_phase(pinfo, ev.sample);
+    }
+
+    if (!monitorStartFlag) {
+      for (const std::string &spec : pendingAdds)
+        attach_workload(spec);
+      pendingAdds.clear();
+    }
+  }
+}
+
+void start_phase_pipeline() {
+  phasePump = new pipeline::SignalPump(SIGSAGE, on_phase_signal);
+  phaseTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (phaseTimerFd == -1)
+    err(1, "cannot create phase timer");
+  phasePump->watchFd(phaseTimerFd, on_phase_timer);
+  planner = std::thread(plan_phases);
+  phasePump->start();
+}
+
+void stop_phase_pipeline() {
+  phasePump->stop();
+  plannerQueue.close();
+  planner.join();
+  log_printf("[TIMECALC] %lu phase signals, %lu timer ticks (%lu missed), at "
+             "most %lu events queued for the planner\n",
+             phasePump->getNumSignals(), phaseTicks.load(),
+             missedPhaseTicks.load(), plannerQueue.getMaxDepth());
+  phasePump->unwatchFd(phaseTimerFd);
+  close(phaseTimerFd);
+  phaseTimerFd = -1;
+  delete phasePump;
+  phasePump = nullptr;
+}
+
+// Daemon mode: written by fini_handler() to stop run_daemon()
+int daemonStopFd = -1;
+
+// Written by fini_handler() to wake up shutdown_on_signal()
+int fatalSignalFd = -1;
+volatile sig_atomic_t fatalSignal = 0;
+
+void stop_async_log() { asyncLog->stop(); }
+
+// Only does what is async-signal-safe: hands the signal to run_daemon() or
+// to the shutdown thread, then parks the interrupted thread until that
+// thread exits the process (returning would re-run a faulting instruction,
+// or let abort() kill us before the children)
 void fini_handler(int sig) {
-  fprintf(stdout, "[KPART] Received signal, killing process tree\n");
-  fflush(stdout);
+  uint64_t one = 1;
+  if (daemonStopFd != -1 && (sig == SIGINT || sig == SIGTERM)) {
+    if (write(daemonStopFd, &one, sizeof(one)) == sizeof(one))
+      return; // run_daemon() shuts down cleanly
+  }
+
+  if (fatalSignalFd == -1)
+    _exit(1);
+  fatalSignal = sig;
+  if (write(fatalSignalFd, &one, sizeof(one)) != sizeof(one))
+    _exit(1);
+  for (;;)
+    pause();
+}
+
+// Runs on its own thread: kills the process tree once fini_handler() is
+// signaled, on a normal thread where stopping the log is allowed
+void shutdown_on_signal() {
+  sigset_t all;
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, nullptr);
+
+  uint64_t count;
+  while (read(fatalSignalFd, &count, sizeof(count)) == -1) {
+    if (errno != EINTR)
+      _exit(1);
+  }
+
+  // The children go first, with nothing that takes a lock
   for (auto &pinfo : processInfo) {
+    if (!pinfo.launched) // attached to, or simulated
+      continue;
     do {
       kill(pinfo.pid, SIGKILL);
     } while (waitpid(pinfo.pid, NULL, 0) != -1);
-    pinfo.flush();
   }
+
+  // Then the logs, as best we can: the thread fini_handler() parked may hold
+  // the stdout lock, or be inside asyncLog->stop() itself, so this gives up
+  // after FLUSH_TIMEOUT_MS
+  const int FLUSH_TIMEOUT_MS = 1000;
+  std::atomic<bool> flushed(false);
+  std::thread([&flushed]() {
+    asyncLog->stop();
+    fprintf(stdout, "[KPART] Received signal %d, killed process tree\n",
+            (int)fatalSignal);
+    fflush(stdout);
+    for (auto &pinfo : processInfo)
+      pinfo.flush();
+    flushed = true;
+  }).detach();
+  for (int ms = 0; ms < FLUSH_TIMEOUT_MS && !flushed; ms += 10)
+    usleep(10 * 1000);
   _exit(1);
 }
 
@@ -1081,33 +2325,71 @@ void print_core_assignments() {
 
     std::vector<int> cores = parse_cpuset(&cpuset);
 
-    printf("[KPART] [Proc %d (pid %d)] Core mapping: ", pinfo.pidx, pinfo.pid);
+    log_printf("[KPART] [Proc %d (pid %d)] Core mapping: ", pinfo.pidx,
+               pinfo.pid);
     for (int c : cores) {
 #ifdef USE_CMT
-      uint64_t rmid = cmtCtrl.getRmid(c);
-      printf("%d (rmid %lu) | ", c, rmid);
+      uint64_t rmid = get_rdt_backend()->getRmid(c);
+      log_printf("%d (rmid %lu) | ", c, rmid);
 #else
-      printf("%d | ", c);
+      log_printf("%d | ", c);
 #endif
     }
-    printf("\n");
+    log_printf("\n");
   }
 
   fflush(stdout);
 }
 
+// Waits for the next launched process to exit, through the pidfds of those
+// still running (or waitpid() on kernels without pidfds). Returns its pid, or
+// -1 with errno set to ECHILD once all have been reaped.
+pid_t wait_launched(int *status) {
+  std::vector<struct pollfd> pfds;
+  std::vector<ProcessInfo *> procs;
+  for (ProcessInfo &pinfo : processInfo) {
+    if (pinfo.pidFd == -1)
+      continue;
+    struct pollfd pfd = { pinfo.pidFd, POLLIN, 0 };
+    pfds.push_back(pfd);
+    procs.push_back(&pinfo);
+  }
+  if (pfds.empty())
+    return waitpid(-1, status, 0);
+
+  if (poll(pfds.data(), pfds.size(), -1) == -1)
+    return -1;
+  for (size_t i = 0; i < pfds.size(); i++) {
+    if (!pfds[i].revents)
+      continue;
+    ProcessInfo &pinfo = *procs[i];
+    close(pinfo.pidFd);
+    pinfo.pidFd = -1;
+    return waitpid(pinfo.pid, status, 0);
+  }
+  return -1;
+}
+
+// Children wait at a start barrier (a pipe) until their counters are set up,
+// then exec; the counters are enabled by the exec itself (enable_on_exec), so
+// KPart never stops or traces them.
 void profile(char **argv) {
+  int barrier[2];
+  if (pipe2(barrier, O_CLOEXEC) == -1)
+    err(1, "cannot create start barrier");
+  bool usePidfds = true;
 
   for (ProcessInfo &pinfo : processInfo) {
     // Don't want buffered parent output showing up in the child's stream
+    asyncLog->drain();
     fflush(stdout);
     fflush(stderr);
     pid_t child = fork();
     if (child == -1)
       err(1, "cannot fork process\n");
 
-    if (child == 0) {                        // child
-      ptrace(PTRACE_TRACEME, 0, NULL, NULL); // pauses after exec
+    if (child == 0) { // child
+      pipeline::SignalPump::unblockSignal(SIGSAGE); // inherited from us
       char **childArgs = new char *[pinfo.args.size() + 1];
 
       for (int i = 0; i < pinfo.args.size(); ++i) {
@@ -1136,11 +2418,18 @@ void profile(char **argv) {
       redirect_stream("stderr", STDERR_FILENO, O_WRONLY | O_CREAT | O_TRUNC,
                       S_IRUSR | S_IWUSR | S_IROTH | S_IWOTH);
 
+      // One byte per child; end of file means KPart is gone
+      close(barrier[1]);
+      char go;
+      if (read(barrier[0], &go, 1) != 1)
+        _exit(1);
+
       execvp(childArgs[0], childArgs);
 
       err(-1, "exec failed");
     } else { // Parent
       pinfo.pid = child;
+      pinfo.launched = true;
 
       // Set CPU affinity for child
       cpu_set_t cpuset;
@@ -1150,12 +2439,28 @@ void profile(char **argv) {
       if (sched_setaffinity(pinfo.pid, sizeof(cpuset), &cpuset) == -1)
         err(-1, "[Proc %d] sched_setaffinity() failed", pinfo.pidx);
 
-      printf("[KPART] Launched Process %d (pid %d)\n", pinfo.pidx, pinfo.pid);
+      log_printf("[KPART] Launched Process %d (pid %d)\n", pinfo.pidx,
+                 pinfo.pid);
       fflush(stdout);
 
+      if (usePidfds) {
+        pinfo.pidFd = open_pidfd(pinfo.pid);
+        if (pinfo.pidFd == -1) {
+          warn("no pidfds; waiting for exits with waitpid()");
+          usePidfds = false;
+        }
+      }
+
       setup_counters(pinfo);
     }
   }
+  if (!usePidfds) {
+    for (ProcessInfo &pinfo : processInfo) {
+      if (pinfo.pidFd != -1)
+        close(pinfo.pidFd);
+      pinfo.pidFd = -1;
+    }
+  }
 
   print_core_assignments();
 
@@ -1167,7 +2472,6 @@ void profile(char **argv) {
 #else
     ++activeProcs;
 #endif
-    ptrace(PTRACE_CONT, pinfo.pid, NULL, NULL);
   }
 
 #ifdef MASTER_PROC
@@ -1177,11 +2481,26 @@ void profile(char **argv) {
 
   inRoi = true;
 
+  // Release all children at once
+  std::string go(processInfo.size(), 'g');
+  if (write(barrier[1], go.data(), go.size()) != (ssize_t) go.size())
+    err(1, "cannot release start barrier");
+  close(barrier[0]);
+  close(barrier[1]);
+  arm_phase_timer();
+
   while (true) {
     int status;
-    pid_t child = waitpid(-1, &status, __WALL);
-    if (activeProcs == 0)
+    pid_t child = wait_launched(&status);
+    if (activeProcs == 0) {
+      // The planner killed the process tree once stats were collected
+      for (auto &pinfo : processInfo) {
+        do {
+          kill(pinfo.pid, SIGKILL);
+        } while (waitpid(pinfo.pid, NULL, 0) != -1);
+      }
       return;
+    }
     if (child == -1) {
       if (errno == ECHILD) {
         return; // no more children
@@ -1190,16 +2509,18 @@ void profile(char **argv) {
       if (WIFEXITED(status)) {
         if (inRoi) {
 
-          printf("\n WIFEXITED(%d); inRoi=True.\n", status);
+          log_printf("\n WIFEXITED(%d); inRoi=True.\n", status);
+          // The planner thread ends phases until it is stopped; only then
+          // are the phase counts final
+          stop_phase_pipeline();
           for (auto &pinfo : processInfo) {
-            printf("[EXIT-LOG] pinfo.pidx = %d, pinfo.pnumPhases = %d \n",
-                   pinfo.pidx, pinfo.numPhases);
+            log_printf("[EXIT-LOG] pinfo.pidx = %d, pinfo.pnumPhases = %d \n",
+                       pinfo.pidx, pinfo.numPhases);
           }
 
           for (auto &pinfo : processInfo) {
             do {
               kill(pinfo.pid, SIGKILL);
-              // ptrace(PTRACE_KILL, pinfo.pid, NULL, NULL);
             } while (waitpid(pinfo.pid, NULL, 0) != -1);
           }
 
@@ -1207,23 +2528,141 @@ void profile(char **argv) {
           double elapsedtime = (endAll.tv_sec - startAll.tv_sec) * 1e3 +
                                (endAll.tv_usec - startAll.tv_usec) * 1e-3;
 
-          printf("[TIMECALC] total elapsed time = %.3f ms\n", elapsedtime);
+          log_printf("[TIMECALC] total elapsed time = %.3f ms\n", elapsedtime);
 
           err(-1, "Child %d finished while in ROI (status %d)", child, status);
         } else {
-          printf("[KPART] Child %d done\n", child);
+          log_printf("[KPART] Child %d done\n", child);
           gettimeofday(&endAll, 0);
           double elapsedtime = (endAll.tv_sec - startAll.tv_sec) * 1e3 +
                                (endAll.tv_usec - startAll.tv_usec) * 1e-3;
-          printf("[TIMECALC] total elapsed time = %.3f ms\n", elapsedtime);
+          log_printf("[TIMECALC] total elapsed time = %.3f ms\n", elapsedtime);
         }
-      } else {
-        ptrace(PTRACE_CONT, child, NULL, NULL);
       }
     }
   }
 }
 
+// Builds the simulated platform described by spec (see
+// sim::parse_platform_config) and installs it before any CAT/CMT access
+void setup_sim(const char *spec) {
+  sim::PlatformConfig cfg;
+  try {
+    cfg = sim::parse_platform_config(spec);
+  } catch (std::exception &e) {
+    errx(1, "[SIM] Invalid KPART_SIM '%s': %s", spec, e.what());
+  }
+  simPlatform = new sim::SimPlatform(cfg);
+  simPlatform->install();
+  log_printf("[SIM] Simulated platform: %d cores, %d ways (%.2f MB each), %d "
+             "COS, %d RMIDs, %.1f GHz\n",
+             cfg.numCores, cfg.numWays, cfg.wayBytes / (1024 * 1024),
+             cfg.numCos, cfg.numRmids, cfg.freqGhz);
+}
+
+// Stands in for global_setup_counters() on the simulated platform: only the
+// event names are kept
+void sim_setup_counters(const char *events) {
+  std::vector<std::string> names;
+  std::stringstream ss(events);
+  std::string name;
+  while (std::getline(ss, name, ','))
+    names.push_back(name);
+  if (names.size() < 3)
+    errx(1, "[SIM] Need instructions, LLC references and cycles events");
+
+  numEvents = names.size();
+  globFds = static_cast<perf_event_desc_t *>(
+      calloc(numEvents, sizeof(perf_event_desc_t)));
+  for (int i = 0; i < numEvents; i++)
+    globFds[i].name = strdup(names[i].c_str());
+}
+
+// Runs every process as the synthetic app given by its command ("sim:...",
+// see sim::parse_app_model) on its first core. Instead of waiting for perf
+// signals, the loop advances the simulated clock straight to the next phase
+// boundary of any process and runs the phase logic for it, so a run is
+// fully deterministic and takes only as long as KPart's own decisions.
+void simulate() {
+  for (ProcessInfo &pinfo : processInfo) {
+    if (pinfo.args.empty() || pinfo.cores.empty())
+      errx(1, "[SIM] Proc %d needs a core and a sim: app spec", pinfo.pidx);
+    int core = pinfo.cores[0];
+    if (core >= simPlatform->getNumCores() || simPlatform->hasApp(core))
+      errx(1, "[SIM] Proc %d: core %d is out of range or taken", pinfo.pidx,
+           core);
+    try {
+      simPlatform->setApp(core, sim::parse_app_model(pinfo.args[0]));
+    } catch (std::exception &e) {
+      errx(1, "[SIM] Proc %d: %s", pinfo.pidx, e.what());
+    }
+
+    pinfo.fds = globFds;
+    pinfo.values.assign(numEvents, 0);
+#ifdef USE_CMT
+    initCmt(pinfo);
+#endif
+#ifdef MASTER_PROC
+    if (pinfo.pidx == 0)
+      ++activeProcs;
+#else
+    ++activeProcs;
+#endif
+    log_printf("[SIM] Process %d: %s on core %d\n", pinfo.pidx, pinfo.args[0],
+               core);
+  }
+
+#ifdef USE_CMT
+  cmtSampler->sampleOnce(); // baseline at time 0
+#endif
+
+  inRoi = true;
+  while (activeProcs > 0) {
+    // Next process to reach a phase boundary; ties go to the lowest index
+    ProcessInfo *next = nullptr;
+    uint64_t nextNs = std::numeric_limits<uint64_t>::max();
+    for (ProcessInfo &pinfo : processInfo) {
+      double boundary = (double)(pinfo.numPhases + 1) * phaseLen;
+      uint64_t ns = simPlatform->nsUntil(pinfo.cores[0], boundary);
+      if (ns < nextNs) {
+        nextNs = ns;
+        next = &pinfo;
+      }
+    }
+
+    simPlatform->advance(nextNs);
+#ifdef USE_CMT
+    cmtSampler->sampleOnce();
+#endif
+    on_phase(*next);
+    dump_counters(*next);
+
+    if (next->numPhases == next->maxPhases) {
+#ifdef MASTER_PROC
+      assert(next->pidx == 0);
+#endif
+      --activeProcs;
+    }
+  }
+  inRoi = false;
+
+  double simMs = simPlatform->nowNs() * 1e-6;
+  double totalIpc = 0.0;
+  for (ProcessInfo &pinfo : processInfo) {
+    sim::SimPlatform::CoreCounters ctrs =
+        simPlatform->getCounters(pinfo.cores[0]);
+    double ipc = ctrs.instructions / ctrs.cycles;
+    totalIpc += ipc;
+    log_printf("[SIM] Proc %d: IPC = %.3f, MPKI = %.2f, effective ways = "
+               "%.2f\n",
+               pinfo.pidx, ipc, ctrs.llcMisses * 1000 / ctrs.instructions,
+               simPlatform->getEffectiveWays(pinfo.cores[0]));
+  }
+  log_printf("[SIM] Simulated time = %.3f ms, throughput = %.3f (sum of "
+             "IPCs)\n",
+             simMs, totalIpc);
+}
+
 std::vector<int> parse_core_list(std::string corestr) {
   std::vector<int> cores;
   size_t remaining_len = corestr.size();
@@ -1245,13 +2684,473 @@ std::vector<int> parse_core_list(std::string corestr) {
   return cores;
 }
 
+// Opens the counter log and the MRC and IPC estimate logs of pinfo.pidx,
+// truncating those of any earlier workload in the slot
+void open_logs(ProcessInfo &pinfo) {
+  int pidx = pinfo.pidx;
+  if (logFile == "-") {
+    pinfo.logFd = stdout;
+    return;
+  }
+
+  // Binary logs start with the names of the events, so they are only
+  // created along with their header (see print_log_header())
+  if (!binaryLog) {
+    std::stringstream ss;
+    ss << logFile << "." << pidx;
+    FILE *fd = fopen(ss.str().c_str(), "w");
+    if (fd == nullptr)
+      errx(-1, "Error opening logFd for pidx %d", pidx);
+    pinfo.logFd = fd;
+  }
+
+  // Logging MRC estimates
+  std::stringstream ssmrc;
+  ssmrc << "onlineMRCSamples"
+        << "." << pidx;
+  FILE *mrclog = fopen(ssmrc.str().c_str(), "w");
+  if (mrclog == nullptr)
+    errx(-1, "Error opening log file for mrc estimates in pidx %d", pidx);
+  pinfo.mrcfd = mrclog;
+
+  // Logging IPC estimates
+  std::stringstream ssipc;
+  ssipc << "onlineIPCSamples"
+        << "." << pidx;
+  FILE *ipclog = fopen(ssipc.str().c_str(), "w");
+  if (ipclog == nullptr)
+    errx(-1, "Error opening log file for ipc estimates in pidx %d", pidx);
+  pinfo.ipcfd = ipclog;
+}
+
+void close_logs(ProcessInfo &pinfo) {
+  asyncLog->drain(); // queued records may still point to the logs
+  pinfo.flush();
+  if (pinfo.logFd && pinfo.logFd != stdout)
+    fclose(pinfo.logFd);
+  if (pinfo.mrcfd)
+    fclose(pinfo.mrcfd);
+  if (pinfo.ipcfd)
+    fclose(pinfo.ipcfd);
+  pinfo.logFd = pinfo.mrcfd = pinfo.ipcfd = nullptr;
+  pinfo.phaseLog.reset();
+}
+
+// Names of the logged values, unless they are pretty-printed with each value.
+// Binary logs instead log the running times behind RUNNING_RATIO, which is
+// the ratio of their increments over a phase.
+void print_log_header(ProcessInfo &pinfo) {
+  if (binaryLog) {
+    std::vector<std::string> columns;
+    for (uint32_t i = 0; i < numEvents; i++)
+      columns.push_back(globFds[i].name);
+#ifdef USE_CMT
+    columns.push_back(lmbName);
+    columns.push_back(l3OccupName);
+#endif
+    columns.push_back("TIME_ENABLED");
+    columns.push_back("TIME_RUNNING");
+
+    std::stringstream ss;
+    ss << logFile << "." << pinfo.pidx;
+    try {
+      pinfo.phaseLog = std::make_shared<PhaseLogWriter>(ss.str(), columns,
+                                                        pinfo.pidx);
+    } catch (PhaseLogException &e) {
+      errx(-1, "%s", e.what());
+    }
+    return;
+  }
+  if (prettyPrint)
+    return;
+  for (uint32_t i = 0; i < numEvents; i++) {
+    fprintf(pinfo.logFd, "%s | %s\n", globFds[i].name, globFds[i].name);
+  }
+#ifdef USE_CMT
+  fprintf(pinfo.logFd, "%s | %s\n", lmbName.c_str(), lmbName.c_str());
+  fprintf(pinfo.logFd, "%s | %s\n", l3OccupName.c_str(), l3OccupName.c_str());
+#endif
+  fprintf(pinfo.logFd, "%s | %s\n", runningRatioName.c_str(),
+          runningRatioName.c_str());
+}
+
+// Tells cache_utils which cores each process runs on; slots without a
+// workload run on none
+void update_app_cores() {
+  std::vector<std::vector<int> > appCores;
+  for (ProcessInfo &pinfo : processInfo)
+    appCores.push_back(pinfo.active ? pinfo.cores : std::vector<int>());
+  cache_utils::set_app_cores(appCores);
+}
+
+// ------------------------- Daemon mode ------------------------- //
+// KPart attaches to workloads that are already running, named by a spec:
+// "pid:<pid>" counts the process's main thread, like the processes KPart
+// launches; "cgroup:<dir>" counts every task of a cgroup v2 directory (e.g.,
+// a systemd service). Workloads come and go through the control FIFO; both
+// attach_workload() and detach_workload() run on the planner thread.
+
+// Slot of the attached workload spec, or -1
+int find_workload(const std::string &spec) {
+  for (int p = 0; p < numProcesses; p++) {
+    if (processInfo[p].active && processInfo[p].spec == spec)
+      return p;
+  }
+  return -1;
+}
+
+// Closes all of pinfo's counter groups. Signals they still have queued are
+// dropped by the phase pipeline.
+void close_counters(ProcessInfo &pinfo) {
+  std::lock_guard<std::mutex> lock(pidMapMutex);
+  pinfo.readers.clear();
+  for (perf_event_desc_t *fds : pinfo.groups) {
+    munmap(fds[phaseEvent].buf,
+           fds[phaseEvent].pgmsk + 1 + sysconf(_SC_PAGESIZE));
+    for (uint32_t i = 0; i < numEvents; i++) {
+      pidMap.erase(fds[i].fd);
+      close(fds[i].fd);
+    }
+    delete[] fds;
+  }
+  pinfo.groups.clear();
+  pinfo.fds = nullptr;
+}
+
+void push_planner_event(PlannerEvent::Kind kind, const std::string &spec) {
+  PlannerEvent ev;
+  ev.kind = kind;
+  ev.spec = spec;
+  plannerQueue.push(std::move(ev));
+}
+
+// Cores the workload may run on: a process's affinity, or a cgroup's
+// effective cpuset (all cores if it has no cpuset controller)
+bool workload_cores(int pid, const std::string &cgroup,
+                    std::vector<int> &cores) {
+  if (pid > 0) {
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    if (sched_getaffinity(pid, sizeof(cpuset), &cpuset) == -1)
+      return false;
+    cores = parse_cpuset(&cpuset);
+    return true;
+  }
+
+  std::ifstream cpus(cgroup + "/cpuset.cpus.effective");
+  std::string line;
+  if (cpus && std::getline(cpus, line))
+    cores = rdt::parse_cpu_list(line);
+  if (cores.empty()) {
+    for (int c = 0; c < numCores; c++)
+      cores.push_back(c);
+  }
+  return true;
+}
+
+void attach_workload(const std::string &spec) {
+  if (find_workload(spec) >= 0) {
+    log_printf("[KPART] %s is already attached\n", spec.c_str());
+    return;
+  }
+
+  int pid = -1;
+  std::string cgroup;
+  if (spec.compare(0, 4, "pid:") == 0 && atoi(spec.c_str() + 4) > 0) {
+    pid = atoi(spec.c_str() + 4);
+  } else if (spec.compare(0, 7, "cgroup:") == 0 && spec.size() > 7) {
+    cgroup = spec.substr(7);
+  } else {
+    log_printf("[ERROR] Bad workload %s (expected pid:<pid> or cgroup:<dir>)\n",
+               spec.c_str());
+    return;
+  }
+
+  std::vector<int> cores;
+  if (!workload_cores(pid, cgroup, cores)) {
+    log_printf("[ERROR] Cannot attach to %s: %s\n", spec.c_str(),
+               strerror(errno));
+    return;
+  }
+
+  // Take over the slot of a workload that is gone, if any. Slots never move,
+  // as pidMap points into processInfo (see run_daemon()).
+  int pidx = 0;
+  while (pidx < numProcesses && processInfo[pidx].active)
+    pidx++;
+  if (pidx == MAX_DAEMON_WORKLOADS) {
+    log_printf("[ERROR] Cannot attach to %s: already managing %d workloads\n",
+               spec.c_str(), MAX_DAEMON_WORKLOADS);
+    return;
+  }
+  // Phases of the slot's last workload that are still queued are dropped by
+  // their generation; this one stays inactive until it is fully set up. The
+  // phase timer goes through all slots (see on_phase_timer()).
+  {
+    std::lock_guard<std::mutex> lock(pidMapMutex);
+    if (pidx == numProcesses) {
+      processInfo.push_back(ProcessInfo());
+      numProcesses++;
+    }
+    uint64_t generation = processInfo[pidx].generation + 1;
+    processInfo[pidx] = ProcessInfo();
+    processInfo[pidx].generation = generation;
+    processInfo[pidx].pidx = pidx;
+  }
+  ProcessInfo &pinfo = processInfo[pidx];
+  pinfo.active = false;
+  pinfo.pid = pid;
+  pinfo.spec = spec;
+  pinfo.cgroup = cgroup;
+  pinfo.cores = cores;
+  pinfo.maxPhases = std::numeric_limits<int>::max();
+
+  bool ok;
+  if (cgroup.empty()) {
+    setup_counters(pinfo);
+    ok = !pinfo.groups.empty();
+  } else {
+    ok = setup_cgroup_counters(pinfo);
+  }
+
+  // The pidfd turns readable once the process exits
+  if (ok && pid > 0) {
+    pinfo.pidFd = open_pidfd(pid);
+    if (pinfo.pidFd == -1) {
+      warn("cannot track exit of %s", spec.c_str());
+      ok = false;
+    }
+  }
+  if (!ok) {
+    close_counters(pinfo);
+    log_printf("[ERROR] Cannot attach to %s\n", spec.c_str());
+    return;
+  }
+  if (pinfo.pidFd != -1) {
+    int pidFd = pinfo.pidFd;
+    phasePump->watchFd(pidFd, [pidFd, spec]() {
+      phasePump->unwatchFd(pidFd); // stays readable
+      push_planner_event(PlannerEvent::REMOVE, spec);
+    });
+  }
+
+  open_logs(pinfo);
+  print_log_header(pinfo);
+#ifdef USE_CMT
+  initCmt(pinfo);
+#endif
+  pinfo.active = true;
+  update_app_cores();
+  log_printf("[KPART] Attached to %s as PROC %d (cores %s)\n", spec.c_str(),
+             pidx, rdt::format_cpu_list(cores).c_str());
+  fflush(stdout);
+}
+
+void detach_workload(const std::string &spec) {
+  int pidx = find_workload(spec);
+  if (pidx < 0) {
+    log_printf("[KPART] %s is not attached\n", spec.c_str());
+    return;
+  }
+  ProcessInfo &pinfo = processInfo[pidx];
+
+  close_counters(pinfo);
+  if (pinfo.pidFd != -1) {
+    if (phasePump)
+      phasePump->unwatchFd(pinfo.pidFd);
+    close(pinfo.pidFd);
+    pinfo.pidFd = -1;
+  }
+#ifdef USE_CMT
+  rmidPinnedProcs.erase(
+      std::remove(rmidPinnedProcs.begin(), rmidPinnedProcs.end(), pidx),
+      rmidPinnedProcs.end());
+  int rmid = rmidPool->removeWorkload(pidx);
+  if (rmid >= 0)
+    get_rdt_backend()->unbindRmid(rmid);
+  pinfo.rmid = -1;
+  rotate_rmids(false); // hand the RMID on once it cools down
+#endif
+  pinfo.active = false;
+  pinfo.profiled = false;
+  close_logs(pinfo);
+  cache_utils::release_cores(pinfo.cores);
+  update_app_cores();
+  log_printf("[KPART] Detached from %s (PROC %d)\n", spec.c_str(), pidx);
+  fflush(stdout);
+
+  // A sweep goes on without the process, if any is left
+  if (monitorStartFlag && profileGroups > 1) {
+    int master = first_active_proc();
+    if (master >= 0) {
+      next_sweep_slice(processInfo[master].numPhases);
+    } else {
+      monitorStartFlag = false;
+      cache_utils::share_all_cache_ways();
+    }
+    return;
+  }
+
+  // A profiling episode goes on with the next process, if any is left
+  if (!monitorStartFlag || pidx != procIdxProfiled_global)
+    return;
+  loggingMRCFlags.zeros();
+  profilingCode = false;
+  sampleSlicesIdx = 0;
+  int next = next_active_proc(pidx);
+  if (next >= 0) {
+    procIdxProfiled_global = next;
+    set_cacheways_to_cores(allAppsCacheAssignments.slice(sampleSlicesIdx),
+                           procIdxProfiled_global);
+    sampleSlicesIdx++;
+    return;
+  }
+
+  monitorStartFlag = false;
+  int master = first_active_proc();
+  procIdxProfiled_global = std::max(0, master);
+  if (master >= 0)
+    repartition(processInfo[master].numPhases);
+  else
+    cache_utils::share_all_cache_ways();
+}
+
+// Parses the commands written to the control FIFO, one per line:
+//   add <spec>
+//   remove <spec>
+void read_control_fifo(int fd, std::string &pending) {
+  char buf[4096];
+  ssize_t n;
+  while ((n = read(fd, buf, sizeof(buf))) > 0)
+    pending.append(buf, n);
+
+  size_t eol;
+  while ((eol = pending.find('\n')) != std::string::npos) {
+    std::istringstream line(pending.substr(0, eol));
+    pending.erase(0, eol + 1);
+    std::string cmd, spec;
+    line >> cmd >> spec;
+    if (cmd == "add" && !spec.empty())
+      push_planner_event(PlannerEvent::ADD, spec);
+    else if (cmd == "remove" && !spec.empty())
+      push_planner_event(PlannerEvent::REMOVE, spec);
+    else if (!cmd.empty())
+      log_printf("[ERROR] Unknown control command: %s\n", line.str().c_str());
+  }
+}
+
+// Manages workloads until SIGINT or SIGTERM, then detaches from all of them
+// and gives the cache back to everyone
+void run_daemon() {
+  daemonStopFd = eventfd(0, 0);
+  if (daemonStopFd == -1)
+    err(1, "cannot create stop event");
+
+  // Opened for writing too, so that the FIFO never reports a hang-up when
+  // its last writer goes away
+  if (mkfifo(controlFifo.c_str(), 0600) == -1 && errno != EEXIST)
+    err(1, "cannot create control FIFO %s", controlFifo.c_str());
+  int controlFd = open(controlFifo.c_str(), O_RDWR | O_NONBLOCK);
+  if (controlFd == -1)
+    err(1, "cannot open control FIFO %s", controlFifo.c_str());
+
+  start_phase_pipeline();
+  std::string pending;
+  phasePump->watchFd(controlFd, [controlFd, &pending]() {
+    read_control_fifo(controlFd, pending);
+  });
+  for (const std::string &spec : daemonSpecs)
+    push_planner_event(PlannerEvent::ADD, spec);
+  arm_phase_timer();
+  log_printf("[KPART] Daemon started, control FIFO %s\n", controlFifo.c_str());
+  fflush(stdout);
+
+  uint64_t count;
+  while (read(daemonStopFd, &count, sizeof(count)) == -1) {
+    if (errno != EINTR)
+      err(1, "cannot wait for stop event");
+  }
+
+  phasePump->unwatchFd(controlFd);
+  stop_phase_pipeline();
+  monitorStartFlag = false; // no episode to go on with
+  for (int p = 0; p < numProcesses; p++) {
+    if (processInfo[p].active)
+      detach_workload(processInfo[p].spec);
+  }
+  close(controlFd);
+  cache_utils::share_all_cache_ways();
+  log_printf("[KPART] Daemon stopped\n");
+}
+
+void parse_phase_driver() {
+  const char *driver = getenv("KPART_PHASE_DRIVER");
+  if (!driver || std::string(driver) == "instructions")
+    return;
+  if (simPlatform)
+    errx(-1, "[KPART] The simulated platform only has instruction phases");
+  if (std::string(driver) == "cycles") {
+    phaseDriver = PHASE_CYCLES; // phaseEvent is found with the events
+  } else if (std::string(driver) == "time") {
+    phaseDriver = PHASE_TIME;
+  } else {
+    errx(-1, "[KPART] Unknown KPART_PHASE_DRIVER %s (instructions, cycles or "
+             "time)",
+         driver);
+  }
+}
+
+// After the RDT backend is up: the number of groups is bound by the COS (COS 0,
+// the shared COS and at least one cluster COS are not groups') and, with
+// CMT, the RMIDs to monitor them with. Reserves a profiling COS per group,
+// plus the shared one.
+void parse_profile_groups() {
+  const char *groups = getenv("KPART_PROFILE_GROUPS");
+  if (!groups)
+    return;
+  char *end;
+  long n = strtol(groups, &end, 10);
+  if (*groups == '\0' || *end != '\0' || n < 1)
+    errx(-1, "[KPART] Bad KPART_PROFILE_GROUPS: %s", groups);
+
+  int maxGroups = get_rdt_backend()->getNumCos() - 3;
+#ifdef USE_CMT
+  maxGroups = std::min(maxGroups, get_rdt_backend()->getNumRmids() - 1);
+#endif
+  profileGroups = std::max(1, (int) std::min<long>(n, maxGroups));
+  if (get_rdt_backend()->isCdpEnabled() && profileGroups > 1) {
+    // Code and data passes go one process at a time
+    log_printf("[KPART] CDP is on, profiling one process at a time\n");
+    profileGroups = 1;
+  }
+  if (profileGroups != n)
+    log_printf("[KPART] Profiling up to %d processes at once, not %ld\n",
+               profileGroups, n);
+  if (profileGroups + 1 > cache_utils::get_num_profiling_cos())
+    cache_utils::reserve_profiling_cos(profileGroups + 1);
+}
+
+void parse_log_format() {
+  const char *format = getenv("KPART_LOG_FORMAT");
+  if (!format || std::string(format) == "text")
+    return;
+  if (std::string(format) != "binary")
+    errx(-1, "[KPART] Unknown KPART_LOG_FORMAT %s (text or binary)", format);
+  if (prettyPrint)
+    errx(-1, "[KPART] Binary logs need a log file, not stdout");
+  binaryLog = true;
+}
+
 void parse_cmdline(int argc, char **argv) {
-  if (argc < 4) {
+  if (argc < 6) {
     errx(-1, "[KPART] Usage: %s <comma-sep-events> <phase_len> "
              "<logfile/- for stdout> <warmup_period_B> <profile_period_B>"
              "-- <max_phases_1> <input_redirect_1/'-' for stdin> "
-             " <comma-sep-core-list> prog1 -- ...",
-         argv[0]);
+             " <comma-sep-core-list> prog1 -- ...\n"
+             "    or: %s <comma-sep-events> <phase_len> "
+             "<logfile/- for stdout> <warmup_period_B> <profile_period_B>"
+             " --daemon <control_fifo> [pid:<pid>|cgroup:<dir>]...",
+         argv[0], argv[0]);
   }
 
   events = argv[1];
@@ -1260,6 +3159,7 @@ void parse_cmdline(int argc, char **argv) {
   logFile = argv[3];
   if (logFile == "-")
     prettyPrint = true;
+  parse_log_format();
 
   // Online profiling variables:
   int warmUpInstrBl = atoll(argv[4]);
@@ -1279,9 +3179,6 @@ void parse_cmdline(int argc, char **argv) {
       ProcessInfo &pinfo = processInfo.back();
       int pidx = numProcesses++;
       pinfo.pidx = pidx;
-#ifdef USE_CMT
-      pinfo.rmid = pidx;
-#endif
 
 // Each process has, as its first three arguments
 // (i.e., immediately following '--'), the following:
@@ -1299,92 +3196,121 @@ void parse_cmdline(int argc, char **argv) {
 #endif
       pinfo.input = argv[++arg];
       pinfo.cores = parse_core_list(argv[++arg]);
-
-      if (logFile == "-") {
-        pinfo.logFd = stdout;
-      } else {
-        std::stringstream ss;
-        ss << logFile << "." << pidx;
-        FILE *fd = fopen(ss.str().c_str(), "w");
-        if (fd == nullptr)
-          errx(-1, "Error opening logFd for pidx %d", pidx);
-        pinfo.logFd = fd;
-
-        // Logging MRC estimates
-        std::stringstream ssmrc;
-        ssmrc << "onlineMRCSamples"
-              << "." << pidx;
-        FILE *mrclog = fopen(ssmrc.str().c_str(), "w");
-        if (mrclog == nullptr)
-          errx(-1, "Error opening log file for mrc estimates in pidx %d", pidx);
-        pinfo.mrcfd = mrclog;
-
-        // Logging IPC estimates
-        std::stringstream ssipc;
-        ssipc << "onlineIPCSamples"
-              << "." << pidx;
-        FILE *ipclog = fopen(ssipc.str().c_str(), "w");
-        if (ipclog == nullptr)
-          errx(-1, "Error opening log file for ipc estimates in pidx %d", pidx);
-        pinfo.ipcfd = ipclog;
-
-      }
+      open_logs(pinfo);
+    } else if (std::string(argv[arg]) == "--daemon" && numProcesses == 0) {
+      // Everything that follows is the control FIFO and initial workloads
+      daemonMode = true;
+      if (++arg >= argc)
+        errx(-1, "[KPART] --daemon needs a control FIFO");
+      controlFifo = argv[arg];
+      while (++arg < argc)
+        daemonSpecs.push_back(argv[arg]);
     } else {
+      if (processInfo.empty())
+        errx(-1, "[KPART] Unexpected argument %s", argv[arg]);
       processInfo.back().args.push_back(argv[arg]);
     }
   }
+
+  update_app_cores();
 }
 
 int main(int argc, char **argv) {
   gettimeofday(&startAll, 0);
 
-  cache_utils::share_all_cache_ways();
+  // Phase signals are only received through the phase pipeline's signalfd,
+  // so they must be blocked before any thread is started
+  pipeline::SignalPump::blockSignal(SIGSAGE);
 
-  //initCacheAssignSamplePlan();
-  generate_profiling_plan(CACHE_WAYS);
+  asyncLog = new pipeline::AsyncLog(LOG_QUEUE_RECORDS, LOG_DRAIN_PERIOD_MS);
+  pipeline::AsyncLog::install(asyncLog);
+  asyncLog->start();
+  atexit(stop_async_log); // e.g., on errx(), so that queued output is kept
+
+  const char *simSpec = getenv("KPART_SIM");
+  if (simSpec)
+    setup_sim(simSpec);
+
+  cache_utils::init_rdt_backend();
+  cache_utils::share_all_cache_ways();
+#ifdef USE_CMT
+  cmtSampler = new rdt::CmtSampler(get_rdt_backend(), CMT_SAMPLE_PERIOD_MS);
+  if (!simPlatform)
+    cmtSampler->start(); // the simulation sweeps at its own phase boundaries
+  rmidPool = new rdt::RmidPool(get_rdt_backend()->getNumRmids(),
+                               RMID_CLEAN_BYTES, RMID_COOLDOWN_ROUNDS);
+  gettimeofday(&lastRmidRotation, 0);
+#endif
 
   parse_cmdline(argc, argv);
+  parse_phase_driver();
+  parse_profile_groups();
+  if (daemonMode) {
+    if (simPlatform)
+      errx(1, "[KPART] Daemon mode needs a real platform");
+    processInfo.reserve(MAX_DAEMON_WORKLOADS);
+  }
 
-  int ret = pfm_initialize();
-  if (ret != PFM_SUCCESS)
-    errx(1, "Cannot initialize library: %s", pfm_strerror(ret));
+  //initCacheAssignSamplePlan();
+  generate_profiling_plan(cacheWays);
 
-  // Set up globals
-  global_setup_counters(events);
+  int ret = PFM_SUCCESS;
+  if (simPlatform) {
+    sim_setup_counters(events);
+  } else {
+    ret = pfm_initialize();
+    if (ret != PFM_SUCCESS)
+      errx(1, "Cannot initialize library: %s", pfm_strerror(ret));
 
-  // Print out header for logfile
-  if (!prettyPrint) {
-    for (ProcessInfo &pinfo : processInfo) {
-      for (uint32_t i = 0; i < numEvents; i++) {
-        fprintf(pinfo.logFd, "%s | %s\n", globFds[i].name, globFds[i].name);
-      }
-#ifdef USE_CMT
-      fprintf(pinfo.logFd, "%s | %s\n", lmbName.c_str(), lmbName.c_str());
-      fprintf(pinfo.logFd, "%s | %s\n", l3OccupName.c_str(),
-              l3OccupName.c_str());
-#endif
-    }
+    // Set up globals
+    global_setup_counters(events);
   }
+  setup_miss_source();
+  setup_memory_model();
 
-  printf("\n[KPART] Profiling %s events, logging to %s\n", events,
-         (logFile == "-") ? "stdout" : logFile.c_str());
+  // Print out header for logfile
+  for (ProcessInfo &pinfo : processInfo)
+    print_log_header(pinfo);
 
-  // Instal SIGSAGE sig handler
-  struct sigaction act;
-  memset(&act, 0, sizeof(act));
-  act.sa_sigaction = sigsage_handler;
-  act.sa_flags = SA_SIGINFO;
-  sigaction(SIGSAGE, &act, 0);
+  log_printf("\n[KPART] Profiling %s events, logging to %s\n", events,
+             (logFile == "-") ? "stdout" : logFile.c_str());
 
   // Ensure we kill all our children on abort
+  fatalSignalFd = eventfd(0, EFD_CLOEXEC);
+  if (fatalSignalFd == -1)
+    err(1, "cannot create shutdown event");
+  std::thread(shutdown_on_signal).detach();
   signal(SIGSEGV, fini_handler);
   signal(SIGINT, fini_handler);
   signal(SIGABRT, fini_handler);
   signal(SIGTERM, fini_handler);
 
-  profile(argv + 4); //skip our args
+  if (simPlatform) {
+    simulate();
+  } else if (daemonMode) {
+    run_daemon();
+  } else {
+    start_phase_pipeline();
+    profile(argv + 4); //skip our args
+    stop_phase_pipeline();
+  }
+
+  print_multiplexing_stats();
+  stop_async_log();
+  log_printf("[TIMECALC] %lu log records written, %lu dropped, at most %lu "
+             "queued by one of %d threads\n",
+             asyncLog->getNumRecords(), asyncLog->getNumDropped(),
+             asyncLog->getMaxDepth(), asyncLog->getNumSources());
+  log_printf("[KPART] Finished\n");
 
-  printf("[KPART] Finished\n");
+#ifdef USE_CMT
+  cmtSampler->stop();
+  log_printf("[TIMECALC] CMT sweep = %.3f ms (avg), %.3f ms (max) over %lu "
+             "sweeps every %.1f ms, %lu failed\n",
+             cmtSampler->getAvgSweepMs(), cmtSampler->getMaxSweepMs(),
+             cmtSampler->getNumSweeps(), cmtSampler->getPeriodMs(),
+             cmtSampler->getNumFailures());
+#endif
 
   //Teardown
   prctl(PR_TASK_PERF_EVENTS_DISABLE);
@@ -1392,52 +3318,101 @@ int main(int argc, char **argv) {
   free(fds);*/
 
   /* free libpfm resources cleanly */
-  pfm_terminate();
+  if (!simPlatform)
+    pfm_terminate();
 
   gettimeofday(&endAll, 0);
   double elapsedtime = (endAll.tv_sec - startAll.tv_sec) * 1e3 +
                        (endAll.tv_usec - startAll.tv_usec) * 1e-3;
-  printf("[TIMECALC] total elapsed time = %.3f ms\n", elapsedtime);
+  log_printf("[TIMECALC] total elapsed time = %.3f ms\n", elapsedtime);
 
   return ret;
 }
 
+// Index of the core cycles event among the configured events (e.g.,
+// "cycles", "UNHALTED_CORE_CYCLES" or "CPU_CLK_UNHALTED.THREAD_P:u", but not
+// reference cycles), or -1 if there is none
+int find_cycles_event() {
+  static const char *cyclesNames[] = { "cycles", "cpu-cycles",
+                                       "PERF_COUNT_HW_CPU_CYCLES",
+                                       "UNHALTED_CORE_CYCLES",
+                                       "CPU_CLK_UNHALTED",
+                                       "CPU_CLK_THREAD_UNHALTED" };
+  for (uint32_t i = 0; i < numEvents; i++) {
+    std::string name = globFds[i].name;
+    size_t end = name.find_first_of(".:");
+    std::string base = name.substr(0, end);
+    std::string rest = (end == std::string::npos) ? "" : name.substr(end);
+    if (strcasestr(rest.c_str(), "REF") != nullptr)
+      continue;
+    for (const char *c : cyclesNames) {
+      if (strcasecmp(base.c_str(), c) == 0)
+        return i;
+    }
+  }
+  return -1;
+}
+
 //Set the fds
 void global_setup_counters(const char *events) {
   int ret = perf_setup_list_events(events, &globFds, (int *)&numEvents);
   if (ret || !numEvents)
     errx(1, "could not initialize events: %s", pfm_strerror(ret));
+  if (phaseDriver == PHASE_CYCLES) {
+    int cycles = find_cycles_event();
+    if (cycles < 0)
+      errx(1, "[KPART] Cycle phases need a cycles event among %s", events);
+    phaseEvent = cycles;
+  }
+  if (numEvents > MAX_LOGGED_EVENTS)
+    errx(1, "at most %d events can be logged", MAX_LOGGED_EVENTS);
 
   for (uint32_t i = 0; i < numEvents; i++) {
-    globFds[i].hw.disabled = 0;
+    // Launched processes count from their exec, attached ones right away
+    globFds[i].hw.disabled = daemonMode ? 0 : 1;
     globFds[i].hw.enable_on_exec = 1;
-    globFds[i].hw.wakeup_events = !!i; // 0 for i=0; 1 otherwise
+    // 0 for the phase event; 1 otherwise
+    globFds[i].hw.wakeup_events = (i == phaseEvent) ? 0 : 1;
     globFds[i].hw.sample_type = PERF_SAMPLE_READ;
-    globFds[i].hw.sample_period = (i == 0) ? phaseLen : (1L << 62);
+    globFds[i].hw.read_format = PERF_FORMAT_GROUP |
+                                PERF_FORMAT_TOTAL_TIME_ENABLED |
+                                PERF_FORMAT_TOTAL_TIME_RUNNING;
+    bool overflows = (i == phaseEvent && phaseDriver != PHASE_TIME);
+    globFds[i].hw.sample_period = overflows ? phaseLen : (1L << 62);
     // pinned should only be specified for group leader
     globFds[i].hw.pinned = (i == 0) ? 1 : 0;
   }
 }
 
-void setup_counters(ProcessInfo &pinfo) {
+// Opens a counter group on pid (or, with PERF_FLAG_PID_CGROUP, on the cgroup
+// whose directory pid is) and cpu, whose phase event signals every period
+// instructions (or cycles). Returns nullptr if pid is gone (daemon mode).
+perf_event_desc_t *open_counter_group(ProcessInfo &pinfo, int pid, int cpu,
+                                      unsigned long flags, uint64_t period) {
 
   // NOTE: If processes are not pinned/CPUs are overcommitted, the 'pinned'
   // value for events (set in global_setup_counters()) might also need to be
   // changed
   perf_event_desc_t *fds = new perf_event_desc_t[numEvents];
   memcpy(fds, globFds, sizeof(perf_event_desc_t) * numEvents);
+  if (phaseDriver != PHASE_TIME)
+    fds[phaseEvent].hw.sample_period = period;
   for (uint32_t i = 0; i < numEvents; i++) {
     int groupFd = (i == 0) ? -1 : fds[0].fd;
-    fds[i].fd = perf_event_open(&fds[i].hw, pinfo.pid, -1, groupFd, 0);
+    fds[i].fd = perf_event_open(&fds[i].hw, pid, cpu, groupFd, flags);
     if (fds[i].fd == -1) {
+      if (daemonMode) {
+        warn("cannot attach event %s to %s", fds[i].name, pinfo.spec.c_str());
+        for (uint32_t j = 0; j < i; j++)
+          close(fds[j].fd);
+        delete[] fds;
+        return nullptr;
+      }
       warn("cannot attach event %s for process %d(%d)", fds[i].name, pinfo.pid,
            pinfo.pid);
     }
 
-    assert(pidMap.find(fds[i].fd) == pidMap.end());
-    pidMap[fds[i].fd] = &pinfo;
-
-    if (i == 0) {
+    if (i == phaseEvent) {
       int buffer_pages = 1;
       size_t pgsz = sysconf(_SC_PAGESIZE);
       fds[i].buf = mmap(NULL, (buffer_pages + 1) * pgsz, PROT_READ | PROT_WRITE,
@@ -1475,15 +3450,73 @@ void setup_counters(ProcessInfo &pinfo) {
     }
 
     // Set this really high. We decide based on counter values at run time
-    // when we are finished
+    // when we are finished. Refreshing enables the event, so events that
+    // wait for the exec keep the default (no overflow limit) instead.
+    if (fds[i].hw.disabled)
+      continue;
     int ret = ioctl(fds[i].fd, PERF_EVENT_IOC_REFRESH, 1L << 62);
 
     if (ret == -1)
       err(1, "cannot refresh");
   }
-  pinfo.fds = fds;
+
+  // Phase ends take the values from the phase event's samples; other reads
+  // go through the reader, which can only use rdpmc on our own events
+  std::vector<int> groupFds;
+  std::vector<void *> pages(numEvents, nullptr);
+  for (uint32_t i = 0; i < numEvents; i++)
+    groupFds.push_back(fds[i].fd);
+  pages[phaseEvent] = fds[phaseEvent].buf;
+  std::shared_ptr<pmu::GroupReader> reader =
+      std::make_shared<pmu::GroupReader>(groupFds, pages,
+                                         pid == getpid() && !flags);
+
+  // The phase pipeline may look the fds up from now on
+  std::lock_guard<std::mutex> lock(pidMapMutex);
+  for (uint32_t i = 0; i < numEvents; i++) {
+    assert(pidMap.find(fds[i].fd) == pidMap.end());
+    pidMap[fds[i].fd] = &pinfo;
+  }
+  pinfo.groups.push_back(fds);
+  pinfo.readers.push_back(reader);
+  pinfo.fds = pinfo.groups[0];
+  return fds;
+}
+
+void setup_counters(ProcessInfo &pinfo) {
+  if (!open_counter_group(pinfo, pinfo.pid, -1, 0, phaseLen))
+    return;
+  log_printf("[INFO] PROC %d: phase ends from ring-buffer samples, other reads "
+             "with %s\n",
+             pinfo.pidx,
+             pmu::GroupReader::getModeName(pinfo.readers[0]->getMode()));
 
 #ifdef USE_CMT
-  initCmt(pinfo);
+  if (!daemonMode) // attach_workload() sets up CMT once counters are open
+    initCmt(pinfo);
 #endif
 }
+
+// Cgroup events only count on one CPU, so a cgroup gets a group on every CPU
+// of its cpuset. Each leader signals after its share of the phase length.
+bool setup_cgroup_counters(ProcessInfo &pinfo) {
+  int dirFd = open(pinfo.cgroup.c_str(), O_RDONLY | O_DIRECTORY);
+  if (dirFd == -1) {
+    warn("cannot open cgroup %s", pinfo.cgroup.c_str());
+    return false;
+  }
+  uint64_t period =
+      std::max<int64_t>(1, phaseLen / (int64_t) pinfo.cores.size());
+  bool ok = true;
+  for (int cpu : pinfo.cores) {
+    if (!open_counter_group(pinfo, dirFd, cpu, PERF_FLAG_PID_CGROUP, period)) {
+      ok = false;
+      break;
+    }
+  }
+  close(dirFd); // the events hold on to the cgroup
+  if (ok)
+    log_printf("[INFO] PROC %d: %lu counter groups on cgroup %s\n", pinfo.pidx,
+               pinfo.groups.size(), pinfo.cgroup.c_str());
+  return ok;
+}
@@ -30,6 +30,8 @@
 **/
 #pragma once
 
+#include <stdint.h>
+
 // Global config parameters for KPart.
 // Set these variables according to your platform specs
 const int CACHE_LINE_SIZE = 64;
@@ -38,15 +40,65 @@ const int CACHE_LINE_SIZE = 64;
 // and MRC-curves
 const int HIST_WINDOW_LENGTH = 3;
 
-// Number of cores in the system
-const int NUM_CORES = 8; //TODO: detect programatically
+// Profiling episodes whose curve estimates each process keeps (and logs), as
+// a ring: a daemon's older episodes are overwritten
+const int EST_HISTORY_LENGTH = 1000;
+static_assert(HIST_WINDOW_LENGTH < EST_HISTORY_LENGTH,
+              "the averaging window must fit in the estimates kept");
+
+// Number of online cores, and available cache capacity (LLC ways, i.e., the
+// CBM length) to profile and partition. Detected at startup by
+// cache_utils::init_rdt_backend().
+extern int numCores;
+extern int cacheWays;
+
+// Period of the background CMT/MBM sampler, in ms. Must be well below the
+// time it takes the 24-bit MBM counter to wrap around at full bandwidth.
+const double CMT_SAMPLE_PERIOD_MS = 10.0;
+
+// With more processes than RMIDs, the monitored ones are rotated out every
+// RMID_ROTATION_MS. A released RMID is handed out again once the sampler
+// reports at most RMID_CLEAN_BYTES of LLC occupancy for it, or after
+// RMID_COOLDOWN_ROUNDS rotations regardless.
+const double RMID_ROTATION_MS = 1000.0;
+const int64_t RMID_CLEAN_BYTES = 64 * 1024;
+const int RMID_COOLDOWN_ROUNDS = 3;
+
+// With instruction or cycle phases, a profiling slice whose process reaches
+// no phase boundary for PROFILE_SLICE_MAX_MS ends with a direct read of its
+// counters instead, so slow (e.g., memory-bound) processes do not hold up the
+// profiling sweep. Checked every PROFILE_SLICE_MAX_MS / 4.
+const double PROFILE_SLICE_MAX_MS = 500.0;
+
+// A profiling sample whose counters ran (i.e., were not multiplexed out)
+// less than MIN_RUNNING_RATIO of the time is taken again, up to
+// MUX_MAX_RETRIES times in a row; after that it is kept as a low-confidence
+// point, which the curves interpolate over when they can.
+const double MIN_RUNNING_RATIO = 0.9;
+const int MUX_MAX_RETRIES = 3;
+
+// COSes a serial profiling slice runs in: one for the profiled process and
+// one for the others
+const int PROFILING_COS_DEFAULT = 2;
+
+// Most workloads KPart manages at once in daemon mode (--daemon). Slots of
+// workloads that are gone are reused.
+const int MAX_DAEMON_WORKLOADS = 64;
 
-// Available cache capacity to profile and partition
-const int CACHE_WAYS = 12; //TODO: detect programatically
+// Peak DRAM bandwidth of one socket in bytes per core cycle (i.e., GB/s
+// divided by the core clock in GHz), and the cycles a core stalls on an LLC
+// miss with unloaded memory. Used to predict the effect of MBA throttling
+// unless KPART_MEM_BW and KPART_MEM_PENALTY give the platform's own.
+const double DEFAULT_MEM_BW_BYTES_PER_CYCLE = 20.0;
+const double DEFAULT_MEM_MISS_PENALTY_CYCLES = 200.0;
 
-// Paths to Intel's Cache Allocation Technology CBM and COS tools
-const std::string CAT_CBM_TOOL_DIR = "../lltools/build/cat_cbm -c ";
-const std::string CAT_COS_TOOL_DIR = "../lltools/build/cat_cos -c ";
+// Log output is queued per thread, LOG_QUEUE_RECORDS records deep, and
+// written out by a background thread every LOG_DRAIN_PERIOD_MS; records that
+// do not fit in a full queue are dropped. Counter logs hold at most
+// MAX_LOGGED_EVENTS events.
+const int LOG_QUEUE_RECORDS = 8192;
+const double LOG_DRAIN_PERIOD_MS = 2.0;
+const int MAX_LOGGED_EVENTS = 32;
 
 //Logging, monitoring and profiling vars
 const bool enableLogging(true); //Turn on for detailed logging of profiling
@@ -0,0 +1,289 @@
+/** $lic$
+* MIT License
+*
+* Copyright (c) 2017-2018 by Massachusetts Institute of Technology
+* Copyright (c) 2017-2018 by Qatar Computing Research Institute, HBKU
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* If you use this software in your research, we request that you reference
+* the KPart paper ("KPart: A Hybrid Cache Partitioning-Sharing Technique for
+* Commodity Multicores", El-Sayed, Mukkara, Tsai, Kasture, Ma, and Sanchez,
+* HPCA-24, February 2018) as the source in any publications that use this
+* software, and that you send us a citation of your work.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+**/
+
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <vector>
+#include "async_log.h"
+
+namespace pipeline {
+
+static AsyncLog *installedLog = nullptr;
+
+// The calling thread's queue, and the log it belongs to
+static thread_local AsyncLog *sourceLog = nullptr;
+static thread_local void *sourcePtr = nullptr;
+
+static void write_text(void *dst, const char *payload, size_t len) {
+  fwrite(payload, 1, len, static_cast<FILE *>(dst));
+}
+
+static void sleep_ms(double ms) {
+  struct timespec ts;
+  ts.tv_sec = ms / 1000;
+  ts.tv_nsec = (ms - ts.tv_sec * 1000) * 1e6;
+  while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+    ;
+}
+
+AsyncLog::AsyncLog(size_t queueRecords, double drainPeriodMs, int maxSources)
+    : queueRecords(queueRecords), drainPeriodMs(drainPeriodMs),
+      maxSources(maxSources), sources(new std::atomic<Source *>[maxSources]),
+      numSources(0), numUnqueued(0), numDroppedReported(0), running(false),
+      stopped(false) {
+  for (int s = 0; s < maxSources; s++)
+    sources[s] = nullptr;
+}
+
+AsyncLog::~AsyncLog() {
+  stop();
+  if (installedLog == this)
+    installedLog = nullptr;
+  for (int s = 0; s < numSources.load(); s++)
+    delete sources[s].load();
+}
+
+void AsyncLog::start() {
+  if (running || stopped)
+    return;
+  running = true;
+  thread = std::thread(&AsyncLog::run, this);
+  threadId = thread.get_id();
+}
+
+void AsyncLog::stop() {
+  if (std::this_thread::get_id() == threadId)
+    return;
+  std::call_once(stopOnce, [this]() {
+    stopped = true;
+    if (!thread.joinable())
+      return;
+    running = false;
+    thread.join();
+    drainOnce(); // records pushed while the thread was finishing up
+  });
+}
+
+AsyncLog::Source *AsyncLog::mySource() {
+  if (sourceLog == this)
+    return static_cast<Source *>(sourcePtr);
+
+  std::lock_guard<std::mutex> lock(sourcesMutex);
+  int s = numSources.load();
+  if (s == maxSources)
+    return nullptr;
+  Source *src = new Source(queueRecords);
+  sources[s].store(src, std::memory_order_release);
+  numSources.store(s + 1, std::memory_order_release);
+  sourceLog = this;
+  sourcePtr = src;
+  return src;
+}
+
+bool AsyncLog::pushRecords(Formatter format, void *dst, const char *data,
+                           size_t len) {
+  if (!running) {
+    for (size_t off = 0; off < len || off == 0; off += PAYLOAD_BYTES) {
+      // Formatters get an aligned copy, as they would from a record
+      uint64_t payload[PAYLOAD_BYTES / sizeof(uint64_t)];
+      size_t n = std::min(len - off, PAYLOAD_BYTES);
+      memcpy(payload, data + off, n);
+      format(dst, reinterpret_cast<const char *>(payload), n);
+    }
+    return true;
+  }
+
+  Source *src = mySource();
+  size_t n = std::max<size_t>(1, (len + PAYLOAD_BYTES - 1) / PAYLOAD_BYTES);
+  if (!src) {
+    numUnqueued++;
+    return false;
+  }
+  if (src->queue.freeSlots() < n) {
+    src->numDropped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  for (size_t r = 0; r < n; r++) {
+    Record &rec = src->queue.slot(r);
+    size_t off = r * PAYLOAD_BYTES;
+    rec.format = format;
+    rec.dst = dst;
+    rec.len = std::min(len - off, PAYLOAD_BYTES);
+    memcpy(rec.payload, data + off, rec.len);
+  }
+  src->queue.publish(n);
+  src->numPushed.fetch_add(n, std::memory_order_release);
+  return true;
+}
+
+bool AsyncLog::push(Formatter format, void *dst, const void *payload,
+                    size_t len) {
+  if (len > PAYLOAD_BYTES)
+    return false;
+  return pushRecords(format, dst, static_cast<const char *>(payload), len);
+}
+
+bool AsyncLog::write(FILE *out, const char *text, size_t len) {
+  if (len == 0)
+    return true;
+  return pushRecords(write_text, out, text, len);
+}
+
+bool AsyncLog::vprintf(FILE *out, const char *fmt, va_list ap) {
+  char buf[1024];
+  va_list ap2;
+  va_copy(ap2, ap);
+  int len = vsnprintf(buf, sizeof(buf), fmt, ap);
+  if (len < 0) {
+    va_end(ap2);
+    return false;
+  }
+  if ((size_t) len < sizeof(buf)) {
+    va_end(ap2);
+    return write(out, buf, len);
+  }
+  std::vector<char> big(len + 1);
+  vsnprintf(big.data(), big.size(), fmt, ap2);
+  va_end(ap2);
+  return write(out, big.data(), len);
+}
+
+bool AsyncLog::printf(FILE *out, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  bool ret = vprintf(out, fmt, ap);
+  va_end(ap);
+  return ret;
+}
+
+void AsyncLog::drain() {
+  if (!running || std::this_thread::get_id() == threadId)
+    return;
+  int n = numSources.load(std::memory_order_acquire);
+  std::vector<uint64_t> pushed(n);
+  for (int s = 0; s < n; s++)
+    pushed[s] = sources[s].load()->numPushed.load(std::memory_order_acquire);
+  for (int s = 0; s < n; s++) {
+    Source *src = sources[s].load();
+    while (running &&
+           src->numWritten.load(std::memory_order_acquire) < pushed[s])
+      sleep_ms(drainPeriodMs / 4);
+  }
+}
+
+void AsyncLog::drainOnce() {
+  int n = numSources.load(std::memory_order_acquire);
+  for (int s = 0; s < n; s++) {
+    Source *src = sources[s].load(std::memory_order_acquire);
+    size_t avail = src->queue.size();
+    if (avail > src->maxDepth.load(std::memory_order_relaxed))
+      src->maxDepth.store(avail, std::memory_order_relaxed);
+    for (size_t r = 0; r < avail; r++) {
+      Record &rec = src->queue.front(r);
+      rec.format(rec.dst, reinterpret_cast<const char *>(rec.payload),
+                 rec.len);
+    }
+    src->queue.release(avail);
+    src->numWritten.fetch_add(avail, std::memory_order_release);
+  }
+
+  uint64_t dropped = getNumDropped();
+  if (dropped != numDroppedReported) {
+    fprintf(stderr, "[INFO] Log queues full, %lu log records dropped so far\n",
+            dropped);
+    numDroppedReported = dropped;
+  }
+}
+
+void AsyncLog::run() {
+  // Signal handlers must run on other threads: KPart's parks the thread it
+  // interrupts until the process exits, and the exit waits for this one
+  sigset_t all;
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, nullptr);
+
+  while (running) {
+    drainOnce();
+    sleep_ms(drainPeriodMs);
+  }
+  drainOnce();
+}
+
+uint64_t AsyncLog::getNumRecords() const {
+  uint64_t total = 0;
+  for (int s = 0; s < numSources.load(); s++)
+    total += sources[s].load()->numWritten.load();
+  return total;
+}
+
+uint64_t AsyncLog::getNumDropped() const {
+  uint64_t total = numUnqueued.load();
+  for (int s = 0; s < numSources.load(); s++)
+    total += sources[s].load()->numDropped.load();
+  return total;
+}
+
+size_t AsyncLog::getMaxDepth() const {
+  size_t depth = 0;
+  for (int s = 0; s < numSources.load(); s++)
+    depth = std::max(depth, sources[s].load()->maxDepth.load());
+  return depth;
+}
+
+void AsyncLog::install(AsyncLog *log) { installedLog = log; }
+
+AsyncLog *AsyncLog::get() { return installedLog; }
+
+bool log_write(const std::string &text) {
+  if (!installedLog) {
+    fwrite(text.data(), 1, text.size(), stdout);
+    return true;
+  }
+  return installedLog->write(stdout, text.data(), text.size());
+}
+
+bool log_printf(const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  bool ret;
+  if (installedLog) {
+    ret = installedLog->vprintf(stdout, fmt, ap);
+  } else {
+    ret = vprintf(fmt, ap) >= 0;
+  }
+  va_end(ap);
+  return ret;
+}
+
+} // namespace pipeline
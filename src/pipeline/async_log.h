@@ -0,0 +1,154 @@
+/** $lic$
+* MIT License
+*
+* Copyright (c) 2017-2018 by Massachusetts Institute of Technology
+* Copyright (c) 2017-2018 by Qatar Computing Research Institute, HBKU
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* If you use this software in your research, we request that you reference
+* the KPart paper ("KPart: A Hybrid Cache Partitioning-Sharing Technique for
+* Commodity Multicores", El-Sayed, Mukkara, Tsai, Kasture, Ma, and Sanchez,
+* HPCA-24, February 2018) as the source in any publications that use this
+* software, and that you send us a citation of your work.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+**/
+#pragma once
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include "spsc_queue.h"
+
+namespace pipeline {
+
+// Takes log output off the threads that produce it. Each producing thread
+// gets its own SpscQueue of fixed-size records, the first time it logs;
+// pushing a record is a copy into the queue, never I/O or a lock. A
+// background thread drains all queues every drainPeriodMs and formats and
+// writes out the records. When a thread's queue is full, its records are
+// dropped (and counted) rather than waiting for the log thread.
+//
+// Records of one thread come out in the order they were pushed; records of
+// different threads may interleave differently than they were pushed. Until
+// start() and after stop(), records are formatted on the pushing thread.
+class AsyncLog {
+public:
+  // Formats and writes out a record: payload holds len bytes, 8-byte
+  // aligned, as passed to push()
+  typedef void (*Formatter)(void *dst, const char *payload, size_t len);
+
+  static const size_t PAYLOAD_BYTES = 488;
+
+  AsyncLog(size_t queueRecords, double drainPeriodMs, int maxSources = 32);
+  ~AsyncLog();
+
+  // A no-op once the log is stopped
+  void start();
+  // Writes out every record pushed so far, then stops the log thread for
+  // good. Only the first call does so; calls racing with it (e.g., atexit()
+  // and a shutdown thread) wait for it to finish. A no-op on the log thread
+  // itself (e.g., from a formatter that exits).
+  void stop();
+
+  // Queues a record with a copy of payload (at most PAYLOAD_BYTES); the log
+  // thread later calls format(dst, payload, len). dst must stay valid until
+  // then (see drain()). Returns false if the record was dropped.
+  bool push(Formatter format, void *dst, const void *payload, size_t len);
+
+  // Queues text for out, split into as many records as it takes; the text
+  // is either queued whole or dropped whole
+  bool write(FILE *out, const char *text, size_t len);
+  bool printf(FILE *out, const char *fmt, ...)
+      __attribute__((format(printf, 3, 4)));
+  bool vprintf(FILE *out, const char *fmt, va_list ap);
+
+  // Returns once every record pushed so far is written out, e.g., before
+  // closing a file records still point to
+  void drain();
+
+  uint64_t getNumRecords() const; // written out
+  uint64_t getNumDropped() const;
+  size_t getMaxDepth() const; // most records waiting in one queue
+  int getNumSources() const { return numSources.load(); }
+
+  // Process-wide log used by log_printf() and friends; without one, they
+  // write to stdout directly
+  static void install(AsyncLog *log);
+  static AsyncLog *get();
+
+private:
+  struct Record {
+    Formatter format;
+    void *dst;
+    uint64_t len;
+    uint64_t payload[PAYLOAD_BYTES / sizeof(uint64_t)];
+  };
+
+  struct Source {
+    SpscQueue<Record> queue;
+    // Records published by the producer, and written out by the log thread
+    std::atomic<uint64_t> numPushed;
+    std::atomic<uint64_t> numWritten;
+    std::atomic<uint64_t> numDropped; // written by the producer
+    std::atomic<size_t> maxDepth; // written by the log thread
+    explicit Source(size_t records)
+        : queue(records), numPushed(0), numWritten(0), numDropped(0),
+          maxDepth(0) {}
+  };
+
+  size_t queueRecords;
+  double drainPeriodMs;
+  int maxSources;
+  std::unique_ptr<std::atomic<Source *>[]> sources;
+  std::atomic<int> numSources;
+  std::atomic<uint64_t> numUnqueued; // dropped for lack of a queue
+  uint64_t numDroppedReported; // by the log thread
+  std::mutex sourcesMutex; // serializes registration
+
+  std::thread thread;
+  std::thread::id threadId;
+  std::atomic<bool> running;
+  std::atomic<bool> stopped;
+  std::once_flag stopOnce;
+
+  Source *mySource();
+  // Splits data over as many records as it takes, all or none of them
+  bool pushRecords(Formatter format, void *dst, const char *data,
+                   size_t len);
+  void drainOnce();
+  void run();
+};
+
+bool log_write(const std::string &text);
+bool log_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+// Logs anything with a print(std::ostream &) method (e.g., armadillo
+// matrices) to stdout
+template <typename T> bool log_print(const T &obj) {
+  std::ostringstream ss;
+  obj.print(ss);
+  return log_write(ss.str());
+}
+
+} // namespace pipeline
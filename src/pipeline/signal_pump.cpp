@@ -0,0 +1,183 @@
+/** $lic$
+* MIT License
+*
+* Copyright (c) 2017-2018 by Massachusetts Institute of Technology
+* Copyright (c) 2017-2018 by Qatar Computing Research Institute, HBKU
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* If you use this software in your research, we request that you reference
+* the KPart paper ("KPart: A Hybrid Cache Partitioning-Sharing Technique for
+* Commodity Multicores", El-Sayed, Mukkara, Tsai, Kasture, Ma, and Sanchez,
+* HPCA-24, February 2018) as the source in any publications that use this
+* software, and that you send us a citation of your work.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+**/
+
+#include <err.h>
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <stdexcept>
+#include <string>
+#include "signal_pump.h"
+
+namespace pipeline {
+
+static std::runtime_error sys_error(const std::string &what) {
+  return std::runtime_error("signal pump: " + what + ": " + strerror(errno));
+}
+
+static void set_signal_blocked(int sig, int how) {
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, sig);
+  int ret = pthread_sigmask(how, &mask, nullptr);
+  if (ret != 0) {
+    errno = ret;
+    throw sys_error("pthread_sigmask");
+  }
+}
+
+void SignalPump::blockSignal(int sig) { set_signal_blocked(sig, SIG_BLOCK); }
+
+void SignalPump::unblockSignal(int sig) {
+  set_signal_blocked(sig, SIG_UNBLOCK);
+}
+
+SignalPump::SignalPump(int sig, Handler handler)
+    : sig(sig), handler(handler), sigFd(-1), stopFd(-1), epollFd(-1),
+      running(false), numSignals(0) {
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, sig);
+  sigFd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  stopFd = eventfd(0, EFD_CLOEXEC);
+  epollFd = epoll_create1(EPOLL_CLOEXEC);
+  if (sigFd == -1 || stopFd == -1 || epollFd == -1)
+    throw sys_error("cannot create descriptors");
+
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.fd = sigFd;
+  if (epoll_ctl(epollFd, EPOLL_CTL_ADD, sigFd, &ev) == -1)
+    throw sys_error("epoll_ctl");
+  ev.data.fd = stopFd;
+  if (epoll_ctl(epollFd, EPOLL_CTL_ADD, stopFd, &ev) == -1)
+    throw sys_error("epoll_ctl");
+}
+
+SignalPump::~SignalPump() {
+  stop();
+  close(epollFd);
+  close(stopFd);
+  close(sigFd);
+}
+
+void SignalPump::watchFd(int fd, FdHandler handler) {
+  {
+    std::lock_guard<std::mutex> lock(fdsMutex);
+    fdHandlers[fd] = handler;
+  }
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.fd = fd;
+  if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) == -1)
+    throw sys_error("epoll_ctl");
+}
+
+void SignalPump::unwatchFd(int fd) {
+  epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+  std::lock_guard<std::mutex> lock(fdsMutex);
+  fdHandlers.erase(fd);
+}
+
+void SignalPump::start() {
+  if (running)
+    return;
+  running = true;
+  thread = std::thread(&SignalPump::run, this);
+}
+
+void SignalPump::stop() {
+  if (!thread.joinable())
+    return;
+  running = false;
+  uint64_t count = 1;
+  if (write(stopFd, &count, sizeof(count)) != sizeof(count))
+    err(1, "signal pump: cannot wake up thread");
+  thread.join();
+  // Rearm for the next start()
+  if (read(stopFd, &count, sizeof(count)) != sizeof(count))
+    err(1, "signal pump: cannot reset stop event");
+}
+
+void SignalPump::run() {
+  // A batch of signals per read(); RT signals are queued one by one, so
+  // draining them in batches keeps the syscalls per signal well below one
+  const int MAX_BATCH = 64;
+  struct signalfd_siginfo infos[MAX_BATCH];
+
+  while (running) {
+    const int MAX_EVENTS = 16;
+    struct epoll_event evs[MAX_EVENTS];
+    int n = epoll_wait(epollFd, evs, MAX_EVENTS, -1);
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      err(1, "signal pump: epoll_wait");
+    }
+
+    for (int e = 0; e < n; e++) {
+      int fd = evs[e].data.fd;
+      if (fd == stopFd)
+        continue; // running is already false
+      if (fd != sigFd) {
+        // Copied out, so the handler may unwatch its own fd
+        FdHandler fdHandler;
+        {
+          std::lock_guard<std::mutex> lock(fdsMutex);
+          auto it = fdHandlers.find(fd);
+          if (it == fdHandlers.end())
+            continue; // unwatched after epoll_wait() returned
+          fdHandler = it->second;
+        }
+        fdHandler();
+        continue;
+      }
+
+      ssize_t bytes = read(sigFd, infos, sizeof(infos));
+      if (bytes == -1) {
+        if (errno == EINTR || errno == EAGAIN)
+          continue;
+        err(1, "signal pump: cannot read signals");
+      }
+      for (size_t i = 0; i < bytes / sizeof(infos[0]); i++) {
+        ++numSignals;
+        handler(infos[i]);
+      }
+    }
+  }
+}
+
+} // namespace pipeline
@@ -0,0 +1,94 @@
+/** $lic$
+* MIT License
+*
+* Copyright (c) 2017-2018 by Massachusetts Institute of Technology
+* Copyright (c) 2017-2018 by Qatar Computing Research Institute, HBKU
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* If you use this software in your research, we request that you reference
+* the KPart paper ("KPart: A Hybrid Cache Partitioning-Sharing Technique for
+* Commodity Multicores", El-Sayed, Mukkara, Tsai, Kasture, Ma, and Sanchez,
+* HPCA-24, February 2018) as the source in any publications that use this
+* software, and that you send us a citation of your work.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+**/
+#pragma once
+#include <stdint.h>
+#include <sys/signalfd.h>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+namespace pipeline {
+
+// Receives a (real-time) signal on a background thread, through signalfd and
+// epoll, instead of in a signal handler. Every delivered signal is passed to
+// the handler in order, on the pump's thread, so the handler may take locks,
+// allocate and do I/O. Other descriptors (pipes, pidfds, ...) can be watched
+// on the same thread.
+//
+// The signal must be blocked in every thread, or the kernel may still run its
+// default action; call blockSignal() from main() before starting any thread.
+class SignalPump {
+public:
+  typedef std::function<void(const struct signalfd_siginfo &)> Handler;
+  typedef std::function<void()> FdHandler;
+
+  // Blocks sig in the calling thread and every thread it creates afterwards.
+  // Children inherit the mask too: unblock it before exec (see
+  // unblockSignal()).
+  static void blockSignal(int sig);
+  static void unblockSignal(int sig);
+
+  SignalPump(int sig, Handler handler);
+  ~SignalPump();
+
+  void start();
+  // Returns once the handler is done with the signal it is running, if any.
+  // Signals still queued stay pending.
+  void stop();
+
+  // Calls handler on the pump's thread whenever fd is readable (or hung
+  // up), until unwatchFd(fd). Both may be called from any thread, including
+  // from a handler. fd stays owned by the caller.
+  void watchFd(int fd, FdHandler handler);
+  void unwatchFd(int fd);
+
+  uint64_t getNumSignals() const { return numSignals.load(); }
+
+private:
+  int sig;
+  Handler handler;
+  int sigFd;
+  int stopFd; // eventfd that wakes the pump up to exit
+  int epollFd;
+
+  std::thread thread;
+  std::atomic<bool> running;
+  std::atomic<uint64_t> numSignals;
+
+  std::mutex fdsMutex;
+  std::unordered_map<int, FdHandler> fdHandlers;
+
+  void run();
+};
+
+} // namespace pipeline
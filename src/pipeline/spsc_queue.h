@@ -0,0 +1,94 @@
+/** $lic$
+* MIT License
+*
+* Copyright (c) 2017-2018 by Massachusetts Institute of Technology
+* Copyright (c) 2017-2018 by Qatar Computing Research Institute, HBKU
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* If you use this software in your research, we request that you reference
+* the KPart paper ("KPart: A Hybrid Cache Partitioning-Sharing Technique for
+* Commodity Multicores", El-Sayed, Mukkara, Tsai, Kasture, Ma, and Sanchez,
+* HPCA-24, February 2018) as the source in any publications that use this
+* software, and that you send us a citation of your work.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+**/
+#pragma once
+#include <stddef.h>
+#include <atomic>
+#include <vector>
+
+namespace pipeline {
+
+// Bounded, lock-free single-producer, single-consumer ring. The producer
+// fills free slots in place and publishes them; the consumer uses published
+// slots in place and releases them. Neither side ever blocks: a full (or
+// empty) queue is the caller's to handle.
+template <typename T> class SpscQueue {
+public:
+  // capacity is rounded up to a power of two
+  explicit SpscQueue(size_t capacity) : head(0), tail(0) {
+    size_t cap = 1;
+    while (cap < capacity)
+      cap *= 2;
+    slots.resize(cap);
+    mask = cap - 1;
+  }
+
+  size_t getCapacity() const { return mask + 1; }
+
+  // Producer side: slot(i) is the i-th of freeSlots() free slots, which
+  // become visible to the consumer, in order, with publish()
+  size_t freeSlots() const {
+    return getCapacity() - (head.load(std::memory_order_relaxed) -
+                            tail.load(std::memory_order_acquire));
+  }
+  T &slot(size_t i) {
+    return slots[(head.load(std::memory_order_relaxed) + i) & mask];
+  }
+  void publish(size_t n) {
+    head.store(head.load(std::memory_order_relaxed) + n,
+               std::memory_order_release);
+  }
+
+  // Consumer side: front(i) is the i-th of size() published slots, which
+  // go back to the producer with release()
+  size_t size() const {
+    return head.load(std::memory_order_acquire) -
+           tail.load(std::memory_order_relaxed);
+  }
+  T &front(size_t i) {
+    return slots[(tail.load(std::memory_order_relaxed) + i) & mask];
+  }
+  void release(size_t n) {
+    tail.store(tail.load(std::memory_order_relaxed) + n,
+               std::memory_order_release);
+  }
+
+private:
+  std::vector<T> slots;
+  size_t mask;
+  // Each index on its own cache line, so that the two sides do not
+  // invalidate each other's on every operation
+  std::atomic<size_t> head; // written by the producer only
+  char pad0[64 - sizeof(std::atomic<size_t>)];
+  std::atomic<size_t> tail; // written by the consumer only
+  char pad1[64 - sizeof(std::atomic<size_t>)];
+};
+
+} // namespace pipeline
@@ -0,0 +1,93 @@
+/** $lic$
+* MIT License
+*
+* Copyright (c) 2017-2018 by Massachusetts Institute of Technology
+* Copyright (c) 2017-2018 by Qatar Computing Research Institute, HBKU
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* If you use this software in your research, we request that you reference
+* the KPart paper ("KPart: A Hybrid Cache Partitioning-Sharing Technique for
+* Commodity Multicores", El-Sayed, Mukkara, Tsai, Kasture, Ma, and Sanchez,
+* HPCA-24, February 2018) as the source in any publications that use this
+* software, and that you send us a citation of your work.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+**/
+#pragma once
+#include <stddef.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+namespace pipeline {
+
+// Unbounded multi-producer, multi-consumer FIFO. Consumers block in pop()
+// until an item arrives or the queue is closed.
+template <typename T> class WorkQueue {
+public:
+  WorkQueue() : closed(false), maxDepth(0) {}
+
+  // Returns false (and drops item) if the queue is closed
+  bool push(T item) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (closed)
+        return false;
+      items.push_back(std::move(item));
+      if (items.size() > maxDepth)
+        maxDepth = items.size();
+    }
+    cond.notify_one();
+    return true;
+  }
+
+  // Returns false once the queue is closed and drained
+  bool pop(T &item) {
+    std::unique_lock<std::mutex> lock(mutex);
+    cond.wait(lock, [this] { return closed || !items.empty(); });
+    if (items.empty())
+      return false;
+    item = std::move(items.front());
+    items.pop_front();
+    return true;
+  }
+
+  // Wakes up all consumers; items already queued are still handed out
+  void close() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      closed = true;
+    }
+    cond.notify_all();
+  }
+
+  // Most items ever waiting at once
+  size_t getMaxDepth() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return maxDepth;
+  }
+
+private:
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::deque<T> items;
+  bool closed;
+  size_t maxDepth;
+};
+
+} // namespace pipeline
@@ -0,0 +1,175 @@
+/** $lic$
+* MIT License
+*
+* Copyright (c) 2017-2018 by Massachusetts Institute of Technology
+* Copyright (c) 2017-2018 by Qatar Computing Research Institute, HBKU
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* If you use this software in your research, we request that you reference
+* the KPart paper ("KPart: A Hybrid Cache Partitioning-Sharing Technique for
+* Commodity Multicores", El-Sayed, Mukkara, Tsai, Kasture, Ma, and Sanchez,
+* HPCA-24, February 2018) as the source in any publications that use this
+* software, and that you send us a citation of your work.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+**/
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include "group_reader.h"
+
+namespace pmu {
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PMU_HAVE_RDPMC 1
+
+static inline uint64_t rdpmc(uint32_t counter) {
+  uint32_t lo, hi;
+  asm volatile("rdpmc" : "=a"(lo), "=d"(hi) : "c"(counter));
+  return lo | ((uint64_t) hi << 32);
+}
+
+static inline uint64_t rdtsc() {
+  uint32_t lo, hi;
+  asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+  return lo | ((uint64_t) hi << 32);
+}
+#else
+#define PMU_HAVE_RDPMC 0
+#endif
+
+#define PMU_BARRIER() asm volatile("" ::: "memory")
+
+GroupReader::GroupReader(const std::vector<int> &fds,
+                         const std::vector<void *> &pages, bool selfMonitoring,
+                         bool allowRdpmc)
+    : fds(fds), pages(fds.size(), nullptr), ownPages(fds.size(), false),
+      mode(GROUP_READ), numFallbacks(0) {
+  if (!PMU_HAVE_RDPMC || !selfMonitoring || !allowRdpmc)
+    return;
+
+  size_t pgsz = sysconf(_SC_PAGESIZE);
+  bool usable = true;
+  for (size_t i = 0; i < fds.size(); i++) {
+    void *page = (i < pages.size()) ? pages[i] : nullptr;
+    if (!page) {
+      page = mmap(NULL, pgsz, PROT_READ, MAP_SHARED, fds[i], 0);
+      if (page == MAP_FAILED) {
+        usable = false;
+        continue;
+      }
+      ownPages[i] = true;
+    }
+    this->pages[i] = static_cast<const perf_event_mmap_page *>(page);
+    usable = usable && this->pages[i]->cap_user_rdpmc;
+  }
+  if (usable)
+    mode = RDPMC;
+}
+
+GroupReader::~GroupReader() {
+  size_t pgsz = sysconf(_SC_PAGESIZE);
+  for (size_t i = 0; i < pages.size(); i++) {
+    if (ownPages[i])
+      munmap(const_cast<perf_event_mmap_page *>(pages[i]), pgsz);
+  }
+}
+
+const char *GroupReader::getModeName(Mode mode) {
+  return (mode == RDPMC) ? "rdpmc" : "group read()";
+}
+
+bool GroupReader::read(std::vector<uint64_t> &values, uint64_t &timeEnabled,
+                       uint64_t &timeRunning) {
+  if (mode == RDPMC) {
+    if (readRdpmc(values, timeEnabled, timeRunning))
+      return true;
+    ++numFallbacks;
+  }
+  return readGroup(values, timeEnabled, timeRunning);
+}
+
+bool GroupReader::readGroup(std::vector<uint64_t> &values,
+                            uint64_t &timeEnabled, uint64_t &timeRunning) {
+  // { nr, time_enabled, time_running, value[nr] }
+  uint64_t buf[3 + fds.size()];
+  ssize_t ret = ::read(fds[0], buf, sizeof(buf));
+  if (ret < (ssize_t)(3 * sizeof(uint64_t)) || buf[0] != fds.size() ||
+      ret < (ssize_t)((3 + buf[0]) * sizeof(uint64_t)))
+    return false;
+  timeEnabled = buf[1];
+  timeRunning = buf[2];
+  values.assign(&buf[3], &buf[3 + fds.size()]);
+  return true;
+}
+
+// Follows the protocol documented in linux/perf_event.h. Every event has its
+// own page, but the events of a group are scheduled together, so the times
+// are taken from the leader's.
+bool GroupReader::readRdpmc(std::vector<uint64_t> &values,
+                            uint64_t &timeEnabled, uint64_t &timeRunning) {
+#if PMU_HAVE_RDPMC
+  values.resize(fds.size());
+  for (size_t i = 0; i < fds.size(); i++) {
+    const volatile perf_event_mmap_page *pc = pages[i];
+    uint32_t seq, idx;
+    uint64_t count, enabled, running;
+    do {
+      seq = pc->lock;
+      PMU_BARRIER();
+      enabled = pc->time_enabled;
+      running = pc->time_running;
+      if (i == 0 && pc->cap_user_time) {
+        // Add the time since the kernel last updated the page
+        uint64_t cyc = rdtsc();
+        uint16_t shift = pc->time_shift;
+        uint64_t quot = cyc >> shift;
+        uint64_t rem = cyc & (((uint64_t) 1 << shift) - 1);
+        uint64_t delta = pc->time_offset + quot * pc->time_mult +
+                         ((rem * pc->time_mult) >> shift);
+        enabled += delta;
+        running += delta;
+      }
+      idx = pc->index;
+      count = pc->offset;
+      if (pc->cap_user_rdpmc && idx) {
+        uint16_t width = pc->pmc_width;
+        int64_t pmc = rdpmc(idx - 1);
+        // Sign-extend the width-bit counter
+        pmc <<= 64 - width;
+        pmc >>= 64 - width;
+        count += pmc;
+      }
+      PMU_BARRIER();
+    } while (pc->lock != seq);
+
+    if (!idx)
+      return false; // not on a counter right now
+    values[i] = count;
+    if (i == 0) {
+      timeEnabled = enabled;
+      timeRunning = running;
+    }
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+} // namespace pmu
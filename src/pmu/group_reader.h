@@ -0,0 +1,85 @@
+/** $lic$
+* MIT License
+*
+* Copyright (c) 2017-2018 by Massachusetts Institute of Technology
+* Copyright (c) 2017-2018 by Qatar Computing Research Institute, HBKU
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* If you use this software in your research, we request that you reference
+* the KPart paper ("KPart: A Hybrid Cache Partitioning-Sharing Technique for
+* Commodity Multicores", El-Sayed, Mukkara, Tsai, Kasture, Ma, and Sanchez,
+* HPCA-24, February 2018) as the source in any publications that use this
+* software, and that you send us a citation of your work.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+**/
+#pragma once
+#include <stdint.h>
+#include <linux/perf_event.h>
+#include <vector>
+
+namespace pmu {
+
+// Reads the values of a perf event group opened with PERF_FORMAT_GROUP |
+// PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING.
+//
+// When the group counts the calling thread and the kernel lets userspace
+// read the PMU (cap_user_rdpmc, i.e. /sys/bus/event_source/devices/cpu/rdpmc
+// is set), values come straight from the counters with rdpmc, through the
+// seqlock protocol of each event's perf_event_mmap_page, with no syscall.
+// rdpmc reads the counters of the CPU it runs on, so events attached to
+// other processes (all of KPart's) always take the fallback: one read() of
+// the group leader.
+class GroupReader {
+public:
+  enum Mode { RDPMC, GROUP_READ };
+
+  // fds[0] is the group leader. pages[i], if given and non-null, is an
+  // existing mapping of fds[i] (e.g., the leader's ring buffer); the other
+  // events get a one-page read-only mapping when rdpmc may be used.
+  // allowRdpmc = false forces group reads.
+  GroupReader(const std::vector<int> &fds,
+              const std::vector<void *> &pages = std::vector<void *>(),
+              bool selfMonitoring = false, bool allowRdpmc = true);
+  ~GroupReader();
+
+  Mode getMode() const { return mode; }
+  static const char *getModeName(Mode mode);
+
+  // Returns false if the group could not be read at all. With rdpmc, falls
+  // back to a group read while any event is not on a counter (e.g., it is
+  // multiplexed out), and counts those reads in getNumFallbacks().
+  bool read(std::vector<uint64_t> &values, uint64_t &timeEnabled,
+            uint64_t &timeRunning);
+
+  uint64_t getNumFallbacks() const { return numFallbacks; }
+
+private:
+  std::vector<int> fds;
+  std::vector<const perf_event_mmap_page *> pages;
+  std::vector<bool> ownPages; // whether we mapped pages[i]
+  Mode mode;
+  uint64_t numFallbacks;
+
+  bool readRdpmc(std::vector<uint64_t> &values, uint64_t &timeEnabled,
+                 uint64_t &timeRunning);
+  bool readGroup(std::vector<uint64_t> &values, uint64_t &timeEnabled,
+                 uint64_t &timeRunning);
+};
+
+} // namespace pmu
@@ -0,0 +1,175 @@
+/** $lic$
+* MIT License
+*
+* Copyright (c) 2017-2018 by Massachusetts Institute of Technology
+* Copyright (c) 2017-2018 by Qatar Computing Research Institute, HBKU
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* If you use this software in your research, we request that you reference
+* the KPart paper ("KPart: A Hybrid Cache Partitioning-Sharing Technique for
+* Commodity Multicores", El-Sayed, Mukkara, Tsai, Kasture, Ma, and Sanchez,
+* HPCA-24, February 2018) as the source in any publications that use this
+* software, and that you send us a citation of your work.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+**/
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <sstream>
+#include <stdexcept>
+#include "miss_source.h"
+
+namespace pmu {
+
+MissSource::MissSource(const std::string &spec,
+                       const std::vector<std::string> &eventNames,
+                       bool haveMbm, int lineSize)
+    : kind(NONE), event(-1), eventWeight(1.0), lineSize(lineSize) {
+  std::string arg;
+  size_t colon = spec.find(':');
+  std::string name = spec.substr(0, colon);
+  if (colon != std::string::npos)
+    arg = spec.substr(colon + 1);
+
+  if (name == "none") {
+    kind = NONE;
+  } else if (name == "mbm-local") {
+    kind = MBM_LOCAL;
+  } else if (name == "mbm-total") {
+    kind = MBM_TOTAL;
+  } else if (name == "event" && !arg.empty()) {
+    kind = EVENT;
+    event = findEvent(arg, eventNames);
+  } else if (name == "blend" && !arg.empty()) {
+    // Event names have colons of their own, so the weight is whatever
+    // follows the last one, if it is a number
+    kind = BLEND;
+    eventWeight = 0.5;
+    size_t last = arg.rfind(':');
+    if (last != std::string::npos) {
+      char *end;
+      std::string weight = arg.substr(last + 1);
+      double w = strtod(weight.c_str(), &end);
+      if (!weight.empty() && *end == '\0') {
+        if (w < 0.0 || w > 1.0)
+          throw std::invalid_argument("blend weight must be in [0, 1]");
+        eventWeight = w;
+        arg = arg.substr(0, last);
+      }
+    }
+    event = findEvent(arg, eventNames);
+  } else {
+    throw std::invalid_argument("unknown miss source '" + spec + "'");
+  }
+
+  if (event >= 0)
+    eventName = eventNames[event];
+  if ((kind == MBM_LOCAL || kind == MBM_TOTAL || kind == BLEND) && !haveMbm)
+    throw std::invalid_argument("miss source '" + spec + "' needs MBM");
+}
+
+int MissSource::findEvent(const std::string &name,
+                          const std::vector<std::string> &eventNames) {
+  for (size_t i = 0; i < eventNames.size(); i++) {
+    if (eventNames[i] == name)
+      return i;
+  }
+  char *end;
+  long idx = strtol(name.c_str(), &end, 10);
+  if (*end == '\0' && idx >= 0 && idx < (long) eventNames.size())
+    return idx;
+  throw std::invalid_argument("no event '" + name + "' in the counter group");
+}
+
+// Event names as perf and libpfm spell the LLC misses of Intel parts, upper
+// case and with '.' and '-' as ':'; modifiers may follow
+static const char *llcMissEvents[] = {
+    "LLC_MISSES",                     "LLC:MISSES",
+    "LLC:LOAD:MISSES",                "CACHE:MISSES",
+    "PERF_COUNT_HW_CACHE_MISSES",     "LONGEST_LAT_CACHE:MISS",
+    "MEM_LOAD_RETIRED:L3_MISS",       "MEM_LOAD_UOPS_RETIRED:L3_MISS",
+    "MEM_LOAD_UOPS_RETIRED:LLC_MISS",
+};
+
+static bool is_llc_miss_event(const std::string &name) {
+  std::string norm = name;
+  for (char &c : norm)
+    c = (c == '.' || c == '-') ? ':' : toupper(c);
+  for (const char *e : llcMissEvents) {
+    std::string event = e;
+    if (norm.compare(0, event.size(), event) == 0 &&
+        (norm.size() == event.size() || norm[event.size()] == ':'))
+      return true;
+  }
+  return false;
+}
+
+std::string MissSource::defaultSpec(const std::vector<std::string> &eventNames,
+                                    bool haveMbm) {
+  for (size_t i = 0; i < eventNames.size(); i++) {
+    if (is_llc_miss_event(eventNames[i])) {
+      std::stringstream ss;
+      ss << "event:" << i;
+      return ss.str();
+    }
+  }
+  return haveMbm ? "mbm-local" : "none";
+}
+
+std::string MissSource::getDescription() const {
+  std::stringstream ss;
+  switch (kind) {
+  case NONE:
+    return "none (flat miss curves)";
+  case EVENT:
+    return "event " + eventName;
+  case MBM_LOCAL:
+    return "MBM local traffic";
+  case MBM_TOTAL:
+    return "MBM total traffic";
+  case BLEND:
+    ss << eventWeight << " * event " << eventName << " + " << 1 - eventWeight
+       << " * MBM local traffic";
+    return ss.str();
+  }
+  return "";
+}
+
+double MissSource::getMisses(const Counts &counts) const {
+  double eventMisses = 0.0;
+  if (event >= 0 && event < (int) counts.values->size())
+    eventMisses = (*counts.values)[event];
+  double localLines = (double) counts.mbmLocalBytes / lineSize;
+
+  switch (kind) {
+  case NONE:
+    return 0.0;
+  case EVENT:
+    return eventMisses;
+  case MBM_LOCAL:
+    return localLines;
+  case MBM_TOTAL:
+    return (double) counts.mbmTotalBytes / lineSize;
+  case BLEND:
+    return eventWeight * eventMisses + (1 - eventWeight) * localLines;
+  }
+  return 0.0;
+}
+
+} // namespace pmu
@@ -0,0 +1,91 @@
+/** $lic$
+* MIT License
+*
+* Copyright (c) 2017-2018 by Massachusetts Institute of Technology
+* Copyright (c) 2017-2018 by Qatar Computing Research Institute, HBKU
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* If you use this software in your research, we request that you reference
+* the KPart paper ("KPart: A Hybrid Cache Partitioning-Sharing Technique for
+* Commodity Multicores", El-Sayed, Mukkara, Tsai, Kasture, Ma, and Sanchez,
+* HPCA-24, February 2018) as the source in any publications that use this
+* software, and that you send us a citation of your work.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+**/
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace pmu {
+
+// Where the LLC misses behind a process's MPKI samples come from. Chosen at
+// run time, so that builds without CMT get miss curves too, and each platform
+// can use its cheapest source. Specs:
+//   event:<event>       a miss event of the process's counter group (e.g.,
+//                       LONGEST_LAT_CACHE:MISS or MEM_LOAD_RETIRED.L3_MISS),
+//                       by name or index
+//   mbm-local           MBM local memory traffic, in cache lines
+//   mbm-total           MBM total (local and remote) memory traffic
+//   blend:<event>[:<w>] w * the event + (1 - w) * MBM local traffic
+//                       (w = 0.5 by default)
+//   none                no misses (flat miss curves)
+class MissSource {
+public:
+  enum Kind { NONE, EVENT, MBM_LOCAL, MBM_TOTAL, BLEND };
+
+  // A process's counts as of one read; MBM counts are cumulative bytes, and
+  // ignored without MBM
+  struct Counts {
+    const std::vector<uint64_t> *values; // of the group, in event order
+    int64_t mbmLocalBytes;
+    int64_t mbmTotalBytes;
+  };
+
+  // eventNames are the group's events, in order. Throws
+  // std::invalid_argument on a bad spec, or an MBM source without MBM.
+  MissSource(const std::string &spec,
+             const std::vector<std::string> &eventNames, bool haveMbm,
+             int lineSize);
+
+  // The first LLC miss event (e.g., LLC_MISSES, cache-misses or
+  // LONGEST_LAT_CACHE.MISS; other misses, such as branch or L1D misses, do
+  // not count), or else MBM local traffic if there is MBM, or else none
+  static std::string defaultSpec(const std::vector<std::string> &eventNames,
+                                 bool haveMbm);
+
+  Kind getKind() const { return kind; }
+  // e.g. "event LONGEST_LAT_CACHE:MISS"
+  std::string getDescription() const;
+
+  // LLC misses counted so far; MPKI comes from the difference of two reads
+  double getMisses(const Counts &counts) const;
+
+private:
+  Kind kind;
+  int event; // EVENT, BLEND
+  std::string eventName;
+  double eventWeight; // BLEND
+  int lineSize;
+
+  static int findEvent(const std::string &name,
+                       const std::vector<std::string> &eventNames);
+};
+
+} // namespace pmu
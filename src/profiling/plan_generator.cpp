@@ -0,0 +1,144 @@
+/** $lic$
+* MIT License
+*
+* Copyright (c) 2017-2018 by Massachusetts Institute of Technology
+* Copyright (c) 2017-2018 by Qatar Computing Research Institute, HBKU
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* If you use this software in your research, we request that you reference
+* the KPart paper ("KPart: A Hybrid Cache Partitioning-Sharing Technique for
+* Commodity Multicores", El-Sayed, Mukkara, Tsai, Kasture, Ma, and Sanchez,
+* HPCA-24, February 2018) as the source in any publications that use this
+* software, and that you send us a citation of your work.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+**/
+
+#include <math.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+#include "plan_generator.h"
+
+namespace profiling {
+
+PlanGenerator::PlanGenerator(const std::string &spec)
+    : spacing(UNIFORM), numSamples(DEFAULT_SAMPLES) {
+  size_t colon = spec.find(':');
+  std::string name = spec.substr(0, colon);
+  if (name == "uniform") {
+    spacing = UNIFORM;
+  } else if (name == "geometric") {
+    spacing = GEOMETRIC;
+  } else if (name == "dense-small") {
+    spacing = DENSE_SMALL;
+  } else {
+    throw std::invalid_argument("unknown profiling plan '" + spec + "'");
+  }
+
+  if (colon != std::string::npos) {
+    std::string samples = spec.substr(colon + 1);
+    char *end;
+    long n = strtol(samples.c_str(), &end, 10);
+    if (samples.empty() || *end != '\0' || n < 2)
+      throw std::invalid_argument("profiling plan '" + spec +
+                                  "' needs at least 2 samples");
+    numSamples = n;
+  }
+}
+
+std::string PlanGenerator::getDescription() const {
+  std::stringstream ss;
+  ss << (spacing == UNIFORM ? "uniform"
+                            : (spacing == GEOMETRIC ? "geometric"
+                                                    : "dense-small"))
+     << ", " << numSamples << " samples";
+  return ss.str();
+}
+
+double PlanGenerator::target(int k, int n, int hi, int lo) const {
+  if (n == 1)
+    return hi;
+  double u = (double) k / (n - 1);
+  switch (spacing) {
+  case GEOMETRIC:
+    return hi * pow((double) lo / hi, u);
+  case DENSE_SMALL:
+    return lo + (hi - lo) * (1 - u) * (1 - u);
+  default:
+    return hi - (hi - lo) * u;
+  }
+}
+
+std::vector<int>
+PlanGenerator::getSampleSizes(int capacity,
+                              const CutAllowed &cutAllowed) const {
+  // Sizes the app can be given, with the cut at its end of the cache or the
+  // other's
+  std::vector<int> valid;
+  for (int p = capacity - 1; p >= 1; p--) {
+    if (cutAllowed(p) || cutAllowed(capacity - p))
+      valid.push_back(p);
+  }
+  if (valid.empty())
+    throw std::invalid_argument("no way count of the cache can be profiled");
+
+  // Closest valid size to each target, keeping them distinct and leaving
+  // enough smaller sizes for the samples still to place
+  int n = std::min<int>(numSamples, valid.size());
+  std::vector<int> sizes;
+  int next = 0; // first index of valid still available
+  for (int k = 0; k < n; k++) {
+    double t = target(k, n, valid.front(), valid.back());
+    int last = valid.size() - (n - k);
+    int best = next;
+    for (int j = next; j <= last; j++) {
+      if (fabs(valid[j] - t) < fabs(valid[best] - t))
+        best = j;
+    }
+    sizes.push_back(valid[best]);
+    next = best + 1;
+  }
+  return sizes;
+}
+
+std::vector<PlanGenerator::Slice>
+PlanGenerator::generate(int capacity, const CutAllowed &cutAllowed) const {
+  if (capacity < 3 || capacity > 64)
+    throw std::invalid_argument("cannot profile a cache of " +
+                                std::to_string(capacity) + " ways");
+  uint64_t allWays = (capacity == 64) ? ~0ULL : (1ULL << capacity) - 1;
+
+  std::vector<int> sizes = getSampleSizes(capacity, cutAllowed);
+  sizes.insert(sizes.begin(), sizes.front()); // warmup
+
+  std::vector<Slice> slices;
+  for (int p : sizes) {
+    // The profiled app takes the bottom ways, or else the top ways
+    Slice slice;
+    slice.profiledWays = p;
+    uint64_t low = (1ULL << p) - 1;
+    slice.profiledMask = cutAllowed(p) ? low : low << (capacity - p);
+    slice.sharedMask = allWays & ~slice.profiledMask;
+    slices.push_back(slice);
+  }
+  return slices;
+}
+
+} // namespace profiling
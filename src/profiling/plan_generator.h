@@ -0,0 +1,92 @@
+/** $lic$
+* MIT License
+*
+* Copyright (c) 2017-2018 by Massachusetts Institute of Technology
+* Copyright (c) 2017-2018 by Qatar Computing Research Institute, HBKU
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* If you use this software in your research, we request that you reference
+* the KPart paper ("KPart: A Hybrid Cache Partitioning-Sharing Technique for
+* Commodity Multicores", El-Sayed, Mukkara, Tsai, Kasture, Ma, and Sanchez,
+* HPCA-24, February 2018) as the source in any publications that use this
+* software, and that you send us a citation of your work.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+**/
+#pragma once
+#include <stdint.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace profiling {
+
+// Builds the profiling sweep of one app: the way counts at which its IPC and
+// miss curves are sampled, and for each, the ways it gets and the ways every
+// other app shares. Specs are "<spacing>[:<samples>]", where spacing places
+// the samples between capacity - 1 ways and one way:
+//   uniform       evenly
+//   geometric     at a constant ratio, i.e., denser at small sizes
+//   dense-small   quadratically, denser at small sizes still
+// and samples is how many distinct way counts to sample (at least 2; 6 by
+// default, or fewer if the cache has fewer sizes to offer). Fewer samples
+// make for a shorter sweep and coarser curves.
+class PlanGenerator {
+public:
+  enum Spacing { UNIFORM, GEOMETRIC, DENSE_SMALL };
+
+  struct Slice {
+    int profiledWays;
+    uint64_t profiledMask; // ways of the profiled app
+    uint64_t sharedMask;   // ways the other apps share
+  };
+
+  // Whether a partition may end right before way w (see rdt/quirks.h)
+  typedef std::function<bool(int)> CutAllowed;
+
+  static const int DEFAULT_SAMPLES = 6;
+
+  // Throws std::invalid_argument on a bad spec
+  explicit PlanGenerator(const std::string &spec);
+
+  // e.g. "uniform, 6 samples"
+  std::string getDescription() const;
+
+  // Way counts to sample, largest first, for a cache (or way budget) of
+  // capacity ways. Each leaves a valid cut: between the profiled app's ways
+  // and the rest, whichever end of the cache the app takes.
+  std::vector<int> getSampleSizes(int capacity,
+                                  const CutAllowed &cutAllowed) const;
+
+  // One slice per sample size, preceded by a warmup slice at the first
+  // size: the first phases after a repartition see the previous allocation's
+  // lines, so they are not used as a sample (see
+  // allAppsCacheAssignments in kpart.cpp). Throws std::invalid_argument if
+  // capacity is below 3 or above 64 ways.
+  std::vector<Slice> generate(int capacity,
+                              const CutAllowed &cutAllowed) const;
+
+private:
+  Spacing spacing;
+  int numSamples;
+
+  // Where sample k of n would go, ignoring rounding and quirks
+  double target(int k, int n, int hi, int lo) const;
+};
+
+} // namespace profiling
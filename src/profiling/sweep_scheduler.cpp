@@ -0,0 +1,188 @@
+/** $lic$
+* MIT License
+*
+* Copyright (c) 2017-2018 by Massachusetts Institute of Technology
+* Copyright (c) 2017-2018 by Qatar Computing Research Institute, HBKU
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* If you use this software in your research, we request that you reference
+* the KPart paper ("KPart: A Hybrid Cache Partitioning-Sharing Technique for
+* Commodity Multicores", El-Sayed, Mukkara, Tsai, Kasture, Ma, and Sanchez,
+* HPCA-24, February 2018) as the source in any publications that use this
+* software, and that you send us a citation of your work.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+**/
+
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include "sweep_scheduler.h"
+
+namespace profiling {
+
+SweepScheduler::SweepScheduler(int capacity, int maxGroups,
+                               const PlanGenerator::CutAllowed &cutAllowed)
+    : capacity(capacity), maxGroups(maxGroups), cutAllowed(cutAllowed) {
+  if (capacity < 3 || capacity > 64)
+    throw std::invalid_argument("cannot profile a cache of " +
+                                std::to_string(capacity) + " ways");
+  if (maxGroups < 1)
+    throw std::invalid_argument("cannot profile apps in " +
+                                std::to_string(maxGroups) + " groups");
+}
+
+std::vector<std::pair<int, int> >
+SweepScheduler::freeRuns(uint64_t used) const {
+  std::vector<std::pair<int, int> > runs;
+  for (int w = 0; w < capacity; w++) {
+    if (used & (1ULL << w))
+      continue;
+    if (runs.empty() || runs.back().first + runs.back().second != w)
+      runs.push_back(std::make_pair(w, 0));
+    runs.back().second++;
+  }
+  return runs;
+}
+
+bool SweepScheduler::place(int ways, uint64_t used, uint64_t &mask,
+                           bool &fromBottom) const {
+  int numFree = capacity - __builtin_popcountll(used);
+  if (ways < 1 || numFree - ways < 1)
+    return false;
+  // Runs start and end at the cache's ends or at other groups' ends, which
+  // are allowed cuts
+  int bestLen = 0;
+  for (const std::pair<int, int> &run : freeRuns(used)) {
+    if (run.second < ways || (bestLen && run.second >= bestLen))
+      continue;
+    int first;
+    if (cutAllowed(run.first + ways))
+      first = run.first;
+    else if (cutAllowed(run.first + run.second - ways))
+      first = run.first + run.second - ways;
+    else
+      continue;
+    mask = ((1ULL << ways) - 1) << first;
+    fromBottom = (first == run.first);
+    bestLen = run.second;
+  }
+  return bestLen != 0;
+}
+
+std::vector<SweepScheduler::Slice>
+SweepScheduler::schedule(const std::vector<std::vector<int> > &sizes) const {
+  int numApps = sizes.size();
+  std::vector<std::vector<int> > left(sizes); // sizes still to sample
+  for (std::vector<int> &l : left)
+    std::sort(l.begin(), l.end(), std::greater<int>());
+
+  std::vector<Slice> slices;
+  // Group of each app in the last slice (app -1 if it had none), and which
+  // end of it the app started from
+  const Group none = {-1, 0, 0, false};
+  std::vector<Group> held(numApps, none);
+  std::vector<bool> fromBottom(numApps, false);
+  while (true) {
+    bool done = true;
+    for (const std::vector<int> &l : left)
+      done = done && l.empty();
+    if (done)
+      break;
+
+    Slice slice;
+    uint64_t used = 0;
+    std::vector<Group> next(numApps, none);
+
+    // Apps that held ways sample within them, keeping the end they started
+    // from, so that their lines are warm: right after a warmup at its very
+    // size, else at the largest size they still need that is no larger and
+    // leaves a valid cut. Apps that have none stop.
+    for (int app = 0; app < numApps; app++) {
+      const Group &h = held[app];
+      if (h.app < 0)
+        continue;
+      int first = __builtin_ctzll(h.mask);
+      for (int ways : left[app]) {
+        if (ways > h.ways || (h.warmup && ways != h.ways))
+          continue;
+        int cut = fromBottom[app] ? first + ways : first + h.ways - ways;
+        if (ways != h.ways && !cutAllowed(cut))
+          continue;
+        uint64_t bits = (1ULL << ways) - 1;
+        Group g = {app, ways, bits << (fromBottom[app] ? first : cut), false};
+        slice.groups.push_back(g);
+        next[app] = g;
+        used |= g.mask;
+        std::vector<int> &l = left[app];
+        l.erase(std::find(l.begin(), l.end(), ways));
+        break;
+      }
+    }
+
+    // Then apps waiting to start (or that stopped) warm up at the largest
+    // size they still need that fits
+    for (int app = 0; app < numApps; app++) {
+      if ((int) slice.groups.size() == maxGroups)
+        break;
+      if (next[app].app >= 0)
+        continue;
+      for (int ways : left[app]) {
+        Group g = {app, ways, 0, true};
+        bool bottom;
+        if (place(ways, used, g.mask, bottom)) {
+          slice.groups.push_back(g);
+          next[app] = g;
+          fromBottom[app] = bottom;
+          used |= g.mask;
+          break;
+        }
+      }
+    }
+
+    // Only if the first app left cannot take its sizes even on its own
+    if (slice.groups.empty()) {
+      int app = 0;
+      while (left[app].empty())
+        app++;
+      throw std::invalid_argument("cannot place " +
+                                  std::to_string(left[app].front()) +
+                                  " ways for app " + std::to_string(app));
+    }
+
+    // Groups only shrink or start with a way to spare, so a run is left
+    std::pair<int, int> shared(0, 0);
+    for (const std::pair<int, int> &run : freeRuns(used)) {
+      if (run.second > shared.second)
+        shared = run;
+    }
+    slice.sharedMask = ((1ULL << shared.second) - 1) << shared.first;
+    slices.push_back(slice);
+    held = next;
+  }
+  return slices;
+}
+
+int SweepScheduler::serialSlices(const std::vector<std::vector<int> > &sizes) {
+  int slices = 0;
+  for (const std::vector<int> &s : sizes)
+    slices += s.size() + 1;
+  return slices;
+}
+
+} // namespace profiling
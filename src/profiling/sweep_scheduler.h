@@ -0,0 +1,93 @@
+/** $lic$
+* MIT License
+*
+* Copyright (c) 2017-2018 by Massachusetts Institute of Technology
+* Copyright (c) 2017-2018 by Qatar Computing Research Institute, HBKU
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* If you use this software in your research, we request that you reference
+* the KPart paper ("KPart: A Hybrid Cache Partitioning-Sharing Technique for
+* Commodity Multicores", El-Sayed, Mukkara, Tsai, Kasture, Ma, and Sanchez,
+* HPCA-24, February 2018) as the source in any publications that use this
+* software, and that you send us a citation of your work.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+**/
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+#include "plan_generator.h"
+
+namespace profiling {
+
+// Packs the profiling sweeps of several apps into shared slices, so that
+// apps are profiled at the same time, each in its own group (COS) of ways,
+// while the apps not being profiled share the rest. Every app samples the
+// same way counts as it would alone (see PlanGenerator), but in any order,
+// and only on ways it held the slice before: after a warmup, at the size it
+// warmed up at, then at ever smaller sizes within the same ways, keeping the
+// end of them it started from. An app that cannot go on that way stops, and
+// waiting apps warm up at the largest size they still need that fits in the
+// ways left. Groups take the smallest run of free ways they fit in, from
+// either end of it, so that no partition ends at a cut the platform forbids;
+// the apps not being profiled share the largest run left.
+class SweepScheduler {
+public:
+  struct Group {
+    int app;       // index into the sizes given to schedule()
+    int ways;
+    uint64_t mask; // ways of the group
+    bool warmup;   // not a sample (see PlanGenerator::generate)
+  };
+
+  struct Slice {
+    std::vector<Group> groups;
+    uint64_t sharedMask; // ways the apps not being profiled share
+  };
+
+  // At most maxGroups apps are profiled in any slice, and the shared ways
+  // always keep at least one way. Throws std::invalid_argument if capacity
+  // is below 3 or above 64 ways, or maxGroups is below 1.
+  SweepScheduler(int capacity, int maxGroups,
+                 const PlanGenerator::CutAllowed &cutAllowed);
+
+  // sizes[a] holds the way counts app a samples; each must be valid for
+  // the app alone, as PlanGenerator::getSampleSizes() returns them
+  std::vector<Slice> schedule(const std::vector<std::vector<int> > &sizes)
+      const;
+
+  // Slices the same samples take one app at a time, each with its warmup
+  static int serialSlices(const std::vector<std::vector<int> > &sizes);
+
+private:
+  int capacity;
+  int maxGroups;
+  PlanGenerator::CutAllowed cutAllowed;
+
+  // Runs of the ways not in used, as (first way, number of ways)
+  std::vector<std::pair<int, int> > freeRuns(uint64_t used) const;
+
+  // Places ways ways in the smallest run of free ways that takes them, at
+  // its bottom or else its top, keeping at least one way free. Returns
+  // false if no run does.
+  bool place(int ways, uint64_t used, uint64_t &mask, bool &fromBottom) const;
+};
+
+} // namespace profiling
@@ -0,0 +1,204 @@
+/** $lic$
+* MIT License
+*
+* Copyright (c) 2017-2018 by Massachusetts Institute of Technology
+* Copyright (c) 2017-2018 by Qatar Computing Research Institute, HBKU
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* If you use this software in your research, we request that you reference
+* the KPart paper ("KPart: A Hybrid Cache Partitioning-Sharing Technique for
+* Commodity Multicores", El-Sayed, Mukkara, Tsai, Kasture, Ma, and Sanchez,
+* HPCA-24, February 2018) as the source in any publications that use this
+* software, and that you send us a citation of your work.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+**/
+
+#include <assert.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <time.h>
+#include <algorithm>
+#include "cmt_sampler.h"
+
+namespace rdt {
+
+static uint64_t now_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+CmtSampler::CmtSampler(RdtBackend *backend, double periodMs, int maxRmids)
+    : backend(backend), periodMs(periodMs), maxRmids(maxRmids),
+      slots(new Slot[maxRmids]), running(false), sweepIdx(0), numSweeps(0),
+      numFailures(0),
+      totalSweepUs(0), maxSweepUs(0) {
+  assert(periodMs > 0);
+  for (int r = 0; r < maxRmids; r++) {
+    slots[r].seq = 0;
+    slots[r].sweep = 0;
+    slots[r].haveBase = false;
+  }
+}
+
+CmtSampler::~CmtSampler() { stop(); }
+
+void CmtSampler::addRmid(uint32_t rmid) {
+  if (rmid >= (uint32_t) maxRmids)
+    throw RdtException("CMT sampler: RMID out of range");
+  std::lock_guard<std::mutex> lock(rmidsMutex);
+  if (std::find(rmids.begin(), rmids.end(), rmid) == rmids.end()) {
+    rmids.push_back(rmid);
+    rmidsAdded.push_back(rmid);
+  }
+}
+
+void CmtSampler::removeRmid(uint32_t rmid) {
+  std::lock_guard<std::mutex> lock(rmidsMutex);
+  rmids.erase(std::remove(rmids.begin(), rmids.end(), rmid), rmids.end());
+}
+
+void CmtSampler::start() {
+  if (running)
+    return;
+  running = true;
+  thread = std::thread(&CmtSampler::run, this);
+}
+
+void CmtSampler::stop() {
+  running = false;
+  if (thread.joinable())
+    thread.join();
+}
+
+bool CmtSampler::getSnapshot(uint32_t rmid, Snapshot &snap) const {
+  if (rmid >= (uint32_t) maxRmids)
+    return false;
+  const Slot &slot = slots[rmid];
+  uint64_t seq0, seq1;
+  do {
+    seq0 = slot.seq.load(std::memory_order_acquire);
+    snap.llcOccupancy = slot.llcOccupancy.load(std::memory_order_relaxed);
+    snap.localMemTraffic = slot.localMemTraffic.load(std::memory_order_relaxed);
+    snap.totalMemTraffic = slot.totalMemTraffic.load(std::memory_order_relaxed);
+    snap.sweep = slot.sweep.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    seq1 = slot.seq.load(std::memory_order_relaxed);
+  } while ((seq0 & 1) || seq0 != seq1);
+  return snap.sweep != 0;
+}
+
+double CmtSampler::getAvgSweepMs() const {
+  uint64_t n = numSweeps.load();
+  return n ? totalSweepUs.load() * 1e-3 / n : 0.0;
+}
+
+void CmtSampler::publish(Slot &slot, const MonSample &s, uint64_t sweepIdx) {
+  uint64_t seq = slot.seq.load(std::memory_order_relaxed);
+  slot.seq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.llcOccupancy.store(s.llcOccupancy, std::memory_order_relaxed);
+  slot.localMemTraffic.store(s.localMemTraffic - slot.localBase,
+                             std::memory_order_relaxed);
+  slot.totalMemTraffic.store(s.totalMemTraffic - slot.totalBase,
+                             std::memory_order_relaxed);
+  slot.sweep.store(sweepIdx, std::memory_order_relaxed);
+  slot.seq.store(seq + 2, std::memory_order_release);
+}
+
+void CmtSampler::sweep(uint64_t sweepIdx) {
+  std::vector<uint32_t> ids;
+  {
+    std::lock_guard<std::mutex> lock(rmidsMutex);
+    ids = rmids;
+    for (uint32_t r : rmidsAdded) {
+      Slot &slot = slots[r];
+      // Mark the slot as not yet sampled until its first sweep publishes
+      MonSample zero = { r, 0, 0, 0 };
+      slot.localBase = slot.totalBase = 0;
+      publish(slot, zero, 0);
+      slot.haveBase = false;
+    }
+    rmidsAdded.clear();
+  }
+  if (ids.empty())
+    return;
+
+  std::vector<MonSample> samples;
+  backend->sampleRmids(ids, samples);
+  for (const MonSample &s : samples) {
+    Slot &slot = slots[s.rmid];
+    if (!slot.haveBase) {
+      slot.localBase = s.localMemTraffic;
+      slot.totalBase = s.totalMemTraffic;
+      slot.haveBase = true;
+    }
+    publish(slot, s, sweepIdx);
+  }
+}
+
+void CmtSampler::timedSweep() {
+  uint64_t start = now_us();
+  try {
+    sweep(++sweepIdx);
+  } catch (std::exception &e) {
+    if (numFailures++ == 0)
+      printf("[ERROR] CMT sampler: %s\n", e.what());
+  }
+  uint64_t elapsed = now_us() - start;
+  totalSweepUs += elapsed;
+  if (elapsed > maxSweepUs)
+    maxSweepUs = elapsed;
+  numSweeps++;
+}
+
+void CmtSampler::sampleOnce() {
+  assert(!running);
+  timedSweep();
+}
+
+void CmtSampler::run() {
+  // Signals (in particular the phase signal, whose handler reads snapshots)
+  // must be delivered to other threads, never to one mid-publish
+  sigset_t all;
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, nullptr);
+
+  const uint64_t periodNs = periodMs * 1e6;
+  struct timespec next;
+  clock_gettime(CLOCK_MONOTONIC, &next);
+  while (running) {
+    timedSweep();
+
+    // Fixed rate: sleep until the next period boundary, skipping any
+    // boundaries a slow sweep has already overrun
+    uint64_t nextNs = next.tv_sec * 1000000000ULL + next.tv_nsec + periodNs;
+    uint64_t nowNs = now_us() * 1000;
+    if (nextNs < nowNs)
+      nextNs += ((nowNs - nextNs) / periodNs + 1) * periodNs;
+    next.tv_sec = nextNs / 1000000000ULL;
+    next.tv_nsec = nextNs % 1000000000ULL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, nullptr) ==
+           EINTR)
+      ;
+  }
+}
+
+} // namespace rdt
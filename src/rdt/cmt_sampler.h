@@ -0,0 +1,125 @@
+/** $lic$
+* MIT License
+*
+* Copyright (c) 2017-2018 by Massachusetts Institute of Technology
+* Copyright (c) 2017-2018 by Qatar Computing Research Institute, HBKU
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* If you use this software in your research, we request that you reference
+* the KPart paper ("KPart: A Hybrid Cache Partitioning-Sharing Technique for
+* Commodity Multicores", El-Sayed, Mukkara, Tsai, Kasture, Ma, and Sanchez,
+* HPCA-24, February 2018) as the source in any publications that use this
+* software, and that you send us a citation of your work.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+**/
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "rdt_backend.h"
+
+namespace rdt {
+
+// Sweeps the monitoring counters of every registered RMID from a background
+// thread at a fixed period, and publishes the latest values as per-RMID
+// snapshots. Snapshots are read lock-free (a seqlock over atomics), so they
+// can be read from a signal handler without touching any MSR or file.
+//
+// Memory traffic is reported as 64-bit byte totals since the RMID was added.
+// The backend folds counter wraparound into its running totals on every
+// sweep, so the period only needs to be shorter than the time it takes the
+// hardware counter to wrap once.
+class CmtSampler {
+public:
+  struct Snapshot {
+    int64_t llcOccupancy;
+    int64_t localMemTraffic;
+    int64_t totalMemTraffic;
+    uint64_t sweep; // sweep that produced this snapshot
+  };
+
+  CmtSampler(RdtBackend *backend, double periodMs, int maxRmids = 1024);
+  ~CmtSampler();
+
+  // RMIDs may be added and removed while the sampler is running
+  void addRmid(uint32_t rmid);
+  void removeRmid(uint32_t rmid);
+
+  void start();
+  void stop();
+
+  // Runs one sweep on the calling thread, for callers that drive time
+  // themselves (e.g., a simulation) instead of starting the thread
+  void sampleOnce();
+
+  // Returns false if rmid has not been sampled since it was added. Lock-free
+  // and async-signal-safe.
+  bool getSnapshot(uint32_t rmid, Snapshot &snap) const;
+
+  uint64_t getNumSweeps() const { return numSweeps.load(); }
+  uint64_t getNumFailures() const { return numFailures.load(); }
+  double getAvgSweepMs() const;
+  double getMaxSweepMs() const { return maxSweepUs.load() * 1e-3; }
+  double getPeriodMs() const { return periodMs; }
+
+private:
+  struct Slot {
+    // Written only by the sampler thread; odd while an update is in flight
+    std::atomic<uint64_t> seq;
+    std::atomic<int64_t> llcOccupancy;
+    std::atomic<int64_t> localMemTraffic;
+    std::atomic<int64_t> totalMemTraffic;
+    std::atomic<uint64_t> sweep;
+
+    // Sampler-private: backend totals at the first sweep after addRmid()
+    int64_t localBase;
+    int64_t totalBase;
+    bool haveBase;
+  };
+
+  RdtBackend *backend;
+  double periodMs;
+  int maxRmids;
+  std::unique_ptr<Slot[]> slots;
+
+  // Registered RMIDs; guarded by rmidsMutex. rmidsAdded holds RMIDs that
+  // still need their slot reset by the sampler thread.
+  std::mutex rmidsMutex;
+  std::vector<uint32_t> rmids;
+  std::vector<uint32_t> rmidsAdded;
+
+  std::thread thread;
+  std::atomic<bool> running;
+  uint64_t sweepIdx; // last sweep started, by whichever thread sweeps
+
+  std::atomic<uint64_t> numSweeps;
+  std::atomic<uint64_t> numFailures;
+  std::atomic<uint64_t> totalSweepUs;
+  std::atomic<uint64_t> maxSweepUs;
+
+  void run();
+  void timedSweep();
+  void sweep(uint64_t sweepIdx);
+  void publish(Slot &slot, const MonSample &s, uint64_t sweepIdx);
+};
+
+} // namespace rdt
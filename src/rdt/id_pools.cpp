@@ -0,0 +1,223 @@
+/** $lic$
+* MIT License
+*
+* Copyright (c) 2017-2018 by Massachusetts Institute of Technology
+* Copyright (c) 2017-2018 by Qatar Computing Research Institute, HBKU
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* If you use this software in your research, we request that you reference
+* the KPart paper ("KPart: A Hybrid Cache Partitioning-Sharing Technique for
+* Commodity Multicores", El-Sayed, Mukkara, Tsai, Kasture, Ma, and Sanchez,
+* HPCA-24, February 2018) as the source in any publications that use this
+* software, and that you send us a citation of your work.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+**/
+
+#include <algorithm>
+#include "id_pools.h"
+
+namespace rdt {
+
+CosPool::CosPool(int numCos, int firstCos)
+    : numCos(numCos), firstCos(firstCos) {}
+
+std::vector<int> CosPool::assign(const std::vector<CosAlloc> &allocs) {
+  // Allocations that stay keep their COS; the rest is free again
+  std::map<CosAlloc, int> kept;
+  std::vector<bool> used(numCos, false);
+  for (const CosAlloc &a : allocs) {
+    auto it = assigned.find(a);
+    if (it != assigned.end() && !kept.count(a)) {
+      kept[a] = it->second;
+      used[it->second] = true;
+    }
+  }
+
+  std::vector<int> cos;
+  int next = firstCos;
+  for (const CosAlloc &a : allocs) {
+    auto it = kept.find(a);
+    if (it == kept.end()) {
+      while (next < numCos && used[next])
+        next++;
+      if (next >= numCos)
+        throw RdtException("more distinct allocations than COSes (" +
+                           std::to_string(getNumCos()) + ")");
+      used[next] = true;
+      it = kept.insert(std::make_pair(a, next)).first;
+    }
+    cos.push_back(it->second);
+  }
+  assigned = kept;
+  return cos;
+}
+
+RmidPool::RmidPool(int numRmids, int64_t cleanBytes, int cooldownRounds,
+                   int firstRmid)
+    : cleanBytes(cleanBytes), cooldownRounds(cooldownRounds), round(0) {
+  // Handed out lowest first
+  for (int r = numRmids - 1; r >= firstRmid; r--)
+    freeRmids.push_back(r);
+}
+
+void RmidPool::addWorkload(int workload) {
+  if (holders.count(workload) ||
+      std::find(waiting.begin(), waiting.end(), workload) != waiting.end())
+    return;
+  waiting.push_back(workload);
+}
+
+int RmidPool::removeWorkload(int workload) {
+  pinned.erase(workload);
+  waiting.erase(std::remove(waiting.begin(), waiting.end(), workload),
+                waiting.end());
+  if (!holders.count(workload))
+    return -1;
+  uint32_t rmid = release(workload);
+  Dirty d = { rmid, 0 };
+  dirtyRmids.push_back(d);
+  return rmid;
+}
+
+void RmidPool::setPinned(int workload, bool pin) {
+  if (pin)
+    pinned[workload] = true;
+  else
+    pinned.erase(workload);
+}
+
+bool RmidPool::isPinned(int workload) const { return pinned.count(workload); }
+
+int RmidPool::getRmid(int workload) const {
+  auto it = holders.find(workload);
+  return (it == holders.end()) ? -1 : it->second;
+}
+
+void RmidPool::give(int workload, uint32_t rmid) {
+  holders[workload] = rmid;
+  heldSince[workload] = round;
+  holdOrder.push_back(workload);
+}
+
+uint32_t RmidPool::release(int workload) {
+  uint32_t rmid = holders[workload];
+  holders.erase(workload);
+  heldSince.erase(workload);
+  holdOrder.erase(std::remove(holdOrder.begin(), holdOrder.end(), workload),
+                  holdOrder.end());
+  return rmid;
+}
+
+int RmidPool::takeRmid(bool allowDirty, const OccupancyFn &occupancy) {
+  if (!freeRmids.empty()) {
+    uint32_t rmid = freeRmids.back();
+    freeRmids.pop_back();
+    return rmid;
+  }
+  if (!allowDirty || dirtyRmids.empty())
+    return -1;
+  // The cleanest one
+  auto best = dirtyRmids.begin();
+  int64_t bestOcc = occupancy(best->rmid);
+  for (auto it = dirtyRmids.begin() + 1; it != dirtyRmids.end(); ++it) {
+    int64_t occ = occupancy(it->rmid);
+    if (occ < bestOcc) {
+      bestOcc = occ;
+      best = it;
+    }
+  }
+  uint32_t rmid = best->rmid;
+  dirtyRmids.erase(best);
+  return rmid;
+}
+
+std::vector<RmidPool::Change>
+RmidPool::rotate(const OccupancyFn &occupancy, bool preempt) {
+  round++;
+  std::vector<Change> changes;
+
+  for (auto it = dirtyRmids.begin(); it != dirtyRmids.end();) {
+    it->rounds++;
+    if (it->rounds >= cooldownRounds || occupancy(it->rmid) <= cleanBytes) {
+      freeRmids.push_back(it->rmid);
+      it = dirtyRmids.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  // Pinned workloads first, then in waiting order
+  std::stable_partition(waiting.begin(), waiting.end(),
+                        [this](int w) { return isPinned(w); });
+  std::deque<int> stillWaiting;
+  while (!waiting.empty()) {
+    int w = waiting.front();
+    waiting.pop_front();
+    bool pin = isPinned(w);
+    int rmid = takeRmid(pin, occupancy);
+    if (rmid < 0 && pin) {
+      // Take over the RMID of the longest-held unpinned workload
+      for (int h : holdOrder) {
+        if (!isPinned(h)) {
+          Change c = { h, (int) holders[h], -1 };
+          rmid = release(h);
+          changes.push_back(c);
+          stillWaiting.push_back(h);
+          break;
+        }
+      }
+    }
+    if (rmid < 0) {
+      stillWaiting.push_back(w);
+      continue;
+    }
+    give(w, rmid);
+    Change c = { w, -1, rmid };
+    changes.push_back(c);
+  }
+  waiting = stillWaiting;
+  if (!preempt)
+    return changes;
+
+  // Make room for the next rotation: as many of the longest-held unpinned
+  // workloads as are left waiting give up their RMIDs, which cool down until
+  // then
+  size_t numWaiting = 0;
+  for (int w : waiting) {
+    if (!isPinned(w))
+      numWaiting++;
+  }
+  std::vector<int> victims;
+  for (int h : holdOrder) {
+    if (victims.size() + dirtyRmids.size() >= numWaiting)
+      break;
+    if (!isPinned(h) && heldSince[h] < round)
+      victims.push_back(h);
+  }
+  for (int h : victims) {
+    Change c = { h, (int) holders[h], -1 };
+    Dirty d = { release(h), 0 };
+    dirtyRmids.push_back(d);
+    waiting.push_back(h);
+    changes.push_back(c);
+  }
+  return changes;
+}
+
+} // namespace rdt
@@ -0,0 +1,145 @@
+/** $lic$
+* MIT License
+*
+* Copyright (c) 2017-2018 by Massachusetts Institute of Technology
+* Copyright (c) 2017-2018 by Qatar Computing Research Institute, HBKU
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* If you use this software in your research, we request that you reference
+* the KPart paper ("KPart: A Hybrid Cache Partitioning-Sharing Technique for
+* Commodity Multicores", El-Sayed, Mukkara, Tsai, Kasture, Ma, and Sanchez,
+* HPCA-24, February 2018) as the source in any publications that use this
+* software, and that you send us a citation of your work.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+**/
+#pragma once
+#include <stdint.h>
+#include <deque>
+#include <functional>
+#include <map>
+#include <vector>
+#include "rdt_backend.h"
+
+namespace rdt {
+
+// What a class of service grants: its data and code masks (the same without
+// CDP) and its memory bandwidth cap (100 without MBA)
+struct CosAlloc {
+  uint32_t cbm;
+  uint32_t codeCbm;
+  int mbaPercent;
+
+  bool operator<(const CosAlloc &o) const {
+    if (cbm != o.cbm)
+      return cbm < o.cbm;
+    if (codeCbm != o.codeCbm)
+      return codeCbm < o.codeCbm;
+    return mbaPercent < o.mbaPercent;
+  }
+};
+
+// Hands out COS IDs firstCos..numCos-1 to partitions, so that K clusters
+// take K COSes however many workloads they hold. Partitions with the same
+// allocation share a COS, and an allocation keeps its COS across plans for as
+// long as it is in use, so unchanged partitions need no register writes.
+class CosPool {
+public:
+  CosPool(int numCos, int firstCos = 1);
+
+  // COS of each of allocs. Allocations missing from allocs give up their
+  // COS. Throws RdtException if allocs hold more distinct allocations than
+  // there are COSes.
+  std::vector<int> assign(const std::vector<CosAlloc> &allocs);
+
+  int getNumCos() const { return numCos - firstCos; }
+
+private:
+  int numCos;
+  int firstCos;
+  std::map<CosAlloc, int> assigned;
+};
+
+// Hands out RMIDs firstRmid..numRmids-1 to workloads. When there are more
+// workloads than RMIDs, they take turns: every rotate() takes RMIDs away from
+// the workloads that held them longest and gives them to those that waited
+// longest. Pinned workloads (e.g., the one being profiled) keep their RMID
+// and are served first.
+//
+// A released RMID still tags the lines its last workload brought in, which
+// would count as the next workload's occupancy, so it cools down until its
+// occupancy falls below cleanBytes (or for cooldownRounds rotations, since
+// lines nobody evicts may stay forever) before anyone else gets it. Pinned
+// workloads may take a dirty RMID rather than wait: memory traffic counts
+// start over on every reassignment anyway, only occupancy reads high.
+class RmidPool {
+public:
+  struct Change {
+    int workload;
+    int oldRmid; // -1 if the workload was not monitored
+    int newRmid; // -1 if the workload is no longer monitored
+  };
+
+  // Returns an RMID's current LLC occupancy, in bytes
+  typedef std::function<int64_t(uint32_t)> OccupancyFn;
+
+  RmidPool(int numRmids, int64_t cleanBytes, int cooldownRounds,
+           int firstRmid = 1);
+
+  // New workloads wait for the next rotate()
+  void addWorkload(int workload);
+  // Returns the workload's RMID, if it had one; that RMID starts cooling down
+  int removeWorkload(int workload);
+  void setPinned(int workload, bool pinned);
+
+  // -1 if the workload is not monitored right now
+  int getRmid(int workload) const;
+  int getNumWaiting() const { return waiting.size(); }
+
+  // Recycles the RMIDs that cooled down and hands them to waiting workloads.
+  // If preempt, the longest-held RMIDs are then taken back for the next
+  // rotation. Returns the RMID changes, in the order to apply them.
+  std::vector<Change> rotate(const OccupancyFn &occupancy, bool preempt);
+
+private:
+  struct Dirty {
+    uint32_t rmid;
+    int rounds;
+  };
+
+  int64_t cleanBytes;
+  int cooldownRounds;
+
+  std::vector<uint32_t> freeRmids;
+  std::vector<Dirty> dirtyRmids;
+  std::map<int, uint32_t> holders;   // workload -> RMID
+  std::map<int, uint64_t> heldSince; // workload -> round it got its RMID
+  std::deque<int> holdOrder;         // holders, longest-held first
+  std::deque<int> waiting;         // longest-waiting first
+  std::map<int, bool> pinned;
+
+  uint64_t round; // rotations so far
+
+  bool isPinned(int workload) const;
+  void give(int workload, uint32_t rmid);
+  uint32_t release(int workload);
+  // -1 if no RMID is free (and, if allowDirty, none is cooling down)
+  int takeRmid(bool allowDirty, const OccupancyFn &occupancy);
+};
+
+} // namespace rdt
@@ -0,0 +1,297 @@
+/** $lic$
+* MIT License
+*
+* Copyright (c) 2017-2018 by Massachusetts Institute of Technology
+* Copyright (c) 2017-2018 by Qatar Computing Research Institute, HBKU
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* If you use this software in your research, we request that you reference
+* the KPart paper ("KPart: A Hybrid Cache Partitioning-Sharing Technique for
+* Commodity Multicores", El-Sayed, Mukkara, Tsai, Kasture, Ma, and Sanchez,
+* HPCA-24, February 2018) as the source in any publications that use this
+* software, and that you send us a citation of your work.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+**/
+
+#include <stdio.h>
+#include <algorithm>
+#include "msr_backend.h"
+
+namespace rdt {
+
+// Hardware value of one mask of cos, or -1 if the packages disagree
+static int64_t read_mask(CATController &cat, int cos,
+                         CATController::MaskType type) {
+  int64_t cbm = cat.getCbm(cos, 0, type);
+  for (int d = 1; d < cat.getNumDomains(); d++) {
+    if (cat.getCbm(cos, d, type) != cbm)
+      return -1; // rewrite all of them
+  }
+  return cbm;
+}
+
+MsrBackend::MsrBackend(const std::string &devDir)
+    : cat(true, devDir), devDir(devDir), mba(nullptr), cmt(nullptr) {
+  numCos = cat.getNumActiveCos();
+  cbmLen = CATController::getCbmLen();
+
+  // Seed the shadow state from hardware so the first plan is diffed too
+  shadowCbm.resize(numCos, -1);
+  shadowCos.resize(getNumCores(), -1);
+  for (int cos = 0; cos < numCos; cos++)
+    shadowCbm[cos] = read_mask(cat, cos, CATController::MASK_DATA);
+  if (cat.isCdpEnabled()) {
+    shadowCodeCbm.resize(numCos, -1);
+    for (int cos = 0; cos < numCos; cos++)
+      shadowCodeCbm[cos] = read_mask(cat, cos, CATController::MASK_CODE);
+  }
+  for (int core = 0; core < (int) shadowCos.size(); core++)
+    shadowCos[core] = cat.getCos(core);
+
+  // Bandwidth percentages only map to delays on a linear scale
+  if (MBAController::mbaSupported() && MBAController::isLinear()) {
+    mba = new MBAController(true, devDir);
+    shadowDelay.resize(MBAController::getNumCos(), -1);
+    for (int cos = 0; cos < (int) shadowDelay.size(); cos++)
+      shadowDelay[cos] = mba->getThrottle(cos);
+  }
+}
+
+MsrBackend::~MsrBackend() {
+  delete mba;
+  delete cmt;
+}
+
+CMTController &MsrBackend::getCmt() const {
+  if (cmt == nullptr)
+    cmt = new CMTController(true, devDir);
+  return *cmt;
+}
+
+void MsrBackend::doBindRmid(uint32_t rmid, pid_t /*pid*/,
+                            const std::vector<int> &cores,
+                            const std::string & /*cgroup*/) {
+  // RMIDs follow cores, not tasks; the workload is expected to be pinned
+  for (int c : cores)
+    getCmt().setRmid(c, rmid);
+  rmidCores[rmid] = cores;
+}
+
+void MsrBackend::doUnbindRmid(uint32_t rmid) {
+  auto it = rmidCores.find(rmid);
+  if (it == rmidCores.end())
+    return;
+  for (int c : it->second) {
+    if (getCmt().getRmid(c) == rmid)
+      getCmt().setRmid(c, 0);
+  }
+  rmidCores.erase(it);
+}
+
+int MsrBackend::getNumRmids() const {
+  // CPUID.(Fh,1).ECX: highest L3 RMID
+  CPUID l3Mon(0xf, 0x1);
+  return l3Mon.ECX() + 1;
+}
+
+static int64_t wrapped_delta(int64_t cur, int64_t last, int64_t max) {
+  return (cur >= last) ? cur - last : (max - last) + cur;
+}
+
+MsrBackend::MbmTotals &MsrBackend::updateMbmTotals(uint32_t rmid) {
+  // One batch covers the RMID's counters on every package
+  std::vector<CMTController::Sample> samples = getCmt().sampleAll({ rmid });
+  return foldMbmSamples(rmid, samples.data(), samples.size());
+}
+
+// samples holds the RMID's counters on each of the n packages
+MsrBackend::MbmTotals &
+MsrBackend::foldMbmSamples(uint32_t rmid, const CMTController::Sample *samples,
+                           int n) {
+  auto it = mbmTotals.find(rmid);
+  if (it == mbmTotals.end()) {
+    MbmTotals t;
+    for (int d = 0; d < n; d++) {
+      t.lastLocal.push_back(samples[d].localMemTraffic);
+      t.lastTotal.push_back(samples[d].totalMemTraffic);
+    }
+    t.localBytes = 0;
+    t.totalBytes = 0;
+    return mbmTotals[rmid] = t;
+  }
+
+  MbmTotals &t = it->second;
+  int64_t max = getCmt().getMemTrafficMax();
+  for (int d = 0; d < n; d++) {
+    const CMTController::Sample &s = samples[d];
+    t.localBytes += wrapped_delta(s.localMemTraffic, t.lastLocal[d], max);
+    t.totalBytes += wrapped_delta(s.totalMemTraffic, t.lastTotal[d], max);
+    t.lastLocal[d] = s.localMemTraffic;
+    t.lastTotal[d] = s.totalMemTraffic;
+  }
+  return t;
+}
+
+void MsrBackend::doSampleRmids(const std::vector<uint32_t> &rmids,
+                               std::vector<MonSample> &samples) {
+  // Every RMID on every package in one MSR batch
+  CMTController &c = getCmt();
+  std::vector<uint64_t> ids(rmids.begin(), rmids.end());
+  std::vector<CMTController::Sample> raw = c.sampleAll(ids);
+  int numDomains = c.getNumDomains();
+
+  samples.clear();
+  for (size_t i = 0; i < rmids.size(); i++) {
+    const CMTController::Sample *perDomain = &raw[i * numDomains];
+    MonSample s;
+    s.rmid = rmids[i];
+    s.llcOccupancy = 0;
+    for (int d = 0; d < numDomains; d++)
+      s.llcOccupancy += perDomain[d].llcOccupancy;
+    MbmTotals &t = foldMbmSamples(rmids[i], perDomain, numDomains);
+    s.localMemTraffic = t.localBytes;
+    s.totalMemTraffic = t.totalBytes;
+    samples.push_back(s);
+  }
+}
+
+uint32_t MsrBackend::getCbm(int cos) {
+  if (cos >= 0 && cos < numCos && shadowCbm[cos] >= 0)
+    return static_cast<uint32_t>(shadowCbm[cos]);
+  return cat.getCbm(cos, 0, CATController::MASK_DATA);
+}
+
+void MsrBackend::invalidateShadow() {
+  std::fill(shadowCbm.begin(), shadowCbm.end(), -1);
+  std::fill(shadowCodeCbm.begin(), shadowCodeCbm.end(), -1);
+  std::fill(shadowCos.begin(), shadowCos.end(), -1);
+  std::fill(shadowDelay.begin(), shadowDelay.end(), -1);
+}
+
+// Queues the masks that differ from the shadow. Every mask is one MSR per
+// package.
+void MsrBackend::diffMasks(const std::vector<uint32_t> &cbms,
+                           const std::vector<int64_t> &shadow,
+                           std::vector<std::pair<int, uint32_t> > &writes) {
+  for (int cos = 0; cos < (int) cbms.size(); cos++) {
+    bool changed = (cos >= numCos || shadow[cos] != cbms[cos]);
+    if (changed)
+      writes.push_back(std::make_pair(cos, cbms[cos]));
+    for (int d = 0; d < cat.getNumDomains(); d++)
+      countWrite(changed);
+  }
+}
+
+int MsrBackend::doApplyPlan(const PartitionPlan &plan) {
+  // Only changed fields are written, each set as a single MSR batch
+  std::vector<std::pair<int, uint32_t> > cbmWrites;
+  std::vector<std::pair<int, uint32_t> > codeWrites;
+  std::vector<std::pair<int, uint32_t> > cosWrites;
+  std::vector<std::pair<int, uint32_t> > delayWrites;
+  bool cdp = cat.isCdpEnabled();
+  try {
+    if (!plan.codeCbms.empty() && !cdp)
+      throw CATException("plan has code masks, but CDP is not enabled");
+    if (!plan.mbaPercents.empty() && !mba)
+      throw CATException("plan has bandwidth caps, but MBA is not supported");
+
+    for (int cos = 0; cos < (int) plan.mbaPercents.size(); cos++) {
+      uint32_t delay = mba->percentToDelay(plan.mbaPercents[cos]);
+      bool changed =
+          (cos >= (int) shadowDelay.size() || shadowDelay[cos] != delay);
+      if (changed)
+        delayWrites.push_back(std::make_pair(cos, delay));
+      for (int d = 0; d < mba->getNumDomains(); d++)
+        countWrite(changed);
+    }
+
+    diffMasks(plan.cbms, shadowCbm, cbmWrites);
+    if (cdp) {
+      // COSes without a code mask use their data mask for code too
+      std::vector<uint32_t> codeCbms = plan.cbms;
+      for (size_t cos = 0; cos < plan.codeCbms.size(); cos++) {
+        if (cos < codeCbms.size())
+          codeCbms[cos] = plan.codeCbms[cos];
+      }
+      diffMasks(codeCbms, shadowCodeCbm, codeWrites);
+    }
+
+    for (int core = 0; core < (int) plan.coreCos.size(); core++) {
+      if (plan.coreCos[core] < 0)
+        continue;
+      if (core >= (int) shadowCos.size()) {
+        std::stringstream ss;
+        ss << "core (" << core << ") exceeds number of cores ("
+           << shadowCos.size() << ")";
+        throw CATException(ss.str());
+      }
+      bool changed = (shadowCos[core] != plan.coreCos[core]);
+      if (changed)
+        cosWrites.push_back(std::make_pair(core, plan.coreCos[core]));
+      countWrite(changed);
+    }
+
+    // Throws (leaving the shadow untouched) on an invalid cos or cbm
+    CATController::MaskType dataType =
+        cdp ? CATController::MASK_DATA : CATController::MASK_UNIFIED;
+    if (!cbmWrites.empty())
+      cat.setCbms(cbmWrites, dataType);
+    for (const std::pair<int, uint32_t> &w : cbmWrites)
+      shadowCbm[w.first] = w.second;
+    cbmWrites.clear();
+
+    if (!codeWrites.empty())
+      cat.setCbms(codeWrites, CATController::MASK_CODE);
+    for (const std::pair<int, uint32_t> &w : codeWrites)
+      shadowCodeCbm[w.first] = w.second;
+    codeWrites.clear();
+
+    if (!delayWrites.empty())
+      mba->setThrottles(delayWrites);
+    for (const std::pair<int, uint32_t> &w : delayWrites)
+      shadowDelay[w.first] = w.second;
+    delayWrites.clear();
+
+    if (!cosWrites.empty())
+      cat.setCoses(cosWrites);
+    for (const std::pair<int, uint32_t> &w : cosWrites)
+      shadowCos[w.first] = w.second;
+  } catch (CATException &e) {
+    printf("[ERROR] MSR backend: %s\n", e.what());
+    return -1;
+  } catch (MBAException &e) {
+    printf("[ERROR] MSR backend: %s\n", e.what());
+    return -1;
+  } catch (MSR::FileIOException &e) {
+    // Part of a batch may have landed; forget what it was meant to change
+    for (const std::pair<int, uint32_t> &w : cbmWrites)
+      shadowCbm[w.first] = -1;
+    for (const std::pair<int, uint32_t> &w : codeWrites)
+      shadowCodeCbm[w.first] = -1;
+    for (const std::pair<int, uint32_t> &w : delayWrites)
+      shadowDelay[w.first] = -1;
+    for (const std::pair<int, uint32_t> &w : cosWrites)
+      shadowCos[w.first] = -1;
+    printf("[ERROR] MSR backend: %s\n", e.what());
+    return -1;
+  }
+  return 0;
+}
+
+} // namespace rdt
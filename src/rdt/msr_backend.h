@@ -0,0 +1,125 @@
+/** $lic$
+* MIT License
+*
+* Copyright (c) 2017-2018 by Massachusetts Institute of Technology
+* Copyright (c) 2017-2018 by Qatar Computing Research Institute, HBKU
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* If you use this software in your research, we request that you reference
+* the KPart paper ("KPart: A Hybrid Cache Partitioning-Sharing Technique for
+* Commodity Multicores", El-Sayed, Mukkara, Tsai, Kasture, Ma, and Sanchez,
+* HPCA-24, February 2018) as the source in any publications that use this
+* software, and that you send us a citation of your work.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+**/
+#pragma once
+#include <limits>
+#include <unordered_map>
+#include "rdt_backend.h"
+#include "cat.h"
+#include "cmt.h"
+#include "mba.h"
+
+namespace rdt {
+
+// Programs CAT directly through IA32_L3_MASK_n / IA32_PQR_ASSOC. The
+// underlying CATController opens every /dev/cpu/N/msr once, at construction
+// (or the files under another devDir, see MSR).
+// Each MSR write is an IPI to the target core, so the backend keeps a shadow
+// copy of the CBM, MBA delay and COS fields it last programmed and only
+// writes deltas.
+class MsrBackend : public RdtBackend {
+private:
+  CATController cat;
+  std::string devDir;
+  int numCos;
+  int cbmLen;
+
+  // -1 means unknown; forces a write on the next apply
+  std::vector<int64_t> shadowCbm;     // indexed by COS; data masks under CDP
+  std::vector<int64_t> shadowCodeCbm; // code masks; empty without CDP
+  std::vector<int64_t> shadowCos; // indexed by core
+  std::vector<int64_t> shadowDelay; // MBA delays, indexed by COS
+
+  // nullptr unless the platform has MBA with a linear delay scale
+  MBAController *mba;
+
+  // Created on first use, so that CAT-only platforms work without CMT
+  mutable CMTController *cmt;
+  CMTController &getCmt() const;
+
+  // Memory traffic counters wrap independently on each package; fold them
+  // into one 64-bit running total per RMID
+  struct MbmTotals {
+    std::vector<int64_t> lastLocal; // indexed by domain
+    std::vector<int64_t> lastTotal;
+    int64_t localBytes;
+    int64_t totalBytes;
+  };
+  std::unordered_map<uint32_t, MbmTotals> mbmTotals;
+
+  std::unordered_map<uint32_t, std::vector<int> > rmidCores; // bound cores
+  MbmTotals &updateMbmTotals(uint32_t rmid);
+  MbmTotals &foldMbmSamples(uint32_t rmid,
+                            const CMTController::Sample *samples, int n);
+
+  void diffMasks(const std::vector<uint32_t> &cbms,
+                 const std::vector<int64_t> &shadow,
+                 std::vector<std::pair<int, uint32_t> > &writes);
+
+protected:
+  int doApplyPlan(const PartitionPlan &plan);
+  void doBindRmid(uint32_t rmid, pid_t pid, const std::vector<int> &cores,
+                  const std::string &cgroup);
+  void doUnbindRmid(uint32_t rmid);
+  void doSampleRmids(const std::vector<uint32_t> &rmids,
+                     std::vector<MonSample> &samples);
+
+public:
+  explicit MsrBackend(const std::string &devDir = "/dev/cpu");
+  ~MsrBackend();
+
+  const char *name() const { return "msr"; }
+  int getNumCos() const { return numCos; }
+  int getCbmLen() const { return cbmLen; }
+  bool isCdpEnabled() const { return cat.isCdpEnabled(); }
+  bool isMbaSupported() const { return mba != nullptr; }
+  int getMbaGranularity() const {
+    return mba ? mba->getBandwidthGranularity() : 100;
+  }
+  uint32_t getCbm(int cos);
+  void invalidateShadow();
+
+  int getNumRmids() const;
+  uint32_t getRmid(int core) { return getCmt().getRmid(core); }
+  int64_t getLlcOccupancy(uint32_t rmid) {
+    return getCmt().getLlcOccupancy(rmid);
+  }
+  int64_t getLocalMemTraffic(uint32_t rmid) {
+    return updateMbmTotals(rmid).localBytes;
+  }
+  int64_t getTotalMemTraffic(uint32_t rmid) {
+    return updateMbmTotals(rmid).totalBytes;
+  }
+  int64_t getMemTrafficMax() const {
+    return std::numeric_limits<int64_t>::max();
+  }
+};
+
+} // namespace rdt
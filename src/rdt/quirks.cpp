@@ -0,0 +1,71 @@
+/** $lic$
+* MIT License
+*
+* Copyright (c) 2017-2018 by Massachusetts Institute of Technology
+* Copyright (c) 2017-2018 by Qatar Computing Research Institute, HBKU
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* If you use this software in your research, we request that you reference
+* the KPart paper ("KPart: A Hybrid Cache Partitioning-Sharing Technique for
+* Commodity Multicores", El-Sayed, Mukkara, Tsai, Kasture, Ma, and Sanchez,
+* HPCA-24, February 2018) as the source in any publications that use this
+* software, and that you send us a citation of your work.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+**/
+
+#include "quirks.h"
+#include "cpuid.h"
+
+namespace rdt {
+
+CpuSignature get_cpu_signature() {
+  CPUID leaf(0x1, 0x0);
+  uint32_t eax = leaf.EAX();
+  CpuSignature cpu;
+  cpu.stepping = eax & 0xf;
+  cpu.model = (eax >> 4) & 0xf;
+  cpu.family = (eax >> 8) & 0xf;
+  if (cpu.family == 0xf)
+    cpu.family += (eax >> 20) & 0xff;
+  if (cpu.family == 0x6 || cpu.family == 0xf)
+    cpu.model |= ((eax >> 16) & 0xf) << 4;
+  return cpu;
+}
+
+const std::vector<PlatformQuirk> &quirk_table() {
+  static const std::vector<PlatformQuirk> table = {
+    // Broadwell-D (Xeon D-15xx): ways 10 and 11 only take effect together
+    { "Broadwell-D", 0x6, 0x56, -1, 12, { { 10, 11 } } },
+  };
+  return table;
+}
+
+std::vector<const PlatformQuirk *> find_quirks(const CpuSignature &cpu,
+                                               int cbmLen) {
+  std::vector<const PlatformQuirk *> quirks;
+  for (const PlatformQuirk &q : quirk_table()) {
+    if (q.family == cpu.family && q.model == cpu.model &&
+        (q.stepping == -1 || q.stepping == cpu.stepping) &&
+        (q.cbmLen == 0 || q.cbmLen == cbmLen))
+      quirks.push_back(&q);
+  }
+  return quirks;
+}
+
+} // namespace rdt
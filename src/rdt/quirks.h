@@ -0,0 +1,65 @@
+/** $lic$
+* MIT License
+*
+* Copyright (c) 2017-2018 by Massachusetts Institute of Technology
+* Copyright (c) 2017-2018 by Qatar Computing Research Institute, HBKU
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* If you use this software in your research, we request that you reference
+* the KPart paper ("KPart: A Hybrid Cache Partitioning-Sharing Technique for
+* Commodity Multicores", El-Sayed, Mukkara, Tsai, Kasture, Ma, and Sanchez,
+* HPCA-24, February 2018) as the source in any publications that use this
+* software, and that you send us a citation of your work.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+**/
+#pragma once
+#include <string>
+#include <vector>
+
+namespace rdt {
+
+// CPU signature from CPUID leaf 1, with the extended family/model folded in
+struct CpuSignature {
+  int family;
+  int model;
+  int stepping;
+};
+
+CpuSignature get_cpu_signature();
+
+// Allocation errata of one CPU part. Every group of coupledWays only works
+// as a whole: a COS whose mask holds one of its ways must hold all of them,
+// so a partitioning plan has to keep each group inside a single partition.
+struct PlatformQuirk {
+  const char *part;
+  int family;
+  int model;
+  int stepping; // -1 matches any stepping
+  int cbmLen;   // 0 matches any CBM length
+  std::vector<std::vector<int> > coupledWays;
+};
+
+// Quirks of every known part; add a part by adding its entry here
+const std::vector<PlatformQuirk> &quirk_table();
+
+// Entries of the table that apply to a CPU with CBMs of cbmLen bits
+std::vector<const PlatformQuirk *> find_quirks(const CpuSignature &cpu,
+                                               int cbmLen);
+
+} // namespace rdt
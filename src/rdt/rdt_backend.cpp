@@ -0,0 +1,166 @@
+/** $lic$
+* MIT License
+*
+* Copyright (c) 2017-2018 by Massachusetts Institute of Technology
+* Copyright (c) 2017-2018 by Qatar Computing Research Institute, HBKU
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* If you use this software in your research, we request that you reference
+* the KPart paper ("KPart: A Hybrid Cache Partitioning-Sharing Technique for
+* Commodity Multicores", El-Sayed, Mukkara, Tsai, Kasture, Ma, and Sanchez,
+* HPCA-24, February 2018) as the source in any publications that use this
+* software, and that you send us a citation of your work.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+**/
+
+#include <signal.h>
+#include <stdlib.h>
+#include <time.h>
+#include <algorithm>
+#include "rdt_backend.h"
+#include "msr_backend.h"
+#include "resctrl_backend.h"
+
+namespace rdt {
+
+// Holds a backend's mutex with every signal blocked on this thread, so that
+// no handler can interrupt the holder
+class BackendLock {
+private:
+  std::mutex &mutex;
+  sigset_t oldMask;
+
+public:
+  explicit BackendLock(std::mutex &mutex) : mutex(mutex) {
+    sigset_t all;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &oldMask);
+    mutex.lock();
+  }
+
+  ~BackendLock() {
+    mutex.unlock();
+    pthread_sigmask(SIG_SETMASK, &oldMask, nullptr);
+  }
+};
+
+static double now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
+
+int RdtBackend::applyPlan(const PartitionPlan &plan) {
+  BackendLock lock(mutex);
+  double start = now_ms();
+  int status = doApplyPlan(plan);
+  double elapsed = now_ms() - start;
+
+  stats.numApplies++;
+  if (status != 0)
+    stats.numFailures++;
+  stats.lastApplyMs = elapsed;
+  stats.totalApplyMs += elapsed;
+  stats.maxApplyMs = std::max(stats.maxApplyMs, elapsed);
+  return status;
+}
+
+void RdtBackend::bindRmid(uint32_t rmid, pid_t pid,
+                          const std::vector<int> &cores,
+                          const std::string &cgroup) {
+  BackendLock lock(mutex);
+  doBindRmid(rmid, pid, cores, cgroup);
+}
+
+void RdtBackend::unbindRmid(uint32_t rmid) {
+  BackendLock lock(mutex);
+  doUnbindRmid(rmid);
+}
+
+void RdtBackend::sampleRmids(const std::vector<uint32_t> &rmids,
+                             std::vector<MonSample> &samples) {
+  BackendLock lock(mutex);
+  doSampleRmids(rmids, samples);
+}
+
+void RdtBackend::doSampleRmids(const std::vector<uint32_t> &rmids,
+                               std::vector<MonSample> &samples) {
+  samples.clear();
+  for (uint32_t rmid : rmids) {
+    MonSample s;
+    s.rmid = rmid;
+    s.llcOccupancy = getLlcOccupancy(rmid);
+    s.localMemTraffic = getLocalMemTraffic(rmid);
+    s.totalMemTraffic = getTotalMemTraffic(rmid);
+    samples.push_back(s);
+  }
+}
+
+uint32_t ways_to_cbm(const std::vector<int> &ways) {
+  uint32_t cbm = 0;
+  for (int w : ways)
+    cbm |= 1U << w;
+  return cbm;
+}
+
+std::vector<int> cbm_to_ways(uint32_t cbm) {
+  std::vector<int> ways;
+  for (int w = 0; cbm > 0; w++, cbm >>= 1) {
+    if (cbm & 0x1U)
+      ways.push_back(w);
+  }
+  return ways;
+}
+
+std::string cbm_to_string(uint32_t cbm) {
+  std::string waysString = "";
+  for (int w : cbm_to_ways(cbm)) {
+    if (!waysString.empty())
+      waysString += ",";
+    waysString += std::to_string(w);
+  }
+  return waysString;
+}
+
+RdtBackend *create_rdt_backend() {
+  const char *rootEnv = getenv("KPART_RESCTRL_ROOT");
+  std::string root = rootEnv ? rootEnv : ResctrlBackend::DEFAULT_ROOT;
+
+  // Once resctrl is mounted, the kernel rewrites IA32_PQR_ASSOC on every
+  // context switch, so raw MSR programming would be silently undone
+  const char *kindEnv = getenv("KPART_RDT_BACKEND");
+  std::string kind =
+      kindEnv ? kindEnv : (ResctrlBackend::isMounted(root) ? "resctrl" : "msr");
+
+  // A simulated platform only exists behind the MSR class
+  if (MSR::getDevice() != nullptr) {
+    if (kindEnv && kind != "msr")
+      throw RdtException("The simulated platform needs the msr backend");
+    kind = "msr";
+  }
+
+  if (kind == "resctrl")
+    return new ResctrlBackend(root);
+  if (kind == "msr")
+    return new MsrBackend();
+  throw RdtException("Unknown KPART_RDT_BACKEND '" + kind +
+                     "' (expected msr or resctrl)");
+}
+
+} // namespace rdt
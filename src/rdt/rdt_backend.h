@@ -0,0 +1,199 @@
+/** $lic$
+* MIT License
+*
+* Copyright (c) 2017-2018 by Massachusetts Institute of Technology
+* Copyright (c) 2017-2018 by Qatar Computing Research Institute, HBKU
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* If you use this software in your research, we request that you reference
+* the KPart paper ("KPart: A Hybrid Cache Partitioning-Sharing Technique for
+* Commodity Multicores", El-Sayed, Mukkara, Tsai, Kasture, Ma, and Sanchez,
+* HPCA-24, February 2018) as the source in any publications that use this
+* software, and that you send us a citation of your work.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+**/
+#pragma once
+#include <stdint.h>
+#include <sys/types.h>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace rdt {
+
+class RdtException : public std::exception {
+private:
+  std::string error;
+
+public:
+  RdtException(std::string error) : error(error) {}
+
+  const char *what() const throw() { return error.c_str(); }
+};
+
+// A complete cache allocation: one capacity bitmask per class of service (COS
+// 0..cbms.size()-1) and the COS every core should be associated with. Cores
+// mapped to -1 (or beyond the end of coreCos) are left untouched, as are COSes
+// beyond the end of cbms.
+//
+// With Code and Data Prioritization (CDP) enabled, cbms are the data masks
+// and codeCbms the code masks; COSes beyond the end of codeCbms use their
+// data mask for code too. Plans with code masks fail without CDP.
+//
+// mbaPercents caps the memory bandwidth of each COS, in percent of peak,
+// through Memory Bandwidth Allocation (MBA); values are rounded down to the
+// platform's granularity, and COSes beyond the end are left untouched. Plans
+// with bandwidth caps fail without MBA.
+struct PartitionPlan {
+  std::vector<uint32_t> cbms;
+  std::vector<uint32_t> codeCbms;
+  std::vector<int> coreCos;
+  std::vector<int> mbaPercents;
+};
+
+// One RMID's monitoring counters. Memory traffic is a running byte count that
+// wraps around at RdtBackend::getMemTrafficMax().
+struct MonSample {
+  uint32_t rmid;
+  int64_t llcOccupancy;
+  int64_t localMemTraffic;
+  int64_t totalMemTraffic;
+};
+
+struct ApplyStats {
+  uint64_t numApplies;
+  uint64_t numFailures;
+  double lastApplyMs;
+  double totalApplyMs;
+  double maxApplyMs;
+
+  // Register writes actually issued vs. skipped because the register already
+  // held the requested value
+  uint64_t writesIssued;
+  uint64_t writesSkipped;
+
+  ApplyStats()
+      : numApplies(0), numFailures(0), lastApplyMs(0.0), totalApplyMs(0.0),
+        maxApplyMs(0.0), writesIssued(0), writesSkipped(0) {}
+
+  double avgApplyMs() const {
+    return numApplies ? totalApplyMs / numApplies : 0.0;
+  }
+};
+
+// Cache allocation and monitoring backend. Implementations keep whatever
+// handles they need (e.g., /dev/cpu/N/msr fds) open for the lifetime of the
+// object, so that a whole partitioning plan is programmed with a single
+// applyPlan() call and no helper processes.
+class RdtBackend {
+private:
+  ApplyStats stats;
+
+  // Serializes applyPlan(), (un)bindRmid() and sampleRmids(), which may be
+  // called from different threads (e.g., the planner and a CmtSampler). It is
+  // held with all signals blocked (see BackendLock in rdt_backend.cpp), so a
+  // handler never runs on a thread that holds it; handlers must not call
+  // these methods either.
+  std::mutex mutex;
+
+protected:
+  virtual int doApplyPlan(const PartitionPlan &plan) = 0;
+  virtual void doBindRmid(uint32_t rmid, pid_t pid,
+                          const std::vector<int> &cores,
+                          const std::string &cgroup) = 0;
+  virtual void doUnbindRmid(uint32_t rmid) = 0;
+
+  // Default: one read per counter. Backends that can read many counters at
+  // once override this.
+  virtual void doSampleRmids(const std::vector<uint32_t> &rmids,
+                             std::vector<MonSample> &samples);
+
+  void countWrite(bool issued) {
+    if (issued)
+      stats.writesIssued++;
+    else
+      stats.writesSkipped++;
+  }
+
+public:
+  virtual ~RdtBackend() {}
+
+  virtual const char *name() const = 0;
+  // Usable COS; halved when CDP is enabled
+  virtual int getNumCos() const = 0;
+  virtual int getCbmLen() const = 0;
+  virtual bool isCdpEnabled() const { return false; }
+  virtual bool isMbaSupported() const { return false; }
+  // Smallest MBA bandwidth step (and cap), in percent
+  virtual int getMbaGranularity() const { return 100; }
+  // Data mask under CDP
+  virtual uint32_t getCbm(int cos) = 0;
+
+  // Program the plan and record how long it took. Returns 0 on success.
+  // Backends only write the registers whose value differs from what they
+  // last programmed.
+  int applyPlan(const PartitionPlan &plan);
+
+  // Forget the last programmed state (e.g., after some other tool touched
+  // the hardware), so that the next applyPlan() rewrites everything.
+  virtual void invalidateShadow() = 0;
+
+  const ApplyStats &getApplyStats() const { return stats; }
+
+  // Monitoring (CMT/MBM). A workload is identified by the RMID it is bound
+  // to; binding attaches the RMID to the workload's cores and/or tasks. The
+  // tasks are those of pid, or, if cgroup is given, every thread in that
+  // cgroup-v2 directory.
+  // Occupancy is in bytes. Memory traffic is a running byte count that wraps
+  // around at getMemTrafficMax().
+  void bindRmid(uint32_t rmid, pid_t pid, const std::vector<int> &cores,
+                const std::string &cgroup = "");
+  // Stops monitoring the workload bound to rmid; its cores and tasks keep
+  // their COS
+  void unbindRmid(uint32_t rmid);
+  // RMIDs the platform has, including the default RMID 0
+  virtual int getNumRmids() const = 0;
+
+  // Reads the counters of all rmids, in order, into samples
+  void sampleRmids(const std::vector<uint32_t> &rmids,
+                   std::vector<MonSample> &samples);
+
+  // Single-counter accessors. These are not serialized against the calls
+  // above; while a CmtSampler is running, read its snapshots instead.
+  virtual uint32_t getRmid(int core) = 0;
+  virtual int64_t getLlcOccupancy(uint32_t rmid) = 0;
+  virtual int64_t getLocalMemTraffic(uint32_t rmid) = 0;
+  virtual int64_t getTotalMemTraffic(uint32_t rmid) = 0;
+  virtual int64_t getMemTrafficMax() const = 0;
+};
+
+// Helpers to convert between way indices and capacity bitmasks
+uint32_t ways_to_cbm(const std::vector<int> &ways);
+std::vector<int> cbm_to_ways(uint32_t cbm);
+std::string cbm_to_string(uint32_t cbm);
+
+// Instantiate the backend for this platform. KPART_RDT_BACKEND=msr|resctrl
+// overrides the default, which is resctrl when it is mounted and raw MSR
+// access otherwise. KPART_RESCTRL_ROOT overrides the resctrl mount point.
+// When an MSRDevice (e.g., a simulated platform) is installed, the MSR backend
+// is always used.
+RdtBackend *create_rdt_backend();
+
+} // namespace rdt
@@ -0,0 +1,599 @@
+/** $lic$
+* MIT License
+*
+* Copyright (c) 2017-2018 by Massachusetts Institute of Technology
+* Copyright (c) 2017-2018 by Qatar Computing Research Institute, HBKU
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* If you use this software in your research, we request that you reference
+* the KPart paper ("KPart: A Hybrid Cache Partitioning-Sharing Technique for
+* Commodity Multicores", El-Sayed, Mukkara, Tsai, Kasture, Ma, and Sanchez,
+* HPCA-24, February 2018) as the source in any publications that use this
+* software, and that you send us a citation of your work.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+**/
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <set>
+#include <sstream>
+#include "resctrl_backend.h"
+#include "sysconfig.h"
+
+namespace rdt {
+
+const char *ResctrlBackend::DEFAULT_ROOT = "/sys/fs/resctrl";
+
+static bool read_file(const std::string &path, std::string &val) {
+  std::ifstream in(path.c_str());
+  if (!in.is_open())
+    return false;
+  std::stringstream ss;
+  ss << in.rdbuf();
+  val = ss.str();
+  while (!val.empty() && isspace(val[val.size() - 1]))
+    val.erase(val.size() - 1);
+  return true;
+}
+
+static std::string read_file_or_throw(const std::string &path) {
+  std::string val;
+  if (!read_file(path, val))
+    throw RdtException("Error reading " + path);
+  return val;
+}
+
+std::vector<int> parse_cpu_list(const std::string &str) {
+  std::vector<int> cpus;
+  std::stringstream ss(str);
+  std::string range;
+  while (std::getline(ss, range, ',')) {
+    if (range.empty() || isspace(range[0]))
+      continue;
+    size_t dash = range.find('-');
+    int first = atoi(range.substr(0, dash).c_str());
+    int last =
+        (dash == std::string::npos) ? first : atoi(range.substr(dash + 1).c_str());
+    for (int c = first; c <= last; c++)
+      cpus.push_back(c);
+  }
+  return cpus;
+}
+
+std::string format_cpu_list(const std::vector<int> &cpus) {
+  std::vector<int> sorted(cpus);
+  std::sort(sorted.begin(), sorted.end());
+  std::stringstream ss;
+  for (size_t i = 0; i < sorted.size();) {
+    size_t j = i;
+    while (j + 1 < sorted.size() && sorted[j + 1] == sorted[j] + 1)
+      j++;
+    if (i > 0)
+      ss << ",";
+    ss << sorted[i];
+    if (j > i)
+      ss << "-" << sorted[j];
+    i = j + 1;
+  }
+  return ss.str();
+}
+
+static bool is_dir(const std::string &path) {
+  struct stat st;
+  return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+// Mounted with -o cdp, resctrl replaces the L3 resource with L3DATA and
+// L3CODE, each with its own schemata line and half the CLOSIDs
+bool ResctrlBackend::isMounted(const std::string &root) {
+  return is_dir(root + "/info/L3") || is_dir(root + "/info/L3DATA");
+}
+
+// Domain ids listed in the given resource's line of a schemata file, e.g.
+// "    L3:0=fff;1=fff" or "    MB:0=100;1=100"
+static std::vector<int> schemata_domains(const std::string &schemata,
+                                         const std::string &resource) {
+  std::vector<int> domains;
+  std::stringstream ss(schemata);
+  std::string line;
+  std::string prefix = resource + ":";
+  while (std::getline(ss, line)) {
+    size_t start = line.find_first_not_of(" \t");
+    if (start == std::string::npos ||
+        line.compare(start, prefix.size(), prefix) != 0)
+      continue;
+    std::stringstream doms(line.substr(start + prefix.size()));
+    std::string dom;
+    while (std::getline(doms, dom, ';'))
+      domains.push_back(atoi(dom.c_str()));
+  }
+  return domains;
+}
+
+ResctrlBackend::ResctrlBackend(const std::string &root) : root(root) {
+  if (!isMounted(root))
+    throw RdtException("resctrl with L3 allocation not mounted at " + root);
+
+  cdp = is_dir(root + "/info/L3DATA");
+  std::string info = root + "/info/" + dataResource();
+  numCos = atoi(read_file_or_throw(info + "/num_closids").c_str());
+  uint64_t cbmMask =
+      strtoull(read_file_or_throw(info + "/cbm_mask").c_str(), NULL, 16);
+  cbmLen = 0;
+  while (cbmMask >> cbmLen)
+    cbmLen++;
+
+  // The default group starts out owning every online CPU
+  std::string rootCpus;
+  numCores = getNumCores();
+  if (read_file(root + "/cpus_list", rootCpus)) {
+    for (int c : parse_cpu_list(rootCpus))
+      numCores = std::max(numCores, c + 1);
+  }
+
+  // Domains come from the L3 (or L3DATA) line of the default group
+  std::string schemata = read_file_or_throw(root + "/schemata");
+  l3Domains = schemata_domains(schemata, dataResource());
+  if (l3Domains.empty())
+    throw RdtException("No L3 domains found in " + root + "/schemata");
+
+  // MBA in percent; the MBps software controller (-o mba_MBps) takes
+  // absolute bandwidths and is not supported
+  std::string mbGran, mbMin;
+  mba = read_file(root + "/info/MB/bandwidth_gran", mbGran) &&
+        read_file(root + "/info/MB/min_bandwidth", mbMin);
+  if (mba) {
+    mbaGran = std::max(1, atoi(mbGran.c_str()));
+    mbaMin = atoi(mbMin.c_str());
+    mbDomains = schemata_domains(schemata, "MB");
+    mba = !mbDomains.empty();
+    shadowMba.resize(numCos, -1);
+  }
+
+  // Each monitoring group takes one RMID; without L3 monitoring there are
+  // none to hand out beyond the default one
+  std::string rmids;
+  numRmids = 1;
+  if (read_file(root + "/info/L3_MON/num_rmids", rmids))
+    numRmids = std::max(1, atoi(rmids.c_str()));
+
+  shadowCbm.resize(numCos, -1);
+  if (cdp)
+    shadowCodeCbm.resize(numCos, -1);
+  groupCreated.resize(numCos, false);
+  groupCreated[0] = true;
+
+  // Cores not claimed by a kpart group (e.g., left over from a previous run)
+  // belong to the default group
+  shadowCos.resize(numCores, 0);
+  for (int cos = 1; cos < numCos; cos++) {
+    std::string cpus;
+    if (!read_file(groupPath(cos) + "/cpus_list", cpus))
+      continue;
+    groupCreated[cos] = true;
+    for (int c : parse_cpu_list(cpus)) {
+      if (c < numCores)
+        shadowCos[c] = cos;
+    }
+  }
+}
+
+std::string ResctrlBackend::groupPath(int cos) const {
+  if (cos == 0)
+    return root;
+  return root + "/kpart_cos" + std::to_string(cos);
+}
+
+std::string ResctrlBackend::monGroupPath(uint32_t rmid, int cos) const {
+  return groupPath(cos) + "/mon_groups/kpart_rmid" + std::to_string(rmid);
+}
+
+std::string ResctrlBackend::lastCmdStatus() const {
+  std::string status;
+  if (!read_file(root + "/info/last_cmd_status", status))
+    return "";
+  return " (" + status + ")";
+}
+
+void ResctrlBackend::makeDir(const std::string &path) {
+  if (mkdir(path.c_str(), 0755) == -1 && errno != EEXIST) {
+    throw RdtException("Error creating " + path + ": " + strerror(errno) +
+                       lastCmdStatus());
+  }
+}
+
+void ResctrlBackend::ensureGroup(int cos) {
+  if (cos < 0 || cos >= numCos) {
+    std::stringstream ss;
+    ss << "cos (" << cos << ") exceeds max supported cos (" << numCos - 1
+       << ")";
+    throw RdtException(ss.str());
+  }
+  if (groupCreated[cos])
+    return;
+  makeDir(groupPath(cos));
+  // The kernel creates mon_groups itself; this is only needed on fake trees
+  makeDir(groupPath(cos) + "/mon_groups");
+  groupCreated[cos] = true;
+}
+
+// Every resctrl file expects its whole new value in a single write()
+void ResctrlBackend::writeFile(const std::string &path,
+                               const std::string &val) {
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1)
+    throw RdtException("Error opening " + path + ": " + strerror(errno));
+  ssize_t nbytes = write(fd, val.c_str(), val.size());
+  int writeErrno = errno;
+  close(fd);
+  if (nbytes != (ssize_t) val.size()) {
+    throw RdtException("Error writing '" + val + "' to " + path + ": " +
+                       strerror(writeErrno) + lastCmdStatus());
+  }
+}
+
+// Moves all threads of the workload (of its pid, or in its cgroup), one tid
+// per write() on a single fd
+void ResctrlBackend::writeTasks(const std::string &path, const Workload &w) {
+  std::vector<std::string> tids;
+  if (!w.cgroup.empty()) {
+    std::ifstream threads(w.cgroup + "/cgroup.threads");
+    std::string tid;
+    while (threads >> tid)
+      tids.push_back(tid);
+    if (tids.empty())
+      return; // nothing runs in the cgroup yet
+  } else {
+    std::string taskDir = "/proc/" + std::to_string(w.pid) + "/task";
+    DIR *dir = opendir(taskDir.c_str());
+    if (dir != nullptr) {
+      struct dirent *ent;
+      while ((ent = readdir(dir)) != nullptr) {
+        if (ent->d_name[0] != '.')
+          tids.push_back(ent->d_name);
+      }
+      closedir(dir);
+    }
+    if (tids.empty())
+      tids.push_back(std::to_string(w.pid));
+  }
+
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (fd == -1)
+    throw RdtException("Error opening " + path + ": " + strerror(errno));
+  for (const std::string &tid : tids) {
+    std::string val = tid + "\n";
+    ssize_t nbytes = write(fd, val.c_str(), val.size());
+    if (nbytes < 0 && errno == ESRCH)
+      continue; // threads may exit while we move them
+    if (nbytes < 0) {
+      int writeErrno = errno;
+      close(fd);
+      throw RdtException("Error moving task " + tid + " to " + path + ": " +
+                         strerror(writeErrno) + lastCmdStatus());
+    }
+    if (nbytes != (ssize_t) val.size()) {
+      close(fd);
+      throw RdtException("Short write moving task " + tid + " to " + path +
+                         lastCmdStatus());
+    }
+  }
+  close(fd);
+}
+
+uint32_t ResctrlBackend::getCbm(int cos) {
+  if (cos >= 0 && cos < numCos && shadowCbm[cos] >= 0)
+    return static_cast<uint32_t>(shadowCbm[cos]);
+
+  std::stringstream schemata(read_file_or_throw(groupPath(cos) + "/schemata"));
+  std::string line;
+  while (std::getline(schemata, line)) {
+    size_t pos = line.find(dataResource() + ":");
+    if (pos == std::string::npos)
+      continue;
+    // All domains get the same mask, so the first one is representative
+    size_t eq = line.find('=', pos);
+    if (eq != std::string::npos)
+      return strtoul(line.c_str() + eq + 1, NULL, 16);
+  }
+  throw RdtException("No L3 schemata for " + groupPath(cos));
+}
+
+void ResctrlBackend::invalidateShadow() {
+  std::fill(shadowCbm.begin(), shadowCbm.end(), -1);
+  std::fill(shadowCodeCbm.begin(), shadowCodeCbm.end(), -1);
+  std::fill(shadowMba.begin(), shadowMba.end(), -1);
+}
+
+// e.g. "L3:0=ff0;1=ff0\n", the same mask on every domain
+std::string ResctrlBackend::schemataLine(const std::string &resource,
+                                         uint32_t cbm) const {
+  std::stringstream ss;
+  ss << resource << ":";
+  for (size_t d = 0; d < l3Domains.size(); d++)
+    ss << (d ? ";" : "") << l3Domains[d] << "=" << std::hex << cbm << std::dec;
+  ss << "\n";
+  return ss.str();
+}
+
+// e.g. "MB:0=50;1=50\n", rounded down to the granularity (the kernel would
+// round up)
+std::string ResctrlBackend::mbSchemataLine(int percent) const {
+  std::stringstream ss;
+  ss << "MB:";
+  for (size_t d = 0; d < mbDomains.size(); d++)
+    ss << (d ? ";" : "") << mbDomains[d] << "=" << percent;
+  ss << "\n";
+  return ss.str();
+}
+
+int ResctrlBackend::doApplyPlan(const PartitionPlan &plan) {
+  try {
+    if (!plan.codeCbms.empty() && !cdp)
+      throw RdtException("plan has code masks, but resctrl is not mounted "
+                         "with -o cdp");
+    if (!plan.mbaPercents.empty() && !mba)
+      throw RdtException("plan has bandwidth caps, but resctrl has no MB "
+                         "resource");
+
+    // One schemata write per group, covering all L3 domains (and, under
+    // CDP, both the data and code lines, and the MB line)
+    int numGroups = std::max(plan.cbms.size(), plan.mbaPercents.size());
+    for (int cos = 0; cos < numGroups; cos++) {
+      ensureGroup(cos);
+      std::string lines;
+      bool hasCbm = (cos < (int) plan.cbms.size());
+      bool changed = hasCbm && (shadowCbm[cos] != plan.cbms[cos]);
+      if (changed)
+        lines += schemataLine(dataResource(), plan.cbms[cos]);
+      if (hasCbm)
+        countWrite(changed);
+
+      int mbPercent = -1;
+      if (cos < (int) plan.mbaPercents.size()) {
+        mbPercent = std::min(plan.mbaPercents[cos], 100) / mbaGran * mbaGran;
+        mbPercent = std::max(mbPercent, mbaMin);
+        bool mbChanged = (shadowMba[cos] != mbPercent);
+        if (mbChanged)
+          lines += mbSchemataLine(mbPercent);
+        countWrite(mbChanged);
+      }
+
+      uint32_t codeCbm = 0;
+      if (cdp && hasCbm) {
+        // COSes without a code mask use their data mask for code too
+        codeCbm = (cos < (int) plan.codeCbms.size()) ? plan.codeCbms[cos]
+                                                     : plan.cbms[cos];
+        bool codeChanged = (shadowCodeCbm[cos] != codeCbm);
+        if (codeChanged)
+          lines += schemataLine("L3CODE", codeCbm);
+        countWrite(codeChanged);
+      }
+
+      if (!lines.empty()) {
+        writeFile(groupPath(cos) + "/schemata", lines);
+        if (hasCbm)
+          shadowCbm[cos] = plan.cbms[cos];
+        if (cdp && hasCbm)
+          shadowCodeCbm[cos] = codeCbm;
+        if (mbPercent >= 0)
+          shadowMba[cos] = mbPercent;
+      }
+    }
+
+    std::vector<int> newCos(shadowCos);
+    std::set<int> dirtyGroups;
+    for (int core = 0; core < (int) plan.coreCos.size(); core++) {
+      int cos = plan.coreCos[core];
+      if (cos < 0)
+        continue;
+      if (core >= numCores) {
+        std::stringstream ss;
+        ss << "core (" << core << ") exceeds number of cores (" << numCores
+           << ")";
+        throw RdtException(ss.str());
+      }
+      ensureGroup(cos);
+      if (newCos[core] != cos) {
+        dirtyGroups.insert(newCos[core]);
+        dirtyGroups.insert(cos);
+        newCos[core] = cos;
+      } else {
+        countWrite(false);
+      }
+    }
+
+    // One cpus_list write per group whose membership changed. The default
+    // group only accepts additions, and implicitly receives every core that
+    // another group gives up, so it is never written.
+    for (int cos : dirtyGroups) {
+      if (cos == 0)
+        continue;
+      std::vector<int> cpus;
+      for (int core = 0; core < numCores; core++) {
+        if (newCos[core] == cos)
+          cpus.push_back(core);
+      }
+      writeFile(groupPath(cos) + "/cpus_list", format_cpu_list(cpus) + "\n");
+      countWrite(true);
+    }
+    shadowCos = newCos;
+
+    // Tasks follow their cores' COS
+    for (auto &it : workloads) {
+      Workload &w = it.second;
+      if (w.cores.empty())
+        continue;
+      int cos = shadowCos[w.cores[0]];
+      if (cos != w.cos) {
+        moveWorkload(w, cos);
+        countWrite(true);
+      }
+    }
+    for (Workload &w : unboundWorkloads) {
+      if (w.cores.empty())
+        continue;
+      int cos = shadowCos[w.cores[0]];
+      if (cos != w.cos) {
+        ensureGroup(cos);
+        writeTasks(groupPath(cos) + "/tasks", w);
+        w.cos = cos;
+        countWrite(true);
+      }
+    }
+  } catch (RdtException &e) {
+    printf("[ERROR] resctrl backend: %s\n", e.what());
+    return -1;
+  }
+  return 0;
+}
+
+void ResctrlBackend::moveWorkload(Workload &w, int cos) {
+  ensureGroup(cos);
+  std::string from = monGroupPath(w.rmid, w.cos);
+  std::string to = monGroupPath(w.rmid, cos);
+
+  // On kernels that support it, renaming a monitoring group into another
+  // control group moves its tasks and keeps its RMID (and counts)
+  if (rename(from.c_str(), to.c_str()) == 0) {
+    w.cos = cos;
+    return;
+  }
+
+  // Older kernels: recreate the monitoring group, carrying over its traffic
+  w.localBytesBase += readMonEvent(w, "mbm_local_bytes");
+  w.totalBytesBase += readMonEvent(w, "mbm_total_bytes");
+  rmdir(from.c_str());
+  writeTasks(groupPath(cos) + "/tasks", w);
+  makeDir(to);
+  writeTasks(to + "/tasks", w);
+  w.cos = cos;
+}
+
+void ResctrlBackend::doBindRmid(uint32_t rmid, pid_t pid,
+                                const std::vector<int> &cores,
+                                const std::string &cgroup) {
+  auto it = workloads.find(rmid);
+  if (it != workloads.end())
+    rmdir(monGroupPath(rmid, it->second.cos).c_str());
+  for (auto u = unboundWorkloads.begin(); u != unboundWorkloads.end(); ++u) {
+    if (u->pid == pid && u->cgroup == cgroup) {
+      unboundWorkloads.erase(u);
+      break;
+    }
+  }
+
+  Workload w;
+  w.rmid = rmid;
+  w.pid = pid;
+  w.cgroup = cgroup;
+  w.cores = cores;
+  w.cos = (!cores.empty() && cores[0] < numCores) ? shadowCos[cores[0]] : 0;
+  w.localBytesBase = 0;
+  w.totalBytesBase = 0;
+
+  ensureGroup(w.cos);
+  std::string monPath = monGroupPath(rmid, w.cos);
+  makeDir(monPath);
+  writeTasks(groupPath(w.cos) + "/tasks", w);
+  writeTasks(monPath + "/tasks", w);
+  workloads[rmid] = w;
+}
+
+void ResctrlBackend::doUnbindRmid(uint32_t rmid) {
+  auto it = workloads.find(rmid);
+  if (it == workloads.end())
+    return;
+  // Removing the monitoring group hands its tasks back to the control group
+  // (and frees its hardware RMID)
+  rmdir(monGroupPath(rmid, it->second.cos).c_str());
+  unboundWorkloads.push_back(it->second);
+  workloads.erase(it);
+}
+
+uint32_t ResctrlBackend::getRmid(int core) {
+  for (auto &it : workloads) {
+    const std::vector<int> &cores = it.second.cores;
+    if (std::find(cores.begin(), cores.end(), core) != cores.end())
+      return it.first;
+  }
+  return 0;
+}
+
+// Sums the event over all L3 monitoring domains (mon_data/mon_L3_XX)
+int64_t ResctrlBackend::readMonEvent(const Workload &w,
+                                     const std::string &event) {
+  std::string monData = monGroupPath(w.rmid, w.cos) + "/mon_data";
+  DIR *dir = opendir(monData.c_str());
+  if (dir == nullptr)
+    throw RdtException("Error opening " + monData);
+
+  int64_t total = 0;
+  struct dirent *ent;
+  while ((ent = readdir(dir)) != nullptr) {
+    if (strncmp(ent->d_name, "mon_L3_", 7) != 0)
+      continue;
+    std::string path = monData + "/" + ent->d_name + "/" + event;
+    std::string val;
+    if (!read_file(path, val) || val.empty() || !isdigit(val[0])) {
+      closedir(dir);
+      throw RdtException("Counter unavailable: " + path + " = " + val);
+    }
+    total += strtoll(val.c_str(), NULL, 10);
+  }
+  closedir(dir);
+  return total;
+}
+
+ResctrlBackend::Workload &ResctrlBackend::findWorkload(uint32_t rmid) {
+  auto it = workloads.find(rmid);
+  if (it == workloads.end())
+    throw RdtException("RMID " + std::to_string(rmid) + " is not bound");
+  return it->second;
+}
+
+int64_t ResctrlBackend::getLlcOccupancy(uint32_t rmid) {
+  return readMonEvent(findWorkload(rmid), "llc_occupancy");
+}
+
+int64_t ResctrlBackend::getLocalMemTraffic(uint32_t rmid) {
+  Workload &w = findWorkload(rmid);
+  return w.localBytesBase + readMonEvent(w, "mbm_local_bytes");
+}
+
+int64_t ResctrlBackend::getTotalMemTraffic(uint32_t rmid) {
+  Workload &w = findWorkload(rmid);
+  return w.totalBytesBase + readMonEvent(w, "mbm_total_bytes");
+}
+
+// resctrl reports 64-bit byte counts and handles counter overflow itself
+int64_t ResctrlBackend::getMemTrafficMax() const {
+  return std::numeric_limits<int64_t>::max();
+}
+
+} // namespace rdt
@@ -0,0 +1,134 @@
+/** $lic$
+* MIT License
+*
+* Copyright (c) 2017-2018 by Massachusetts Institute of Technology
+* Copyright (c) 2017-2018 by Qatar Computing Research Institute, HBKU
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* If you use this software in your research, we request that you reference
+* the KPart paper ("KPart: A Hybrid Cache Partitioning-Sharing Technique for
+* Commodity Multicores", El-Sayed, Mukkara, Tsai, Kasture, Ma, and Sanchez,
+* HPCA-24, February 2018) as the source in any publications that use this
+* software, and that you send us a citation of your work.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+**/
+#pragma once
+#include <unordered_map>
+#include "rdt_backend.h"
+
+namespace rdt {
+
+// Drives the Linux resctrl filesystem instead of raw MSRs. COS 0 is the
+// default (root) group; COS n maps to the control group "kpart_cos<n>". Each
+// bound workload gets a task-based monitoring group "kpart_rmid<r>" inside
+// the control group of its cores, and that monitoring group (with its tasks
+// and hardware RMID) is moved along when the workload changes COS.
+//
+// The root directory is a parameter so that the backend can be exercised
+// against a fake resctrl tree (plain directories and files) without RDT.
+class ResctrlBackend : public RdtBackend {
+private:
+  struct Workload {
+    uint32_t rmid;
+    pid_t pid;
+    std::string cgroup; // if set, the tasks are this cgroup's threads
+    std::vector<int> cores;
+    int cos; // control group currently holding the monitoring group
+
+    // Traffic accumulated by earlier incarnations of the monitoring group,
+    // when it had to be recreated rather than moved
+    int64_t localBytesBase;
+    int64_t totalBytesBase;
+  };
+
+  std::string root;
+  int numCos;
+  int cbmLen;
+  int numCores;
+  std::vector<int> l3Domains; // cache ids listed in the L3 schemata line
+
+  bool cdp; // mounted with -o cdp: separate L3DATA and L3CODE masks
+
+  // Memory bandwidth allocation (the MB resource), in percent
+  bool mba;
+  int mbaGran;
+  int mbaMin;
+  std::vector<int> mbDomains; // ids listed in the MB schemata line
+
+  std::vector<int64_t> shadowCbm;     // indexed by COS, -1 means unknown
+  std::vector<int64_t> shadowCodeCbm; // code masks; empty without CDP
+  std::vector<int> shadowCos;     // indexed by core
+  std::vector<int> shadowMba;     // indexed by COS, -1 means unknown
+  std::vector<bool> groupCreated;
+
+  std::unordered_map<uint32_t, Workload> workloads; // keyed by rmid
+  // Unmonitored workloads; their tasks still follow their cores' COS
+  std::vector<Workload> unboundWorkloads;
+  int numRmids;
+
+  std::string dataResource() const { return cdp ? "L3DATA" : "L3"; }
+  std::string schemataLine(const std::string &resource, uint32_t cbm) const;
+  std::string mbSchemataLine(int percent) const;
+  std::string groupPath(int cos) const;
+  std::string monGroupPath(uint32_t rmid, int cos) const;
+  void ensureGroup(int cos);
+  Workload &findWorkload(uint32_t rmid);
+  void moveWorkload(Workload &w, int cos);
+  int64_t readMonEvent(const Workload &w, const std::string &event);
+
+  std::string lastCmdStatus() const;
+  void writeFile(const std::string &path, const std::string &val);
+  void writeTasks(const std::string &path, const Workload &w);
+  void makeDir(const std::string &path);
+
+protected:
+  int doApplyPlan(const PartitionPlan &plan);
+  void doBindRmid(uint32_t rmid, pid_t pid, const std::vector<int> &cores,
+                  const std::string &cgroup);
+  void doUnbindRmid(uint32_t rmid);
+
+public:
+  static const char *DEFAULT_ROOT;
+
+  explicit ResctrlBackend(const std::string &root = DEFAULT_ROOT);
+
+  static bool isMounted(const std::string &root);
+
+  const char *name() const { return "resctrl"; }
+  int getNumCos() const { return numCos; }
+  int getCbmLen() const { return cbmLen; }
+  bool isCdpEnabled() const { return cdp; }
+  bool isMbaSupported() const { return mba; }
+  int getMbaGranularity() const { return mba ? mbaGran : 100; }
+  uint32_t getCbm(int cos);
+  void invalidateShadow();
+
+  int getNumRmids() const { return numRmids; }
+  uint32_t getRmid(int core);
+  int64_t getLlcOccupancy(uint32_t rmid);
+  int64_t getLocalMemTraffic(uint32_t rmid);
+  int64_t getTotalMemTraffic(uint32_t rmid);
+  int64_t getMemTrafficMax() const;
+};
+
+// Parse/format the "0-3,8,10-11" CPU list syntax used by cpus_list files
+std::vector<int> parse_cpu_list(const std::string &str);
+std::string format_cpu_list(const std::vector<int> &cpus);
+
+} // namespace rdt
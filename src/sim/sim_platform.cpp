@@ -0,0 +1,403 @@
+/** $lic$
+* MIT License
+*
+* Copyright (c) 2017-2018 by Massachusetts Institute of Technology
+* Copyright (c) 2017-2018 by Qatar Computing Research Institute, HBKU
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* If you use this software in your research, we request that you reference
+* the KPart paper ("KPart: A Hybrid Cache Partitioning-Sharing Technique for
+* Commodity Multicores", El-Sayed, Mukkara, Tsai, Kasture, Ma, and Sanchez,
+* HPCA-24, February 2018) as the source in any publications that use this
+* software, and that you send us a citation of your work.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+**/
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+#include "cpuid.h"
+#include "msr_haswell.h"
+#include "sysconfig.h"
+#include "sim_platform.h"
+
+namespace sim {
+
+// Splits "key=value,key=value" into a map
+static std::map<std::string, double> parse_params(const std::string &spec) {
+  std::map<std::string, double> params;
+  std::stringstream ss(spec);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    size_t eq = item.find('=');
+    if (eq == std::string::npos)
+      continue;
+    char *end;
+    std::string val = item.substr(eq + 1);
+    params[item.substr(0, eq)] = strtod(val.c_str(), &end);
+    if (val.empty() || *end != '\0')
+      throw std::invalid_argument("bad value in '" + item + "'");
+  }
+  return params;
+}
+
+static void set_param(const std::map<std::string, double> &params,
+                      const char *key, double &field) {
+  auto it = params.find(key);
+  if (it != params.end())
+    field = it->second;
+}
+
+double AppModel::mpki(double dataWays, double codeWays) const {
+  dataWays = std::min(dataWays, footprintWays);
+  return mpkiMin + (mpkiMax - mpkiMin) * exp(-dataWays / decayWays) +
+         codeMpkiMax * exp(-codeWays / codeDecayWays);
+}
+
+AppModel parse_app_model(const std::string &spec) {
+  if (spec.compare(0, 4, "sim:") != 0)
+    throw std::invalid_argument("'" + spec + "' is not a sim: app spec");
+  std::map<std::string, double> params = parse_params(spec.substr(4));
+  AppModel app;
+  set_param(params, "mpki", app.mpkiMax);
+  set_param(params, "min", app.mpkiMin);
+  set_param(params, "decay", app.decayWays);
+  set_param(params, "footprint", app.footprintWays);
+  set_param(params, "code", app.codeMpkiMax);
+  set_param(params, "codedecay", app.codeDecayWays);
+  set_param(params, "cpi", app.cpiBase);
+  set_param(params, "penalty", app.missPenalty);
+  set_param(params, "refs", app.refsPki);
+  if (app.decayWays <= 0 || app.codeDecayWays <= 0 || app.cpiBase <= 0)
+    throw std::invalid_argument("decay, codedecay and cpi must be positive");
+  return app;
+}
+
+PlatformConfig parse_platform_config(const std::string &spec) {
+  std::map<std::string, double> params = parse_params(spec);
+  PlatformConfig cfg;
+  double cores = cfg.numCores, ways = cfg.numWays, cos = cfg.numCos;
+  double rmids = cfg.numRmids, wayMb = cfg.wayBytes / (1024 * 1024);
+  double mult = cfg.mbmMultiplier, cdp = 0, mba = cfg.mbaMaxDelay;
+  double noncontig = 0;
+  double family = cfg.family, model = cfg.model, stepping = cfg.stepping;
+  set_param(params, "cores", cores);
+  set_param(params, "ways", ways);
+  set_param(params, "cos", cos);
+  set_param(params, "rmids", rmids);
+  set_param(params, "ghz", cfg.freqGhz);
+  set_param(params, "waymb", wayMb);
+  set_param(params, "mult", mult);
+  set_param(params, "cdp", cdp);
+  set_param(params, "noncontig", noncontig);
+  set_param(params, "memgbs", cfg.memGBs);
+  set_param(params, "mba", mba);
+  set_param(params, "family", family);
+  set_param(params, "model", model);
+  set_param(params, "stepping", stepping);
+  cfg.numCores = cores;
+  cfg.numWays = ways;
+  cfg.numCos = cos;
+  cfg.numRmids = rmids;
+  cfg.wayBytes = wayMb * 1024 * 1024;
+  cfg.mbmMultiplier = mult;
+  cfg.cdp = (cdp != 0);
+  cfg.nonContigCbm = (noncontig != 0);
+  cfg.mbaMaxDelay = mba;
+  cfg.family = family;
+  cfg.model = model;
+  cfg.stepping = stepping;
+  if (cfg.numCores < 1 || cfg.numWays < 1 || cfg.numWays > 32 ||
+      cfg.numCos < (cfg.cdp ? 2 : 1) || cfg.numRmids < 1 || cfg.numRmids > 1024 ||
+      cfg.freqGhz <= 0 || cfg.mbmMultiplier < 1 || cfg.memGBs <= 0 ||
+      cfg.mbaMaxDelay < 0 || cfg.mbaMaxDelay > 99 || cfg.family < 1 ||
+      cfg.family > 0xff + 0xf || cfg.model < 0 || cfg.model > 0xff ||
+      cfg.stepping < 0 || cfg.stepping > 0xf)
+    throw std::invalid_argument("simulated platform parameter out of range");
+  return cfg;
+}
+
+SimPlatform::SimPlatform(const PlatformConfig &cfg)
+    : cfg(cfg), clockNs(0), apps(cfg.numCores), pqrAssoc(cfg.numCores, 0),
+      qmEvtsel(cfg.numCores, 0), l3Masks(cfg.numCos), qosCfg(cfg.cdp ? 1 : 0),
+      mbaDelays(cfg.numCos, 0), rmidMemBytes(cfg.numRmids, 0.0) {
+  // Out of reset, every COS may use the whole cache
+  for (uint64_t &m : l3Masks)
+    m = (1ULL << cfg.numWays) - 1;
+  for (CoreApp &a : apps) {
+    a.present = false;
+    a.ctrs = CoreCounters();
+  }
+}
+
+SimPlatform::~SimPlatform() {
+  if (MSR::getDevice() == this)
+    uninstall();
+}
+
+void SimPlatform::install() {
+  // CPUID.(1,0).EAX: stepping, model, family, extended model and family
+  uint32_t signature = cfg.stepping | ((cfg.model & 0xf) << 4) |
+                       (std::min(cfg.family, 0xf) << 8) |
+                       ((cfg.model >> 4) << 16) |
+                       (std::max(cfg.family - 0xf, 0) << 20);
+  CPUID::setOverride(0x1, 0x0, signature, 0, 0, 0);
+  // CPUID.(7,0).EBX: bit 12 = RDT monitoring, bit 15 = RDT allocation
+  CPUID::setOverride(0x7, 0x0, 0, (1U << 12) | (1U << 15), 0, 0);
+  // CPUID.(10h,0).EBX bit 1: L3 CAT; (10h,1): CBM length, CDP support (ECX
+  // bit 2), non-contiguous CBMs (ECX bit 3), COS count
+  CPUID::setOverride(0x10, 0x0, 0, (1U << 1) | (cfg.mbaMaxDelay ? 1U << 3 : 0),
+                     0, 0);
+  CPUID::setOverride(0x10, 0x1, cfg.numWays - 1, 0,
+                     (cfg.cdp ? (1U << 2) : 0) |
+                         (cfg.nonContigCbm ? (1U << 3) : 0),
+                     cfg.numCos - 1);
+  // CPUID.(10h,3): max MBA delay, linear delay scale (ECX bit 2), COS count
+  if (cfg.mbaMaxDelay)
+    CPUID::setOverride(0x10, 0x3, cfg.mbaMaxDelay - 1, 0, 1U << 2,
+                       cfg.numCos - 1);
+  // CPUID.(Fh,0).EDX bit 1: L3 monitoring; (Fh,1): counter multiplier, max
+  // RMID, and occupancy/total/local events
+  CPUID::setOverride(0xf, 0x0, 0, cfg.numRmids - 1, 0, 1U << 1);
+  CPUID::setOverride(0xf, 0x1, 0, cfg.mbmMultiplier, cfg.numRmids - 1, 0x7);
+
+  simulatedNumCores() = cfg.numCores;
+  MSR::setDevice(this);
+}
+
+void SimPlatform::uninstall() {
+  MSR::setDevice(nullptr);
+  simulatedNumCores() = 0;
+  CPUID::clearOverrides();
+}
+
+void SimPlatform::setApp(int core, const AppModel &app) {
+  apps.at(core).present = true;
+  apps[core].model = app;
+}
+
+uint32_t SimPlatform::coreCbm(int core, bool code) const {
+  uint64_t cos = pqrAssoc[core] >> 32;
+  return cdpOn() ? l3Masks[2 * cos + (code ? 1 : 0)] : l3Masks[cos];
+}
+
+double SimPlatform::effectiveWays(uint32_t cbm) const {
+  // A way shared by n running apps counts 1/n towards each of them
+  double ways = 0.0;
+  for (int w = 0; w < cfg.numWays; w++) {
+    if (!(cbm & (1U << w)))
+      continue;
+    int sharers = 0;
+    for (int c = 0; c < cfg.numCores; c++) {
+      uint32_t used = coreCbm(c, false) | coreCbm(c, true);
+      if (apps[c].present && (used & (1U << w)))
+        sharers++;
+    }
+    ways += 1.0 / std::max(sharers, 1);
+  }
+  return ways;
+}
+
+double SimPlatform::getEffectiveWays(int core) {
+  std::lock_guard<std::mutex> lock(mutex);
+  return effectiveWays(coreCbm(core, false));
+}
+
+void SimPlatform::coreRates(std::vector<double> &instrPerNs,
+                            std::vector<double> &mpkis) const {
+  instrPerNs.assign(cfg.numCores, 0.0);
+  mpkis.assign(cfg.numCores, 0.0);
+  std::vector<double> cpiBase(cfg.numCores, 0.0);
+  std::vector<double> stallPi(cfg.numCores, 0.0); // miss cycles per instr
+  std::vector<double> capGBs(cfg.numCores, 0.0);
+
+  // Bandwidth demanded by each core with unloaded memory, as far as MBA lets
+  // it through; GB/s == bytes/ns
+  double demand = 0.0;
+  for (int c = 0; c < cfg.numCores; c++) {
+    const CoreApp &a = apps[c];
+    if (!a.present)
+      continue;
+    double dataWays = effectiveWays(coreCbm(c, false));
+    double codeWays = effectiveWays(coreCbm(c, true));
+    mpkis[c] = a.model.mpki(dataWays, codeWays);
+    cpiBase[c] = a.model.cpiBase;
+    stallPi[c] = mpkis[c] * a.model.missPenalty / 1000;
+    uint64_t cos = pqrAssoc[c] >> 32;
+    capGBs[c] = cfg.memGBs * (100.0 - mbaDelays[cos]) / 100;
+    double unloaded =
+        cfg.freqGhz / (cpiBase[c] + stallPi[c]) * mpkis[c] * 64 / 1000;
+    demand += std::min(unloaded, capGBs[c]);
+  }
+
+  // Past saturation, misses queue up: stretch their latency until the
+  // demand fits (one step, which is enough for a coarse model)
+  double stretch = std::max(1.0, demand / cfg.memGBs);
+  for (int c = 0; c < cfg.numCores; c++) {
+    if (!apps[c].present)
+      continue;
+    instrPerNs[c] = cfg.freqGhz / (cpiBase[c] + stallPi[c] * stretch);
+    // MBA throttles the core's own requests
+    double bytesPerInstr = mpkis[c] * 64 / 1000;
+    if (instrPerNs[c] * bytesPerInstr > capGBs[c])
+      instrPerNs[c] = capGBs[c] / bytesPerInstr;
+  }
+}
+
+void SimPlatform::advance(uint64_t ns) {
+  std::lock_guard<std::mutex> lock(mutex);
+  std::vector<double> instrPerNs, mpkis;
+  coreRates(instrPerNs, mpkis);
+  for (int c = 0; c < cfg.numCores; c++) {
+    CoreApp &a = apps[c];
+    if (!a.present)
+      continue;
+    double cycles = ns * cfg.freqGhz;
+    double instrs = ns * instrPerNs[c];
+    double misses = instrs * mpkis[c] / 1000;
+    a.ctrs.cycles += cycles;
+    a.ctrs.instructions += instrs;
+    a.ctrs.llcRefs += instrs * a.model.refsPki / 1000;
+    a.ctrs.llcMisses += misses;
+    rmidMemBytes[coreRmid(c) % cfg.numRmids] += misses * 64;
+  }
+  clockNs += ns;
+}
+
+uint64_t SimPlatform::nsUntil(int core, double instructions) {
+  std::lock_guard<std::mutex> lock(mutex);
+  const CoreApp &a = apps[core];
+  double left = instructions - a.ctrs.instructions;
+  if (!a.present || left <= 0)
+    return 0;
+  std::vector<double> instrPerNs, mpkis;
+  coreRates(instrPerNs, mpkis);
+  return static_cast<uint64_t>(ceil(left / instrPerNs[core]));
+}
+
+SimPlatform::CoreCounters SimPlatform::getCounters(int core) const {
+  return apps[core].ctrs;
+}
+
+uint64_t SimPlatform::readQmCtr(int core) const {
+  uint32_t rmid = (qmEvtsel[core] >> 32) & 0x3ff;
+  uint32_t evt = qmEvtsel[core] & 0xff;
+  if (rmid >= (uint32_t) cfg.numRmids || evt < 1 || evt > 3)
+    return 1ULL << 63; // error bit
+
+  if (evt == 1) { // LLC occupancy: what the RMID's cores hold right now
+    double bytes = 0.0;
+    for (int c = 0; c < cfg.numCores; c++) {
+      if (apps[c].present && coreRmid(c) == rmid) {
+        uint32_t used = coreCbm(c, false) | coreCbm(c, true);
+        double ways =
+            std::min(effectiveWays(used), apps[c].model.footprintWays);
+        bytes += ways * cfg.wayBytes;
+      }
+    }
+    return static_cast<uint64_t>(bytes / cfg.mbmMultiplier);
+  }
+  // Total and local traffic are the same on one package. The counter is 24
+  // bits wide, as on real parts.
+  uint64_t count = rmidMemBytes[rmid] / cfg.mbmMultiplier;
+  return count & ((1ULL << 24) - 1);
+}
+
+int SimPlatform::read(int core, uint32_t msr, uint64_t &val) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (core < 0 || core >= cfg.numCores) {
+    errno = ENXIO;
+    return -1;
+  }
+  if (msr == MSR_IA32_PQR_ASSOC) {
+    val = pqrAssoc[core];
+  } else if (msr == MSR_IA32_QM_EVTSEL) {
+    val = qmEvtsel[core];
+  } else if (msr == MSR_IA32_QM_CTR) {
+    val = readQmCtr(core);
+  } else if (msr == MSR_IA32_L3_QOS_CFG) {
+    val = qosCfg;
+  } else if (msr >= MSR_IA32_L3_MASK_0 &&
+             msr < MSR_IA32_L3_MASK_0 + (uint32_t) cfg.numCos) {
+    val = l3Masks[msr - MSR_IA32_L3_MASK_0];
+  } else if (cfg.mbaMaxDelay && msr >= MSR_IA32_L2_QOS_EXT_BW_THRTL_0 &&
+             msr < MSR_IA32_L2_QOS_EXT_BW_THRTL_0 + (uint32_t) cfg.numCos) {
+    val = mbaDelays[msr - MSR_IA32_L2_QOS_EXT_BW_THRTL_0];
+  } else {
+    auto it = otherMsrs.find(std::make_pair(core, msr));
+    val = (it != otherMsrs.end()) ? it->second : 0;
+  }
+  return 0;
+}
+
+int SimPlatform::write(int core, uint32_t msr, uint64_t val) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (core < 0 || core >= cfg.numCores) {
+    errno = ENXIO;
+    return -1;
+  }
+  if (msr == MSR_IA32_PQR_ASSOC) {
+    // Out-of-range COS or RMID raise #GP, which the msr driver reports as EIO
+    if ((val >> 32) >= (uint64_t) numActiveCos() ||
+        (val & 0x3ff) >= (uint64_t) cfg.numRmids) {
+      errno = EIO;
+      return -1;
+    }
+    pqrAssoc[core] = val;
+  } else if (msr == MSR_IA32_QM_EVTSEL) {
+    qmEvtsel[core] = val;
+  } else if (msr == MSR_IA32_QM_CTR) {
+    errno = EIO; // read-only
+    return -1;
+  } else if (msr == MSR_IA32_L3_QOS_CFG) {
+    if ((val & ~1ULL) || ((val & 1) && !cfg.cdp)) {
+      errno = EIO;
+      return -1;
+    }
+    qosCfg = val;
+  } else if (msr >= MSR_IA32_L3_MASK_0 &&
+             msr < MSR_IA32_L3_MASK_0 + (uint32_t) cfg.numCos) {
+    // Masks must be non-empty and fit in the CBM length, and contiguous
+    // unless the platform allows holes
+    uint64_t cbm = val;
+    bool contiguous = cbm && (((cbm >> __builtin_ctzll(cbm)) + 1) &
+                              (cbm >> __builtin_ctzll(cbm))) == 0;
+    if (!cbm || (!contiguous && !cfg.nonContigCbm) ||
+        (cbm >> cfg.numWays) != 0) {
+      errno = EIO;
+      return -1;
+    }
+    l3Masks[msr - MSR_IA32_L3_MASK_0] = val;
+  } else if (cfg.mbaMaxDelay && msr >= MSR_IA32_L2_QOS_EXT_BW_THRTL_0 &&
+             msr < MSR_IA32_L2_QOS_EXT_BW_THRTL_0 + (uint32_t) cfg.numCos) {
+    if (val > (uint64_t) cfg.mbaMaxDelay) {
+      errno = EIO;
+      return -1;
+    }
+    mbaDelays[msr - MSR_IA32_L2_QOS_EXT_BW_THRTL_0] = val;
+  } else {
+    otherMsrs[std::make_pair(core, msr)] = val;
+  }
+  return 0;
+}
+
+} // namespace sim
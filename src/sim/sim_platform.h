@@ -0,0 +1,187 @@
+/** $lic$
+* MIT License
+*
+* Copyright (c) 2017-2018 by Massachusetts Institute of Technology
+* Copyright (c) 2017-2018 by Qatar Computing Research Institute, HBKU
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* If you use this software in your research, we request that you reference
+* the KPart paper ("KPart: A Hybrid Cache Partitioning-Sharing Technique for
+* Commodity Multicores", El-Sayed, Mukkara, Tsai, Kasture, Ma, and Sanchez,
+* HPCA-24, February 2018) as the source in any publications that use this
+* software, and that you send us a citation of your work.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+**/
+#pragma once
+#include <stdint.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "msr.h"
+
+namespace sim {
+
+// Synthetic application: data misses per kilo-instruction decay
+// exponentially with the (effective) number of LLC ways until the footprint
+// fits, instruction misses do the same with the ways the code mask grants
+// (the same ways, unless CDP is on), and every miss costs a fixed number of
+// cycles on top of a base CPI.
+struct AppModel {
+  double mpkiMax;       // data MPKI with no cache
+  double mpkiMin;       // data MPKI once the footprint fits
+  double decayWays;     // ways to reduce the excess data MPKI by 1/e
+  double footprintWays; // ways beyond which more cache does not help
+  double codeMpkiMax;   // instruction MPKI with no cache
+  double codeDecayWays; // ways to reduce the instruction MPKI by 1/e
+  double cpiBase;       // CPI with no misses
+  double missPenalty;   // cycles per miss
+  double refsPki;       // LLC references per kilo-instruction
+
+  AppModel()
+      : mpkiMax(20.0), mpkiMin(1.0), decayWays(3.0), footprintWays(1e9),
+        codeMpkiMax(0.0), codeDecayWays(1.0), cpiBase(0.7),
+        missPenalty(200.0), refsPki(25.0) {}
+
+  double mpki(double dataWays, double codeWays) const;
+  double cpi(double dataWays, double codeWays) const {
+    return cpiBase + mpki(dataWays, codeWays) * missPenalty / 1000;
+  }
+};
+
+// Parses "sim:key=value,...", keys named after the AppModel fields (mpki,
+// min, decay, footprint, code, codedecay, cpi, penalty, refs). Throws
+// std::invalid_argument.
+AppModel parse_app_model(const std::string &spec);
+
+struct PlatformConfig {
+  int numCores;
+  int numWays;
+  int numCos;
+  int numRmids;
+  double freqGhz;
+  double wayBytes;
+  uint32_t mbmMultiplier; // bytes per IA32_QM_CTR count
+  bool cdp; // CDP supported and enabled out of reset
+  bool nonContigCbm; // CBMs may have holes (CPUID.(10h,1).ECX bit 3)
+  double memGBs;   // peak DRAM bandwidth, shared by all cores
+  int mbaMaxDelay; // largest MBA throttling delay; 0 means no MBA
+  // CPU signature reported by CPUID leaf 1, which selects the platform
+  // quirks (see rdt/quirks.h); Broadwell-D by default
+  int family;
+  int model;
+  int stepping;
+
+  PlatformConfig()
+      : numCores(8), numWays(12), numCos(16), numRmids(64), freqGhz(2.0),
+        wayBytes(1.25 * 1024 * 1024), mbmMultiplier(65536), cdp(false),
+        nonContigCbm(false), memGBs(40.0), mbaMaxDelay(90), family(0x6),
+        model(0x56), stepping(3) {}
+};
+
+// Parses "key=value,..." (cores, ways, cos, rmids, ghz, waymb, mult, cdp,
+// noncontig, memgbs, mba, family, model, stepping); any other string (e.g.,
+// "1") selects the defaults
+PlatformConfig parse_platform_config(const std::string &spec);
+
+// A single-package CAT/CMT/MBM machine that exists only in memory. Once
+// installed, CPUID reports the configured RDT features, the MSR class reads
+// and writes this object instead of /dev/cpu/N/msr, and sysconfig reports
+// numCores cores, so the real CAT/CMT controllers and the MSR backend run
+// unmodified on top of it.
+//
+// Time only moves when advance() is called. Between two calls, every core
+// runs its app at the CPI given by the ways its COS mask grants it (ways
+// shared with other running apps count fractionally), and its misses are
+// charged as memory traffic to the RMID currently in its IA32_PQR_ASSOC.
+// A core's memory bandwidth is capped by the MBA delay of its COS, and when
+// the cores together ask for more than memGBs, every miss takes
+// proportionally longer.
+class SimPlatform : public MSRDevice {
+public:
+  struct CoreCounters {
+    double instructions;
+    double cycles;
+    double llcRefs;
+    double llcMisses;
+  };
+
+  explicit SimPlatform(const PlatformConfig &cfg);
+  ~SimPlatform();
+
+  // Makes CPUID, MSR and getNumCores() see this platform
+  void install();
+  void uninstall();
+
+  const PlatformConfig &getConfig() const { return cfg; }
+
+  void setApp(int core, const AppModel &app);
+  bool hasApp(int core) const { return apps[core].present; }
+
+  uint64_t nowNs() const { return clockNs; }
+  void advance(uint64_t ns);
+
+  // Time until core has retired `instructions` in total at its current rate
+  // (rates only change when the allocation does)
+  uint64_t nsUntil(int core, double instructions);
+
+  CoreCounters getCounters(int core) const;
+  // Effective ways of the core's data (or unified) mask
+  double getEffectiveWays(int core);
+
+  // MSRDevice
+  int getNumCores() const { return cfg.numCores; }
+  int read(int core, uint32_t msr, uint64_t &val);
+  int write(int core, uint32_t msr, uint64_t val);
+
+private:
+  struct CoreApp {
+    bool present;
+    AppModel model;
+    CoreCounters ctrs;
+  };
+
+  PlatformConfig cfg;
+  uint64_t clockNs;
+  std::vector<CoreApp> apps;
+
+  // Architectural state
+  std::vector<uint64_t> pqrAssoc; // per core
+  std::vector<uint64_t> qmEvtsel; // per core
+  std::vector<uint64_t> l3Masks;  // per mask MSR (2 per COS under CDP)
+  uint64_t qosCfg;                // IA32_L3_QOS_CFG; bit 0 enables CDP
+  std::vector<uint64_t> mbaDelays; // per COS
+  std::vector<double> rmidMemBytes;
+  std::map<std::pair<int, uint32_t>, uint64_t> otherMsrs;
+
+  // MSRs may be accessed from several threads (see MSRDevice)
+  std::mutex mutex;
+
+  bool cdpOn() const { return qosCfg & 0x1; }
+  int numActiveCos() const { return cdpOn() ? cfg.numCos / 2 : cfg.numCos; }
+  uint32_t coreRmid(int core) const { return pqrAssoc[core] & 0x3ff; }
+  uint32_t coreCbm(int core, bool code) const;
+  double effectiveWays(uint32_t cbm) const;
+  // Instructions per ns and MPKI of every core under the current allocation
+  void coreRates(std::vector<double> &instrPerNs,
+                 std::vector<double> &mpkis) const;
+  uint64_t readQmCtr(int core) const;
+};
+
+} // namespace sim
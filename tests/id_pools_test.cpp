@@ -0,0 +1,240 @@
+/** $lic$
+* MIT License
+*
+* Copyright (c) 2017-2018 by Massachusetts Institute of Technology
+* Copyright (c) 2017-2018 by Qatar Computing Research Institute, HBKU
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* If you use this software in your research, we request that you reference
+* the KPart paper ("KPart: A Hybrid Cache Partitioning-Sharing Technique for
+* Commodity Multicores", El-Sayed, Mukkara, Tsai, Kasture, Ma, and Sanchez,
+* HPCA-24, February 2018) as the source in any publications that use this
+* software, and that you send us a citation of your work.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+**/
+
+// Checks the COS and RMID pools (rdt/id_pools.h), which are pure bookkeeping
+
+#include "rdt/id_pools.h"
+#include "unit_test.h"
+
+using rdt::CosAlloc;
+using rdt::CosPool;
+using rdt::RmidPool;
+
+static CosAlloc alloc(uint32_t cbm, int mbaPercent = 100) {
+  CosAlloc a = { cbm, cbm, mbaPercent };
+  return a;
+}
+
+static int64_t clean(uint32_t) { return 0; }
+static int64_t dirty(uint32_t) { return 1 << 20; }
+
+static void test_cos_assign() {
+  CosPool pool(4); // COS 1-3
+  CHECK_EQ(pool.getNumCos(), 3);
+
+  // Same allocations share a COS; distinct ones get the lowest free one
+  std::vector<CosAlloc> allocs = { alloc(0x00f), alloc(0x0f0), alloc(0x00f) };
+  std::vector<int> cos = pool.assign(allocs);
+  CHECK_EQ(cos.size(), 3u);
+  CHECK_EQ(cos[0], 1);
+  CHECK_EQ(cos[1], 2);
+  CHECK_EQ(cos[2], 1);
+
+  // A bandwidth cap alone makes an allocation distinct
+  allocs = { alloc(0x00f), alloc(0x0f0), alloc(0x00f, 50) };
+  cos = pool.assign(allocs);
+  CHECK_EQ(cos[0], 1);
+  CHECK_EQ(cos[1], 2);
+  CHECK_EQ(cos[2], 3);
+}
+
+static void test_cos_release() {
+  CosPool pool(4);
+  std::vector<CosAlloc> allocs = { alloc(0x00f), alloc(0x0f0), alloc(0xf00) };
+  pool.assign(allocs);
+
+  // Allocations that stay keep their COS, even if their order changes; the
+  // one that is gone gives up its COS to the new one
+  allocs = { alloc(0xf00), alloc(0xff0), alloc(0x00f) };
+  std::vector<int> cos = pool.assign(allocs);
+  CHECK_EQ(cos[0], 3);
+  CHECK_EQ(cos[1], 2);
+  CHECK_EQ(cos[2], 1);
+
+  // Releasing everything frees every COS
+  pool.assign(std::vector<CosAlloc>());
+  cos = pool.assign(std::vector<CosAlloc>(1, alloc(0x003)));
+  CHECK_EQ(cos[0], 1);
+}
+
+static void test_cos_exhaustion() {
+  CosPool pool(3, 1); // COS 1-2
+  std::vector<CosAlloc> allocs = { alloc(0x001), alloc(0x002),
+                                   alloc(0x004) };
+  bool threw = false;
+  try {
+    pool.assign(allocs);
+  } catch (rdt::RdtException &e) {
+    threw = true;
+  }
+  CHECK(threw);
+
+  // A failed assignment leaves the pool as it was
+  allocs.pop_back();
+  std::vector<int> cos = pool.assign(allocs);
+  CHECK_EQ(cos[0], 1);
+  CHECK_EQ(cos[1], 2);
+
+  // firstCos reserves the COSes below it
+  CosPool reserved(4, 2);
+  CHECK_EQ(reserved.getNumCos(), 2);
+  cos = reserved.assign(std::vector<CosAlloc>(1, alloc(0x001)));
+  CHECK_EQ(cos[0], 2);
+}
+
+static void test_rmid_allocate_release() {
+  RmidPool pool(4, 1024, 3); // RMIDs 1-3
+  for (int w = 0; w < 3; w++)
+    pool.addWorkload(w);
+  pool.addWorkload(0); // already waiting
+  CHECK_EQ(pool.getNumWaiting(), 3);
+  CHECK_EQ(pool.getRmid(0), -1);
+
+  std::vector<RmidPool::Change> changes = pool.rotate(clean, false);
+  CHECK_EQ(changes.size(), 3u);
+  CHECK_EQ(pool.getNumWaiting(), 0);
+  for (int w = 0; w < 3; w++)
+    CHECK_EQ(pool.getRmid(w), w + 1); // lowest first
+
+  // A released RMID cools down before anyone else gets it: until its
+  // occupancy is low enough, or for cooldownRounds rotations
+  CHECK_EQ(pool.removeWorkload(1), 2);
+  CHECK_EQ(pool.removeWorkload(1), -1);
+  CHECK_EQ(pool.getRmid(1), -1);
+  pool.addWorkload(3);
+  pool.rotate(dirty, false);
+  CHECK_EQ(pool.getRmid(3), -1);
+  pool.rotate(dirty, false);
+  CHECK_EQ(pool.getRmid(3), -1);
+  changes = pool.rotate(dirty, false);
+  CHECK_EQ(pool.getRmid(3), 2);
+  CHECK_EQ(changes.size(), 1u);
+  CHECK_EQ(changes[0].workload, 3);
+  CHECK_EQ(changes[0].oldRmid, -1);
+  CHECK_EQ(changes[0].newRmid, 2);
+
+  CHECK_EQ(pool.removeWorkload(3), 2);
+  pool.addWorkload(4);
+  pool.rotate(clean, false);
+  CHECK_EQ(pool.getRmid(4), 2);
+}
+
+static void test_rmid_exhaustion() {
+  RmidPool pool(3, 1024, 2); // RMIDs 1-2
+  for (int w = 0; w < 3; w++)
+    pool.addWorkload(w);
+  pool.rotate(clean, false);
+  CHECK_EQ(pool.getRmid(0), 1);
+  CHECK_EQ(pool.getRmid(1), 2);
+  CHECK_EQ(pool.getRmid(2), -1);
+  CHECK_EQ(pool.getNumWaiting(), 1);
+
+  // Without preemption, the waiting workload stays waiting
+  pool.rotate(clean, false);
+  CHECK_EQ(pool.getRmid(2), -1);
+
+  // A removed waiting workload leaves the queue
+  pool.removeWorkload(2);
+  CHECK_EQ(pool.getNumWaiting(), 0);
+}
+
+static void test_rmid_rotation() {
+  RmidPool pool(4, 1024, 3); // RMIDs 1-3
+  for (int w = 0; w < 5; w++)
+    pool.addWorkload(w);
+
+  // Workloads that got their RMIDs in this rotation keep them
+  pool.rotate(clean, true);
+  for (int w = 0; w < 3; w++)
+    CHECK(pool.getRmid(w) > 0);
+  CHECK_EQ(pool.getNumWaiting(), 2);
+
+  // Then the longest-held ones give theirs up for the waiting ones, which
+  // get them once they cool down
+  std::vector<RmidPool::Change> changes = pool.rotate(clean, true);
+  CHECK_EQ(changes.size(), 2u);
+  CHECK_EQ(pool.getRmid(0), -1);
+  CHECK_EQ(pool.getRmid(1), -1);
+  CHECK(pool.getRmid(2) > 0);
+  CHECK_EQ(pool.getNumWaiting(), 4);
+
+  pool.rotate(clean, false);
+  CHECK(pool.getRmid(3) > 0);
+  CHECK(pool.getRmid(4) > 0);
+  CHECK(pool.getRmid(3) != pool.getRmid(4));
+  CHECK_EQ(pool.getRmid(0), -1);
+  CHECK_EQ(pool.getNumWaiting(), 2);
+
+  // Everyone gets a turn
+  pool.rotate(clean, true);
+  pool.rotate(clean, false);
+  CHECK(pool.getRmid(0) > 0);
+  CHECK(pool.getRmid(1) > 0);
+}
+
+static void test_rmid_pinned() {
+  RmidPool pool(3, 1024, 3); // RMIDs 1-2
+  for (int w = 0; w < 3; w++)
+    pool.addWorkload(w);
+  pool.rotate(clean, false);
+  CHECK_EQ(pool.getRmid(2), -1);
+
+  // A pinned workload takes the RMID of the longest-held unpinned one
+  pool.setPinned(1, true);
+  pool.setPinned(2, true);
+  std::vector<RmidPool::Change> changes = pool.rotate(dirty, true);
+  CHECK_EQ(pool.getRmid(0), -1);
+  CHECK_EQ(pool.getRmid(1), 2);
+  CHECK_EQ(pool.getRmid(2), 1);
+  CHECK_EQ(changes.size(), 2u);
+  CHECK_EQ(changes[0].workload, 0);
+  CHECK_EQ(changes[0].newRmid, -1);
+  CHECK_EQ(changes[1].workload, 2);
+  CHECK_EQ(changes[1].newRmid, 1);
+
+  // and pinned workloads are never preempted
+  pool.rotate(clean, true);
+  pool.rotate(clean, true);
+  CHECK_EQ(pool.getRmid(1), 2);
+  CHECK_EQ(pool.getRmid(2), 1);
+  CHECK_EQ(pool.getNumWaiting(), 1);
+}
+
+int main() {
+  test_cos_assign();
+  test_cos_release();
+  test_cos_exhaustion();
+  test_rmid_allocate_release();
+  test_rmid_exhaustion();
+  test_rmid_rotation();
+  test_rmid_pinned();
+  return test_result("id_pools_test");
+}
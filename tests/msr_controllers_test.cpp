@@ -0,0 +1,232 @@
+/** $lic$
+* MIT License
+*
+* Copyright (c) 2017-2018 by Massachusetts Institute of Technology
+* Copyright (c) 2017-2018 by Qatar Computing Research Institute, HBKU
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* If you use this software in your research, we request that you reference
+* the KPart paper ("KPart: A Hybrid Cache Partitioning-Sharing Technique for
+* Commodity Multicores", El-Sayed, Mukkara, Tsai, Kasture, Ma, and Sanchez,
+* HPCA-24, February 2018) as the source in any publications that use this
+* software, and that you send us a citation of your work.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+**/
+
+// Drives the CAT, MBA and CMT controllers and MSRBatch on a fake /dev/cpu
+// tree of regular files, with CPUID leaves faked to report the features
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "cat.h"
+#include "cmt.h"
+#include "mba.h"
+#include "unit_test.h"
+
+static const int NUM_CORES = 4;
+static std::string devDir;
+
+// Fake MSR files hold MSR m at offset 8 * m (see MSR)
+static uint64_t read_msr(int core, uint32_t msr) {
+  std::string path = devDir + "/" + std::to_string(core) + "/msr";
+  int fd = open(path.c_str(), O_RDONLY);
+  uint64_t val = 0;
+  if (fd == -1 || pread(fd, &val, sizeof(val), msr * 8) != sizeof(val))
+    numFailures++;
+  close(fd);
+  return val;
+}
+
+static void write_msr(int core, uint32_t msr, uint64_t val) {
+  std::string path = devDir + "/" + std::to_string(core) + "/msr";
+  int fd = open(path.c_str(), O_WRONLY);
+  if (fd == -1 || pwrite(fd, &val, sizeof(val), msr * 8) != sizeof(val))
+    numFailures++;
+  close(fd);
+}
+
+static void make_dev_tree() {
+  devDir = make_temp_dir();
+  for (int c = 0; c < NUM_CORES; c++) {
+    std::string dir = devDir + "/" + std::to_string(c);
+    mkdir(dir.c_str(), 0755);
+    int fd = open((dir + "/msr").c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd == -1 || ftruncate(fd, 0x10000 * 8) != 0)
+      exit(2);
+    close(fd);
+  }
+}
+
+// 4 COS and 12 ways, optionally with CDP; MBA up to a delay of 90 (in steps
+// of 10%); 16 RMIDs counting in units of 64 bytes
+static void fake_cpuid(bool cdp) {
+  CPUID::clearOverrides();
+  CPUID::setOverride(0x7, 0x0, 0, (1U << 12) | (1U << 15), 0, 0);
+  CPUID::setOverride(0x10, 0x0, 0, (1U << 1) | (1U << 3), 0, 0);
+  CPUID::setOverride(0x10, 0x1, 11, 0, cdp ? (1U << 2) : 0, 3);
+  CPUID::setOverride(0x10, 0x3, 89, 0, 1U << 2, 3);
+  CPUID::setOverride(0xf, 0x0, 0, 15, 0, 1U << 1);
+  CPUID::setOverride(0xf, 0x1, 0, 64, 15, 0x7);
+}
+
+static void test_cat() {
+  fake_cpuid(false);
+  CATController cat(true, devDir);
+  CHECK_EQ(cat.getNumActiveCos(), 4);
+  CHECK_EQ(cat.getNumDomains(), 1);
+  CHECK(!cat.isCdpEnabled());
+
+  cat.setCbms({ std::make_pair(1, 0xf00u), std::make_pair(2, 0x0ffu) });
+  CHECK_EQ(read_msr(0, MSR_IA32_L3_MASK_0 + 1), 0xf00u);
+  CHECK_EQ(read_msr(0, MSR_IA32_L3_MASK_0 + 2), 0x0ffu);
+  CHECK_EQ(cat.getCbm(1), 0xf00u);
+
+  // Only bits 31:0 of a mask MSR hold the mask
+  write_msr(0, MSR_IA32_L3_MASK_0 + 3, 0xabcd00000000ULL);
+  cat.setCbm(3, 0x3);
+  CHECK_EQ(read_msr(0, MSR_IA32_L3_MASK_0 + 3), 0xabcd00000003ULL);
+
+  // COS changes keep the RMID in bits 9:0 of PQR_ASSOC
+  write_msr(2, MSR_IA32_PQR_ASSOC, 5);
+  cat.setCoses({ std::make_pair(2, 3u), std::make_pair(3, 1u) });
+  CHECK_EQ(read_msr(2, MSR_IA32_PQR_ASSOC), (3ULL << 32) | 5);
+  CHECK_EQ(cat.getCos(3), 1u);
+
+  bool threw = false;
+  try {
+    cat.setCbms({ std::make_pair(1, 0x1000u) }); // 13 ways
+  } catch (CATException &e) {
+    threw = true;
+  }
+  CHECK(threw);
+  threw = false;
+  try {
+    cat.setCos(0, 4);
+  } catch (CATException &e) {
+    threw = true;
+  }
+  CHECK(threw);
+}
+
+static void test_cdp() {
+  fake_cpuid(true);
+  write_msr(0, MSR_IA32_L3_QOS_CFG, 1);
+  CATController cat(true, devDir);
+  CHECK(cat.isCdpEnabled());
+  CHECK_EQ(cat.getNumActiveCos(), 2);
+
+  // COS n has its data mask in MASK_2n and its code mask in MASK_2n+1
+  cat.setCbms({ std::make_pair(1, 0xff0u) }, CATController::MASK_DATA);
+  cat.setCbms({ std::make_pair(1, 0x00fu) }, CATController::MASK_CODE);
+  CHECK_EQ(read_msr(0, MSR_IA32_L3_MASK_0 + 2), 0xff0u);
+  CHECK_EQ(read_msr(0, MSR_IA32_L3_MASK_0 + 3), 0x00fu);
+  CHECK_EQ(cat.getCbm(1, 0, CATController::MASK_CODE), 0x00fu);
+  write_msr(0, MSR_IA32_L3_QOS_CFG, 0);
+}
+
+static void test_mba() {
+  fake_cpuid(false);
+  MBAController mba(true, devDir);
+  CHECK_EQ(mba.getBandwidthGranularity(), 10);
+  CHECK_EQ(mba.percentToDelay(55), 50u);
+  CHECK_EQ(mba.percentToDelay(5), 90u);
+  CHECK_EQ(mba.percentToDelay(100), 0u);
+
+  mba.setThrottles({ std::make_pair(1, 30u), std::make_pair(3, 90u) });
+  CHECK_EQ(read_msr(0, MSR_IA32_L2_QOS_EXT_BW_THRTL_0 + 1), 30u);
+  CHECK_EQ(mba.getThrottle(3), 90u);
+
+  bool threw = false;
+  try {
+    mba.setThrottle(1, 91);
+  } catch (MBAException &e) {
+    threw = true;
+  }
+  CHECK(threw);
+}
+
+static void test_cmt() {
+  fake_cpuid(false);
+  CMTController cmt(true, devDir);
+  write_msr(1, MSR_IA32_PQR_ASSOC, 2ULL << 32);
+  cmt.setRmid(1, 7);
+  CHECK_EQ(read_msr(1, MSR_IA32_PQR_ASSOC), (2ULL << 32) | 7);
+  CHECK_EQ(cmt.getRmid(1), 7u);
+
+  // Counters are read through core 0, after selecting the RMID and event
+  write_msr(0, MSR_IA32_QM_CTR, 10);
+  CHECK_EQ(cmt.getLlcOccupancy(7), 640);
+  CHECK_EQ(read_msr(0, MSR_IA32_QM_EVTSEL), (7ULL << 32) | 1);
+  std::vector<CMTController::Sample> samples = cmt.sampleAll({ 7, 8 });
+  CHECK_EQ(samples.size(), 2u);
+  CHECK_EQ(samples[1].rmid, 8u);
+  CHECK_EQ(samples[1].totalMemTraffic, 640);
+  CHECK_EQ(read_msr(0, MSR_IA32_QM_EVTSEL), (8ULL << 32) | 2);
+
+  write_msr(0, MSR_IA32_QM_CTR, 1ULL << 62); // unavailable
+  bool threw = false;
+  try {
+    cmt.getLlcOccupancy(7);
+  } catch (CMTException &e) {
+    threw = true;
+  }
+  CHECK(threw);
+}
+
+static void test_batch() {
+  MSR msr(true, devDir, NUM_CORES);
+  MSRBatch batch(msr);
+  batch.write(1, 0x10, 42);
+  size_t same = batch.read(1, 0x10); // runs after the write on core 1
+  size_t bad = batch.read(NUM_CORES, 0x10);
+  batch.run();
+  CHECK(batch.ok(same));
+  CHECK_EQ(batch.value(same), 42u);
+  CHECK(!batch.ok(bad));
+  CHECK_EQ(batch.numErrors(), 1u);
+  bool threw = false;
+  try {
+    batch.check();
+  } catch (MSR::FileIOException &e) {
+    threw = true;
+  }
+  CHECK(threw);
+
+  threw = false;
+  try {
+    MSR missing(false, devDir + "/none", 1);
+  } catch (MSR::FileIOException &e) {
+    threw = true;
+  }
+  CHECK(threw);
+}
+
+int main() {
+  simulatedNumCores() = NUM_CORES; // one package
+  make_dev_tree();
+  test_cat();
+  test_cdp();
+  test_mba();
+  test_cmt();
+  test_batch();
+  CPUID::clearOverrides();
+  remove_temp_dir(devDir);
+  return test_result("msr_controllers_test");
+}
@@ -0,0 +1,163 @@
+/** $lic$
+* MIT License
+*
+* Copyright (c) 2017-2018 by Massachusetts Institute of Technology
+* Copyright (c) 2017-2018 by Qatar Computing Research Institute, HBKU
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* If you use this software in your research, we request that you reference
+* the KPart paper ("KPart: A Hybrid Cache Partitioning-Sharing Technique for
+* Commodity Multicores", El-Sayed, Mukkara, Tsai, Kasture, Ma, and Sanchez,
+* HPCA-24, February 2018) as the source in any publications that use this
+* software, and that you send us a citation of your work.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+**/
+
+// Checks the binary phase log (lltools/include/phase_log.h): records written
+// by PhaseLogWriter read back as written, both through PhaseLogReader and as
+// the CSV that lltools' phase_log_csv prints
+
+#include <libgen.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "phase_log.h"
+#include "unit_test.h"
+
+static std::string csvTool;
+
+static const std::vector<std::string> columns = { "CYCLES", "INSTRUCTIONS",
+                                                  "LLC_MISSES" };
+
+// Writes phases 0..numPhases-1; a small buffer makes the writer flush midway
+static void write_log(const std::string &path, uint64_t numPhases) {
+  PhaseLogWriter log(path, columns, 7, 4);
+  for (uint64_t phase = 0; phase < numPhases; phase++) {
+    uint64_t values[] = { phase * 1000, phase * 2000 + 1, (1ul << 40) + phase };
+    log.append(phase, values);
+  }
+}
+
+static std::string expected_csv(uint64_t numPhases) {
+  std::string csv = "# pidx 7\nPHASE,CYCLES,INSTRUCTIONS,LLC_MISSES\n";
+  for (uint64_t phase = 0; phase < numPhases; phase++) {
+    char line[128];
+    snprintf(line, sizeof(line), "%lu,%lu,%lu,%lu\n", phase, phase * 1000,
+             phase * 2000 + 1, (1ul << 40) + phase);
+    csv += line;
+  }
+  return csv;
+}
+
+static std::string run_csv_tool(const std::string &path, int *status) {
+  std::string cmd = csvTool + " '" + path + "' 2>/dev/null";
+  FILE *out = popen(cmd.c_str(), "r");
+  if (out == nullptr) {
+    perror("popen");
+    exit(2);
+  }
+  std::string csv;
+  char buf[4096];
+  size_t len;
+  while ((len = fread(buf, 1, sizeof(buf), out)) > 0)
+    csv.append(buf, len);
+  *status = pclose(out);
+  return csv;
+}
+
+static void test_read_back(const std::string &dir) {
+  std::string path = dir + "/read_back.log";
+  write_log(path, 10);
+
+  PhaseLogReader log(path);
+  CHECK_EQ(log.getPidx(), 7);
+  CHECK(log.getColumns() == columns);
+  CHECK_EQ(log.findColumn("INSTRUCTIONS"), 1);
+  CHECK_EQ(log.findColumn("CYCLES:u"), -1);
+
+  uint64_t phase, numPhases = 0;
+  std::vector<uint64_t> values;
+  while (log.next(phase, values)) {
+    CHECK_EQ(phase, numPhases);
+    CHECK_EQ(values.size(), columns.size());
+    CHECK_EQ(values[0], phase * 1000);
+    CHECK_EQ(values[1], phase * 2000 + 1);
+    CHECK_EQ(values[2], (1ul << 40) + phase);
+    numPhases++;
+  }
+  CHECK_EQ(numPhases, 10u);
+}
+
+static void test_csv(const std::string &dir) {
+  std::string path = dir + "/csv.log";
+  int status;
+
+  write_log(path, 10);
+  CHECK(run_csv_tool(path, &status) == expected_csv(10));
+  CHECK_EQ(status, 0);
+
+  // A log with no phases is just its header
+  write_log(path, 0);
+  CHECK(run_csv_tool(path, &status) == expected_csv(0));
+  CHECK_EQ(status, 0);
+}
+
+static void test_truncated(const std::string &dir) {
+  std::string path = dir + "/truncated.log";
+  write_log(path, 10);
+
+  // A writer killed halfway through the last record loses only that record
+  struct stat st;
+  CHECK_EQ(stat(path.c_str(), &st), 0);
+  CHECK_EQ(truncate(path.c_str(), st.st_size - 5), 0);
+  int status;
+  CHECK(run_csv_tool(path, &status) == expected_csv(9));
+  CHECK_EQ(status, 0);
+
+  // but a log without a full header is rejected
+  CHECK_EQ(truncate(path.c_str(), 10), 0);
+  CHECK(run_csv_tool(path, &status).empty());
+  CHECK(status != 0);
+  bool threw = false;
+  try {
+    PhaseLogReader log(path);
+  } catch (PhaseLogException &) {
+    threw = true;
+  }
+  CHECK(threw);
+}
+
+int main(int argc, char *argv[]) {
+  (void)argc;
+  // phase_log_csv is built next to this test
+  std::string self = argv[0];
+  csvTool = std::string(dirname(&self[0])) + "/phase_log_csv";
+
+  std::string dir = make_temp_dir();
+  test_read_back(dir);
+  test_csv(dir);
+  test_truncated(dir);
+  remove_temp_dir(dir);
+  return test_result("phase_log_test");
+}
@@ -0,0 +1,182 @@
+/** $lic$
+* MIT License
+*
+* Copyright (c) 2017-2018 by Massachusetts Institute of Technology
+* Copyright (c) 2017-2018 by Qatar Computing Research Institute, HBKU
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* If you use this software in your research, we request that you reference
+* the KPart paper ("KPart: A Hybrid Cache Partitioning-Sharing Technique for
+* Commodity Multicores", El-Sayed, Mukkara, Tsai, Kasture, Ma, and Sanchez,
+* HPCA-24, February 2018) as the source in any publications that use this
+* software, and that you send us a citation of your work.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+**/
+
+// Checks the profiling plans (profiling/plan_generator.h): the way counts
+// each spacing samples, how cut quirks move and drop them, and the slices'
+// masks
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "profiling/plan_generator.h"
+#include "unit_test.h"
+
+using profiling::PlanGenerator;
+
+typedef std::vector<int> Sizes;
+
+static bool anyCut(int) { return true; }
+static bool noCut(int) { return false; }
+
+static Sizes sizes(const std::string &spec, int capacity,
+                   const PlanGenerator::CutAllowed &cutAllowed = anyCut) {
+  return PlanGenerator(spec).getSampleSizes(capacity, cutAllowed);
+}
+
+static bool throws(const std::string &spec, int capacity,
+                   const PlanGenerator::CutAllowed &cutAllowed = anyCut) {
+  try {
+    PlanGenerator(spec).generate(capacity, cutAllowed);
+  } catch (std::invalid_argument &) {
+    return true;
+  }
+  return false;
+}
+
+static void test_specs() {
+  CHECK(PlanGenerator("uniform").getDescription() == "uniform, 6 samples");
+  CHECK(PlanGenerator("geometric:4").getDescription() ==
+        "geometric, 4 samples");
+  CHECK(PlanGenerator("dense-small:8").getDescription() ==
+        "dense-small, 8 samples");
+
+  const char *bad[] = { "", "linear", "uniform:", "uniform:1", "uniform:x",
+                        "uniform:4x" };
+  for (const char *spec : bad) {
+    bool threw = false;
+    try {
+      PlanGenerator gen(spec);
+    } catch (std::invalid_argument &) {
+      threw = true;
+    }
+    CHECK(threw);
+  }
+}
+
+static void test_spacings() {
+  // Samples go from capacity - 1 ways down to one way
+  CHECK(sizes("uniform", 12) == Sizes({ 11, 9, 7, 5, 3, 1 }));
+  CHECK(sizes("geometric", 12) == Sizes({ 11, 7, 4, 3, 2, 1 }));
+  CHECK(sizes("dense-small", 12) == Sizes({ 11, 7, 5, 3, 2, 1 }));
+
+  CHECK(sizes("uniform", 20) == Sizes({ 19, 15, 12, 8, 5, 1 }));
+  CHECK(sizes("geometric", 20) == Sizes({ 19, 11, 6, 3, 2, 1 }));
+  CHECK(sizes("dense-small", 20) == Sizes({ 19, 13, 7, 4, 2, 1 }));
+
+  // Fewer samples make for a coarser sweep
+  CHECK(sizes("uniform:3", 20) == Sizes({ 19, 10, 1 }));
+  CHECK(sizes("uniform:2", 12) == Sizes({ 11, 1 }));
+}
+
+static void test_small_caches() {
+  // Three ways have only two sizes to offer, whatever the spacing
+  CHECK(sizes("uniform", 3) == Sizes({ 2, 1 }));
+  CHECK(sizes("geometric", 3) == Sizes({ 2, 1 }));
+  CHECK(sizes("dense-small", 3) == Sizes({ 2, 1 }));
+  // and more samples than sizes sample every size
+  CHECK(sizes("uniform:8", 6) == Sizes({ 5, 4, 3, 2, 1 }));
+
+  std::vector<PlanGenerator::Slice> slices =
+      PlanGenerator("uniform").generate(3, anyCut);
+  CHECK_EQ(slices.size(), 3u); // warmup at 2 ways, then 2 and 1
+  CHECK_EQ(slices[0].profiledWays, 2);
+  CHECK_EQ(slices[1].profiledWays, 2);
+  CHECK_EQ(slices[2].profiledWays, 1);
+  CHECK_EQ(slices[0].profiledMask, 0x3u);
+  CHECK_EQ(slices[0].sharedMask, 0x4u);
+  CHECK_EQ(slices[2].profiledMask, 0x1u);
+  CHECK_EQ(slices[2].sharedMask, 0x6u);
+}
+
+static void test_slices() {
+  std::vector<PlanGenerator::Slice> slices =
+      PlanGenerator("uniform").generate(20, anyCut);
+  CHECK_EQ(slices.size(), 7u);
+  // The warmup slice repeats the first sample
+  CHECK_EQ(slices[0].profiledWays, 19);
+  CHECK_EQ(slices[1].profiledWays, 19);
+  for (const PlanGenerator::Slice &s : slices) {
+    CHECK_EQ(s.profiledMask, (1ULL << s.profiledWays) - 1);
+    CHECK_EQ(s.profiledMask | s.sharedMask, 0xfffffULL);
+    CHECK_EQ(s.profiledMask & s.sharedMask, 0u);
+  }
+}
+
+static void test_cut_quirks() {
+  // No cut below way 4: small allocations take the top ways instead
+  auto from4 = [](int w) { return w >= 4; };
+  CHECK(sizes("uniform", 12, from4) == Sizes({ 11, 9, 7, 5, 3, 1 }));
+  std::vector<PlanGenerator::Slice> slices =
+      PlanGenerator("uniform").generate(12, from4);
+  CHECK_EQ(slices[1].profiledMask, 0x7ffu);
+  CHECK_EQ(slices[5].profiledMask, 0xe00u); // 3 ways, at the top
+  CHECK_EQ(slices[5].sharedMask, 0x1ffu);
+  CHECK_EQ(slices[6].profiledMask, 0x800u);
+  CHECK_EQ(slices[6].sharedMask, 0x7ffu);
+
+  // Cuts only every third way leave three sizes to sample
+  auto every3 = [](int w) { return w % 3 == 0; };
+  CHECK(sizes("uniform", 12, every3) == Sizes({ 9, 6, 3 }));
+  CHECK(sizes("geometric", 12, every3) == Sizes({ 9, 6, 3 }));
+
+  // Only even cuts: the closest allowed size stands in for each target
+  auto even = [](int w) { return w % 2 == 0; };
+  CHECK(sizes("uniform:4", 20, even) == Sizes({ 18, 12, 8, 2 }));
+  CHECK(sizes("geometric:4", 20, even) == Sizes({ 18, 8, 4, 2 }));
+
+  // Nothing to profile without a single allowed cut
+  CHECK(throws("uniform", 12, noCut));
+}
+
+static void test_capacity_bounds() {
+  CHECK(throws("uniform", 2));
+  CHECK(throws("uniform", 65));
+  CHECK(!throws("uniform", 3));
+
+  std::vector<PlanGenerator::Slice> slices =
+      PlanGenerator("uniform").generate(64, anyCut);
+  CHECK_EQ(slices[1].profiledWays, 63);
+  CHECK_EQ(slices[1].profiledMask, ~0ULL >> 1);
+  CHECK_EQ(slices[1].sharedMask, 1ULL << 63);
+  CHECK_EQ(slices.back().profiledWays, 1);
+  CHECK_EQ(slices.back().sharedMask, ~1ULL);
+}
+
+int main() {
+  test_specs();
+  test_spacings();
+  test_small_caches();
+  test_slices();
+  test_cut_quirks();
+  test_capacity_bounds();
+  return test_result("plan_generator_test");
+}
@@ -0,0 +1,239 @@
+/** $lic$
+* MIT License
+*
+* Copyright (c) 2017-2018 by Massachusetts Institute of Technology
+* Copyright (c) 2017-2018 by Qatar Computing Research Institute, HBKU
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* If you use this software in your research, we request that you reference
+* the KPart paper ("KPart: A Hybrid Cache Partitioning-Sharing Technique for
+* Commodity Multicores", El-Sayed, Mukkara, Tsai, Kasture, Ma, and Sanchez,
+* HPCA-24, February 2018) as the source in any publications that use this
+* software, and that you send us a citation of your work.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+**/
+
+// Drives rdt::ResctrlBackend against a fake resctrl tree of plain
+// directories and files
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fstream>
+#include <sstream>
+#include "rdt/resctrl_backend.h"
+#include "unit_test.h"
+
+static void write_file(const std::string &path, const std::string &val) {
+  std::ofstream out(path.c_str());
+  out << val;
+}
+
+static std::string read_file(const std::string &path) {
+  std::ifstream in(path.c_str());
+  std::stringstream ss;
+  ss << in.rdbuf();
+  return ss.str();
+}
+
+static bool exists(const std::string &path) {
+  struct stat st;
+  return stat(path.c_str(), &st) == 0;
+}
+
+static void make_dirs(const std::string &path) {
+  std::string cmd = "mkdir -p '" + path + "'";
+  if (system(cmd.c_str()) != 0)
+    exit(2);
+}
+
+// 4 COS, 12 ways on 2 L3 domains, 8 RMIDs and MBA in steps of 10%, 4 cores
+static std::string make_tree() {
+  std::string root = make_temp_dir();
+  make_dirs(root + "/info/L3");
+  make_dirs(root + "/info/L3_MON");
+  make_dirs(root + "/info/MB");
+  write_file(root + "/info/L3/num_closids", "4\n");
+  write_file(root + "/info/L3/cbm_mask", "fff\n");
+  write_file(root + "/info/L3_MON/num_rmids", "8\n");
+  write_file(root + "/info/MB/bandwidth_gran", "10\n");
+  write_file(root + "/info/MB/min_bandwidth", "10\n");
+  write_file(root + "/schemata", "    L3:0=fff;1=fff\n    MB:0=100;1=100\n");
+  write_file(root + "/cpus_list", "0-3\n");
+  return root;
+}
+
+static void test_discovery(const std::string &root) {
+  rdt::ResctrlBackend backend(root);
+  CHECK_EQ(backend.getNumCos(), 4);
+  CHECK_EQ(backend.getCbmLen(), 12);
+  CHECK_EQ(backend.getNumRmids(), 8);
+  CHECK(!backend.isCdpEnabled());
+  CHECK(backend.isMbaSupported());
+  CHECK_EQ(backend.getMbaGranularity(), 10);
+}
+
+static void test_apply_plan(const std::string &root) {
+  rdt::ResctrlBackend backend(root);
+  rdt::PartitionPlan plan;
+  plan.cbms = {0xfff, 0xf00, 0x0ff};
+  plan.mbaPercents = {100, 55, 5};
+  plan.coreCos = {0, 1, 1, 2};
+  CHECK_EQ(backend.applyPlan(plan), 0);
+
+  // Bandwidths round down to the granularity, but not below the minimum
+  CHECK_EQ(read_file(root + "/kpart_cos1/schemata"),
+           "L3:0=f00;1=f00\nMB:0=50;1=50\n");
+  CHECK_EQ(read_file(root + "/kpart_cos2/schemata"),
+           "L3:0=ff;1=ff\nMB:0=10;1=10\n");
+  CHECK_EQ(read_file(root + "/kpart_cos1/cpus_list"), "1-2\n");
+  CHECK_EQ(read_file(root + "/kpart_cos2/cpus_list"), "3\n");
+  CHECK(!exists(root + "/kpart_cos3"));
+
+  // The same plan again writes nothing
+  uint64_t issued = backend.getApplyStats().writesIssued;
+  CHECK_EQ(backend.applyPlan(plan), 0);
+  CHECK_EQ(backend.getApplyStats().writesIssued, issued);
+  CHECK_EQ(backend.getCbm(1), 0xf00u);
+
+  // Core 2 goes back to the default group, which is never written
+  plan.coreCos = {0, 1, 0, 2};
+  CHECK_EQ(backend.applyPlan(plan), 0);
+  CHECK_EQ(read_file(root + "/kpart_cos1/cpus_list"), "1\n");
+  CHECK_EQ(read_file(root + "/cpus_list"), "0-3\n");
+
+  // A backend started on a tree with kpart groups picks their cores up
+  rdt::ResctrlBackend restarted(root);
+  rdt::PartitionPlan same;
+  same.coreCos = {0, 1, 0, 2};
+  issued = restarted.getApplyStats().writesIssued;
+  CHECK_EQ(restarted.applyPlan(same), 0);
+  CHECK_EQ(restarted.getApplyStats().writesIssued, issued);
+}
+
+static void test_bad_plans(const std::string &root) {
+  rdt::ResctrlBackend backend(root);
+  rdt::PartitionPlan plan;
+  plan.cbms = {0xfff, 0xff, 0xf, 0x3, 0x1}; // one COS too many
+  CHECK(backend.applyPlan(plan) != 0);
+
+  plan.cbms = {0xfff};
+  plan.codeCbms = {0xfff}; // not mounted with -o cdp
+  CHECK(backend.applyPlan(plan) != 0);
+
+  plan.codeCbms.clear();
+  plan.coreCos.assign(4097, 0);
+  plan.coreCos.back() = 1; // no such core
+  CHECK(backend.applyPlan(plan) != 0);
+  CHECK_EQ(backend.getApplyStats().numFailures, 3u);
+}
+
+static void test_bind_and_move(const std::string &root) {
+  rdt::ResctrlBackend backend(root);
+  rdt::PartitionPlan plan;
+  plan.cbms = {0xfff, 0xf00, 0x0ff};
+  plan.coreCos = {0, 1, 1, 2};
+  CHECK_EQ(backend.applyPlan(plan), 0);
+
+  // Our own threads stand in for the workload's
+  std::string self = std::to_string(getpid()) + "\n";
+  backend.bindRmid(5, getpid(), {1, 2});
+  std::string monGroup = root + "/kpart_cos1/mon_groups/kpart_rmid5";
+  CHECK(exists(monGroup));
+  CHECK(read_file(monGroup + "/tasks").find(self) != std::string::npos);
+  CHECK(read_file(root + "/kpart_cos1/tasks").find(self) !=
+        std::string::npos);
+  CHECK_EQ(backend.getRmid(2), 5u);
+  CHECK_EQ(backend.getRmid(3), 0u);
+
+  // Traffic adds up over the L3 domains
+  make_dirs(monGroup + "/mon_data/mon_L3_00");
+  make_dirs(monGroup + "/mon_data/mon_L3_01");
+  write_file(monGroup + "/mon_data/mon_L3_00/mbm_local_bytes", "100\n");
+  write_file(monGroup + "/mon_data/mon_L3_01/mbm_local_bytes", "23\n");
+  write_file(monGroup + "/mon_data/mon_L3_00/llc_occupancy", "4096\n");
+  write_file(monGroup + "/mon_data/mon_L3_01/llc_occupancy", "0\n");
+  CHECK_EQ(backend.getLocalMemTraffic(5), 123);
+  CHECK_EQ(backend.getLlcOccupancy(5), 4096);
+
+  // The monitoring group follows the workload's cores to their new COS
+  plan.coreCos = {0, 2, 2, 2};
+  CHECK_EQ(backend.applyPlan(plan), 0);
+  CHECK(!exists(monGroup));
+  CHECK(exists(root + "/kpart_cos2/mon_groups/kpart_rmid5"));
+  CHECK_EQ(backend.getLocalMemTraffic(5), 123);
+
+  // Unbinding drops the monitoring group (which stays on a fake tree, as
+  // it is not empty), not the tasks' COS
+  backend.unbindRmid(5);
+  CHECK_EQ(backend.getRmid(2), 0u);
+  bool unbound = false;
+  try {
+    backend.getLocalMemTraffic(5);
+  } catch (rdt::RdtException &e) {
+    unbound = true;
+  }
+  CHECK(unbound);
+}
+
+static void test_failed_task_move(const std::string &root) {
+  rdt::ResctrlBackend backend(root);
+  rdt::PartitionPlan plan;
+  plan.coreCos = {0, 3, 0, 0};
+  CHECK_EQ(backend.applyPlan(plan), 0);
+
+  // A tasks file that cannot be written fails the bind
+  make_dirs(root + "/kpart_cos3/tasks");
+  bool failed = false;
+  try {
+    backend.bindRmid(6, getpid(), {1});
+  } catch (rdt::RdtException &e) {
+    failed = true;
+  }
+  CHECK(failed);
+}
+
+static void test_cpu_lists() {
+  std::vector<int> cpus = rdt::parse_cpu_list("0-3,8,10-11\n");
+  CHECK_EQ(cpus.size(), 7u);
+  CHECK_EQ(rdt::format_cpu_list(cpus), "0-3,8,10-11");
+  CHECK_EQ(rdt::format_cpu_list({5, 1, 2}), "1-2,5");
+  CHECK(rdt::parse_cpu_list("").empty());
+}
+
+int main() {
+  std::string root = make_tree();
+  test_discovery(root);
+  test_apply_plan(root);
+  remove_temp_dir(root);
+
+  root = make_tree();
+  test_bad_plans(root);
+  remove_temp_dir(root);
+
+  root = make_tree();
+  test_bind_and_move(root);
+  remove_temp_dir(root);
+
+  root = make_tree();
+  test_failed_task_move(root);
+  remove_temp_dir(root);
+
+  test_cpu_lists();
+  return test_result("resctrl_backend_test");
+}
@@ -0,0 +1,203 @@
+/** $lic$
+* MIT License
+*
+* Copyright (c) 2017-2018 by Massachusetts Institute of Technology
+* Copyright (c) 2017-2018 by Qatar Computing Research Institute, HBKU
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* If you use this software in your research, we request that you reference
+* the KPart paper ("KPart: A Hybrid Cache Partitioning-Sharing Technique for
+* Commodity Multicores", El-Sayed, Mukkara, Tsai, Kasture, Ma, and Sanchez,
+* HPCA-24, February 2018) as the source in any publications that use this
+* software, and that you send us a citation of your work.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+**/
+
+// Checks the profiling sweeps of several apps at once
+// (profiling/sweep_scheduler.h): every slice's groups are disjoint and leave
+// shared ways, every app samples each of its sizes once, right after a
+// warmup at the same size or a sample, and the sweep beats a serial one
+
+#include <stdint.h>
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <vector>
+
+#include "profiling/sweep_scheduler.h"
+#include "unit_test.h"
+
+using profiling::PlanGenerator;
+using profiling::SweepScheduler;
+
+typedef std::vector<std::vector<int> > AppSizes;
+
+static bool anyCut(int) { return true; }
+
+static int popcount(uint64_t mask) { return __builtin_popcountll(mask); }
+
+// Checks the invariants of a sweep of sizes, whatever its slice count
+static void check_sweep(const std::vector<SweepScheduler::Slice> &slices,
+                        const AppSizes &sizes, int capacity, int maxGroups,
+                        const PlanGenerator::CutAllowed &cutAllowed) {
+  uint64_t allWays = (capacity == 64) ? ~0ULL : (1ULL << capacity) - 1;
+  int numApps = sizes.size();
+  AppSizes sampled(numApps);
+  std::vector<const SweepScheduler::Group *> last(numApps, nullptr);
+
+  for (const SweepScheduler::Slice &slice : slices) {
+    CHECK(!slice.groups.empty());
+    CHECK((int) slice.groups.size() <= maxGroups);
+
+    uint64_t used = 0;
+    std::vector<const SweepScheduler::Group *> cur(numApps, nullptr);
+    for (const SweepScheduler::Group &g : slice.groups) {
+      CHECK(g.app >= 0 && g.app < numApps);
+      CHECK(cur[g.app] == nullptr); // one group per app
+      cur[g.app] = &g;
+
+      // Contiguous, of the right size, disjoint from the other groups, and
+      // ending at allowed cuts
+      CHECK_EQ(popcount(g.mask), g.ways);
+      int lo = __builtin_ctzll(g.mask);
+      CHECK_EQ(g.mask >> lo, (1ULL << g.ways) - 1);
+      CHECK(lo == 0 || cutAllowed(lo));
+      CHECK(lo + g.ways == capacity || cutAllowed(lo + g.ways));
+      CHECK_EQ(g.mask & used, 0u);
+      used |= g.mask;
+
+      if (g.warmup)
+        continue;
+      // No app samples cold: only on ways it held the slice before, on the
+      // very ways of its warmup right after one
+      const SweepScheduler::Group *prev = last[g.app];
+      CHECK(prev != nullptr);
+      if (prev) {
+        CHECK_EQ(g.mask & ~prev->mask, 0u);
+        if (prev->warmup)
+          CHECK_EQ(g.mask, prev->mask);
+      }
+      sampled[g.app].push_back(g.ways);
+    }
+
+    // The other apps always keep at least one way, contiguous and between
+    // allowed cuts
+    CHECK(slice.sharedMask != 0);
+    CHECK_EQ(slice.sharedMask & used, 0u);
+    CHECK_EQ(slice.sharedMask & ~allWays, 0u);
+    int lo = __builtin_ctzll(slice.sharedMask);
+    int ways = popcount(slice.sharedMask);
+    CHECK_EQ(slice.sharedMask >> lo, (1ULL << ways) - 1);
+    CHECK(lo == 0 || cutAllowed(lo));
+    CHECK(lo + ways == capacity || cutAllowed(lo + ways));
+    last = cur;
+  }
+
+  // Every size sampled exactly once (sizes are given largest first)
+  for (int a = 0; a < numApps; a++) {
+    std::vector<int> s = sampled[a];
+    std::sort(s.begin(), s.end(), std::greater<int>());
+    CHECK(s == sizes[a]);
+  }
+}
+
+static void test_serial() {
+  // One group is a serial sweep: a warmup, then the samples largest first
+  std::vector<int> sizes = { 11, 9, 7, 5, 3, 1 };
+  SweepScheduler scheduler(12, 1, anyCut);
+  std::vector<SweepScheduler::Slice> slices =
+      scheduler.schedule(AppSizes(2, sizes));
+  CHECK_EQ(slices.size(), 14u);
+  CHECK_EQ(SweepScheduler::serialSlices(AppSizes(2, sizes)), 14);
+  CHECK(slices[0].groups[0].warmup);
+  CHECK_EQ(slices[0].groups[0].ways, 11);
+  for (size_t s = 1; s < 7; s++) {
+    CHECK_EQ(slices[s].groups[0].app, 0);
+    CHECK_EQ(slices[s].groups[0].ways, sizes[s - 1]);
+    CHECK(!slices[s].groups[0].warmup);
+  }
+  check_sweep(slices, AppSizes(2, sizes), 12, 1, anyCut);
+}
+
+static void test_groups() {
+  // 8 apps on 12 ways, as PlanGenerator("uniform") samples them
+  std::vector<int> sizes = { 11, 9, 7, 5, 3, 1 };
+  AppSizes apps(8, sizes);
+  int serial = SweepScheduler::serialSlices(apps);
+  CHECK_EQ(serial, 56);
+  for (int groups = 2; groups <= 8; groups++) {
+    SweepScheduler scheduler(12, groups, anyCut);
+    std::vector<SweepScheduler::Slice> slices = scheduler.schedule(apps);
+    check_sweep(slices, apps, 12, groups, anyCut);
+    CHECK((int) slices.size() < serial);
+  }
+  CHECK_EQ(SweepScheduler(12, 4, anyCut).schedule(apps).size(), 43u);
+
+  // Apps with sizes of their own, and a slice that shares a single way
+  AppSizes mixed = { { 11, 7, 4, 3, 2, 1 }, { 11, 9, 7, 5, 3, 1 },
+                     { 11, 7, 5, 3, 2, 1 }, { 10, 1 } };
+  std::vector<SweepScheduler::Slice> slices =
+      SweepScheduler(12, 3, anyCut).schedule(mixed);
+  check_sweep(slices, mixed, 12, 3, anyCut);
+  bool oneShared = false;
+  for (const SweepScheduler::Slice &slice : slices)
+    oneShared = oneShared || popcount(slice.sharedMask) == 1;
+  CHECK(oneShared);
+}
+
+static void test_cut_quirks() {
+  // No cut below way 4, nor at way 10: groups go to whichever end allows them
+  auto cutAllowed = [](int w) { return w >= 4 && w != 10; };
+  PlanGenerator gen("uniform");
+  std::vector<int> sizes = gen.getSampleSizes(20, cutAllowed);
+  AppSizes apps(6, sizes);
+  for (int groups = 1; groups <= 4; groups++) {
+    std::vector<SweepScheduler::Slice> slices =
+        SweepScheduler(20, groups, cutAllowed).schedule(apps);
+    check_sweep(slices, apps, 20, groups, cutAllowed);
+  }
+}
+
+static bool throws(int capacity, int maxGroups, const AppSizes &sizes) {
+  try {
+    SweepScheduler(capacity, maxGroups, anyCut).schedule(sizes);
+  } catch (std::invalid_argument &) {
+    return true;
+  }
+  return false;
+}
+
+static void test_bad_args() {
+  AppSizes apps(2, std::vector<int>({ 2, 1 }));
+  CHECK(throws(2, 2, apps));
+  CHECK(throws(65, 2, apps));
+  CHECK(throws(12, 0, apps));
+  CHECK(!throws(3, 2, apps));
+  // A size that leaves the others no way cannot be placed
+  CHECK(throws(12, 2, AppSizes(1, std::vector<int>({ 12 }))));
+  CHECK(SweepScheduler(12, 2, anyCut).schedule(AppSizes()).empty());
+}
+
+int main() {
+  test_serial();
+  test_groups();
+  test_cut_quirks();
+  test_bad_args();
+  return test_result("sweep_scheduler_test");
+}
@@ -0,0 +1,76 @@
+/** $lic$
+* MIT License
+*
+* Copyright (c) 2017-2018 by Massachusetts Institute of Technology
+* Copyright (c) 2017-2018 by Qatar Computing Research Institute, HBKU
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* If you use this software in your research, we request that you reference
+* the KPart paper ("KPart: A Hybrid Cache Partitioning-Sharing Technique for
+* Commodity Multicores", El-Sayed, Mukkara, Tsai, Kasture, Ma, and Sanchez,
+* HPCA-24, February 2018) as the source in any publications that use this
+* software, and that you send us a citation of your work.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+**/
+#pragma once
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+// Checks for the unit tests. A failed check is reported and counted, and the
+// test goes on; test_result() then makes the exit status.
+static int numFailures = 0;
+
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      numFailures++;                                                           \
+    }                                                                          \
+  } while (0)
+
+#define CHECK_EQ(a, b)                                                         \
+  do {                                                                         \
+    if (!((a) == (b))) {                                                       \
+      fprintf(stderr, "%s:%d: CHECK_EQ(%s, %s) failed\n", __FILE__, __LINE__,  \
+              #a, #b);                                                         \
+      numFailures++;                                                           \
+    }                                                                          \
+  } while (0)
+
+static inline int test_result(const char *name) {
+  printf("%s: %s\n", name, numFailures ? "FAILED" : "passed");
+  return numFailures ? 1 : 0;
+}
+
+// A fresh directory for a test's fake files, e.g. a resctrl or /dev/cpu tree
+static inline std::string make_temp_dir() {
+  char path[] = "/tmp/kpart_test.XXXXXX";
+  if (mkdtemp(path) == nullptr) {
+    perror("mkdtemp");
+    exit(2);
+  }
+  return path;
+}
+
+static inline void remove_temp_dir(const std::string &path) {
+  std::string cmd = "rm -rf '" + path + "'";
+  if (system(cmd.c_str()) != 0)
+    fprintf(stderr, "Could not remove %s\n", path.c_str());
+}